@@ -6,12 +6,17 @@
             "src/hub.cpp",
             "src/log.cpp",
             "src/errable.cpp",
+            "src/event_coalescer.cpp",
+            "src/ignore_rules.cpp",
             "src/queue.cpp",
             "src/lock.cpp",
             "src/message.cpp",
             "src/message_buffer.cpp",
+            "src/path_filter.cpp",
             "src/thread_starter.cpp",
             "src/thread.cpp",
+            "src/thread_pool.cpp",
+            "src/stat_engine.cpp",
             "src/status.cpp",
             "src/worker/worker_thread.cpp",
             "src/worker/recent_file_cache.cpp",
@@ -22,6 +27,8 @@
             "src/helper/libuv.cpp",
             "src/nan/async_callback.cpp",
             "src/nan/all_callback.cpp",
+            "src/nan/event_columns.cpp",
+            "src/nan/event_objects.cpp",
             "src/nan/functional_callback.cpp",
             "src/nan/options.cpp"
         ],
@@ -72,10 +79,17 @@
                 ],
                 "sources": [
                     "src/helper/common_posix.cpp",
-                    "src/worker/linux/pipe.cpp",
+                    "src/helper/linux/directory_reader.cpp",
+                    "src/worker/linux/epoll.cpp",
+                    "src/worker/linux/event_fd.cpp",
+                    "src/worker/linux/timer_fd.cpp",
                     "src/worker/linux/side_effect.cpp",
                     "src/worker/linux/cookie_jar.cpp",
+                    "src/worker/linux/fanotify_registry.cpp",
                     "src/worker/linux/watched_directory.cpp",
+                    "src/worker/linux/directory_snapshot.cpp",
+                    "src/worker/linux/watch_budget.cpp",
+                    "src/worker/linux/watch_crawl.cpp",
                     "src/worker/linux/watch_registry.cpp",
                     "src/worker/linux/linux_worker_platform.cpp"
                 ]
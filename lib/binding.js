@@ -84,8 +84,22 @@ function configure (options) {
   jsLogOption(options.jsLog)
 
   if (options.workerCacheSize) normalized.workerCacheSize = options.workerCacheSize
+  if (options.workerTraversalThreads !== undefined) normalized.workerTraversalThreads = options.workerTraversalThreads
+  if (options.workerFanotify === true) normalized.workerFanotifyEnable = true
+  if (options.workerFanotify === false) normalized.workerFanotifyDisable = true
+  if (options.workerResyncOnOverflow === true) normalized.workerResyncOnOverflowEnable = true
+  if (options.workerResyncOnOverflow === false) normalized.workerResyncOnOverflowDisable = true
+  if (options.workerWatchDepth !== undefined) normalized.workerWatchDepth = options.workerWatchDepth
+  if (options.workerRenameWindow !== undefined) normalized.workerRenameWindow = options.workerRenameWindow
   if (options.pollingThrottle) normalized.pollingThrottle = options.pollingThrottle
   if (options.pollingInterval) normalized.pollingInterval = options.pollingInterval
+  if (options.pollingStatBackend !== undefined) normalized.pollingStatBackend = options.pollingStatBackend
+  if (options.coalesceLatency !== undefined) normalized.coalesceLatency = options.coalesceLatency
+  if (options.eventBudget !== undefined) normalized.eventBudget = options.eventBudget
+  if (options.eventOverflow !== undefined) normalized.eventOverflow = options.eventOverflow
+  if (options.dispatchBudget !== undefined) normalized.dispatchBudget = options.dispatchBudget
+  if (options.binaryEvents === true) normalized.binaryEventsEnable = true
+  if (options.binaryEvents === false) normalized.binaryEventsDisable = true
 
   return new Promise((resolve, reject) => {
     getWatcher().configure(normalized, err => (err ? reject(err) : resolve()))
@@ -0,0 +1,152 @@
+const ACTIONS = ['created', 'deleted', 'modified', 'renamed', 'resynced', 'overflowed']
+
+const ENTRIES = ['file', 'directory', 'symlink', 'unknown']
+
+// Private: Columns decoded from a Buffer produced by the native EventColumns class. See src/nan/event_columns.h for
+// the layout.
+class Columns {
+  constructor (buffer) {
+    let bytes = buffer
+    if (bytes.byteOffset % 4 !== 0) {
+      // Typed array views of uint32 columns must begin on a four-byte boundary.
+      bytes = Buffer.from(buffer)
+    }
+
+    const header = new Uint32Array(bytes.buffer, bytes.byteOffset, 2)
+    const count = header[0]
+    const pathLength = header[1]
+
+    let offset = bytes.byteOffset + 8
+    this.count = count
+    this.actions = new Uint8Array(bytes.buffer, offset, count)
+    this.kinds = new Uint8Array(bytes.buffer, offset + count, count)
+    offset += (2 * count + 3) & ~3
+
+    this.pathOffsets = new Uint32Array(bytes.buffer, offset, count)
+    this.pathLengths = new Uint32Array(bytes.buffer, offset + 4 * count, count)
+    this.oldPathOffsets = new Uint32Array(bytes.buffer, offset + 8 * count, count)
+    this.oldPathLengths = new Uint32Array(bytes.buffer, offset + 12 * count, count)
+    offset += 16 * count
+
+    this.paths = Buffer.from(bytes.buffer, offset, pathLength)
+  }
+
+  path (i) {
+    const start = this.pathOffsets[i]
+    return this.paths.toString('utf8', start, start + this.pathLengths[i])
+  }
+
+  oldPath (i) {
+    const length = this.oldPathLengths[i]
+    if (length === 0) return undefined
+
+    const start = this.oldPathOffsets[i]
+    return this.paths.toString('utf8', start, start + length)
+  }
+}
+
+// Extended: A batch of filesystem events delivered when the `binaryEvents` option is enabled. Rather than constructing
+// an object for every event, each field is decoded from a shared Buffer when it's accessed.
+//
+// An EventBatch has a `length` and may be iterated, yielding the same event objects that are delivered without the
+// option. Use {::actionAt}, {::kindAt}, {::pathAt} and {::oldPathAt} to read individual fields without allocating an
+// object per event.
+class EventBatch {
+  // Private: Wrap a Buffer of encoded events from the native binding, or derive a batch from an existing one.
+  //
+  // * `source` Either a {Buffer} or the {Columns} of an existing batch.
+  // * `selection` (optional) {Array} choosing the events of this batch. Each element is either the {Number} index of an
+  //   event within `source` or an event object.
+  // * `rewrite` (optional) {Function} applied to each path and old path that's read from `source`.
+  constructor (source, selection = null, rewrite = null) {
+    this.columns = source instanceof Columns ? source : new Columns(source)
+    this.selection = selection
+    this.rewrite = rewrite
+  }
+
+  // Extended: The number of events within this batch.
+  get length () {
+    return this.selection === null ? this.columns.count : this.selection.length
+  }
+
+  // Extended: Return the action {String} of the event at `i`: one of `"created"`, `"modified"`, `"deleted"`,
+  // `"renamed"`, `"resynced"`, or `"overflowed"`.
+  actionAt (i) {
+    const s = this.sourceIndex(i)
+    return typeof s === 'number' ? ACTIONS[this.columns.actions[s]] : s.action
+  }
+
+  // Extended: Return the entry kind {String} of the event at `i`: one of `"file"`, `"directory"`, `"symlink"`, or
+  // `"unknown"`.
+  kindAt (i) {
+    const s = this.sourceIndex(i)
+    return typeof s === 'number' ? ENTRIES[this.columns.kinds[s]] : s.kind
+  }
+
+  // Extended: Return the absolute path {String} of the event at `i`.
+  pathAt (i) {
+    const s = this.sourceIndex(i)
+    if (typeof s !== 'number') return s.path
+
+    const p = this.columns.path(s)
+    return this.rewrite === null ? p : this.rewrite(p)
+  }
+
+  // Extended: Return the former absolute path {String} of the rename event at `i`, or `undefined` for any other event.
+  oldPathAt (i) {
+    const s = this.sourceIndex(i)
+    if (typeof s !== 'number') return s.oldPath
+
+    const p = this.columns.oldPath(s)
+    return this.rewrite === null || p === undefined ? p : this.rewrite(p)
+  }
+
+  // Extended: Construct an event object for the event at `i`.
+  eventAt (i) {
+    const s = this.sourceIndex(i)
+    if (typeof s !== 'number') return s
+
+    const e = { action: this.actionAt(i), kind: this.kindAt(i), path: this.pathAt(i) }
+    const oldPath = this.oldPathAt(i)
+    if (oldPath !== undefined) e.oldPath = oldPath
+    return e
+  }
+
+  // Extended: Construct an {Array} of event objects for every event in this batch.
+  toArray () {
+    const events = new Array(this.length)
+    for (let i = 0; i < events.length; i++) {
+      events[i] = this.eventAt(i)
+    }
+    return events
+  }
+
+  * [Symbol.iterator] () {
+    for (let i = 0; i < this.length; i++) {
+      yield this.eventAt(i)
+    }
+  }
+
+  // Private: Derive a new batch that shares this one's Buffer.
+  //
+  // * `selection` {Array} whose elements are either indices of events within this batch or event objects.
+  // * `rewrite` (optional) {Function} to apply to each path read from this batch, after any of its own rewriting.
+  derive (selection, rewrite = null) {
+    const sourceSelection = selection.map(s => typeof s === 'number' ? this.sourceIndex(s) : s)
+
+    let composed = this.rewrite
+    if (rewrite !== null) {
+      const inner = this.rewrite
+      composed = inner === null ? rewrite : p => rewrite(inner(p))
+    }
+
+    return new EventBatch(this.columns, sourceSelection, composed)
+  }
+
+  // Private: Map an index within this batch to an index within its Columns, or to an event object.
+  sourceIndex (i) {
+    return this.selection === null ? i : this.selection[i]
+  }
+}
+
+module.exports = { EventBatch }
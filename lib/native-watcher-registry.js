@@ -2,6 +2,11 @@ const path = require('path')
 const { log } = require('./logger')
 const { Tree } = require('./registry/tree')
 
+// Private: Return `true` if a {PathWatcher}'s options ask its native watcher to filter events.
+function hasPathFilter (options) {
+  return (options.exclude || []).length > 0 || (options.include || []).length > 0 || Boolean(options.gitignore)
+}
+
 // Private: Track the directories being monitored by native filesystem watchers. Minimize the number of native watchers
 // allocated to receive events for a desired set of directories by:
 //
@@ -9,12 +14,17 @@ const { Tree } = require('./registry/tree')
 // 2. Subscribing to an existing {NativeWatcher} on a parent of a desired directory.
 // 3. Replacing multiple {NativeWatcher} instances on child directories with a single new {NativeWatcher} on the
 //    parent.
+//
+// Watchers with `exclude`, `include`, or `gitignore` rules are given a {NativeWatcher} of their own, outside of the
+// tree. Their native watchers discard events before they reach JavaScript, so they can't deliver what other watchers
+// need.
 class NativeWatcherRegistry {
   // Private: Instantiate an empty registry.
   //
   // * `createNative` {Function} that will be called with a normalized filesystem path to create a new native
   //   filesystem watcher.
   constructor (createNative) {
+    this.createNative = createNative
     this.tree = new Tree([], createNative)
   }
 
@@ -31,10 +41,19 @@ class NativeWatcherRegistry {
   async attach (watcher) {
     log('attaching watcher %s to native registry.', watcher)
     const normalizedDirectory = await watcher.getNormalizedPathPromise()
+    const options = watcher.getOptions()
+
+    if (hasPathFilter(options)) {
+      log('creating an unshared native watcher for filtered watcher %s.', watcher)
+      const native = this.createNative(normalizedDirectory, options)
+      watcher.attachToNative(native, normalizedDirectory, options)
+      return
+    }
+
     const pathSegments = normalizedDirectory.split(path.sep).filter(segment => segment.length > 0)
 
     log('adding watcher %s to tree.', watcher)
-    this.tree.add(pathSegments, watcher.getOptions(), (native, nativePath, options) => {
+    this.tree.add(pathSegments, options, (native, nativePath, options) => {
       watcher.attachToNative(native, nativePath, options)
     })
     log('watcher %s added. tree state:\n%s', watcher, this.print())
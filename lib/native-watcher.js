@@ -1,20 +1,7 @@
 const binding = require('./binding')
 const { Emitter, CompositeDisposable, Disposable } = require('event-kit')
 const { log } = require('./logger')
-
-const ACTIONS = new Map([
-  [0, 'created'],
-  [1, 'deleted'],
-  [2, 'modified'],
-  [3, 'renamed']
-])
-
-const ENTRIES = new Map([
-  [0, 'file'],
-  [1, 'directory'],
-  [2, 'symlink'],
-  [3, 'unknown']
-])
+const { EventBatch } = require('./event-batch')
 
 // Private: Possible states of a {NativeWatcher}.
 const STOPPED = Symbol('stopped')
@@ -191,27 +178,21 @@ class NativeWatcher {
   }
 
   // Private: Callback function invoked by the native watcher when a debounced group of filesystem events arrive.
-  // Normalize and re-broadcast them to any subscribers.
+  // Re-broadcast them to any subscribers.
   //
-  // * `events` An Array of filesystem events.
+  // * `events` An Array of filesystem events, or a Buffer of encoded events if the `binaryEvents` option is enabled.
   onEvents (err, events) {
     if (err) {
       return this.onError(err)
     }
 
-    const translated = events.map(event => {
-      const n = {
-        action: ACTIONS.get(event.action),
-        kind: ENTRIES.get(event.kind),
-        path: event.path
-      }
-
-      if (event.oldPath !== '') n.oldPath = event.oldPath
-
-      return n
-    })
+    if (events instanceof Uint8Array) {
+      this.emitter.emit('did-change', new EventBatch(events))
+      return
+    }
 
-    this.emitter.emit('did-change', translated)
+    // Events arrive from the native binding already in their public form.
+    this.emitter.emit('did-change', events)
   }
 
   // Private: Callback function invoked by the native watcher when an error occurs.
@@ -0,0 +1,99 @@
+// Private: Translate a single glob pattern into an object with a `regex` that matches whole relative paths and a
+// `basename` flag that's true when the pattern should only be matched against a path's final component. Returns `null`
+// for patterns that are empty once leading and trailing separators are removed.
+function compile (glob) {
+  const trimmed = glob.replace(/^\/+|\/+$/g, '')
+  if (trimmed.length === 0) return null
+
+  let source = ''
+  for (let i = 0; i < trimmed.length; i++) {
+    const c = trimmed[i]
+    if (c === '*' && trimmed[i + 1] === '*') {
+      if (trimmed[i + 2] === '/') {
+        source += '(?:.*/)?'
+        i += 2
+      } else {
+        source += '.*'
+        i += 1
+      }
+    } else if (c === '*') {
+      source += '[^/]*'
+    } else if (c === '?') {
+      source += '[^/]'
+    } else if (c === '[' && classEnd(trimmed, i) !== -1) {
+      const close = classEnd(trimmed, i)
+      let body = trimmed.substring(i + 1, close)
+      const negated = body[0] === '!' || body[0] === '^'
+      if (negated) body = body.substring(1)
+      source += `(?!/)[${negated ? '^' : ''}${body.replace(/[\\^[\]]/g, '\\$&')}]`
+      i = close
+    } else {
+      source += c.replace(/[.+^${}()|[\]\\]/g, '\\$&')
+    }
+  }
+
+  return { regex: new RegExp(`^${source}$`), basename: !trimmed.includes('/') }
+}
+
+// Private: Return the index of the `]` that closes the character class opened at `open` within `glob`, or -1 if it's
+// unterminated. A `]` immediately after the `[` or its negation is taken literally.
+function classEnd (glob, open) {
+  let i = open + 1
+  if (glob[i] === '!' || glob[i] === '^') i++
+  if (glob[i] === ']') i++
+  return glob.indexOf(']', i)
+}
+
+function compileAll (optionName, globs) {
+  if (globs === undefined) return []
+  if (!Array.isArray(globs) || globs.some(glob => typeof glob !== 'string')) {
+    throw new Error(`option ${optionName} must be an Array of Strings`)
+  }
+  return globs.map(compile).filter(pattern => pattern !== null)
+}
+
+function anyMatch (patterns, relativePath) {
+  const basename = relativePath.substring(relativePath.lastIndexOf('/') + 1)
+  return patterns.some(pattern => pattern.regex.test(pattern.basename ? basename : relativePath))
+}
+
+// Private: Glob-style `exclude` and `include` rules that select which paths beneath a watch root are reported. These
+// follow the same rules as the native PathFilter, so that events are filtered identically whether or not the
+// {NativeWatcher} delivering them was able to apply them.
+//
+// Relative paths use `/` as their separator on every platform.
+class PathFilter {
+  // Private: Compile the `exclude` and `include` watchPath options. Either may be `undefined`.
+  constructor (exclude, include) {
+    this.exclude = compileAll('exclude', exclude)
+    this.include = compileAll('include', include)
+  }
+
+  // Private: Return `true` if this filter has no rules at all.
+  isEmpty () {
+    return this.exclude.length === 0 && this.include.length === 0
+  }
+
+  // Private: Return `true` if `relativePath` or any directory containing it matches an exclude pattern.
+  excludes (relativePath) {
+    if (this.exclude.length === 0) return false
+
+    let end = relativePath.indexOf('/')
+    while (end !== -1) {
+      if (anyMatch(this.exclude, relativePath.substring(0, end))) return true
+      end = relativePath.indexOf('/', end + 1)
+    }
+    return anyMatch(this.exclude, relativePath)
+  }
+
+  // Private: Return `true` if events at `relativePath` should be reported. The root itself is always reported.
+  accepts (relativePath) {
+    if (relativePath.length === 0) return true
+    if (this.excludes(relativePath)) return false
+    if (this.include.length === 0) return true
+
+    return anyMatch(this.include, relativePath)
+  }
+}
+
+module.exports = { PathFilter }
@@ -3,6 +3,8 @@ const path = require('path')
 
 const { Emitter, CompositeDisposable, Disposable } = require('event-kit')
 const { log } = require('./logger')
+const { EventBatch } = require('./event-batch')
+const { PathFilter } = require('./path-filter')
 
 // Extended: Manage a subscription to filesystem events that occur beneath a root directory. Construct these by
 // calling `watchPath`.
@@ -48,9 +50,10 @@ const { log } = require('./logger')
 //
 // `eventCallback` {Function} to be called each time a batch of filesystem events is observed. Each event object has
 // the keys: `action`, a {String} describing the filesystem action that occurred, one of `"created"`, `"modified"`,
-// `"deleted"`, or `"renamed"`; `path`, a {String} containing the absolute path to the filesystem entry that was acted
-// upon; `kind`, a {String} describing the type of filesystem entry, one of `"file"`, `"directory"`, or `"unknown"`;
-// for rename events only, `oldPath`, a {String} containing the filesystem entry's former absolute path.
+// `"deleted"`, `"renamed"`, `"resynced"` once lost events have been reconstructed, or `"overflowed"` once events have
+// been discarded; `path`, a {String} containing the absolute path to the filesystem entry that was acted upon; `kind`,
+// a {String} describing the type of filesystem entry, one of `"file"`, `"directory"`, or `"unknown"`; for rename events
+// only, `oldPath`, a {String} containing the filesystem entry's former absolute path.
 class PathWatcher {
   // Private: Instantiate a new PathWatcher. Call {watchPath} instead.
   //
@@ -60,7 +63,9 @@ class PathWatcher {
   constructor (nativeWatcherRegistry, watchedPath, options) {
     this.nativeWatcherRegistry = nativeWatcherRegistry
     this.watchedPath = watchedPath
-    this.options = Object.assign({ recursive: true, include: () => true }, options)
+    this.options = Object.assign({ recursive: true }, options)
+    this.filter = new PathFilter(this.options.exclude, this.options.include)
+    this.onlyPath = null
     log('create PathWatcher at %s with options %j.', watchedPath, options)
 
     this.normalizedPath = null
@@ -89,7 +94,13 @@ class PathWatcher {
       } else {
         this.normalizedPath = path.dirname(real)
         this.options.recursive = false
-        this.options.include = p => p === real
+        this.onlyPath = real
+
+        // Filters are relative to a watched directory.
+        delete this.options.exclude
+        delete this.options.include
+        delete this.options.gitignore
+        this.filter = new PathFilter()
       }
 
       return this.normalizedPath
@@ -251,7 +262,11 @@ class PathWatcher {
       if (!this.options.recursive) {
         if (path.dirname(eventPath) !== this.normalizedPath && eventPath !== this.normalizedPath) return false
       }
-      if (!this.options.include(eventPath)) return false
+      if (this.onlyPath !== null && eventPath !== this.onlyPath) return false
+      if (!this.filter.isEmpty()) {
+        const relativePath = eventPath.substring(this.normalizedPath.length + 1).split(path.sep).join('/')
+        if (!this.filter.accepts(relativePath)) return false
+      }
 
       return true
     }
@@ -268,11 +283,19 @@ class PathWatcher {
       }
       : event => event
 
+    if (events instanceof EventBatch) {
+      this.onNativeEventBatch(events, callback, isWatchedPath, shouldRewrite ? modifyPath : null)
+      return
+    }
+
     const filtered = []
     for (let i = 0; i < events.length; i++) {
       const event = events[i]
 
-      if (event.action === 'renamed') {
+      if (event.action === 'resynced' || event.action === 'overflowed') {
+        // Reported once for the native watcher's root, which may lie above this watcher's own root.
+        filtered.push({ action: event.action, kind: 'directory', path: this.watchedPath })
+      } else if (event.action === 'renamed') {
         const srcWatched = isWatchedPath(event.oldPath)
         const destWatched = isWatchedPath(event.path)
 
@@ -295,6 +318,40 @@ class PathWatcher {
     }
   }
 
+  // Private: Filter an {EventBatch} from the attached native watcher by the same rules as {::onNativeEvents}. Events
+  // that pass through unchanged are selected by index, so that their fields are only decoded if they're read.
+  onNativeEventBatch (batch, callback, isWatchedPath, modifyPath) {
+    const rewrite = modifyPath || (eventPath => eventPath)
+
+    const selected = []
+    for (let i = 0; i < batch.length; i++) {
+      const action = batch.actionAt(i)
+
+      if (action === 'resynced' || action === 'overflowed') {
+        selected.push({ action, kind: 'directory', path: this.watchedPath })
+      } else if (action === 'renamed') {
+        const oldPath = batch.oldPathAt(i)
+        const newPath = batch.pathAt(i)
+        const srcWatched = isWatchedPath(oldPath)
+        const destWatched = isWatchedPath(newPath)
+
+        if (srcWatched && destWatched) {
+          selected.push(i)
+        } else if (srcWatched && !destWatched) {
+          selected.push({ action: 'deleted', kind: batch.kindAt(i), path: rewrite(oldPath) })
+        } else if (!srcWatched && destWatched) {
+          selected.push({ action: 'created', kind: batch.kindAt(i), path: rewrite(newPath) })
+        }
+      } else if (isWatchedPath(batch.pathAt(i))) {
+        selected.push(i)
+      }
+    }
+
+    if (selected.length > 0) {
+      callback(batch.derive(selected, modifyPath))
+    }
+  }
+
   // Extended: Unsubscribe all subscribers from filesystem events. Native resources will be release asynchronously,
   // but this watcher will stop broadcasting events immediately.
   dispose () {
@@ -1,19 +1,23 @@
+#include <cstdint>
 #include <memory>
 #include <nan.h>
 #include <string>
 #include <utility>
 #include <v8.h>
+#include <vector>
 
 #include "hub.h"
 #include "nan/all_callback.h"
 #include "nan/async_callback.h"
 #include "nan/options.h"
+#include "path_filter.h"
 
 using std::endl;
 using std::move;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 using v8::Function;
 using v8::FunctionTemplate;
 using v8::Local;
@@ -21,6 +25,9 @@ using v8::Object;
 using v8::String;
 using v8::Value;
 
+// Zero is a valid value for several numeric configure() options, so they use this sentinel to mean "not provided".
+static const uint_fast32_t UINT_OPTION_UNSET = UINT_FAST32_MAX;
+
 void configure(const Nan::FunctionCallbackInfo<Value> &info)
 {
   string main_log_file;
@@ -33,6 +40,13 @@ void configure(const Nan::FunctionCallbackInfo<Value> &info)
   bool worker_log_stderr = false;
   bool worker_log_stdout = false;
   uint_fast32_t worker_cache_size = 0;
+  uint_fast32_t worker_traversal_threads = UINT_OPTION_UNSET;
+  bool worker_fanotify_enable = false;
+  bool worker_fanotify_disable = false;
+  bool worker_resync_on_overflow_enable = false;
+  bool worker_resync_on_overflow_disable = false;
+  uint_fast32_t worker_watch_depth = UINT_OPTION_UNSET;
+  uint_fast32_t worker_rename_window = UINT_OPTION_UNSET;
 
   string polling_log_file;
   bool polling_log_disable = false;
@@ -40,6 +54,15 @@ void configure(const Nan::FunctionCallbackInfo<Value> &info)
   bool polling_log_stdout = false;
   uint_fast32_t polling_interval = 0;
   uint_fast32_t polling_throttle = 0;
+  string polling_stat_backend;
+
+  uint_fast32_t coalesce_latency = UINT_OPTION_UNSET;
+  uint_fast32_t event_budget = UINT_OPTION_UNSET;
+  string event_overflow;
+  uint_fast32_t dispatch_budget = UINT_OPTION_UNSET;
+
+  bool binary_events_enable = false;
+  bool binary_events_disable = false;
 
   Nan::MaybeLocal<Object> maybe_options = Nan::To<Object>(info[0]);
   if (maybe_options.IsEmpty()) {
@@ -58,6 +81,13 @@ void configure(const Nan::FunctionCallbackInfo<Value> &info)
   if (!get_bool_option(options, "workerLogStderr", worker_log_stderr)) return;
   if (!get_bool_option(options, "workerLogStdout", worker_log_stdout)) return;
   if (!get_uint_option(options, "workerCacheSize", worker_cache_size)) return;
+  if (!get_uint_option(options, "workerTraversalThreads", worker_traversal_threads)) return;
+  if (!get_bool_option(options, "workerFanotifyEnable", worker_fanotify_enable)) return;
+  if (!get_bool_option(options, "workerFanotifyDisable", worker_fanotify_disable)) return;
+  if (!get_bool_option(options, "workerResyncOnOverflowEnable", worker_resync_on_overflow_enable)) return;
+  if (!get_bool_option(options, "workerResyncOnOverflowDisable", worker_resync_on_overflow_disable)) return;
+  if (!get_uint_option(options, "workerWatchDepth", worker_watch_depth)) return;
+  if (!get_uint_option(options, "workerRenameWindow", worker_rename_window)) return;
 
   if (!get_string_option(options, "pollingLogFile", polling_log_file)) return;
   if (!get_bool_option(options, "pollingLogDisable", polling_log_disable)) return;
@@ -65,6 +95,37 @@ void configure(const Nan::FunctionCallbackInfo<Value> &info)
   if (!get_bool_option(options, "pollingLogStdout", polling_log_stdout)) return;
   if (!get_uint_option(options, "pollingInterval", polling_interval)) return;
   if (!get_uint_option(options, "pollingThrottle", polling_throttle)) return;
+  if (!get_string_option(options, "pollingStatBackend", polling_stat_backend)) return;
+
+  if (!get_uint_option(options, "coalesceLatency", coalesce_latency)) return;
+
+  if (!get_uint_option(options, "eventBudget", event_budget)) return;
+  if (!get_string_option(options, "eventOverflow", event_overflow)) return;
+
+  if (!get_uint_option(options, "dispatchBudget", dispatch_budget)) return;
+
+  if (!get_bool_option(options, "binaryEventsEnable", binary_events_enable)) return;
+  if (!get_bool_option(options, "binaryEventsDisable", binary_events_disable)) return;
+
+  OverflowPolicy overflow_policy = OVERFLOW_COALESCE;
+  if (event_overflow == "drop") {
+    overflow_policy = OVERFLOW_DROP;
+  } else if (event_overflow == "block") {
+    overflow_policy = OVERFLOW_BLOCK;
+  } else if (!event_overflow.empty() && event_overflow != "coalesce") {
+    Nan::ThrowError("option eventOverflow must be one of \"coalesce\", \"drop\", or \"block\"");
+    return;
+  }
+
+  StatBackend stat_backend = STAT_BACKEND_DEFAULT;
+  if (polling_stat_backend == "pool") {
+    stat_backend = STAT_BACKEND_POOL;
+  } else if (polling_stat_backend == "synchronous") {
+    stat_backend = STAT_BACKEND_SYNCHRONOUS;
+  } else if (!polling_stat_backend.empty() && polling_stat_backend != "default") {
+    Nan::ThrowError("option pollingStatBackend must be one of \"default\", \"pool\", or \"synchronous\"");
+    return;
+  }
 
   unique_ptr<AsyncCallback> callback(new AsyncCallback("@atom/watcher:configure", info[1].As<Function>()));
   shared_ptr<AllCallback> all = AllCallback::create(move(callback));
@@ -99,6 +160,31 @@ void configure(const Nan::FunctionCallbackInfo<Value> &info)
       worker_cache_size, all->create_callback("@atom/watcher:binding.configure.worker_cache_size"));
   }
 
+  if (worker_traversal_threads != UINT_OPTION_UNSET) {
+    r &= Hub::get()->worker_traversal_threads(
+      worker_traversal_threads, all->create_callback("@atom/watcher:binding.configure.worker_traversal_threads"));
+  }
+
+  if (worker_fanotify_enable || worker_fanotify_disable) {
+    r &= Hub::get()->worker_fanotify(
+      worker_fanotify_enable, all->create_callback("@atom/watcher:binding.configure.worker_fanotify"));
+  }
+
+  if (worker_resync_on_overflow_enable || worker_resync_on_overflow_disable) {
+    r &= Hub::get()->worker_resync_on_overflow(worker_resync_on_overflow_enable,
+      all->create_callback("@atom/watcher:binding.configure.worker_resync_on_overflow"));
+  }
+
+  if (worker_watch_depth != UINT_OPTION_UNSET) {
+    r &= Hub::get()->worker_watch_depth(
+      worker_watch_depth, all->create_callback("@atom/watcher:binding.configure.worker_watch_depth"));
+  }
+
+  if (worker_rename_window != UINT_OPTION_UNSET) {
+    r &= Hub::get()->worker_rename_window(
+      worker_rename_window, all->create_callback("@atom/watcher:binding.configure.worker_rename_window"));
+  }
+
   if (polling_log_disable) {
     r &= Hub::get()->disable_polling_log(all->create_callback("@atom/watcher:binding.configure.disable_polling_log"));
   } else if (!polling_log_file.empty()) {
@@ -122,6 +208,34 @@ void configure(const Nan::FunctionCallbackInfo<Value> &info)
       polling_throttle, all->create_callback("@atom/watcher:binding.configure.set_polling_throttle"));
   }
 
+  if (!polling_stat_backend.empty()) {
+    r &= Hub::get()->set_polling_stat_backend(
+      stat_backend, all->create_callback("@atom/watcher:binding.configure.set_polling_stat_backend"));
+  }
+
+  if (coalesce_latency != UINT_OPTION_UNSET) {
+    r &= Hub::get()->worker_coalesce_latency(
+      coalesce_latency, all->create_callback("@atom/watcher:binding.configure.worker_coalesce_latency"));
+    r &= Hub::get()->polling_coalesce_latency(
+      coalesce_latency, all->create_callback("@atom/watcher:binding.configure.polling_coalesce_latency"));
+  }
+
+  if (event_budget != UINT_OPTION_UNSET) {
+    r &= Hub::get()->set_event_budget(event_budget);
+  }
+
+  if (!event_overflow.empty()) {
+    r &= Hub::get()->set_overflow_policy(overflow_policy);
+  }
+
+  if (dispatch_budget != UINT_OPTION_UNSET) {
+    r &= Hub::get()->set_dispatch_budget(dispatch_budget);
+  }
+
+  if (binary_events_enable || binary_events_disable) {
+    r &= Hub::get()->set_binary_events(binary_events_enable);
+  }
+
   all->set_result(move(r));
   all->fire_if_empty(true);
 }
@@ -154,14 +268,38 @@ void watch(const Nan::FunctionCallbackInfo<Value> &info)
 
   bool poll = false;
   bool recursive = true;
+  string backend_str;
+  vector<string> exclude;
+  vector<string> include;
+  bool gitignore = false;
   if (!get_bool_option(options, "poll", poll)) return;
   if (!get_bool_option(options, "recursive", recursive)) return;
+  if (!get_string_option(options, "backend", backend_str)) return;
+  if (!get_string_array_option(options, "exclude", exclude)) return;
+  if (!get_string_array_option(options, "include", include)) return;
+  if (!get_bool_option(options, "gitignore", gitignore)) return;
+
+  WatchBackend backend = BACKEND_DEFAULT;
+  if (backend_str == "inotify") {
+    backend = BACKEND_INOTIFY;
+  } else if (backend_str == "fanotify") {
+    backend = BACKEND_FANOTIFY;
+  } else if (!backend_str.empty()) {
+    Nan::ThrowError("watch() option backend must be \"inotify\" or \"fanotify\"");
+    return;
+  }
 
   unique_ptr<AsyncCallback> ack_callback(new AsyncCallback("@atom/watcher:binding.watch.ack", info[2].As<Function>()));
   unique_ptr<AsyncCallback> event_callback(
     new AsyncCallback("@atom/watcher:binding.watch.event", info[3].As<Function>()));
 
-  Result<> r = Hub::get()->watch(move(root_str), poll, recursive, move(ack_callback), move(event_callback));
+  shared_ptr<const PathFilter> filter;
+  if (!exclude.empty() || !include.empty() || gitignore) {
+    filter.reset(new PathFilter(string(root_str), move(exclude), move(include), gitignore));
+  }
+
+  Result<> r = Hub::get()->watch(
+    move(root_str), poll, recursive, backend, move(filter), move(ack_callback), move(event_callback));
   if (r.is_error()) {
     Nan::ThrowError(r.get_error().c_str());
   }
@@ -0,0 +1,138 @@
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "event_coalescer.h"
+#include "log.h"
+#include "message.h"
+#include "message_buffer.h"
+
+using std::endl;
+using std::make_pair;
+using std::move;
+using std::string;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+void EventCoalescer::absorb(MessageBuffer &in, MessageBuffer &out)
+{
+  for (Message &message : in) {
+    const FileSystemBatchPayload *batch = message.as_filesystem_batch();
+    if (batch != nullptr) {
+      for (size_t i = 0; i < batch->size(); i++) {
+        add(Message(batch->payload_at(i)));
+      }
+    } else if (message.as_filesystem() != nullptr) {
+      add(move(message));
+    } else {
+      out.add(move(message));
+    }
+  }
+}
+
+void EventCoalescer::flush(MessageBuffer &out)
+{
+  size_t delivered = 0;
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (!live[i]) continue;
+
+    out.add(move(pending[i]));
+    delivered++;
+  }
+
+  LOGGER << "Coalesced " << plural(pending.size(), "filesystem event") << " into " << plural(delivered, "message")
+         << "." << endl;
+
+  pending.clear();
+  live.clear();
+  latest.clear();
+}
+
+void EventCoalescer::discard(ChannelID channel_id)
+{
+  for (size_t i = 0; i < pending.size(); i++) {
+    if (pending[i].as_filesystem()->get_channel_id() == channel_id) live[i] = false;
+  }
+
+  auto it = latest.lower_bound(make_pair(channel_id, string()));
+  while (it != latest.end() && it->first.first == channel_id) {
+    it = latest.erase(it);
+  }
+}
+
+milliseconds EventCoalescer::until_due() const
+{
+  if (pending.empty()) return milliseconds(0);
+
+  milliseconds elapsed = duration_cast<milliseconds>(steady_clock::now() - opened);
+  return elapsed >= latency ? milliseconds(0) : latency - elapsed;
+}
+
+void EventCoalescer::add(Message &&message)
+{
+  if (pending.empty()) opened = steady_clock::now();
+
+  const FileSystemPayload *payload = message.as_filesystem();
+  ChannelID channel_id = payload->get_channel_id();
+
+  FileSystemAction action = payload->get_filesystem_action();
+  if (action == ACTION_RENAMED || action == ACTION_RESYNCED || action == ACTION_OVERFLOWED) {
+    // Later events at either end of a rename must not be reordered before it.
+    latest.erase(make_pair(channel_id, payload->get_old_path()));
+    latest.erase(make_pair(channel_id, payload->get_path()));
+
+    pending.emplace_back(move(message));
+    live.push_back(true);
+    return;
+  }
+
+  Key key(channel_id, payload->get_path());
+  auto existing = latest.find(key);
+  if (existing == latest.end()) {
+    latest.emplace(move(key), pending.size());
+    pending.emplace_back(move(message));
+    live.push_back(true);
+    return;
+  }
+
+  size_t prior = existing->second;
+  switch (reduce(*pending[prior].as_filesystem(), *payload)) {
+    case KEEP_PRIOR: return;
+    case KEEP_NEITHER:
+      live[prior] = false;
+      latest.erase(existing);
+      return;
+    case KEEP_NEW: live[prior] = false; break;
+    case KEEP_BOTH: break;
+  }
+
+  existing->second = pending.size();
+  pending.emplace_back(move(message));
+  live.push_back(true);
+}
+
+EventCoalescer::Reduction EventCoalescer::reduce(const FileSystemPayload &prior, const FileSystemPayload &next)
+{
+  if (kinds_are_different(prior.get_entry_kind(), next.get_entry_kind())) return KEEP_BOTH;
+
+  FileSystemAction before = prior.get_filesystem_action();
+  FileSystemAction after = next.get_filesystem_action();
+
+  if (before == ACTION_CREATED) {
+    if (after == ACTION_CREATED || after == ACTION_MODIFIED) return KEEP_PRIOR;
+    if (after == ACTION_DELETED) return KEEP_NEITHER;
+  }
+
+  if (before == ACTION_MODIFIED) {
+    if (after == ACTION_MODIFIED) return KEEP_PRIOR;
+    if (after == ACTION_DELETED) return KEEP_NEW;
+  }
+
+  if (before == ACTION_DELETED && after == ACTION_DELETED) return KEEP_PRIOR;
+
+  return KEEP_BOTH;
+}
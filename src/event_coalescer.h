@@ -0,0 +1,100 @@
+#ifndef EVENT_COALESCER_H
+#define EVENT_COALESCER_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "message.h"
+#include "message_buffer.h"
+
+// Hold filesystem events for a short, configurable window and merge those that affect the same path on the same
+// channel, so that a burst of activity on one entry crosses to the main thread as a single message. Each sequence of
+// events on a path is reduced to its net effect:
+//
+// * created, then modified: created
+// * created, then deleted: nothing
+// * modified, then modified: modified
+// * modified, then deleted: deleted
+//
+// Events that can't be reduced, like a deletion followed by a creation, are kept in their original order. Renames are
+// never merged; an entry renamed away from or onto a path starts a fresh sequence there.
+//
+// The window opens when the first event is absorbed and closes a fixed latency later, regardless of how many events
+// arrive in the meantime, so no event is delayed by more than the configured latency. The owning thread is responsible
+// for calling flush() once is_due() returns true.
+class EventCoalescer
+{
+public:
+  EventCoalescer() = default;
+  ~EventCoalescer() = default;
+
+  // Change the coalescing window. A latency of zero disables coalescing.
+  void set_latency(std::chrono::milliseconds latency) { this->latency = latency; }
+
+  std::chrono::milliseconds get_latency() const { return latency; }
+
+  // Return true if events should be routed through this EventCoalescer.
+  bool is_enabled() const { return latency.count() > 0; }
+
+  // Move filesystem messages from `in` into the pending window. Other messages, like acks and errors, are not delayed:
+  // move them into `out` to be emitted right away.
+  void absorb(MessageBuffer &in, MessageBuffer &out);
+
+  // Merge a single filesystem message into the window.
+  void add(Message &&message);
+
+  // Move every pending event, in order, into `out` and close the window.
+  void flush(MessageBuffer &out);
+
+  // Discard pending events for a channel that is no longer being watched.
+  void discard(ChannelID channel_id);
+
+  // Time remaining until the current window closes, or zero if no window is open or it has already closed.
+  std::chrono::milliseconds until_due() const;
+
+  // Return true if a window is open and its latency has elapsed.
+  bool is_due() const { return !empty() && until_due().count() == 0; }
+
+  // Return true if no events are pending.
+  bool empty() const { return pending.empty(); }
+
+  // Number of events absorbed within the current window, including those that have since been reduced away.
+  size_t size() const { return pending.size(); }
+
+  EventCoalescer(const EventCoalescer &) = delete;
+  EventCoalescer(EventCoalescer &&) = delete;
+  EventCoalescer &operator=(const EventCoalescer &) = delete;
+  EventCoalescer &operator=(EventCoalescer &&) = delete;
+
+private:
+  // How a newly absorbed event combines with the pending event for the same channel and path.
+  enum Reduction
+  {
+    KEEP_BOTH,  // Deliver both events, in order.
+    KEEP_PRIOR,  // The new event adds nothing; drop it.
+    KEEP_NEW,  // The new event supersedes the prior one; drop the prior event.
+    KEEP_NEITHER  // The two events cancel out; drop both.
+  };
+
+  using Key = std::pair<ChannelID, std::string>;
+
+  // Decide how `next` combines with `prior`, an earlier event for the same channel and path.
+  static Reduction reduce(const FileSystemPayload &prior, const FileSystemPayload &next);
+
+  std::chrono::milliseconds latency{0};
+
+  // When the current window opened.
+  std::chrono::steady_clock::time_point opened;
+
+  // Every event absorbed within the current window, in arrival order, and whether each is still to be delivered.
+  std::vector<Message> pending;
+  std::vector<bool> live;
+
+  // Index within `pending` of the most recent event for each channel and path that later events may be merged into.
+  std::map<Key, size_t> latest;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "directory_reader.h"
+
+using std::string;
+
+namespace
+{
+
+// Record layout written by getdents64(2). glibc only declares this (as `struct dirent64`) with _LARGEFILE64_SOURCE
+// and only wraps the system call itself from 2.30 on, so spell both out here.
+struct linux_dirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+} // namespace
+
+const size_t DirectoryReader::DEFAULT_BUFFER_SIZE;
+
+bool DirectoryReader::Entry::may_be_directory() const
+{
+  return type == DT_DIR || type == DT_UNKNOWN;
+}
+
+DirectoryReader::DirectoryReader(size_t buffer_size) :
+  fd{-1}, list_errno{0}, buffer(buffer_size), position{0}, filled{0}
+{
+  //
+}
+
+DirectoryReader::~DirectoryReader()
+{
+  close();
+}
+
+int DirectoryReader::open(const string &path)
+{
+  close();
+  list_errno = 0;
+
+  fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return errno;
+  return 0;
+}
+
+bool DirectoryReader::next(Entry &entry)
+{
+  if (fd == -1) return false;
+
+  while (true) {
+    if (position >= filled) {
+      long count = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+      if (count < 0) {
+        if (errno == EINTR) continue;
+        list_errno = errno;
+        close();
+        return false;
+      }
+      if (count == 0) {
+        close();
+        return false;
+      }
+
+      position = 0;
+      filled = static_cast<size_t>(count);
+    }
+
+    auto *record = reinterpret_cast<linux_dirent64 *>(buffer.data() + position);
+    position += record->d_reclen;
+
+    const char *name = record->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+    entry.name = name;
+    entry.type = record->d_type;
+    entry.ino = record->d_ino;
+    return true;
+  }
+}
+
+int DirectoryReader::stat(struct stat &out) const
+{
+  if (fd == -1) return EBADF;
+  if (::fstat(fd, &out) == -1) return errno;
+  return 0;
+}
+
+void DirectoryReader::close()
+{
+  if (fd != -1) {
+    ::close(fd);
+    fd = -1;
+  }
+  position = 0;
+  filled = 0;
+}
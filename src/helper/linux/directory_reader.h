@@ -0,0 +1,80 @@
+#ifndef DIRECTORY_READER_H
+#define DIRECTORY_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// Enumerate directory entries with raw getdents64(2) calls into a large, reusable buffer. Entry names are handed back
+// as pointers into that buffer, so listing a directory performs no per-entry allocation. The `.` and `..` entries are
+// skipped.
+//
+// A single DirectoryReader lists one directory at a time and is not thread-safe. Reuse one instance per thread to
+// amortize the buffer across directories.
+class DirectoryReader
+{
+public:
+  // A single entry within the open directory. `name` remains valid until the next call to `next()`, `open()`, or
+  // `close()`.
+  struct Entry
+  {
+    const char *name;
+
+    // One of the DT_* constants from <dirent.h>. Filesystems that don't report entry types produce DT_UNKNOWN.
+    unsigned char type;
+
+    // Inode number of the entry.
+    uint64_t ino;
+
+    // Return true if this entry is, or may be, a directory.
+    bool may_be_directory() const;
+  };
+
+  // Bytes requested from each getdents64() call by default.
+  static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+  explicit DirectoryReader(size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+  // close() any directory that's still open.
+  ~DirectoryReader();
+
+  // Begin listing the directory at `path`, closing any directory that was previously open. Return 0 on success or
+  // the errno value reported by open(2).
+  int open(const std::string &path);
+
+  // Advance to the next entry. Return false once the directory has been exhausted or a getdents64() call has failed;
+  // use `get_errno()` to tell the two apart.
+  bool next(Entry &entry);
+
+  // fstat(2) the open directory into `out`. Call this before the directory has been exhausted. Return 0 on success or
+  // the errno value reported by fstat().
+  int stat(struct stat &out) const;
+
+  // errno reported by the most recent failed getdents64() call, or 0 if listing completed successfully.
+  int get_errno() const { return list_errno; }
+
+  // Release the directory file descriptor early. The buffer is retained for reuse.
+  void close();
+
+  DirectoryReader(const DirectoryReader &) = delete;
+  DirectoryReader(DirectoryReader &&) = delete;
+  DirectoryReader &operator=(const DirectoryReader &) = delete;
+  DirectoryReader &operator=(DirectoryReader &&) = delete;
+
+private:
+  int fd;
+  int list_errno;
+
+  std::vector<char> buffer;
+
+  // Offset of the next unread record within `buffer`.
+  size_t position;
+
+  // Number of valid bytes returned into `buffer` by the last getdents64() call.
+  size_t filled;
+};
+
+#endif
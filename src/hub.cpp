@@ -13,6 +13,8 @@
 #include "message.h"
 #include "nan/all_callback.h"
 #include "nan/async_callback.h"
+#include "nan/event_columns.h"
+#include "nan/event_objects.h"
 #include "nan/functional_callback.h"
 #include "polling/polling_thread.h"
 #include "result.h"
@@ -48,7 +50,15 @@ Hub::Hub() :
   polling_thread(&event_handler),
   next_command_id{NULL_COMMAND_ID + 1},
   next_channel_id{NULL_CHANNEL_ID + 1},
-  next_request_id{NULL_REQUEST_ID + 1}
+  next_request_id{NULL_REQUEST_ID + 1},
+  event_budget{0},
+  overflow_policy{OVERFLOW_COALESCE},
+  binary_events{false},
+  dispatching{false},
+  dispatch_budget{0},
+  dispatch_latest{0},
+  dispatch_longest{0},
+  dispatch_yield_count{0}
 {
   int err;
 
@@ -67,6 +77,8 @@ Hub::Hub() :
 Result<> Hub::watch(string &&root,
   bool poll,
   bool recursive,
+  WatchBackend backend,
+  shared_ptr<const PathFilter> &&filter,
   unique_ptr<AsyncCallback> ack_callback,
   unique_ptr<AsyncCallback> event_callback)
 {
@@ -77,13 +89,12 @@ Result<> Hub::watch(string &&root,
 
   channel_callbacks.emplace(channel_id, move(event_callback));
 
-  if (poll) {
-    return send_command(
-      polling_thread, CommandPayloadBuilder::add(channel_id, move(root), recursive, 1), move(ack_callback));
-  }
+  CommandPayloadBuilder builder = CommandPayloadBuilder::add(channel_id, move(root), recursive, 1);
+  builder.set_filter(filter);
+  if (poll) return send_command(polling_thread, move(builder), move(ack_callback));
 
-  return send_command(
-    worker_thread, CommandPayloadBuilder::add(channel_id, move(root), recursive, 1), move(ack_callback));
+  builder.set_backend(backend);
+  return send_command(worker_thread, move(builder), move(ack_callback));
 }
 
 Result<> Hub::unwatch(ChannelID channel_id, unique_ptr<AsyncCallback> &&ack_callback)
@@ -121,6 +132,10 @@ Result<> Hub::status(std::unique_ptr<AsyncCallback> &&status_callback)
   // Main thread statistics
   req->status.pending_callback_count = pending_callbacks.size();
   req->status.channel_callback_count = channel_callbacks.size();
+  req->status.dispatch_latest = dispatch_latest;
+  req->status.dispatch_longest = dispatch_longest;
+  req->status.dispatch_yield_count = dispatch_yield_count;
+  dispatch_longest = 0;
 
   status_reqs.emplace(request_id, move(req));
 
@@ -132,8 +147,33 @@ Result<> Hub::status(std::unique_ptr<AsyncCallback> &&status_callback)
 
 void Hub::handle_events()
 {
-  handle_events_from(worker_thread);
-  handle_events_from(polling_thread);
+  if (dispatching) {
+    // A callback that's being dispatched has called back into the Hub. Finish the messages already received before
+    // accepting any more, so that they're delivered in order.
+    uv_async_send(&event_handler);
+    return;
+  }
+  dispatching = true;
+
+  uint64_t start = uv_hrtime();
+  uint64_t deadline = dispatch_budget > 0 ? start + dispatch_budget * 1000 : 0;
+
+  // Each thread makes some progress, even if the other exhausts the budget.
+  bool worker_done = handle_events_from(worker_thread, deadline);
+  bool polling_done = handle_events_from(polling_thread, deadline);
+
+  uint64_t elapsed = (uv_hrtime() - start) / 1000;
+  dispatch_latest = elapsed;
+  if (elapsed > dispatch_longest) dispatch_longest = elapsed;
+
+  dispatching = false;
+
+  if (!worker_done || !polling_done) {
+    // Yield to the rest of the event loop and resume with the next iteration.
+    LOGGER << "Dispatch budget exhausted after " << elapsed << "us. Yielding." << endl;
+    dispatch_yield_count++;
+    uv_async_send(&event_handler);
+  }
 }
 
 Result<> Hub::send_command(Thread &thread, CommandPayloadBuilder &&builder, std::unique_ptr<AsyncCallback> callback)
@@ -162,141 +202,208 @@ bool Hub::check_async(const std::unique_ptr<AsyncCallback> &callback)
   return false;
 }
 
-void Hub::handle_events_from(Thread &thread)
+// Number of events from a FileSystemBatchPayload dispatched between checks of the dispatch deadline.
+static const size_t DEADLINE_CHECK_INTERVAL = 64;
+
+// Return true once the uv_hrtime() `deadline` has passed. A deadline of zero never passes.
+static bool past_deadline(uint64_t deadline)
 {
-  Nan::HandleScope scope;
-  bool repeat = true;
+  return deadline != 0 && uv_hrtime() >= deadline;
+}
 
-  unique_ptr<vector<Message>> accepted = thread.receive_all();
-  if (!accepted) {
-    // No events to process.
-    return;
-  }
+bool Hub::handle_events_from(Thread &thread, uint64_t deadline)
+{
+  Nan::HandleScope scope;
+  Backlog &backlog = &thread == &worker_thread ? worker_backlog : polling_backlog;
+  bool exhausted = false;
+  bool progressed = false;
 
-  map<ChannelID, vector<Local<Object>>> to_deliver;
+  map<ChannelID, vector<Local<Value>>> to_deliver;
+  map<ChannelID, EventColumns> to_encode;
   multimap<ChannelID, Local<Value>> errors;
   set<ChannelID> to_unwatch;
 
-  for (Message &message : *accepted) {
-    const AckPayload *ack = message.as_ack();
-    if (ack != nullptr) {
-      LOGGER << "Received ack message " << message << "." << endl;
-
-      auto maybe_callback = pending_callbacks.find(ack->get_key());
-      if (maybe_callback == pending_callbacks.end()) {
-        LOGGER << "Ignoring unexpected ack " << message << "." << endl;
-        continue;
-      }
+  while (!exhausted) {
+    if (!backlog.messages) {
+      backlog.messages = thread.receive_all();
+      backlog.next_message = 0;
+      backlog.next_event = 0;
+      if (!backlog.messages) break;
+    }
+    vector<Message> &accepted = *backlog.messages;
 
-      unique_ptr<AsyncCallback> callback = move(maybe_callback->second);
-      pending_callbacks.erase(maybe_callback);
-
-      ChannelID channel_id = ack->get_channel_id();
-      if (ack->was_successful()) {
-        Local<Value> argv[] = {Nan::Null(), Nan::New<Number>(channel_id)};
-        callback->Call(2, argv);
-      } else {
-        Local<Value> err = Nan::Error(ack->get_message().c_str());
-        Local<Value> argv[] = {err, Nan::Null()};
-        callback->Call(2, argv);
+    for (; backlog.next_message < accepted.size(); backlog.next_message++) {
+      if (progressed && past_deadline(deadline)) {
+        exhausted = true;
+        break;
       }
+      progressed = true;
 
-      continue;
-    }
+      Message &message = accepted[backlog.next_message];
 
-    const FileSystemPayload *fs = message.as_filesystem();
-    if (fs != nullptr) {
-      LOGGER << "Received filesystem event message " << message << "." << endl;
+      const AckPayload *ack = message.as_ack();
+      if (ack != nullptr) {
+        LOGGER << "Received ack message " << message << "." << endl;
 
-      ChannelID channel_id = fs->get_channel_id();
+        auto maybe_callback = pending_callbacks.find(ack->get_key());
+        if (maybe_callback == pending_callbacks.end()) {
+          LOGGER << "Ignoring unexpected ack " << message << "." << endl;
+          continue;
+        }
 
-      v8::Local<v8::Context> context = Nan::GetCurrentContext();
-      Local<Object> js_event = Nan::New<Object>();
-      js_event->Set(context,
-        Nan::New<String>("action").ToLocalChecked(), Nan::New<Number>(static_cast<int>(fs->get_filesystem_action())));
-      js_event->Set(context,
-        Nan::New<String>("kind").ToLocalChecked(), Nan::New<Number>(static_cast<int>(fs->get_entry_kind())));
-      js_event->Set(context,
-        Nan::New<String>("oldPath").ToLocalChecked(), Nan::New<String>(fs->get_old_path()).ToLocalChecked());
-      js_event->Set(context, Nan::New<String>("path").ToLocalChecked(), Nan::New<String>(fs->get_path()).ToLocalChecked());
+        unique_ptr<AsyncCallback> callback = move(maybe_callback->second);
+        pending_callbacks.erase(maybe_callback);
+
+        ChannelID channel_id = ack->get_channel_id();
+        if (ack->was_successful()) {
+          Local<Value> argv[] = {Nan::Null(), Nan::New<Number>(channel_id)};
+          callback->Call(2, argv);
+        } else {
+          Local<Value> err = Nan::Error(ack->get_message().c_str());
+          Local<Value> argv[] = {err, Nan::Null()};
+          callback->Call(2, argv);
+        }
 
-      to_deliver[channel_id].push_back(js_event);
-      continue;
-    }
+        continue;
+      }
 
-    const CommandPayload *command = message.as_command();
-    if (command != nullptr) {
-      LOGGER << "Received command message " << message << "." << endl;
+      const FileSystemPayload *fs = message.as_filesystem();
+      if (fs != nullptr) {
+        LOGGER << "Received filesystem event message " << message << "." << endl;
 
-      if (command->get_action() == COMMAND_DRAIN) {
-        Result<bool> dr = thread.drain();
-        if (dr.is_error()) {
-          LOGGER << "Unable to drain dead letter office: " << dr << "." << endl;
-        } else if (dr.get_value()) {
-          repeat = true;
+        if (binary_events) {
+          to_encode[fs->get_channel_id()].add(
+            fs->get_filesystem_action(), fs->get_entry_kind(), fs->get_old_path(), fs->get_path());
+          continue;
         }
-      } else if (command->get_action() == COMMAND_ADD && &thread == &worker_thread) {
-        polling_thread.send(move(message));
-      } else {
-        LOGGER << "Ignoring unexpected command." << endl;
-      }
 
-      continue;
-    }
+        to_deliver[fs->get_channel_id()].push_back(event_objects.create(
+          fs->get_filesystem_action(), fs->get_entry_kind(), fs->get_old_path(), fs->get_path()));
+        continue;
+      }
 
-    const ErrorPayload *error = message.as_error();
-    if (error != nullptr) {
-      LOGGER << "Received error message " << message << "." << endl;
+      const FileSystemBatchPayload *fs_batch = message.as_filesystem_batch();
+      if (fs_batch != nullptr) {
+        LOGGER << "Received filesystem event batch " << message << "." << endl;
+
+        // Paths are appended directly from the batch's storage to each channel's columns, or reassembled within the
+        // same two strings.
+        EventColumns *columns = nullptr;
+        vector<Local<Value>> *js_events = nullptr;
+        ChannelID current_channel_id = NULL_CHANNEL_ID;
+        string old_path, path;
+
+        size_t first = backlog.next_event;
+        size_t i = first;
+        for (; i < fs_batch->size(); i++) {
+          if (i > first && i % DEADLINE_CHECK_INTERVAL == 0 && past_deadline(deadline)) break;
+
+          ChannelID channel_id = fs_batch->get_channel_id(i);
+          bool switched = i == first || channel_id != current_channel_id;
+          current_channel_id = channel_id;
+
+          if (binary_events) {
+            if (switched) columns = &to_encode[channel_id];
+            columns->add(*fs_batch, i);
+            continue;
+          }
+
+          if (switched) js_events = &to_deliver[channel_id];
+          fs_batch->copy_old_path(i, old_path);
+          fs_batch->copy_path(i, path);
+          js_events->push_back(
+            event_objects.create(fs_batch->get_filesystem_action(i), fs_batch->get_entry_kind(i), old_path, path));
+        }
 
-      const ChannelID &channel_id = error->get_channel_id();
+        if (i < fs_batch->size()) {
+          // Resume from the next event once the event loop has had a turn.
+          backlog.next_event = i;
+          exhausted = true;
+          break;
+        }
+        backlog.next_event = 0;
+        continue;
+      }
 
-      Local<Value> js_err = Nan::Error(error->get_message().c_str());
-      errors.emplace(channel_id, js_err);
+      const CommandPayload *command = message.as_command();
+      if (command != nullptr) {
+        LOGGER << "Received command message " << message << "." << endl;
+
+        if (command->get_action() == COMMAND_DRAIN) {
+          Result<bool> dr = thread.drain();
+          // Any drained messages are received along with the rest of the out queue.
+          if (dr.is_error()) LOGGER << "Unable to drain dead letter office: " << dr << "." << endl;
+        } else if (command->get_action() == COMMAND_ADD && &thread == &worker_thread) {
+          polling_thread.send(move(message));
+        } else if (command->get_action() == COMMAND_PROMOTE && &thread == &polling_thread) {
+          worker_thread.send(move(message));
+        } else if (command->get_action() == COMMAND_RELEASE && &thread == &polling_thread) {
+          worker_thread.send(move(message));
+        } else if (command->get_action() == COMMAND_RELEASE && &thread == &worker_thread) {
+          polling_thread.send(move(message));
+        } else {
+          LOGGER << "Ignoring unexpected command." << endl;
+        }
 
-      if (error->was_fatal()) {
-        to_unwatch.insert(channel_id);
+        continue;
       }
 
-      continue;
-    }
+      const ErrorPayload *error = message.as_error();
+      if (error != nullptr) {
+        LOGGER << "Received error message " << message << "." << endl;
 
-    const StatusPayload *status = message.as_status();
-    if (status != nullptr) {
-      LOGGER << "Received status message " << message << "." << endl;
+        const ChannelID &channel_id = error->get_channel_id();
 
-      const RequestID &request_id = status->get_request_id();
+        Local<Value> js_err = Nan::Error(error->get_message().c_str());
+        errors.emplace(channel_id, js_err);
 
-      auto req = status_reqs.find(request_id);
-      if (req == status_reqs.end()) {
-        LOGGER << "Unrecognized request ID " << request_id << "." << endl;
-        continue;
-      }
+        if (error->was_fatal()) {
+          to_unwatch.insert(channel_id);
+        }
 
-      Status &s = req->second->status;
-      if (&thread == &worker_thread) {
-        s.assimilate_worker_status(status->get_status());
-      } else if (&thread == &polling_thread) {
-        s.assimilate_polling_status(status->get_status());
-      } else {
-        LOGGER << "Unknown thread." << endl;
         continue;
       }
 
-      if (s.complete()) {
-        handle_completed_status(*(req->second));
-        status_reqs.erase(req);
-        LOGGER << "Status request " << request_id << " has been completed." << endl;
+      const StatusPayload *status = message.as_status();
+      if (status != nullptr) {
+        LOGGER << "Received status message " << message << "." << endl;
+
+        const RequestID &request_id = status->get_request_id();
+
+        auto req = status_reqs.find(request_id);
+        if (req == status_reqs.end()) {
+          LOGGER << "Unrecognized request ID " << request_id << "." << endl;
+          continue;
+        }
+
+        Status &s = req->second->status;
+        if (&thread == &worker_thread) {
+          s.assimilate_worker_status(status->get_status());
+        } else if (&thread == &polling_thread) {
+          s.assimilate_polling_status(status->get_status());
+        } else {
+          LOGGER << "Unknown thread." << endl;
+          continue;
+        }
+
+        if (s.complete()) {
+          handle_completed_status(*(req->second));
+          status_reqs.erase(req);
+          LOGGER << "Status request " << request_id << " has been completed." << endl;
+        }
+
+        continue;
       }
 
-      continue;
+      LOGGER << "Received unexpected message " << message << "." << endl;
     }
 
-    LOGGER << "Received unexpected message " << message << "." << endl;
+    if (!exhausted) backlog.messages.reset();
   }
 
   for (auto &pair : to_deliver) {
     const ChannelID &channel_id = pair.first;
-    vector<Local<Object>> &js_events = pair.second;
+    vector<Local<Value>> &js_events = pair.second;
 
     auto maybe_callback = channel_callbacks.find(channel_id);
     if (maybe_callback == channel_callbacks.end()) {
@@ -308,16 +415,35 @@ void Hub::handle_events_from(Thread &thread)
     LOGGER << "Dispatching " << js_events.size() << " event(s) on channel " << channel_id << " to the node callback."
            << endl;
 
-    Local<Array> js_array = Nan::New<Array>(js_events.size());
+    Local<Array> js_array = Array::New(v8::Isolate::GetCurrent(), js_events.data(), js_events.size());
+
+    Local<Value> argv[] = {Nan::Null(), js_array};
+    callback->Call(2, argv);
+  }
 
-    v8::Local<v8::Context> context = Nan::GetCurrentContext();
-    int index = 0;
-    for (auto &js_event : js_events) {
-      js_array->Set(context, index, js_event);
-      index++;
+  for (auto &pair : to_encode) {
+    const ChannelID &channel_id = pair.first;
+    EventColumns &columns = pair.second;
+
+    auto maybe_callback = channel_callbacks.find(channel_id);
+    if (maybe_callback == channel_callbacks.end()) {
+      LOGGER << "Ignoring unexpected filesystem event channel " << channel_id << "." << endl;
+      continue;
     }
+    shared_ptr<AsyncCallback> callback = maybe_callback->second;
 
-    Local<Value> argv[] = {Nan::Null(), js_array};
+    LOGGER << "Dispatching " << columns.size() << " encoded event(s) on channel " << channel_id
+           << " to the node callback." << endl;
+
+    Local<Object> js_buffer;
+    if (!columns.to_buffer().ToLocal(&js_buffer)) {
+      LOGGER << "Unable to allocate a buffer for " << columns.size() << " event(s)." << endl;
+      Local<Value> argv[] = {Nan::Error("Unable to allocate a buffer for filesystem events")};
+      callback->Call(1, argv);
+      continue;
+    }
+
+    Local<Value> argv[] = {Nan::Null(), js_buffer};
     callback->Call(2, argv);
   }
 
@@ -343,7 +469,7 @@ void Hub::handle_events_from(Thread &thread)
     if (er.is_error()) LOGGER << "Unable to unwatch fatally errored channel " << channel_id << "." << endl;
   }
 
-  if (repeat) handle_events_from(thread);
+  return !exhausted;
 }
 
 void Hub::handle_completed_status(StatusReq &req)
@@ -359,6 +485,15 @@ void Hub::handle_completed_status(StatusReq &req)
   Nan::Set(status_object,
     Nan::New<String>("channelCallbackCount").ToLocalChecked(),
     Nan::New<Uint32>(static_cast<uint32_t>(status.channel_callback_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("dispatchLatestMicroseconds").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(status.dispatch_latest)));
+  Nan::Set(status_object,
+    Nan::New<String>("dispatchLongestMicroseconds").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(status.dispatch_longest)));
+  Nan::Set(status_object,
+    Nan::New<String>("dispatchYieldCount").ToLocalChecked(),
+    Nan::New<Number>(static_cast<double>(status.dispatch_yield_count)));
 
   // Worker thread
   Nan::Set(status_object,
@@ -379,17 +514,23 @@ void Hub::handle_completed_status(StatusReq &req)
   Nan::Set(status_object,
     Nan::New<String>("workerOutOk").ToLocalChecked(),
     Nan::New<String>(status.worker_out_ok).ToLocalChecked());
+  Nan::Set(status_object,
+    Nan::New<String>("workerOutChannelDepth").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_out_channel_depth)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerOutDropped").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_out_dropped)));
 
   Nan::Set(status_object,
     Nan::New<String>("workerSubscriptionCount").ToLocalChecked(),
     Nan::New<Uint32>(static_cast<uint32_t>(status.worker_subscription_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerRecentFileCacheSize").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_recent_file_cache_size)));
 #ifdef PLATFORM_MACOS
   Nan::Set(status_object,
     Nan::New<String>("workerRenameBufferSize").ToLocalChecked(),
     Nan::New<Uint32>(static_cast<uint32_t>(status.worker_rename_buffer_size)));
-  Nan::Set(status_object,
-    Nan::New<String>("workerRecentFileCacheSize").ToLocalChecked(),
-    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_recent_file_cache_size)));
 #endif
 #ifdef PLATFORM_LINUX
   Nan::Set(status_object,
@@ -401,6 +542,27 @@ void Hub::handle_completed_status(StatusReq &req)
   Nan::Set(status_object,
     Nan::New<String>("workerCookieJarSize").ToLocalChecked(),
     Nan::New<Uint32>(static_cast<uint32_t>(status.worker_cookie_jar_size)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerWatchLimit").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_watch_limit)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerWatchAllowance").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_watch_allowance)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerBudgetPolledRootCount").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_budget_polled_root_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerBudgetPolledDirectoryCount").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_budget_polled_directory_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerPromotedSubtreeCount").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_promoted_subtree_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerPromotionCount").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_promotion_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("workerDemotionCount").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.worker_demotion_count)));
 #endif
 
   // Polling thread
@@ -422,12 +584,24 @@ void Hub::handle_completed_status(StatusReq &req)
   Nan::Set(status_object,
     Nan::New<String>("pollingOutOk").ToLocalChecked(),
     Nan::New<String>(status.polling_out_ok).ToLocalChecked());
+  Nan::Set(status_object,
+    Nan::New<String>("pollingOutChannelDepth").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.polling_out_channel_depth)));
+  Nan::Set(status_object,
+    Nan::New<String>("pollingOutDropped").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.polling_out_dropped)));
   Nan::Set(status_object,
     Nan::New<String>("pollingRootCount").ToLocalChecked(),
     Nan::New<Uint32>(static_cast<uint32_t>(status.polling_root_count)));
   Nan::Set(status_object,
     Nan::New<String>("pollingEntryCount").ToLocalChecked(),
     Nan::New<Uint32>(static_cast<uint32_t>(status.polling_entry_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("pollingLazyRootCount").ToLocalChecked(),
+    Nan::New<Uint32>(static_cast<uint32_t>(status.polling_lazy_root_count)));
+  Nan::Set(status_object,
+    Nan::New<String>("pollingStatBackend").ToLocalChecked(),
+    Nan::New<String>(status.polling_stat_backend).ToLocalChecked());
 
   Local<Value> argv[] = {Nan::Null(), status_object};
   req.callback->Call(2, argv);
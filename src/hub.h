@@ -7,11 +7,15 @@
 #include <unordered_map>
 #include <utility>
 #include <uv.h>
+#include <vector>
 
 #include "errable.h"
 #include "log.h"
 #include "message.h"
 #include "nan/async_callback.h"
+#include "nan/event_columns.h"
+#include "nan/event_objects.h"
+#include "path_filter.h"
 #include "polling/polling_thread.h"
 #include "result.h"
 #include "worker/worker_thread.h"
@@ -106,6 +110,48 @@ public:
     return send_command(worker_thread, CommandPayloadBuilder::cache_size(cache_size), std::move(callback));
   }
 
+  Result<> worker_traversal_threads(size_t thread_count, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(worker_thread, CommandPayloadBuilder::traversal_threads(thread_count), std::move(callback));
+  }
+
+  Result<> worker_fanotify(bool enabled, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(worker_thread, CommandPayloadBuilder::fanotify(enabled), std::move(callback));
+  }
+
+  Result<> worker_coalesce_latency(uint_fast32_t latency, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(worker_thread, CommandPayloadBuilder::coalesce_latency(latency), std::move(callback));
+  }
+
+  Result<> worker_resync_on_overflow(bool enabled, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(worker_thread, CommandPayloadBuilder::overflow_resync(enabled), std::move(callback));
+  }
+
+  Result<> worker_watch_depth(uint_fast32_t depth, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(worker_thread, CommandPayloadBuilder::watch_depth(depth), std::move(callback));
+  }
+
+  Result<> worker_rename_window(uint_fast32_t window, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(worker_thread, CommandPayloadBuilder::rename_window(window), std::move(callback));
+  }
+
   Result<> use_polling_log_file(std::string &&polling_log_file, std::unique_ptr<AsyncCallback> callback)
   {
     if (!check_async(callback)) return ok_result();
@@ -149,9 +195,71 @@ public:
     return send_command(polling_thread, CommandPayloadBuilder::polling_throttle(throttle), std::move(callback));
   }
 
+  Result<> set_polling_stat_backend(StatBackend backend, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(polling_thread, CommandPayloadBuilder::polling_stat_backend(backend), std::move(callback));
+  }
+
+  Result<> polling_coalesce_latency(uint_fast32_t latency, std::unique_ptr<AsyncCallback> callback)
+  {
+    if (!check_async(callback)) return ok_result();
+
+    return send_command(polling_thread, CommandPayloadBuilder::coalesce_latency(latency), std::move(callback));
+  }
+
+  // Limit the filesystem events from each channel that may wait for the main thread on the worker and polling
+  // threads' output queues. Takes effect immediately, under the current overflow policy.
+  Result<> set_event_budget(size_t budget)
+  {
+    Result<> h = health_err_result();
+    if (h.is_error()) return h;
+
+    event_budget = budget;
+    apply_event_budget();
+    return ok_result();
+  }
+
+  // Choose what happens to filesystem events beyond the event budget. Takes effect immediately, with the current
+  // budget.
+  Result<> set_overflow_policy(OverflowPolicy policy)
+  {
+    Result<> h = health_err_result();
+    if (h.is_error()) return h;
+
+    overflow_policy = policy;
+    apply_event_budget();
+    return ok_result();
+  }
+
+  // Deliver each channel's filesystem events to JavaScript as a single Buffer of columns, decoded by
+  // lib/event-batch.js, rather than as an Array of event objects. Takes effect with the next delivery.
+  Result<> set_binary_events(bool enabled)
+  {
+    Result<> h = health_err_result();
+    if (h.is_error()) return h;
+
+    binary_events = enabled;
+    return ok_result();
+  }
+
+  // Spend no more than `budget` microseconds delivering messages to JavaScript in each turn of the event loop before
+  // yielding and resuming in the next. Zero removes the limit. Takes effect with the next delivery.
+  Result<> set_dispatch_budget(uint_fast32_t budget)
+  {
+    Result<> h = health_err_result();
+    if (h.is_error()) return h;
+
+    dispatch_budget = budget;
+    return ok_result();
+  }
+
   Result<> watch(std::string &&root,
     bool poll,
     bool recursive,
+    WatchBackend backend,
+    std::shared_ptr<const PathFilter> &&filter,
     std::unique_ptr<AsyncCallback> ack_callback,
     std::unique_ptr<AsyncCallback> event_callback);
 
@@ -181,13 +289,33 @@ private:
     std::unique_ptr<AsyncCallback> callback;
   };
 
+  // Messages accepted from a Thread's out queue that are still to be delivered, because the dispatch budget ran out.
+  struct Backlog
+  {
+    std::unique_ptr<std::vector<Message>> messages;
+
+    size_t next_message{0};
+
+    // Position within a FileSystemBatchPayload at `next_message`.
+    size_t next_event{0};
+  };
+
   Hub();
 
   Result<> send_command(Thread &thread, CommandPayloadBuilder &&builder, std::unique_ptr<AsyncCallback> callback);
 
   bool check_async(const std::unique_ptr<AsyncCallback> &callback);
 
-  void handle_events_from(Thread &thread);
+  // Send the current event budget and overflow policy to both threads' output queues.
+  void apply_event_budget()
+  {
+    worker_thread.set_event_budget(event_budget, overflow_policy);
+    polling_thread.set_event_budget(event_budget, overflow_policy);
+  }
+
+  // Deliver messages from `thread` until its out queue is empty or the uv_hrtime() `deadline` passes, whichever is
+  // first. A `deadline` of zero never passes. Return true if the out queue was emptied.
+  bool handle_events_from(Thread &thread, uint64_t deadline);
 
   void handle_completed_status(StatusReq &req);
 
@@ -202,6 +330,25 @@ private:
   ChannelID next_channel_id;
   RequestID next_request_id;
 
+  size_t event_budget;
+  OverflowPolicy overflow_policy;
+
+  bool binary_events;
+
+  EventObjects event_objects;
+
+  Backlog worker_backlog;
+  Backlog polling_backlog;
+
+  // True while handle_events() is delivering messages.
+  bool dispatching;
+
+  // Microseconds.
+  uint_fast32_t dispatch_budget;
+  uint64_t dispatch_latest;
+  uint64_t dispatch_longest;
+  size_t dispatch_yield_count;
+
   std::unordered_map<CommandID, std::unique_ptr<AsyncCallback>> pending_callbacks;
   std::unordered_map<RequestID, std::unique_ptr<StatusReq>> status_reqs;
   std::unordered_map<ChannelID, std::shared_ptr<AsyncCallback>> channel_callbacks;
@@ -0,0 +1,153 @@
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "helper/common.h"
+#include "ignore_rules.h"
+#include "path_filter.h"
+
+using std::ifstream;
+using std::move;
+using std::string;
+using std::vector;
+
+#ifdef PLATFORM_WINDOWS
+const char *const IgnoreRules::SEPARATORS = "/\\";
+#else
+const char *const IgnoreRules::SEPARATORS = "/";
+#endif
+
+// Locate the first character of `path` that lies beneath `root`. Return string::npos if `path` is the root itself or
+// lies outside of it.
+static size_t relative_start(const string &root, const string &path)
+{
+  if (root.empty() || path.compare(0, root.size(), root) != 0) return string::npos;
+
+  if (root.find_last_of(IgnoreRules::SEPARATORS) == root.size() - 1) {
+    return path.size() > root.size() ? root.size() : string::npos;
+  }
+
+  if (path.size() <= root.size() + 1 || path.find_first_of(IgnoreRules::SEPARATORS, root.size()) != root.size()) {
+    return string::npos;
+  }
+  return root.size() + 1;
+}
+
+IgnoreRules::IgnoreRules(string &&root) : root(move(root))
+{
+  //
+}
+
+bool IgnoreRules::ignores(const string &path, bool directory)
+{
+  size_t start = relative_start(root, path);
+  if (start == string::npos) return false;
+
+  // Test each containing directory first, because nothing within an ignored directory can be re-included.
+  for (size_t end = path.find_first_of(SEPARATORS, start); end != string::npos;
+       end = path.find_first_of(SEPARATORS, end + 1)) {
+    if (decide(path, end, true)) return true;
+  }
+  return decide(path, path.size(), directory);
+}
+
+void IgnoreRules::reload(const string &dir)
+{
+  by_directory.erase(dir);
+}
+
+void IgnoreRules::reload_ancestors(const string &path)
+{
+  size_t start = relative_start(root, path);
+  if (start == string::npos) return;
+
+  by_directory.erase(root);
+  for (size_t end = path.find_first_of(SEPARATORS, start); end != string::npos;
+       end = path.find_first_of(SEPARATORS, end + 1)) {
+    by_directory.erase(path.substr(0, end));
+  }
+}
+
+void IgnoreRules::adopt(IgnoreRules &other)
+{
+  for (auto &pair : other.by_directory) {
+    if (by_directory.find(pair.first) == by_directory.end()) by_directory.emplace(pair.first, move(pair.second));
+  }
+  other.by_directory.clear();
+}
+
+const vector<IgnoreRules::Rule> &IgnoreRules::rules_for(const string &dir)
+{
+  auto existing = by_directory.find(dir);
+  if (existing != by_directory.end()) return existing->second;
+
+  vector<Rule> rules;
+  read_file(path_join(dir, ".gitignore"), rules);
+  read_file(path_join(dir, ".ignore"), rules);
+  return by_directory.emplace(dir, move(rules)).first->second;
+}
+
+void IgnoreRules::read_file(const string &path, vector<Rule> &rules)
+{
+  ifstream in(path);
+  if (!in) return;
+
+  string line;
+  while (getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+
+    // Trailing spaces are dropped unless the last of them is escaped.
+    size_t last = line.find_last_not_of(' ');
+    if (last == string::npos) continue;
+    if (line[last] == '\\' && last + 1 < line.size()) {
+      line.erase(last, 1);
+    }
+    line.resize(last + 1);
+
+    if (line[0] == '#') continue;
+
+    bool negated = line[0] == '!';
+    size_t begin = negated ? 1 : 0;
+    if (line[0] == '\\' && line.size() > 1 && (line[1] == '#' || line[1] == '!')) begin = 1;
+    string glob = line.substr(begin);
+
+    bool directory_only = !glob.empty() && glob.back() == '/';
+    if (directory_only) glob.pop_back();
+
+    bool basename = glob.find('/') == string::npos;
+    if (!glob.empty() && glob[0] == '/') glob.erase(0, 1);
+    if (glob.empty()) continue;
+
+    rules.push_back(Rule{move(glob), negated, directory_only, basename});
+  }
+}
+
+bool IgnoreRules::decide(const string &path, size_t end, bool directory)
+{
+  size_t root_end = relative_start(root, path) - 1;
+  size_t name_start = path.find_last_of(SEPARATORS, end - 1) + 1;
+
+  // Consult each directory from the entry's parent up to the root.
+  size_t dir_end = name_start - 1;
+  string dir;
+  while (true) {
+    if (dir_end == root_end) {
+      dir = root;
+    } else {
+      dir.assign(path, 0, dir_end);
+    }
+
+    const vector<Rule> &rules = rules_for(dir);
+    for (auto rule = rules.rbegin(); rule != rules.rend(); ++rule) {
+      if (rule->directory_only && !directory) continue;
+
+      size_t from = rule->basename ? name_start : dir_end + 1;
+      if (PathFilter::glob_matches(rule->glob, path, from, end)) return !rule->negated;
+    }
+
+    if (dir_end <= root_end) return false;
+    dir_end = path.find_last_of(SEPARATORS, dir_end - 1);
+  }
+}
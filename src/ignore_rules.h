@@ -0,0 +1,90 @@
+#ifndef IGNORE_RULES_H
+#define IGNORE_RULES_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The rules of the `.gitignore` and `.ignore` files found beneath a watch root, with git's semantics:
+//
+// * Blank lines and lines that begin with `#` are skipped. A leading `\` escapes a `#` or `!`.
+// * A pattern prefixed with `!` re-includes entries that an earlier pattern ignored.
+// * A pattern with a trailing `/` matches directories only.
+// * A pattern with a `/` elsewhere is anchored to the directory containing the ignore file. Others match the final
+//   component of each path at any depth beneath it.
+// * Globs are matched as they are by PathFilter.
+//
+// Rules within deeper directories take precedence over those above them, and later rules take precedence over earlier
+// ones, with `.ignore` read after `.gitignore`. An entry within an ignored directory is ignored regardless of any
+// negated pattern. Ignore files above the root are not consulted.
+//
+// Each directory's ignore files are read and compiled the first time an entry within it is tested, then cached until
+// reload() is called. IgnoreRules are not thread-safe.
+class IgnoreRules
+{
+public:
+  explicit IgnoreRules(std::string &&root);
+
+  ~IgnoreRules() = default;
+
+  // Return true if the entry at the absolute path `path`, or any directory containing it, is ignored. `directory`
+  // indicates whether or not the entry is known to be a directory. The root itself and paths outside of it are never
+  // ignored.
+  bool ignores(const std::string &path, bool directory);
+
+  // Forget the cached rules of the directory at the absolute path `dir`, so that its ignore files are read again the
+  // next time they're needed.
+  void reload(const std::string &dir);
+
+  // Forget the cached rules of every directory that contains the absolute path `path`.
+  void reload_ancestors(const std::string &path);
+
+  // Take the cached rules of `other`, which must share this root, for each directory that has none cached here.
+  void adopt(IgnoreRules &other);
+
+  // Access the absolute path of the root directory.
+  const std::string &get_root() const { return root; }
+
+  // Return true if a file named `name` contributes rules.
+  static bool is_ignore_file(const std::string &name) { return name == ".gitignore" || name == ".ignore"; }
+
+  // Characters that separate path components.
+  static const char *const SEPARATORS;
+
+  IgnoreRules(const IgnoreRules &) = delete;
+  IgnoreRules(IgnoreRules &&) = delete;
+  IgnoreRules &operator=(const IgnoreRules &) = delete;
+  IgnoreRules &operator=(IgnoreRules &&) = delete;
+
+private:
+  struct Rule
+  {
+    std::string glob;
+
+    // If true, re-include matching entries.
+    bool negated;
+
+    // If true, match directories only.
+    bool directory_only;
+
+    // If true, match the final path component only.
+    bool basename;
+  };
+
+  // Access the compiled rules of the directory at `dir`, reading its ignore files if they aren't cached.
+  const std::vector<Rule> &rules_for(const std::string &dir);
+
+  // Compile the rules of the ignore file at `path`, if it exists, into `rules`.
+  static void read_file(const std::string &path, std::vector<Rule> &rules);
+
+  // Return the verdict of the closest rule that matches the entry at `path`, ending at `end`, from the directories
+  // between it and the root. Return false if no rule matches.
+  bool decide(const std::string &path, size_t end, bool directory);
+
+  const std::string root;
+
+  // Compiled rules, keyed by absolute directory path. Directories without ignore files have empty entries.
+  std::unordered_map<std::string, std::vector<Rule>> by_directory;
+};
+
+#endif
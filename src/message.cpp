@@ -1,10 +1,13 @@
+#include <cstring>
 #include <iomanip>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "message.h"
+#include "path_filter.h"
 #include "status.h"
 
 using std::move;
@@ -20,6 +23,8 @@ ostream &operator<<(ostream &out, FileSystemAction action)
     case ACTION_DELETED: out << "deleted"; break;
     case ACTION_MODIFIED: out << "modified"; break;
     case ACTION_RENAMED: out << "renamed"; break;
+    case ACTION_RESYNCED: out << "resynced"; break;
+    case ACTION_OVERFLOWED: out << "overflowed"; break;
     default: out << "!! FileSystemAction=" << static_cast<int>(action);
   }
   return out;
@@ -76,13 +81,117 @@ string FileSystemPayload::describe() const
   return builder.str();
 }
 
+FileSystemBatchPayload::FileSystemBatchPayload(FileSystemBatchPayload &&original) noexcept :
+  records{move(original.records)}, chars{move(original.chars)}, next_recent_dir{original.next_recent_dir}
+{
+  for (size_t i = 0; i < RECENT_DIRS; i++) {
+    recent_dirs[i] = original.recent_dirs[i];
+    original.recent_dirs[i] = Span{};
+  }
+  original.records.clear();
+  original.chars.clear();
+  original.next_recent_dir = 0;
+}
+
+void FileSystemBatchPayload::add(ChannelID channel_id,
+  FileSystemAction action,
+  EntryKind kind,
+  const string &old_path,
+  const string &path)
+{
+  Record record{};
+  record.channel_id = channel_id;
+  record.action = static_cast<uint8_t>(action);
+  record.kind = static_cast<uint8_t>(kind);
+  if (!old_path.empty()) record.old_path = store(old_path);
+  record.path = store(path);
+  records.push_back(record);
+}
+
+FileSystemPayload FileSystemBatchPayload::payload_at(size_t index) const
+{
+  const Record &record = records[index];
+  string old_path, path;
+  copy(record.old_path, old_path);
+  copy(record.path, path);
+  return FileSystemPayload(record.channel_id,
+    static_cast<FileSystemAction>(record.action),
+    static_cast<EntryKind>(record.kind),
+    move(old_path),
+    move(path));
+}
+
+FileSystemBatchPayload::SplitPath FileSystemBatchPayload::store(const string &path)
+{
+  size_t separator = path.find_last_of("/\\");
+  size_t dir_length = separator == string::npos ? 0 : separator + 1;
+
+  SplitPath split{};
+  if (dir_length > 0) {
+    bool found = false;
+    for (const Span &recent : recent_dirs) {
+      if (recent.length == dir_length && memcmp(chars.data() + recent.offset, path.data(), dir_length) == 0) {
+        split.dir = recent;
+        found = true;
+        break;
+      }
+    }
+
+    if (!found) {
+      split.dir = store_span(path.data(), dir_length);
+      recent_dirs[next_recent_dir] = split.dir;
+      next_recent_dir = (next_recent_dir + 1) % RECENT_DIRS;
+    }
+  }
+
+  split.name = store_span(path.data() + dir_length, path.size() - dir_length);
+  return split;
+}
+
+FileSystemBatchPayload::Span FileSystemBatchPayload::store_span(const char *data, size_t length)
+{
+  Span span{static_cast<uint32_t>(chars.size()), static_cast<uint32_t>(length)};
+  chars.insert(chars.end(), data, data + length);
+  return span;
+}
+
+void FileSystemBatchPayload::copy(const SplitPath &path, string &into) const
+{
+  into.clear();
+  append(path, into);
+}
+
+void FileSystemBatchPayload::append(const SplitPath &path, string &into) const
+{
+  if (path.dir.length > 0) into.append(chars.data() + path.dir.offset, path.dir.length);
+  if (path.name.length > 0) into.append(chars.data() + path.name.offset, path.name.length);
+}
+
+string FileSystemBatchPayload::describe() const
+{
+  ostringstream builder;
+  builder << "[FileSystemBatchPayload " << records.size() << " events in " << chars.size() << " characters]";
+  return builder.str();
+}
+
 CommandPayload::CommandPayload(CommandAction action,
   CommandID id,
   std::string &&root,
   uint_fast32_t arg,
   bool recursive,
-  size_t split_count) :
-  id{id}, action{action}, root{move(root)}, arg{arg}, recursive{recursive}, split_count{split_count}
+  size_t split_count,
+  WatchBackend backend,
+  bool lazy,
+  std::shared_ptr<const PathFilter> &&filter) :
+  id{id},
+  action{action},
+  root{move(root)},
+  arg{arg},
+  recursive{recursive},
+  split_count{split_count},
+  backend{backend},
+  lazy{lazy},
+  filter{move(filter)}
 {
   //
 }
@@ -93,7 +202,10 @@ CommandPayload::CommandPayload(CommandPayload &&original) noexcept :
   root{move(original.root)},
   arg{original.arg},
   recursive{original.recursive},
-  split_count{original.split_count}
+  split_count{original.split_count},
+  backend{original.backend},
+  lazy{original.lazy},
+  filter{move(original.filter)}
 {
   //
 }
@@ -107,6 +219,10 @@ string CommandPayload::describe() const
     case COMMAND_ADD:
       builder << "add " << root << " at channel " << arg;
       if (!recursive) builder << " (non-recursively)";
+      if (backend == BACKEND_INOTIFY) builder << " with inotify";
+      if (backend == BACKEND_FANOTIFY) builder << " with fanotify";
+      if (lazy) builder << " lazily";
+      if (filter) builder << " with " << filter->describe();
       break;
     case COMMAND_REMOVE: builder << "remove channel " << arg; break;
     case COMMAND_LOG_FILE: builder << "log to file " << root; break;
@@ -115,7 +231,16 @@ string CommandPayload::describe() const
     case COMMAND_LOG_DISABLE: builder << "disable logging"; break;
     case COMMAND_POLLING_INTERVAL: builder << "polling interval " << arg; break;
     case COMMAND_POLLING_THROTTLE: builder << "polling throttle " << arg; break;
+    case COMMAND_POLLING_STAT_BACKEND: builder << "polling stat backend " << arg; break;
     case COMMAND_CACHE_SIZE: builder << "cache size " << arg; break;
+    case COMMAND_TRAVERSAL_THREADS: builder << "traversal threads " << arg; break;
+    case COMMAND_FANOTIFY: builder << (arg != 0 ? "enable" : "disable") << " fanotify"; break;
+    case COMMAND_COALESCE_LATENCY: builder << "coalesce latency " << arg << "ms"; break;
+    case COMMAND_OVERFLOW_RESYNC: builder << (arg != 0 ? "enable" : "disable") << " overflow resync"; break;
+    case COMMAND_WATCH_DEPTH: builder << "watch depth " << arg; break;
+    case COMMAND_RENAME_WINDOW: builder << "rename window " << arg << "ms"; break;
+    case COMMAND_PROMOTE: builder << "promote " << root << " at channel " << arg; break;
+    case COMMAND_RELEASE: builder << "release " << root << " at channel " << arg; break;
     case COMMAND_DRAIN: builder << "drain"; break;
     case COMMAND_STATUS: builder << "status request " << arg; break;
     default: builder << "!!action=" << action; break;
@@ -195,6 +320,11 @@ const StatusPayload *Message::as_status() const
   return kind == MSG_STATUS ? &status_payload : nullptr;
 }
 
+const FileSystemBatchPayload *Message::as_filesystem_batch() const
+{
+  return kind == MSG_FILESYSTEM_BATCH ? &filesystem_batch_payload : nullptr;
+}
+
 Message Message::ack(const Message &original, bool success, string &&message)
 {
   const CommandPayload *payload = original.as_command();
@@ -237,6 +367,12 @@ Message::Message(StatusPayload &&payload) : kind{MSG_STATUS}, status_payload{mov
   //
 }
 
+Message::Message(FileSystemBatchPayload &&payload) :
+  kind{MSG_FILESYSTEM_BATCH}, filesystem_batch_payload{move(payload)}
+{
+  //
+}
+
 Message::Message(Message &&original) noexcept : kind{original.kind}, pending{true}
 {
   switch (kind) {
@@ -245,6 +381,9 @@ Message::Message(Message &&original) noexcept : kind{original.kind}, pending{tru
     case MSG_ACK: new (&ack_payload) AckPayload(move(original.ack_payload)); break;
     case MSG_ERROR: new (&error_payload) ErrorPayload(move(original.error_payload)); break;
     case MSG_STATUS: new (&status_payload) StatusPayload(move(original.status_payload)); break;
+    case MSG_FILESYSTEM_BATCH:
+      new (&filesystem_batch_payload) FileSystemBatchPayload(move(original.filesystem_batch_payload));
+      break;
   };
 }
 
@@ -256,6 +395,7 @@ Message::~Message()
     case MSG_ACK: ack_payload.~AckPayload(); break;
     case MSG_ERROR: error_payload.~ErrorPayload(); break;
     case MSG_STATUS: status_payload.~StatusPayload(); break;
+    case MSG_FILESYSTEM_BATCH: filesystem_batch_payload.~FileSystemBatchPayload(); break;
   };
 }
 
@@ -270,6 +410,7 @@ string Message::describe() const
     case MSG_ACK: builder << ack_payload; break;
     case MSG_ERROR: builder << error_payload; break;
     case MSG_STATUS: builder << status_payload; break;
+    case MSG_FILESYSTEM_BATCH: builder << filesystem_batch_payload; break;
     default: builder << "!!kind=" << kind; break;
   };
 
@@ -307,6 +448,12 @@ std::ostream &operator<<(std::ostream &stream, const StatusPayload &e)
   return stream;
 }
 
+std::ostream &operator<<(std::ostream &stream, const FileSystemBatchPayload &e)
+{
+  stream << e.describe();
+  return stream;
+}
+
 std::ostream &operator<<(std::ostream &stream, const Message &e)
 {
   stream << e.describe();
@@ -6,10 +6,14 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "result.h"
+#include "stat_engine.h"
 #include "status.h"
 
+class PathFilter;
+
 enum EntryKind
 {
   KIND_FILE = 0,
@@ -40,8 +44,10 @@ enum FileSystemAction
   ACTION_DELETED = 1,
   ACTION_MODIFIED = 2,
   ACTION_RENAMED = 3,
+  ACTION_RESYNCED = 4,  // Events may have been lost beneath a root, and have been reconstructed by rescanning it.
+  ACTION_OVERFLOWED = 5,  // Events were discarded before delivery. The client should rescan the root.
   ACTION_MIN = ACTION_CREATED,
-  ACTION_MAX = ACTION_RENAMED
+  ACTION_MAX = ACTION_OVERFLOWED
 };
 
 std::ostream &operator<<(std::ostream &out, FileSystemAction action);
@@ -72,6 +78,18 @@ public:
     return FileSystemPayload(channel_id, ACTION_RENAMED, kind, std::move(old_path), std::move(path));
   }
 
+  static FileSystemPayload resynced(ChannelID channel_id, std::string &&root)
+  {
+    return FileSystemPayload(channel_id, ACTION_RESYNCED, KIND_DIRECTORY, "", std::move(root));
+  }
+
+  // The queue that discards events doesn't know the channel's root, so the JavaScript layer substitutes it for the
+  // empty path.
+  static FileSystemPayload overflowed(ChannelID channel_id)
+  {
+    return FileSystemPayload(channel_id, ACTION_OVERFLOWED, KIND_DIRECTORY, "", "");
+  }
+
   FileSystemPayload(FileSystemPayload &&original) noexcept;
 
   ~FileSystemPayload() = default;
@@ -93,6 +111,8 @@ public:
   FileSystemPayload &operator=(FileSystemPayload &&original) = delete;
 
 private:
+  friend class FileSystemBatchPayload;
+
   FileSystemPayload(ChannelID channel_id,
     FileSystemAction action,
     EntryKind entry_kind,
@@ -106,6 +126,123 @@ private:
   std::string path;
 };
 
+// A sequence of filesystem events packed into two contiguous buffers, so that a batch of any size is built with a
+// handful of amortized allocations and crosses from a producing thread to the main thread as a single Message.
+//
+// Each event is a fixed-size record holding its channel, action, and kind, with its paths stored as spans of a shared
+// character area. A path is split at its final separator and the directory portion is shared with recent events in
+// the same directory, so a burst of activity within one directory stores the directory's path only once.
+class FileSystemBatchPayload
+{
+public:
+  FileSystemBatchPayload() = default;
+
+  // Leave `original` empty and ready to be refilled.
+  FileSystemBatchPayload(FileSystemBatchPayload &&original) noexcept;
+
+  ~FileSystemBatchPayload() = default;
+
+  // Append an event. `old_path` is empty for every action but ACTION_RENAMED.
+  void add(ChannelID channel_id,
+    FileSystemAction action,
+    EntryKind kind,
+    const std::string &old_path,
+    const std::string &path);
+
+  void add(const FileSystemPayload &payload)
+  {
+    add(payload.get_channel_id(),
+      payload.get_filesystem_action(),
+      payload.get_entry_kind(),
+      payload.get_old_path(),
+      payload.get_path());
+  }
+
+  void reserve(size_t events) { records.reserve(events); }
+
+  size_t size() const { return records.size(); }
+
+  bool empty() const { return records.empty(); }
+
+  // Number of characters held in the shared character area.
+  size_t get_char_count() const { return chars.size(); }
+
+  ChannelID get_channel_id(size_t index) const { return records[index].channel_id; }
+
+  FileSystemAction get_filesystem_action(size_t index) const
+  {
+    return static_cast<FileSystemAction>(records[index].action);
+  }
+
+  EntryKind get_entry_kind(size_t index) const { return static_cast<EntryKind>(records[index].kind); }
+
+  // Replace the contents of `into` with the path or former path of the event at `index`. Reusing one string for every
+  // event in the batch avoids allocating one for each.
+  void copy_path(size_t index, std::string &into) const { copy(records[index].path, into); }
+
+  void copy_old_path(size_t index, std::string &into) const { copy(records[index].old_path, into); }
+
+  // Append the path or former path of the event at `index` to `into`.
+  void append_path(size_t index, std::string &into) const { append(records[index].path, into); }
+
+  void append_old_path(size_t index, std::string &into) const { append(records[index].old_path, into); }
+
+  // Construct a standalone payload for the event at `index`, for consumers that inspect or reorder events one at a
+  // time.
+  FileSystemPayload payload_at(size_t index) const;
+
+  std::string describe() const;
+
+  FileSystemBatchPayload(const FileSystemBatchPayload &) = delete;
+  FileSystemBatchPayload &operator=(const FileSystemBatchPayload &) = delete;
+  FileSystemBatchPayload &operator=(FileSystemBatchPayload &&) = delete;
+
+private:
+  // A range of `chars`.
+  struct Span
+  {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  // A path stored as its directory, including the final separator, followed by the name within it.
+  struct SplitPath
+  {
+    Span dir;
+    Span name;
+  };
+
+  struct Record
+  {
+    ChannelID channel_id;
+    uint8_t action;
+    uint8_t kind;
+    SplitPath old_path;
+    SplitPath path;
+  };
+
+  // Store `path` in `chars`, sharing its directory with a recently stored path when possible.
+  SplitPath store(const std::string &path);
+
+  // Append `length` characters from `data` to `chars`.
+  Span store_span(const char *data, size_t length);
+
+  // Replace the contents of `into` with a path reassembled from `chars`.
+  void copy(const SplitPath &path, std::string &into) const;
+
+  // Append a path reassembled from `chars` to `into`.
+  void append(const SplitPath &path, std::string &into) const;
+
+  std::vector<Record> records;
+
+  std::vector<char> chars;
+
+  // Directories stored most recently, reused by later paths within them.
+  static const size_t RECENT_DIRS = 4;
+  Span recent_dirs[RECENT_DIRS]{};
+  size_t next_recent_dir{0};
+};
+
 enum CommandAction
 {
   COMMAND_ADD,
@@ -116,7 +253,16 @@ enum CommandAction
   COMMAND_LOG_DISABLE,
   COMMAND_POLLING_INTERVAL,
   COMMAND_POLLING_THROTTLE,
+  COMMAND_POLLING_STAT_BACKEND,
   COMMAND_CACHE_SIZE,
+  COMMAND_TRAVERSAL_THREADS,
+  COMMAND_FANOTIFY,
+  COMMAND_COALESCE_LATENCY,
+  COMMAND_OVERFLOW_RESYNC,
+  COMMAND_WATCH_DEPTH,
+  COMMAND_RENAME_WINDOW,
+  COMMAND_PROMOTE,
+  COMMAND_RELEASE,
   COMMAND_DRAIN,
   COMMAND_STATUS,
   COMMAND_MIN = COMMAND_ADD,
@@ -125,6 +271,15 @@ enum CommandAction
 
 using CommandID = uint_fast32_t;
 
+// Kernel facility requested for a watch root by COMMAND_ADD. Only the Linux worker offers a choice; other platforms
+// ignore it.
+enum WatchBackend
+{
+  BACKEND_DEFAULT,  // Use the worker's configured default.
+  BACKEND_INOTIFY,  // One inotify watch descriptor per directory.
+  BACKEND_FANOTIFY  // One fanotify mark per filesystem.
+};
+
 const CommandID NULL_COMMAND_ID = 0;
 
 class CommandPayload
@@ -152,6 +307,12 @@ public:
 
   const size_t &get_split_count() const { return split_count; }
 
+  const WatchBackend &get_backend() const { return backend; }
+
+  const bool &get_lazy() const { return lazy; }
+
+  const std::shared_ptr<const PathFilter> &get_filter() const { return filter; }
+
   std::string describe() const;
 
   CommandPayload &operator=(const CommandPayload &original) = delete;
@@ -163,7 +324,10 @@ private:
     std::string &&root,
     uint_fast32_t arg,
     bool recursive,
-    size_t split_count);
+    size_t split_count,
+    WatchBackend backend,
+    bool lazy,
+    std::shared_ptr<const PathFilter> &&filter);
 
   const CommandID id;
   const CommandAction action;
@@ -171,6 +335,9 @@ private:
   const uint_fast32_t arg;
   bool recursive;
   const size_t split_count;
+  const WatchBackend backend;
+  const bool lazy;
+  std::shared_ptr<const PathFilter> filter;
 
   friend class CommandPayloadBuilder;
 };
@@ -218,11 +385,59 @@ public:
     return CommandPayloadBuilder(COMMAND_POLLING_THROTTLE, "", throttle, false, 1);
   }
 
+  static CommandPayloadBuilder polling_stat_backend(StatBackend backend)
+  {
+    return CommandPayloadBuilder(COMMAND_POLLING_STAT_BACKEND, "", backend, false, 1);
+  }
+
   static CommandPayloadBuilder cache_size(uint_fast32_t maximum_size)
   {
     return CommandPayloadBuilder(COMMAND_CACHE_SIZE, "", maximum_size, false, 1);
   }
 
+  static CommandPayloadBuilder traversal_threads(uint_fast32_t thread_count)
+  {
+    return CommandPayloadBuilder(COMMAND_TRAVERSAL_THREADS, "", thread_count, false, 1);
+  }
+
+  static CommandPayloadBuilder fanotify(bool enabled)
+  {
+    return CommandPayloadBuilder(COMMAND_FANOTIFY, "", enabled ? 1 : 0, false, 1);
+  }
+
+  static CommandPayloadBuilder coalesce_latency(uint_fast32_t latency)
+  {
+    return CommandPayloadBuilder(COMMAND_COALESCE_LATENCY, "", latency, false, 1);
+  }
+
+  static CommandPayloadBuilder overflow_resync(bool enabled)
+  {
+    return CommandPayloadBuilder(COMMAND_OVERFLOW_RESYNC, "", enabled ? 1 : 0, false, 1);
+  }
+
+  static CommandPayloadBuilder watch_depth(uint_fast32_t depth)
+  {
+    return CommandPayloadBuilder(COMMAND_WATCH_DEPTH, "", depth, false, 1);
+  }
+
+  static CommandPayloadBuilder rename_window(uint_fast32_t window)
+  {
+    return CommandPayloadBuilder(COMMAND_RENAME_WINDOW, "", window, false, 1);
+  }
+
+  // Sent by the polling thread to ask the worker thread to watch a lazily polled subtree that has changed.
+  static CommandPayloadBuilder promote(ChannelID channel_id, std::string &&root)
+  {
+    return CommandPayloadBuilder(COMMAND_PROMOTE, std::move(root), channel_id, true, 1);
+  }
+
+  // Sent between the worker and polling threads once the sender covers a subtree that it's taking over, so that the
+  // receiver may stop covering it.
+  static CommandPayloadBuilder release(ChannelID channel_id, std::string &&root)
+  {
+    return CommandPayloadBuilder(COMMAND_RELEASE, std::move(root), channel_id, true, 1);
+  }
+
   static CommandPayloadBuilder drain() { return CommandPayloadBuilder(COMMAND_DRAIN, "", NULL_CHANNEL_ID, false, 1); }
 
   static CommandPayloadBuilder status(RequestID request_id)
@@ -236,7 +451,10 @@ public:
     root{std::move(original.root)},
     arg{original.arg},
     recursive{original.recursive},
-    split_count{original.split_count}
+    split_count{original.split_count},
+    backend{original.backend},
+    lazy{original.lazy},
+    filter{std::move(original.filter)}
   {
     //
   }
@@ -249,10 +467,32 @@ public:
     return *this;
   }
 
+  CommandPayloadBuilder &set_backend(WatchBackend backend)
+  {
+    this->backend = backend;
+    return *this;
+  }
+
+  // Mark a polled root as lying beneath the worker thread's watch depth. The polling thread sweeps lazy roots less
+  // often than others and asks the worker thread to promote each one as soon as it changes.
+  CommandPayloadBuilder &set_lazy(bool lazy)
+  {
+    this->lazy = lazy;
+    return *this;
+  }
+
+  // Report only the paths beneath a watch root that `filter` accepts. Filters are shared among every root that the
+  // worker and polling threads split a channel into.
+  CommandPayloadBuilder &set_filter(const std::shared_ptr<const PathFilter> &filter)
+  {
+    this->filter = filter;
+    return *this;
+  }
+
   CommandPayload build()
   {
     assert(action >= COMMAND_MIN && action <= COMMAND_MAX);
-    return CommandPayload(action, id, std::move(root), arg, recursive, split_count);
+    return CommandPayload(action, id, std::move(root), arg, recursive, split_count, backend, lazy, std::move(filter));
   }
 
   CommandPayloadBuilder(const CommandPayloadBuilder &) = delete;
@@ -265,7 +505,14 @@ private:
     uint_fast32_t arg,
     bool recursive,
     size_t split_count) :
-    id{NULL_COMMAND_ID}, action{action}, root{std::move(root)}, arg{arg}, recursive{recursive}, split_count{split_count}
+    id{NULL_COMMAND_ID},
+    action{action},
+    root{std::move(root)},
+    arg{arg},
+    recursive{recursive},
+    split_count{split_count},
+    backend{BACKEND_DEFAULT},
+    lazy{false}
   {}
 
   CommandID id;
@@ -274,6 +521,9 @@ private:
   uint_fast32_t arg;
   bool recursive;
   size_t split_count;
+  WatchBackend backend;
+  bool lazy;
+  std::shared_ptr<const PathFilter> filter;
 };
 
 class AckPayload
@@ -364,8 +614,9 @@ enum MessageKind
   MSG_ACK,
   MSG_ERROR,
   MSG_STATUS,
+  MSG_FILESYSTEM_BATCH,
   MSG_MIN = MSG_FILESYSTEM,
-  MSG_MAX = MSG_STATUS
+  MSG_MAX = MSG_FILESYSTEM_BATCH
 };
 
 class Message
@@ -385,6 +636,8 @@ public:
 
   explicit Message(StatusPayload &&payload);
 
+  explicit Message(FileSystemBatchPayload &&payload);
+
   Message(Message &&original) noexcept;
 
   ~Message();
@@ -399,6 +652,8 @@ public:
 
   const StatusPayload *as_status() const;
 
+  const FileSystemBatchPayload *as_filesystem_batch() const;
+
   std::string describe() const;
 
   Message(const Message &) = delete;
@@ -414,6 +669,7 @@ private:
     AckPayload ack_payload;
     ErrorPayload error_payload;
     StatusPayload status_payload;
+    FileSystemBatchPayload filesystem_batch_payload;
     bool pending{false};
   };
 };
@@ -428,6 +684,8 @@ std::ostream &operator<<(std::ostream &stream, const ErrorPayload &e);
 
 std::ostream &operator<<(std::ostream &stream, const StatusPayload &e);
 
+std::ostream &operator<<(std::ostream &stream, const FileSystemBatchPayload &e);
+
 std::ostream &operator<<(std::ostream &stream, const Message &e);
 
 #endif
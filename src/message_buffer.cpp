@@ -9,48 +9,106 @@
 
 using std::endl;
 using std::move;
+using std::ostream;
 using std::string;
 
+// Batches are closed before their character area outgrows the offsets that index it.
+static const size_t MAX_BATCH_CHARS = 64 * 1024 * 1024;
+
 void MessageBuffer::created(ChannelID channel_id, std::string &&path, const EntryKind &kind)
 {
-  Message message(FileSystemPayload::created(channel_id, move(path), kind));
-  LOGGER << "Emitting filesystem message " << message << endl;
-  messages.push_back(move(message));
+  if (!accepts(channel_id, path, kind)) return;
+
+  add_event(channel_id, ACTION_CREATED, kind, string(), path);
 }
 
 void MessageBuffer::modified(ChannelID channel_id, std::string &&path, const EntryKind &kind)
 {
-  Message message(FileSystemPayload::modified(channel_id, move(path), kind));
-  LOGGER << "Emitting filesystem message " << message << endl;
-  messages.push_back(move(message));
+  if (!accepts(channel_id, path, kind)) return;
+
+  add_event(channel_id, ACTION_MODIFIED, kind, string(), path);
 }
 
 void MessageBuffer::deleted(ChannelID channel_id, std::string &&path, const EntryKind &kind)
 {
-  Message message(FileSystemPayload::deleted(channel_id, move(path), kind));
-  LOGGER << "Emitting filesystem message " << message << endl;
-  messages.push_back(move(message));
+  if (!accepts(channel_id, path, kind)) return;
+
+  add_event(channel_id, ACTION_DELETED, kind, string(), path);
 }
 
 void MessageBuffer::renamed(ChannelID channel_id, std::string &&old_path, std::string &&path, const EntryKind &kind)
 {
-  Message message(FileSystemPayload::renamed(channel_id, move(old_path), move(path), kind));
-  LOGGER << "Emitting filesystem message " << message << endl;
-  messages.push_back(move(message));
+  // An entry renamed across the edge of a PathFilter appears or disappears from the channel's point of view.
+  bool old_accepted = accepts(channel_id, old_path, kind);
+  bool accepted = accepts(channel_id, path, kind);
+  if (!old_accepted && !accepted) return;
+  if (!old_accepted) return created(channel_id, move(path), kind);
+  if (!accepted) return deleted(channel_id, move(old_path), kind);
+
+  add_event(channel_id, ACTION_RENAMED, kind, old_path, path);
+}
+
+void MessageBuffer::resynced(ChannelID channel_id, std::string &&root)
+{
+  add_event(channel_id, ACTION_RESYNCED, KIND_DIRECTORY, string(), root);
 }
 
 void MessageBuffer::ack(CommandID command_id, ChannelID channel_id, bool success, string &&msg)
 {
   Message message(AckPayload(command_id, channel_id, success, move(msg)));
   LOGGER << "Emitting ack message " << message << endl;
-  messages.push_back(move(message));
+  add(move(message));
 }
 
 void MessageBuffer::error(ChannelID channel_id, string &&message, bool fatal)
 {
   Message m(ErrorPayload(channel_id, move(message), fatal));
   LOGGER << "Emitting error message " << m << endl;
-  messages.push_back(move(m));
+  add(move(m));
+}
+
+void MessageBuffer::add(Message &&message)
+{
+  const FileSystemPayload *fs = message.as_filesystem();
+  if (fs != nullptr) {
+    add_event(
+      fs->get_channel_id(), fs->get_filesystem_action(), fs->get_entry_kind(), fs->get_old_path(), fs->get_path());
+    return;
+  }
+
+  const FileSystemBatchPayload *fs_batch = message.as_filesystem_batch();
+  count += fs_batch != nullptr ? fs_batch->size() : 1;
+
+  seal();
+  messages.emplace_back(move(message));
+}
+
+void MessageBuffer::add_event(ChannelID channel_id,
+  FileSystemAction action,
+  EntryKind kind,
+  const string &old_path,
+  const string &path)
+{
+  ostream &logline = LOGGER;
+  logline << "Emitting filesystem event [channel " << channel_id << " " << kind << " " << action;
+  if (!old_path.empty()) {
+    logline << " {" << old_path << " => " << path << "}]" << endl;
+  } else {
+    logline << " " << path << "]" << endl;
+  }
+
+  if (batch.get_char_count() > MAX_BATCH_CHARS) seal();
+
+  batch.add(channel_id, action, kind, old_path, path);
+  count++;
+}
+
+void MessageBuffer::seal()
+{
+  if (batch.empty()) return;
+
+  // Moving from the batch leaves it empty and ready to be refilled.
+  messages.emplace_back(move(batch));
 }
 
 ChannelMessageBuffer::ChannelMessageBuffer(MessageBuffer &buffer, ChannelID channel_id) :
@@ -6,12 +6,20 @@
 #include <vector>
 
 #include "message.h"
+#include "path_filter.h"
 
+// Collect Messages to be emitted together. Consecutive filesystem events are packed into a FileSystemBatchPayload as
+// they arrive instead of being built into Messages of their own, so a burst of events costs a few amortized
+// allocations on the producing thread and crosses to the main thread as a single Message.
 class MessageBuffer
 {
 public:
   MessageBuffer() = default;
 
+  // Silently discard filesystem events that the PathFilter or IgnoreRules of their channel within `filters` don't
+  // accept, and let the table observe changes to ignore files. The PathFilterTable must outlive this buffer.
+  explicit MessageBuffer(PathFilterTable *filters) : filters{filters} {}
+
   ~MessageBuffer() = default;
 
   using iter = std::vector<Message>::iterator;
@@ -24,21 +32,34 @@ public:
 
   void renamed(ChannelID channel_id, std::string &&old_path, std::string &&path, const EntryKind &kind);
 
+  void resynced(ChannelID channel_id, std::string &&root);
+
   void ack(CommandID command_id, ChannelID channel_id, bool success, std::string &&msg);
 
   void error(ChannelID channel_id, std::string &&message, bool fatal);
 
-  void reserve(size_t capacity) { messages.reserve(capacity); }
+  void reserve(size_t capacity) { batch.reserve(capacity); }
 
-  void add(Message &&message) { messages.emplace_back(std::move(message)); }
+  // Append a Message. Filesystem events are copied into the open batch.
+  void add(Message &&message);
 
-  MessageBuffer::iter begin() { return messages.begin(); }
+  // Iterate over the buffered Messages, packing any open batch into a Message of its own first.
+  MessageBuffer::iter begin()
+  {
+    seal();
+    return messages.begin();
+  }
 
-  MessageBuffer::iter end() { return messages.end(); }
+  MessageBuffer::iter end()
+  {
+    seal();
+    return messages.end();
+  }
 
-  size_t size() { return messages.size(); }
+  // Count the buffered filesystem events and other Messages.
+  size_t size() { return count; }
 
-  bool empty() { return messages.empty(); }
+  bool empty() { return count == 0; }
 
   MessageBuffer(const MessageBuffer &) = delete;
   MessageBuffer(MessageBuffer &&) = delete;
@@ -46,7 +67,31 @@ public:
   MessageBuffer &operator=(MessageBuffer &&) = delete;
 
 private:
+  bool accepts(ChannelID channel_id, const std::string &path, EntryKind kind)
+  {
+    if (filters == nullptr) return true;
+
+    filters->observe(channel_id, path);
+    return filters->accepts(channel_id, path, kind == KIND_DIRECTORY);
+  }
+
+  // Append a filesystem event to the open batch.
+  void add_event(ChannelID channel_id,
+    FileSystemAction action,
+    EntryKind kind,
+    const std::string &old_path,
+    const std::string &path);
+
+  // Close the open batch, if it holds any events, by moving it to the end of `messages`.
+  void seal();
+
   std::vector<Message> messages;
+
+  FileSystemBatchPayload batch;
+
+  size_t count{0};
+
+  PathFilterTable *filters{nullptr};
 };
 
 class ChannelMessageBuffer
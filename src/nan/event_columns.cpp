@@ -0,0 +1,85 @@
+#include <cstdint>
+#include <cstring>
+#include <nan.h>
+#include <string>
+#include <v8.h>
+#include <vector>
+
+#include "../message.h"
+#include "event_columns.h"
+
+using std::string;
+using std::vector;
+using v8::Local;
+using v8::Object;
+
+// Copy the contents of `column` to `dest`, returning the position just past them.
+template <class T>
+static char *write_column(char *dest, const vector<T> &column)
+{
+  size_t length = column.size() * sizeof(T);
+  if (length > 0) memcpy(dest, column.data(), length);
+  return dest + length;
+}
+
+void EventColumns::add(FileSystemAction action, EntryKind kind, const string &old_path, const string &path)
+{
+  actions.push_back(static_cast<uint8_t>(action));
+  kinds.push_back(static_cast<uint8_t>(kind));
+
+  old_path_offsets.push_back(static_cast<uint32_t>(paths.size()));
+  old_path_lengths.push_back(static_cast<uint32_t>(old_path.size()));
+  paths.append(old_path);
+
+  path_offsets.push_back(static_cast<uint32_t>(paths.size()));
+  path_lengths.push_back(static_cast<uint32_t>(path.size()));
+  paths.append(path);
+}
+
+void EventColumns::add(const FileSystemBatchPayload &batch, size_t index)
+{
+  actions.push_back(static_cast<uint8_t>(batch.get_filesystem_action(index)));
+  kinds.push_back(static_cast<uint8_t>(batch.get_entry_kind(index)));
+
+  size_t before = paths.size();
+  batch.append_old_path(index, paths);
+  old_path_offsets.push_back(static_cast<uint32_t>(before));
+  old_path_lengths.push_back(static_cast<uint32_t>(paths.size() - before));
+
+  before = paths.size();
+  batch.append_path(index, paths);
+  path_offsets.push_back(static_cast<uint32_t>(before));
+  path_lengths.push_back(static_cast<uint32_t>(paths.size() - before));
+}
+
+Nan::MaybeLocal<Object> EventColumns::to_buffer() const
+{
+  size_t count = actions.size();
+  size_t header_length = 2 * sizeof(uint32_t);
+  size_t byte_columns_length = (2 * count + 3) & ~static_cast<size_t>(3);
+  size_t word_columns_length = 4 * count * sizeof(uint32_t);
+  size_t total = header_length + byte_columns_length + word_columns_length + paths.size();
+
+  Nan::MaybeLocal<Object> maybe_buffer = Nan::NewBuffer(static_cast<uint32_t>(total));
+  Local<Object> buffer;
+  if (!maybe_buffer.ToLocal(&buffer)) return maybe_buffer;
+
+  char *data = node::Buffer::Data(buffer);
+
+  uint32_t header[2] = {static_cast<uint32_t>(count), static_cast<uint32_t>(paths.size())};
+  memcpy(data, header, header_length);
+
+  char *cursor = data + header_length;
+  cursor = write_column(cursor, actions);
+  cursor = write_column(cursor, kinds);
+  memset(cursor, 0, data + header_length + byte_columns_length - cursor);
+  cursor = data + header_length + byte_columns_length;
+
+  cursor = write_column(cursor, path_offsets);
+  cursor = write_column(cursor, path_lengths);
+  cursor = write_column(cursor, old_path_offsets);
+  cursor = write_column(cursor, old_path_lengths);
+  if (!paths.empty()) memcpy(cursor, paths.data(), paths.size());
+
+  return buffer;
+}
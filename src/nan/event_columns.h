@@ -0,0 +1,55 @@
+#ifndef EVENT_COLUMNS_H
+#define EVENT_COLUMNS_H
+
+#include <cstdint>
+#include <nan.h>
+#include <string>
+#include <v8.h>
+#include <vector>
+
+#include "../message.h"
+
+// Accumulate the filesystem events delivered to a single channel as columns, so that they reach JavaScript as one
+// Buffer instead of as an Array of objects. The Buffer's layout, in native byte order, is:
+//
+// * The uint32 number of events, N, and the uint32 number of bytes of paths, P.
+// * N uint8 actions, then N uint8 entry kinds, padded with zeroes to a multiple of four bytes.
+// * N uint32 path offsets, N uint32 path lengths, N uint32 old path offsets, and N uint32 old path lengths, each in
+//   bytes within the path area. An old path length of 0 means that the event has no old path.
+// * P bytes of UTF-8 paths.
+//
+// lib/event-batch.js decodes this layout.
+class EventColumns
+{
+public:
+  EventColumns() = default;
+
+  EventColumns(EventColumns &&original) = default;
+
+  ~EventColumns() = default;
+
+  void add(FileSystemAction action, EntryKind kind, const std::string &old_path, const std::string &path);
+
+  void add(const FileSystemBatchPayload &batch, size_t index);
+
+  size_t size() const { return actions.size(); }
+
+  // Pack every event added so far into a new Buffer.
+  Nan::MaybeLocal<v8::Object> to_buffer() const;
+
+  EventColumns(const EventColumns &) = delete;
+  EventColumns &operator=(const EventColumns &) = delete;
+  EventColumns &operator=(EventColumns &&) = delete;
+
+private:
+  std::vector<uint8_t> actions;
+  std::vector<uint8_t> kinds;
+  std::vector<uint32_t> path_offsets;
+  std::vector<uint32_t> path_lengths;
+  std::vector<uint32_t> old_path_offsets;
+  std::vector<uint32_t> old_path_lengths;
+
+  std::string paths;
+};
+
+#endif
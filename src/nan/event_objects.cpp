@@ -0,0 +1,87 @@
+#include <nan.h>
+#include <string>
+#include <v8.h>
+
+#include "../message.h"
+#include "event_objects.h"
+
+using std::string;
+using v8::Context;
+using v8::Isolate;
+using v8::Local;
+using v8::NewStringType;
+using v8::Object;
+using v8::ObjectTemplate;
+using v8::String;
+
+static const char *const ACTION_NAMES[ACTION_MAX + 1] =
+  {"created", "deleted", "modified", "renamed", "resynced", "overflowed"};
+
+static const char *const KIND_NAMES[KIND_MAX + 1] = {"file", "directory", "symlink", "unknown"};
+
+// Create an internalized string, so that V8 doesn't need to look it up again whenever it's used as a property key.
+static Local<String> internalize(Isolate *isolate, const char *str)
+{
+  return String::NewFromUtf8(isolate, str, NewStringType::kInternalized).ToLocalChecked();
+}
+
+void EventObjects::initialize()
+{
+  Isolate *isolate = Isolate::GetCurrent();
+
+  Local<String> action = internalize(isolate, "action");
+  Local<String> kind = internalize(isolate, "kind");
+  Local<String> path = internalize(isolate, "path");
+  Local<String> old_path = internalize(isolate, "oldPath");
+  action_key.Reset(action);
+  kind_key.Reset(kind);
+  path_key.Reset(path);
+  old_path_key.Reset(old_path);
+
+  for (int i = ACTION_MIN; i <= ACTION_MAX; i++) {
+    action_names[i].Reset(internalize(isolate, ACTION_NAMES[i]));
+  }
+  for (int i = KIND_MIN; i <= KIND_MAX; i++) {
+    kind_names[i].Reset(internalize(isolate, KIND_NAMES[i]));
+  }
+
+  // Declare the properties in the order that NativeWatcher has always produced them.
+  Local<ObjectTemplate> tpl = Nan::New<ObjectTemplate>();
+  tpl->Set(action, Nan::Undefined());
+  tpl->Set(kind, Nan::Undefined());
+  tpl->Set(path, Nan::Undefined());
+  event_template.Reset(tpl);
+
+  Local<ObjectTemplate> renamed_tpl = Nan::New<ObjectTemplate>();
+  renamed_tpl->Set(action, Nan::Undefined());
+  renamed_tpl->Set(kind, Nan::Undefined());
+  renamed_tpl->Set(path, Nan::Undefined());
+  renamed_tpl->Set(old_path, Nan::Undefined());
+  renamed_event_template.Reset(renamed_tpl);
+
+  initialized = true;
+}
+
+Local<Object> EventObjects::create(FileSystemAction action,
+  EntryKind kind,
+  const string &old_path,
+  const string &path)
+{
+  if (!initialized) initialize();
+
+  Local<Context> context = Nan::GetCurrentContext();
+  bool has_old_path = !old_path.empty();
+
+  Local<Object> js_event =
+    Nan::NewInstance(Nan::New(has_old_path ? renamed_event_template : event_template)).ToLocalChecked();
+
+  // Overwriting the template's own data properties leaves the instance's hidden class as it is.
+  js_event->CreateDataProperty(context, Nan::New(action_key), Nan::New(action_names[action])).FromJust();
+  js_event->CreateDataProperty(context, Nan::New(kind_key), Nan::New(kind_names[kind])).FromJust();
+  js_event->CreateDataProperty(context, Nan::New(path_key), Nan::New<String>(path).ToLocalChecked()).FromJust();
+  if (has_old_path) {
+    js_event->CreateDataProperty(context, Nan::New(old_path_key), Nan::New<String>(old_path).ToLocalChecked())
+      .FromJust();
+  }
+  return js_event;
+}
@@ -0,0 +1,52 @@
+#ifndef EVENT_OBJECTS_H
+#define EVENT_OBJECTS_H
+
+#include <nan.h>
+#include <string>
+#include <v8.h>
+
+#include "../message.h"
+
+// Construct the objects that represent filesystem events to JavaScript, in the form that NativeWatcher delivers them:
+// `action` and `kind` as strings, `path`, and `oldPath` only for events that have one.
+//
+// Property keys and the strings for each action and entry kind are created once and reused. Every event is
+// instantiated from one of two cached object templates, one with an `oldPath` and one without, so that all events
+// share one of two hidden classes and filling them in never changes their shape.
+class EventObjects
+{
+public:
+  EventObjects() = default;
+
+  ~EventObjects() = default;
+
+  // Must be called within a HandleScope on the main thread.
+  v8::Local<v8::Object> create(FileSystemAction action,
+    EntryKind kind,
+    const std::string &old_path,
+    const std::string &path);
+
+  EventObjects(const EventObjects &) = delete;
+  EventObjects(EventObjects &&) = delete;
+  EventObjects &operator=(const EventObjects &) = delete;
+  EventObjects &operator=(EventObjects &&) = delete;
+
+private:
+  // Create every persistent handle. Deferred until the first event, when V8 is certain to be available.
+  void initialize();
+
+  bool initialized{false};
+
+  Nan::Persistent<v8::String> action_key;
+  Nan::Persistent<v8::String> kind_key;
+  Nan::Persistent<v8::String> path_key;
+  Nan::Persistent<v8::String> old_path_key;
+
+  Nan::Persistent<v8::String> action_names[ACTION_MAX + 1];
+  Nan::Persistent<v8::String> kind_names[KIND_MAX + 1];
+
+  Nan::Persistent<v8::ObjectTemplate> event_template;
+  Nan::Persistent<v8::ObjectTemplate> renamed_event_template;
+};
+
+#endif
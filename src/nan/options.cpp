@@ -2,6 +2,7 @@
 #include <sstream>
 #include <string>
 #include <v8.h>
+#include <vector>
 
 #include "options.h"
 
@@ -9,6 +10,8 @@ using Nan::Maybe;
 using Nan::MaybeLocal;
 using std::ostringstream;
 using std::string;
+using std::vector;
+using v8::Array;
 using v8::Local;
 using v8::Object;
 using v8::String;
@@ -105,3 +108,47 @@ bool get_uint_option(v8::Local<v8::Object> &options, const char *key_name, uint_
   out = as_maybe_uint.FromJust();
   return true;
 }
+
+bool get_string_array_option(Local<Object> &options, const char *key_name, vector<string> &out)
+{
+  Nan::HandleScope scope;
+  const Local<String> key = Nan::New<String>(key_name).ToLocalChecked();
+
+  MaybeLocal<Value> as_maybe_value = Nan::Get(options, key);
+  if (as_maybe_value.IsEmpty()) {
+    return true;
+  }
+  Local<Value> as_value = as_maybe_value.ToLocalChecked();
+  if (as_value->IsUndefined()) {
+    return true;
+  }
+
+  if (!as_value->IsArray()) {
+    ostringstream message;
+    message << "option " << key_name << " must be an Array of Strings";
+    Nan::ThrowError(message.str().c_str());
+    return false;
+  }
+
+  Local<Array> as_array = as_value.As<Array>();
+  for (uint32_t i = 0; i < as_array->Length(); i++) {
+    MaybeLocal<Value> maybe_element = Nan::Get(as_array, i);
+    if (maybe_element.IsEmpty() || !maybe_element.ToLocalChecked()->IsString()) {
+      ostringstream message;
+      message << "option " << key_name << " must be an Array of Strings";
+      Nan::ThrowError(message.str().c_str());
+      return false;
+    }
+
+    Nan::Utf8String as_string(maybe_element.ToLocalChecked());
+    if (*as_string == nullptr) {
+      ostringstream message;
+      message << "option " << key_name << " must contain valid UTF-8 Strings";
+      Nan::ThrowError(message.str().c_str());
+      return false;
+    }
+
+    out.emplace_back(*as_string, as_string.length());
+  }
+  return true;
+}
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <v8.h>
+#include <vector>
 
 bool get_string_option(v8::Local<v8::Object> &options, const char *key_name, std::string &out);
 
@@ -10,4 +11,6 @@ bool get_bool_option(v8::Local<v8::Object> &options, const char *key_name, bool
 
 bool get_uint_option(v8::Local<v8::Object> &options, const char *key_name, uint_fast32_t &out);
 
+bool get_string_array_option(v8::Local<v8::Object> &options, const char *key_name, std::vector<std::string> &out);
+
 #endif
@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ignore_rules.h"
+#include "message.h"
+#include "path_filter.h"
+
+using std::find;
+using std::move;
+using std::ostringstream;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+static bool is_separator(char c)
+{
+#ifdef PLATFORM_WINDOWS
+  return c == '/' || c == '\\';
+#else
+  return c == '/';
+#endif
+}
+
+PathFilter::PathFilter(string &&root, vector<string> &&exclude, vector<string> &&include, bool ignore_files) :
+  root(move(root)),
+  exclude(compile(move(exclude))),
+  include(compile(move(include))),
+  ignore_files{ignore_files}
+{
+  //
+}
+
+vector<PathFilter::Pattern> PathFilter::compile(vector<string> &&globs)
+{
+  vector<Pattern> patterns;
+  patterns.reserve(globs.size());
+
+  for (string &glob : globs) {
+    // Leading and trailing separators carry no meaning of their own.
+    size_t first = glob.find_first_not_of('/');
+    size_t last = glob.find_last_not_of('/');
+    if (first == string::npos) continue;
+
+    string trimmed = glob.substr(first, last - first + 1);
+    bool basename = trimmed.find('/') == string::npos;
+    patterns.push_back(Pattern{move(trimmed), basename});
+  }
+
+  return patterns;
+}
+
+bool PathFilter::accepts(const string &path) const
+{
+  size_t start = 0;
+  if (!relative_start(path, start)) return true;
+  if (excludes(path)) return false;
+  if (include.empty()) return true;
+
+  return any_match(include, path, start, path.size());
+}
+
+bool PathFilter::excludes(const string &path) const
+{
+  if (exclude.empty()) return false;
+
+  size_t start = 0;
+  if (!relative_start(path, start)) return false;
+
+  // Test each containing directory, then the entry itself.
+  for (size_t end = start + 1; end <= path.size(); end++) {
+    if (end < path.size() && !is_separator(path[end])) continue;
+    if (any_match(exclude, path, start, end)) return true;
+  }
+  return false;
+}
+
+string PathFilter::describe() const
+{
+  ostringstream out;
+  out << "exclude [";
+  for (size_t i = 0; i < exclude.size(); i++) {
+    if (i > 0) out << " ";
+    out << exclude[i].glob;
+  }
+  out << "] include [";
+  for (size_t i = 0; i < include.size(); i++) {
+    if (i > 0) out << " ";
+    out << include[i].glob;
+  }
+  out << "]";
+  if (ignore_files) out << " honoring ignore files";
+  return out.str();
+}
+
+bool PathFilter::relative_start(const string &path, size_t &start) const
+{
+  if (path.compare(0, root.size(), root) != 0) return false;
+
+  if (!root.empty() && is_separator(root.back())) {
+    start = root.size();
+    return start < path.size();
+  }
+
+  if (path.size() <= root.size() + 1 || !is_separator(path[root.size()])) return false;
+  start = root.size() + 1;
+  return true;
+}
+
+bool PathFilter::any_match(const vector<Pattern> &patterns, const string &path, size_t start, size_t end)
+{
+  size_t component = end;
+  while (component > start && !is_separator(path[component - 1])) {
+    component--;
+  }
+
+  for (const Pattern &pattern : patterns) {
+    if (match(pattern.glob, 0, path, pattern.basename ? component : start, end)) return true;
+  }
+  return false;
+}
+
+bool PathFilter::match(const string &glob, size_t gi, const string &path, size_t pi, size_t end)
+{
+  while (gi < glob.size()) {
+    char g = glob[gi];
+
+    if (g == '*') {
+      if (gi + 1 < glob.size() && glob[gi + 1] == '*') {
+        gi += 2;
+
+        // "**/" may also stand for no directories at all.
+        if (gi < glob.size() && glob[gi] == '/' && match(glob, gi + 1, path, pi, end)) return true;
+
+        for (size_t k = pi; k <= end; k++) {
+          if (match(glob, gi, path, k, end)) return true;
+        }
+        return false;
+      }
+
+      gi++;
+      for (size_t k = pi;; k++) {
+        if (match(glob, gi, path, k, end)) return true;
+        if (k == end || is_separator(path[k])) return false;
+      }
+    }
+
+    if (pi == end) return false;
+
+    char p = path[pi];
+    if (g == '[') {
+      // An unterminated class is matched literally.
+      size_t begin = gi + 1;
+      size_t close = begin;
+      if (close < glob.size() && (glob[close] == '!' || glob[close] == '^')) close++;
+      if (close < glob.size() && glob[close] == ']') close++;
+      close = glob.find(']', close);
+
+      if (close != string::npos) {
+        if (is_separator(p) || !class_matches(glob, begin, close, p)) return false;
+
+        gi = close + 1;
+        pi++;
+        continue;
+      }
+    }
+
+    if (g == '?') {
+      if (is_separator(p)) return false;
+    } else if (g == '/') {
+      if (!is_separator(p)) return false;
+    } else if (g != p) {
+      return false;
+    }
+
+    gi++;
+    pi++;
+  }
+
+  return pi == end;
+}
+
+bool PathFilter::class_matches(const string &glob, size_t begin, size_t close, char c)
+{
+  bool negated = glob[begin] == '!' || glob[begin] == '^';
+  if (negated) begin++;
+
+  bool matched = false;
+  for (size_t i = begin; i < close && !matched; i++) {
+    if (i + 2 < close && glob[i + 1] == '-') {
+      matched = glob[i] <= c && c <= glob[i + 2];
+      i += 2;
+    } else {
+      matched = glob[i] == c;
+    }
+  }
+  return matched != negated;
+}
+
+void PathFilterTable::set(ChannelID channel_id, const shared_ptr<const PathFilter> &filter)
+{
+  if (!filter || filter->empty()) {
+    filters.erase(channel_id);
+    return;
+  }
+
+  Entry &entry = filters[channel_id];
+  entry.filter = filter;
+  if (!filter->honors_ignore_files()) {
+    entry.ignore.reset();
+  } else if (!entry.ignore) {
+    entry.ignore.reset(new IgnoreRules(string(filter->get_root())));
+  }
+}
+
+shared_ptr<const PathFilter> PathFilterTable::get(ChannelID channel_id) const
+{
+  auto it = filters.find(channel_id);
+  return it != filters.end() ? it->second.filter : shared_ptr<const PathFilter>();
+}
+
+shared_ptr<IgnoreRules> PathFilterTable::get_ignore_rules(ChannelID channel_id) const
+{
+  auto it = filters.find(channel_id);
+  return it != filters.end() ? it->second.ignore : shared_ptr<IgnoreRules>();
+}
+
+bool PathFilterTable::excludes(ChannelID channel_id, const string &path, bool directory) const
+{
+  auto it = filters.find(channel_id);
+  if (it == filters.end()) return false;
+
+  const Entry &entry = it->second;
+  if (entry.filter->excludes(path)) return true;
+  return entry.ignore && entry.ignore->ignores(path, directory);
+}
+
+void PathFilterTable::observe(ChannelID channel_id, const string &path)
+{
+  if (filters.empty()) return;
+
+  size_t slash = path.find_last_of(IgnoreRules::SEPARATORS);
+  if (slash == string::npos || !IgnoreRules::is_ignore_file(path.substr(slash + 1))) return;
+
+  auto it = filters.find(channel_id);
+  if (it == filters.end() || !it->second.ignore) return;
+
+  pair<ChannelID, string> changed(channel_id, path.substr(0, slash));
+  if (find(changed_ignore_files.begin(), changed_ignore_files.end(), changed) == changed_ignore_files.end()) {
+    changed_ignore_files.push_back(move(changed));
+  }
+}
+
+vector<pair<ChannelID, string>> PathFilterTable::take_changed_ignore_files()
+{
+  vector<pair<ChannelID, string>> changed;
+  changed.swap(changed_ignore_files);
+  return changed;
+}
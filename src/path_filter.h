@@ -0,0 +1,168 @@
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ignore_rules.h"
+#include "message.h"
+
+// Glob-style rules that select which paths beneath a watch root are reported. Each pattern is matched against an
+// entry's path relative to the root, with components separated by `/`:
+//
+// * `*` matches any run of characters within a single path component.
+// * `?` matches any single character other than a separator.
+// * `**` matches any run of characters, including separators. `**/` also matches no directories at all.
+// * `[abc]` and `[a-z]` match any single listed character other than a separator. `[!abc]` matches any other.
+//
+// A pattern that contains no `/` is matched against the final component of each path, so `node_modules` matches a
+// directory of that name at any depth. Other patterns are anchored at the root.
+//
+// An entry is excluded if it, or any directory containing it, matches an exclude pattern. Excluded directories are
+// neither watched nor scanned. If any include patterns are present, only entries that match at least one of them are
+// reported, but every directory that isn't excluded is still traversed.
+//
+// A PathFilter may also ask for the `.gitignore` and `.ignore` files within the root to be honored. Those rules change
+// as the files do, so they're kept by each thread in an IgnoreRules instance of its own; see PathFilterTable.
+//
+// PathFilters are immutable once constructed, so a single instance may be shared between threads.
+class PathFilter
+{
+public:
+  PathFilter(std::string &&root,
+    std::vector<std::string> &&exclude,
+    std::vector<std::string> &&include,
+    bool ignore_files);
+
+  ~PathFilter() = default;
+
+  // Return true if events at the absolute path `path` should be reported. Paths outside of the root are always
+  // reported.
+  bool accepts(const std::string &path) const;
+
+  // Return true if the absolute path `path` or any directory containing it matches an exclude pattern.
+  bool excludes(const std::string &path) const;
+
+  // Return true if this filter has no rules at all.
+  bool empty() const { return exclude.empty() && include.empty() && !ignore_files; }
+
+  // Return true if ignore files beneath the root should be honored.
+  bool honors_ignore_files() const { return ignore_files; }
+
+  // Access the absolute path of the root directory.
+  const std::string &get_root() const { return root; }
+
+  std::string describe() const;
+
+  // Return true if `glob` matches the span [`start`, `end`) of `path` in its entirety.
+  static bool glob_matches(const std::string &glob, const std::string &path, size_t start, size_t end)
+  {
+    return match(glob, 0, path, start, end);
+  }
+
+  PathFilter(const PathFilter &) = delete;
+  PathFilter(PathFilter &&) = delete;
+  PathFilter &operator=(const PathFilter &) = delete;
+  PathFilter &operator=(PathFilter &&) = delete;
+
+private:
+  struct Pattern
+  {
+    std::string glob;
+
+    // If true, match the final path component only.
+    bool basename;
+  };
+
+  static std::vector<Pattern> compile(std::vector<std::string> &&globs);
+
+  // Locate the first character of `path` that lies beneath the root. Return false if `path` is the root itself or lies
+  // outside of it.
+  bool relative_start(const std::string &path, size_t &start) const;
+
+  // Return true if any of `patterns` matches the relative path that spans [`start`, `end`) of `path`.
+  static bool any_match(const std::vector<Pattern> &patterns, const std::string &path, size_t start, size_t end);
+
+  // Match `glob` from `gi` onward against [`pi`, `end`) of `path`.
+  static bool match(const std::string &glob, size_t gi, const std::string &path, size_t pi, size_t end);
+
+  // Return true if the character class that spans [`begin`, `close`) of `glob` admits `c`.
+  static bool class_matches(const std::string &glob, size_t begin, size_t close, char c);
+
+  const std::string root;
+  const std::vector<Pattern> exclude;
+  const std::vector<Pattern> include;
+  const bool ignore_files;
+};
+
+// The PathFilter for each filtered channel on a single thread, and the IgnoreRules of each channel that honors ignore
+// files. IgnoreRules are loaded lazily and change as ignore files do, so a table must only be used by a single thread.
+class PathFilterTable
+{
+public:
+  PathFilterTable() = default;
+
+  ~PathFilterTable() = default;
+
+  // Filter events on `channel_id` with `filter`. A null or empty filter reports everything. If the filter honors
+  // ignore files, the channel's IgnoreRules are created on first use and kept when the filter is set again.
+  void set(ChannelID channel_id, const std::shared_ptr<const PathFilter> &filter);
+
+  void remove(ChannelID channel_id) { filters.erase(channel_id); }
+
+  // Access the PathFilter for a channel, or null if its events are unfiltered.
+  std::shared_ptr<const PathFilter> get(ChannelID channel_id) const;
+
+  // Access the IgnoreRules of a channel, or null if it doesn't honor ignore files.
+  std::shared_ptr<IgnoreRules> get_ignore_rules(ChannelID channel_id) const;
+
+  // Return true if the entry at `path` should not be watched or scanned on `channel_id`, because its PathFilter
+  // excludes it or an ignore file ignores it.
+  bool excludes(ChannelID channel_id, const std::string &path, bool directory) const;
+
+  // Return true if events at `path` should be reported on `channel_id`.
+  bool accepts(ChannelID channel_id, const std::string &path, bool directory) const
+  {
+    if (filters.empty()) return true;
+
+    auto it = filters.find(channel_id);
+    if (it == filters.end()) return true;
+
+    const Entry &entry = it->second;
+    if (entry.ignore && entry.ignore->ignores(path, directory)) return false;
+    return entry.filter->accepts(path);
+  }
+
+  // Note a filesystem event at `path` on `channel_id`. If it names an ignore file beneath a channel that honors them,
+  // remember its directory until take_changed_ignore_files().
+  void observe(ChannelID channel_id, const std::string &path);
+
+  // Return and forget each channel and directory whose ignore files have been observed to change since the last call.
+  // The caller is responsible for reloading their IgnoreRules.
+  std::vector<std::pair<ChannelID, std::string>> take_changed_ignore_files();
+
+  bool empty() const { return filters.empty(); }
+
+  PathFilterTable(const PathFilterTable &) = delete;
+  PathFilterTable(PathFilterTable &&) = delete;
+  PathFilterTable &operator=(const PathFilterTable &) = delete;
+  PathFilterTable &operator=(PathFilterTable &&) = delete;
+
+private:
+  struct Entry
+  {
+    std::shared_ptr<const PathFilter> filter;
+
+    // Null unless the filter honors ignore files.
+    std::shared_ptr<IgnoreRules> ignore;
+  };
+
+  std::unordered_map<ChannelID, Entry> filters;
+
+  std::vector<std::pair<ChannelID, std::string>> changed_ignore_files;
+};
+
+#endif
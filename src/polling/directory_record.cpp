@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -11,9 +12,14 @@
 #include "../helper/libuv.h"
 #include "../log.h"
 #include "../message.h"
+#include "../stat_engine.h"
 #include "directory_record.h"
 #include "polling_iterator.h"
 
+#ifdef PLATFORM_LINUX
+#include "../helper/linux/directory_reader.h"
+#endif
+
 using std::move;
 using std::ostringstream;
 using std::set;
@@ -33,10 +39,57 @@ string DirectoryRecord::path() const
 
 void DirectoryRecord::scan(BoundPollingIterator *it)
 {
-  FSReq scan_req;
   set<Entry> scanned_entries;
-
   string dir = path();
+
+#ifdef PLATFORM_LINUX
+  // The polling thread reuses a single getdents64() buffer for every directory it scans.
+  static thread_local DirectoryReader reader;
+
+  int open_errno = reader.open(dir);
+  if (open_errno != 0) {
+    if (open_errno == ENOENT || open_errno == ENOTDIR || open_errno == EACCES) {
+      if (was_present) {
+        entry_deleted(it, dir, KIND_DIRECTORY);
+        was_present = false;
+      }
+    } else {
+      ostringstream msg;
+      msg << "Unable to scan directory " << dir << ": " << strerror(open_errno);
+      it->get_buffer().error(msg.str(), false);
+    }
+
+    return;
+  }
+
+  if (!was_present) {
+    entry_created(it, dir, KIND_DIRECTORY);
+    was_present = true;
+  }
+
+  DirectoryReader::Entry dirent{};
+  while (reader.next(dirent)) {
+    EntryKind entry_kind = KIND_UNKNOWN;
+    if (dirent.type == DT_REG) entry_kind = KIND_FILE;
+    if (dirent.type == DT_DIR) entry_kind = KIND_DIRECTORY;
+
+    if (!it->push_entry(string(dirent.name), entry_kind)) {
+      forget_entry(dirent.name);
+    } else if (populated) {
+      scanned_entries.emplace(string(dirent.name), entry_kind);
+    }
+  }
+
+  if (reader.get_errno() != 0) {
+    ostringstream msg;
+    msg << "Unable to list entries in directory " << dir << ": " << strerror(reader.get_errno());
+
+    it->get_buffer().error(msg.str(), false);
+  } else {
+    report_missing_entries(it, dir, scanned_entries);
+  }
+#else
+  FSReq scan_req;
   int scan_err = uv_fs_scandir(nullptr, &scan_req.req, dir.c_str(), 0, nullptr);
   if (scan_err < 0) {
     if (scan_err == UV_ENOENT || scan_err == UV_ENOTDIR || scan_err == UV_EACCES) {
@@ -67,8 +120,11 @@ void DirectoryRecord::scan(BoundPollingIterator *it)
     if (dirent.type == UV_DIRENT_FILE) entry_kind = KIND_FILE;
     if (dirent.type == UV_DIRENT_DIR) entry_kind = KIND_DIRECTORY;
 
-    it->push_entry(string(entry_name), entry_kind);
-    if (populated) scanned_entries.emplace(move(entry_name), entry_kind);
+    if (!it->push_entry(string(entry_name), entry_kind)) {
+      forget_entry(entry_name);
+    } else if (populated) {
+      scanned_entries.emplace(move(entry_name), entry_kind);
+    }
 
     next_err = uv_fs_scandir_next(&scan_req.req, &dirent);
   }
@@ -79,26 +135,39 @@ void DirectoryRecord::scan(BoundPollingIterator *it)
 
     it->get_buffer().error(msg.str(), false);
   } else {
-    // Report entries that were present the last time we scanned this directory, but aren't included in this
-    // scan.
-    auto previous = entries.begin();
-    while (previous != entries.end()) {
-      const string &previous_entry_name = previous->first;
-      const string previous_entry_path(path_join(dir, previous_entry_name));
-      EntryKind previous_entry_kind = kind_from_stat(previous->second);
-      Entry previous_entry(previous_entry_name, previous_entry_kind);
-      Entry unknown_entry(previous_entry_name, KIND_UNKNOWN);
-
-      if (scanned_entries.count(previous_entry) == 0 && scanned_entries.count(unknown_entry) == 0) {
-        entry_deleted(it, previous_entry_path, previous_entry_kind);
-        auto former = previous;
-        ++previous;
-
-        subdirectories.erase(previous_entry_name);
-        entries.erase(former);
-      } else {
-        ++previous;
-      }
+    report_missing_entries(it, dir, scanned_entries);
+  }
+#endif
+}
+
+void DirectoryRecord::forget_entry(const string &entry_name)
+{
+  entries.erase(entry_name);
+  subdirectories.erase(entry_name);
+}
+
+void DirectoryRecord::report_missing_entries(BoundPollingIterator *it,
+  const string &dir,
+  const set<Entry> &scanned_entries)
+{
+  // Report entries that were present the last time we scanned this directory, but aren't included in this scan.
+  auto previous = entries.begin();
+  while (previous != entries.end()) {
+    const string &previous_entry_name = previous->first;
+    const string previous_entry_path(path_join(dir, previous_entry_name));
+    EntryKind previous_entry_kind = kind_from_stat(previous->second);
+    Entry previous_entry(previous_entry_name, previous_entry_kind);
+    Entry unknown_entry(previous_entry_name, KIND_UNKNOWN);
+
+    if (scanned_entries.count(previous_entry) == 0 && scanned_entries.count(unknown_entry) == 0) {
+      entry_deleted(it, previous_entry_path, previous_entry_kind);
+      auto former = previous;
+      ++previous;
+
+      subdirectories.erase(previous_entry_name);
+      entries.erase(former);
+    } else {
+      ++previous;
     }
   }
 }
@@ -106,13 +175,13 @@ void DirectoryRecord::scan(BoundPollingIterator *it)
 void DirectoryRecord::entry(BoundPollingIterator *it,
   const string &entry_name,
   const string &entry_path,
-  EntryKind scan_kind)
+  EntryKind scan_kind,
+  const StatOutcome &outcome)
 {
-  FSReq lstat_req;
   EntryKind previous_kind = scan_kind;
   EntryKind current_kind = scan_kind;
 
-  int lstat_err = uv_fs_lstat(nullptr, &lstat_req.req, entry_path.c_str(), nullptr);
+  int lstat_err = outcome.err;
   if (lstat_err != 0 && lstat_err != UV_ENOENT && lstat_err != UV_EACCES) {
     ostringstream msg;
     msg << "Unable to stat " << entry_path << ": " << uv_strerror(lstat_err);
@@ -125,12 +194,12 @@ void DirectoryRecord::entry(BoundPollingIterator *it,
   bool exists_now = lstat_err == 0;
 
   if (existed_before) previous_kind = kind_from_stat(previous->second);
-  if (exists_now) current_kind = kind_from_stat(lstat_req.req.statbuf);
+  if (exists_now) current_kind = kind_from_stat(outcome.stat);
 
   if (existed_before && exists_now) {
     // Modification or no change
     uv_stat_t &previous_stat = previous->second;
-    uv_stat_t &current_stat = lstat_req.req.statbuf;
+    const uv_stat_t &current_stat = outcome.stat;
 
     // TODO consider modifications to mode or ownership bits?
     if (kinds_are_different(previous_kind, current_kind) || previous_stat.st_ino != current_stat.st_ino) {
@@ -168,7 +237,7 @@ void DirectoryRecord::entry(BoundPollingIterator *it,
 
   // Update entries with the latest stat information
   if (existed_before) entries.erase(previous);
-  if (exists_now) entries.emplace(entry_name, lstat_req.req.statbuf);
+  if (exists_now) entries.emplace(entry_name, outcome.stat);
 
   // Update subdirectories if this is or was a subdirectory
   auto dir = subdirectories.find(entry_name);
@@ -4,10 +4,12 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <uv.h>
 
 #include "../message.h"
+#include "../stat_engine.h"
 
 class BoundPollingIterator;
 
@@ -38,13 +40,14 @@ public:
   // before but are now missing. Store the discovered entries within `it` as part of the iteration state.
   void scan(BoundPollingIterator *it);
 
-  // Perform a single `lstat()` on an entry within this directory. If the DirectoryRecord is populated and the entry
-  // has been created, deleted, or modified since the previous `DirectoryRecord::entry()` call, emit the appropriate
-  // events into the `it`'s buffer.
+  // Record the `lstat()` result `outcome` of an entry within this directory. If the DirectoryRecord is populated and
+  // the entry has been created, deleted, or modified since the previous `DirectoryRecord::entry()` call, emit the
+  // appropriate events into the `it`'s buffer.
   void entry(BoundPollingIterator *it,
     const std::string &entry_name,
     const std::string &entry_path,
-    EntryKind scan_kind);
+    EntryKind scan_kind,
+    const StatOutcome &outcome);
 
   // Note that this `DirectoryResult` has had an initial `scan()` and set of `entry()` calls completed. Subsequent
   // calls should emit actual events.
@@ -61,6 +64,14 @@ private:
   // Construct a `DirectoryRecord` for a child entry.
   DirectoryRecord(DirectoryRecord *parent, std::string &&name);
 
+  // Silently discard the records of an entry that's no longer scanned, because the rules of an ignore file now skip
+  // it.
+  void forget_entry(const std::string &entry_name);
+
+  // Emit deletion events for entries recorded by a previous scan of `dir` that are absent from `scanned_entries`,
+  // and forget them.
+  void report_missing_entries(BoundPollingIterator *it, const std::string &dir, const std::set<Entry> &scanned_entries);
+
   // Use an iterator to emit deletion, creation, or modification events.
   void entry_deleted(BoundPollingIterator *it, const std::string &entry_path, EntryKind kind);
   void entry_created(BoundPollingIterator *it, const std::string &entry_path, EntryKind kind);
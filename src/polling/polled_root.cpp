@@ -1,24 +1,38 @@
 #include <string>
 #include <utility>
 
+#include "../ignore_rules.h"
 #include "../message.h"
 #include "../message_buffer.h"
+#include "../path_filter.h"
+#include "../stat_engine.h"
 #include "directory_record.h"
 #include "polled_root.h"
 
 using std::move;
+using std::shared_ptr;
 using std::string;
 
-PolledRoot::PolledRoot(string &&root_path, ChannelID channel_id, bool recursive) :
-  root(new DirectoryRecord(move(root_path))), channel_id{channel_id}, iterator(root, recursive), all_populated{false}
+PolledRoot::PolledRoot(string &&root_path,
+  ChannelID channel_id,
+  bool recursive,
+  bool lazy,
+  shared_ptr<const PathFilter> filter,
+  shared_ptr<IgnoreRules> ignore) :
+  root(new DirectoryRecord(move(root_path))),
+  channel_id{channel_id},
+  iterator(root, recursive, move(filter), move(ignore)),
+  all_populated{false},
+  lazy{lazy},
+  promoting{false}
 {
   //
 }
 
-size_t PolledRoot::advance(MessageBuffer &buffer, size_t throttle_allocation)
+size_t PolledRoot::advance(MessageBuffer &buffer, StatEngine &stats, size_t throttle_allocation)
 {
   ChannelMessageBuffer channel_buffer(buffer, channel_id);
-  BoundPollingIterator bound_iterator(iterator, channel_buffer);
+  BoundPollingIterator bound_iterator(iterator, channel_buffer, stats);
 
   size_t progress = bound_iterator.advance(throttle_allocation);
 
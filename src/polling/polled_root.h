@@ -5,7 +5,10 @@
 #include <memory>
 #include <string>
 
+#include "../ignore_rules.h"
 #include "../message.h"
+#include "../path_filter.h"
+#include "../stat_engine.h"
 #include "directory_record.h"
 #include "polling_iterator.h"
 
@@ -18,17 +21,27 @@ public:
   //
   // The newly constructed root does *not* contain any initial scan information, to avoid CPU usage spikes when
   // watching large directory trees. The subtree's records will be populated on the first scan.
-  PolledRoot(std::string &&root_path, ChannelID channel_id, bool recursive);
+  //
+  // A `lazy` root covers a subtree beneath the worker thread's watch depth. It's swept less often, and handed back to
+  // the worker thread to be watched as soon as it changes. Both threads cover the subtree until its hand-off completes.
+  //
+  // Entries that `filter` excludes or `ignore` ignores are never scanned. Either may be null.
+  PolledRoot(std::string &&root_path,
+    ChannelID channel_id,
+    bool recursive,
+    bool lazy,
+    std::shared_ptr<const PathFilter> filter,
+    std::shared_ptr<IgnoreRules> ignore);
 
   ~PolledRoot() = default;
 
   // Perform at most `throttle_allocation` operations, accumulating any changes into a provided `buffer` for batch
-  // delivery. Return the number of operations actually performed.
+  // delivery. Entries are lstat()ed in batches with `stats`. Return the number of operations actually performed.
   //
   // Iteration state is persisted within a `PollingIterator`, so subsequent calls to `PolledRoot::advance()` will pick
   // up where this call left off. When a complete scan is performed, the iteration will stop and the iterator will be
   // left ready to begin again at the root directory next time.
-  size_t advance(MessageBuffer &buffer, size_t throttle_allocation);
+  size_t advance(MessageBuffer &buffer, StatEngine &stats, size_t throttle_allocation);
 
   // Return `true` once the first complete scan has been completed by calls to `PolledRoot::advance()`.
   bool is_all_populated() { return all_populated; }
@@ -36,6 +49,19 @@ public:
   // Count the number of filesystem entries that are covered by this polling thread.
   size_t count_entries() const;
 
+  // Return `true` if this root lies beneath the worker thread's watch depth.
+  bool is_lazy() const { return lazy; }
+
+  // Note that the worker thread has been asked to watch this lazy root. It's polled as usual until the worker
+  // thread releases it.
+  void mark_promoting() { promoting = true; }
+
+  // Return `true` if the worker thread has been asked to watch this root but hasn't yet released it.
+  bool is_promoting() const { return promoting; }
+
+  // Access the absolute path of the root directory.
+  std::string get_path() const { return root->path(); }
+
   PolledRoot(const PolledRoot &) = delete;
   PolledRoot(PolledRoot &&) = delete;
   PolledRoot &operator=(const PolledRoot &) = delete;
@@ -54,6 +80,12 @@ private:
   // Becomes `true` when the first full subtree scan has completed.
   bool all_populated;
 
+  // If `true`, this root is only polled until the worker thread can watch it.
+  bool lazy;
+
+  // If `true`, a `COMMAND_PROMOTE` message for this root has been sent to the worker thread.
+  bool promoting;
+
   // Diagnostics and logging are your friend.
   friend std::ostream &operator<<(std::ostream &out, const PolledRoot &root)
   {
@@ -4,25 +4,55 @@
 #include <string>
 
 #include "../helper/common.h"
+#include "../ignore_rules.h"
 #include "../message_buffer.h"
+#include "../path_filter.h"
+#include "../stat_engine.h"
 #include "directory_record.h"
 #include "polling_iterator.h"
 
+using std::move;
 using std::shared_ptr;
 using std::string;
 
-PollingIterator::PollingIterator(const shared_ptr<DirectoryRecord> &root, bool recursive) :
-  root(root), recursive{recursive}, current(root), current_path(root->path()), phase{PollingIterator::SCAN}
+// Upper bound on the number of entries whose `lstat()` results are fetched together. Results are compared as soon
+// as the batch completes, so this also limits how stale the last result in a batch can become.
+static const size_t MAX_STAT_BATCH = 256;
+
+PollingIterator::PollingIterator(const shared_ptr<DirectoryRecord> &root,
+  bool recursive,
+  shared_ptr<const PathFilter> &&filter,
+  shared_ptr<IgnoreRules> &&ignore) :
+  root(root),
+  recursive{recursive},
+  filter(move(filter)),
+  ignore(move(ignore)),
+  current(root),
+  current_path(root->path()),
+  batch_start{0},
+  phase{PollingIterator::SCAN}
 {
   //
 }
 
-BoundPollingIterator::BoundPollingIterator(PollingIterator &iterator, ChannelMessageBuffer &buffer) :
-  buffer{buffer}, iterator{iterator}
+BoundPollingIterator::BoundPollingIterator(PollingIterator &iterator, ChannelMessageBuffer &buffer, StatEngine &stats) :
+  buffer{buffer}, iterator{iterator}, stats{stats}
 {
   //
 }
 
+bool BoundPollingIterator::push_entry(string &&entry, EntryKind kind)
+{
+  if (iterator.filter || iterator.ignore) {
+    string entry_path(path_join(iterator.current_path, entry));
+    if (iterator.filter && iterator.filter->excludes(entry_path)) return false;
+    if (iterator.ignore && iterator.ignore->ignores(entry_path, kind == KIND_DIRECTORY)) return false;
+  }
+
+  iterator.entries.emplace_back(move(entry), kind);
+  return true;
+}
+
 size_t BoundPollingIterator::advance(size_t throttle_allocation)
 {
   size_t total = throttle_allocation > 0 ? throttle_allocation : 1;
@@ -32,7 +62,7 @@ size_t BoundPollingIterator::advance(size_t throttle_allocation)
     if (iterator.phase == PollingIterator::SCAN) {
       advance_scan();
     } else if (iterator.phase == PollingIterator::ENTRIES) {
-      advance_entry();
+      advance_entry(total - count);
     } else if (iterator.phase == PollingIterator::RESET) {
       break;
     }
@@ -43,6 +73,9 @@ size_t BoundPollingIterator::advance(size_t throttle_allocation)
     iterator.current = iterator.root;
     iterator.current_path = iterator.current->path();
     iterator.phase = PollingIterator::SCAN;
+
+    // Ignore files above the root aren't scanned here, so reread them once per pass.
+    if (iterator.ignore) iterator.ignore->reload_ancestors(iterator.current_path);
   }
 
   return count;
@@ -56,13 +89,29 @@ void BoundPollingIterator::advance_scan()
   iterator.phase = PollingIterator::ENTRIES;
 }
 
-void BoundPollingIterator::advance_entry()
+void BoundPollingIterator::advance_entry(size_t budget)
 {
   if (iterator.current_entry != iterator.entries.end()) {
-    string &entry_name = iterator.current_entry->first;
-    EntryKind kind = iterator.current_entry->second;
+    size_t index = iterator.current_entry - iterator.entries.begin();
+    if (index < iterator.batch_start || index >= iterator.batch_start + iterator.batch_stats.size()) {
+      size_t remaining = iterator.entries.size() - index;
+      size_t batch_size = remaining < budget ? remaining : budget;
+      if (batch_size > MAX_STAT_BATCH) batch_size = MAX_STAT_BATCH;
+
+      iterator.batch_paths.clear();
+      for (size_t i = index; i < index + batch_size; i++) {
+        iterator.batch_paths.push_back(path_join(iterator.current_path, iterator.entries[i].first));
+      }
+      stats.lstat_all(iterator.batch_paths, iterator.batch_stats);
+      iterator.batch_start = index;
+    }
 
-    iterator.current->entry(this, entry_name, path_join(iterator.current_path, entry_name), kind);
+    size_t offset = index - iterator.batch_start;
+    iterator.current->entry(this,
+      iterator.current_entry->first,
+      iterator.batch_paths[offset],
+      iterator.current_entry->second,
+      iterator.batch_stats[offset]);
     iterator.current_entry++;
   }
 
@@ -74,6 +123,8 @@ void BoundPollingIterator::advance_entry()
   iterator.current->mark_populated();
   iterator.entries.clear();
   iterator.current_entry = iterator.entries.end();
+  iterator.batch_paths.clear();
+  iterator.batch_stats.clear();
 
   if (iterator.directories.empty()) {
     iterator.phase = PollingIterator::RESET;
@@ -10,7 +10,10 @@
 #include <uv.h>
 
 #include "../message.h"
+#include "../ignore_rules.h"
 #include "../message_buffer.h"
+#include "../path_filter.h"
+#include "../stat_engine.h"
 
 class DirectoryRecord;
 
@@ -22,8 +25,12 @@ class PollingIterator
 {
 public:
   // Create an iterator poised to begin at a root `DirectoryRecord`. If `recursive` is true, the iterator will
-  // automatically advance into subdirectories of the root.
-  explicit PollingIterator(const std::shared_ptr<DirectoryRecord> &root, bool recursive);
+  // automatically advance into subdirectories of the root. Entries excluded by `filter` or ignored by `ignore`, if
+  // they're non-null, are skipped without being examined.
+  PollingIterator(const std::shared_ptr<DirectoryRecord> &root,
+    bool recursive,
+    std::shared_ptr<const PathFilter> &&filter,
+    std::shared_ptr<IgnoreRules> &&ignore);
 
   PollingIterator(const PollingIterator &) = delete;
   PollingIterator(PollingIterator &&) = delete;
@@ -38,6 +45,12 @@ private:
   // If `true`, the iterator will automatically descend into subdirectories as they are discovered.
   bool recursive;
 
+  // Excluded and ignored entries are never `lstat()`ed, recorded, or descended into.
+  std::shared_ptr<const PathFilter> filter;
+
+  // Shared by every root of the same channel on the polling thread.
+  std::shared_ptr<IgnoreRules> ignore;
+
   // The `DirectoryRecord` that we're on right now.
   std::shared_ptr<DirectoryRecord> current;
 
@@ -51,6 +64,12 @@ private:
   // Save our place within the `entries` vector during the `ENTRIES` phase.
   std::vector<Entry>::iterator current_entry;
 
+  // Full paths and `lstat()` results of a run of `entries` beginning at index `batch_start`, fetched together by
+  // `BoundPollingIterator::advance_entry()`.
+  std::vector<std::string> batch_paths;
+  std::vector<StatOutcome> batch_stats;
+  size_t batch_start;
+
   // A queue of subdirectories to traverse next. Populated by `BoundPollingIterator::advance_scan()` in the `SCAN`
   // phase.
   std::queue<std::shared_ptr<DirectoryRecord>> directories;
@@ -91,8 +110,9 @@ class BoundPollingIterator
 {
 public:
   // Bind an existing `PollingIterator` containing persistent polling state with a `ChannelMessageBuffer` that
-  // determines where events emitted by this polling cycle should be sent.
-  BoundPollingIterator(PollingIterator &iterator, ChannelMessageBuffer &buffer);
+  // determines where events emitted by this polling cycle should be sent, and a `StatEngine` that performs its
+  // `lstat()` calls.
+  BoundPollingIterator(PollingIterator &iterator, ChannelMessageBuffer &buffer, StatEngine &stats);
 
   BoundPollingIterator(const BoundPollingIterator &) = delete;
   BoundPollingIterator(BoundPollingIterator &&) = delete;
@@ -100,8 +120,9 @@ public:
   BoundPollingIterator &operator=(const BoundPollingIterator &) = delete;
   BoundPollingIterator &operator=(BoundPollingIterator &&) = delete;
 
-  // Called from `DirectoryRecord::scan()` to make note of an entry within the current directory.
-  void push_entry(std::string &&entry, EntryKind kind) { iterator.entries.emplace_back(std::move(entry), kind); }
+  // Called from `DirectoryRecord::scan()` to make note of an entry within the current directory, unless the
+  // iterator's `PathFilter` excludes it or its `IgnoreRules` ignore it. Return false if the entry was skipped.
+  bool push_entry(std::string &&entry, EntryKind kind);
 
   // Called from `DirectoryRecord::entry()` when a subdirectory is encountered to enqueue it for traversal.
   void push_directory(const std::shared_ptr<DirectoryRecord> &subdirectory)
@@ -127,13 +148,15 @@ private:
   // iterator ready to advance through the discovered entries.
   void advance_scan();
 
-  // Perform a single stat call with `DirectoryRecord::entry()`. Advance the `current_entry`. If no more entries
-  // remain, pop the next `DirectoryRecord` from the queue. If the queue is empty, reset the iterator back to its
-  // root.
-  void advance_entry();
+  // Compare the `current_entry` to its `lstat()` result with `DirectoryRecord::entry()`, and advance it. If its result
+  // hasn't been fetched, fetch the results of as many of the following entries as `budget` allows in the same batch.
+  // If no more entries remain, pop the next `DirectoryRecord` from the queue. If the queue is empty, reset the iterator
+  // back to its root.
+  void advance_entry(size_t budget);
 
   ChannelMessageBuffer &buffer;
   PollingIterator &iterator;
+  StatEngine &stats;
 
   friend std::ostream &operator<<(std::ostream &out, const BoundPollingIterator &it)
   {
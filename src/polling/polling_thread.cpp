@@ -9,6 +9,7 @@
 #include <uv.h>
 #include <vector>
 
+#include "../ignore_rules.h"
 #include "../log.h"
 #include "../message_buffer.h"
 #include "../result.h"
@@ -20,13 +21,18 @@
 using std::endl;
 using std::move;
 using std::ostream;
+using std::pair;
+using std::shared_ptr;
 using std::string;
 using std::to_string;
 using std::unique_ptr;
 using std::vector;
 
 PollingThread::PollingThread(uv_async_t *main_callback) :
-  Thread("polling thread", main_callback), poll_interval{DEFAULT_POLL_INTERVAL}, poll_throttle{DEFAULT_POLL_THROTTLE}
+  Thread("polling thread", main_callback),
+  poll_interval{DEFAULT_POLL_INTERVAL},
+  poll_throttle{DEFAULT_POLL_THROTTLE},
+  cycle_count{0}
 {
   freeze();
 }
@@ -66,28 +72,61 @@ Result<> PollingThread::body()
 
 Result<> PollingThread::cycle()
 {
-  MessageBuffer buffer;
+  MessageBuffer buffer(&filters);
   size_t remaining = poll_throttle;
+  cycle_count++;
 
-  size_t roots_left = roots.size();
+  size_t roots_left = 0;
+  for (auto &it : roots) {
+    if (is_due(it.second)) roots_left++;
+  }
   LOGGER << "Polling " << plural(roots_left, "root") << " with " << plural(poll_throttle, "throttle slot") << "."
          << endl;
 
-  for (auto &it : roots) {
-    PolledRoot &root = it.second;
+  vector<std::multimap<ChannelID, PolledRoot>::iterator> promoted;
+  for (auto it = roots.begin(); it != roots.end(); ++it) {
+    PolledRoot &root = it->second;
+    if (!is_due(root)) continue;
+
     size_t allotment = remaining / roots_left;
 
     LOGGER << "Polling " << root << " with an allotment of " << plural(allotment, "throttle slot") << "." << endl;
 
-    size_t progress = root.advance(buffer, allotment);
-    remaining -= progress;
+    // Changes observed within a populated lazy root are reported, then the root is handed to the worker thread.
+    bool sweeping = root.is_lazy() && root.is_all_populated();
+    bool populating = root.is_lazy() && !root.is_all_populated();
+    size_t before = buffer.size();
+
+    size_t progress = root.advance(buffer, stats, allotment);
+    remaining -= progress < remaining ? progress : remaining;
     if (progress != allotment) {
       LOGGER << root << " only consumed " << plural(progress, "throttle slot") << "." << endl;
     }
 
+    if (sweeping && !root.is_promoting() && buffer.size() > before) promoted.push_back(it);
+
+    // A lazy root's first listing is its baseline. From here on, the worker thread's watches are no longer needed.
+    if (populating && root.is_all_populated()) {
+      buffer.add(Message(CommandPayloadBuilder::release(it->first, root.get_path()).build()));
+    }
+
     roots_left--;
   }
 
+  // Promoted roots are polled until the worker thread releases them, so that no change is missed while the worker
+  // thread installs its watches.
+  for (auto &it : promoted) {
+    LOGGER << "Promoting " << it->second << " after observing changes within it." << endl;
+    buffer.add(Message(CommandPayloadBuilder::promote(it->first, it->second.get_path()).build()));
+    it->second.mark_promoting();
+  }
+
+  // Changed ignore files take effect from the next scan of their directories onward.
+  for (pair<ChannelID, string> &changed : filters.take_changed_ignore_files()) {
+    shared_ptr<IgnoreRules> rules = filters.get_ignore_rules(changed.first);
+    if (rules) rules->reload(changed.second);
+  }
+
   // Ack any commands whose roots are now fully populated.
   vector<ChannelID> to_erase;
   for (auto &split : pending_splits) {
@@ -97,7 +136,7 @@ Result<> PollingThread::cycle()
     size_t populated_roots = 0;
     auto channel_roots = roots.equal_range(channel_id);
     for (auto root = channel_roots.first; root != channel_roots.second; ++root) {
-      if (root->second.is_all_populated()) populated_roots++;
+      if (!root->second.is_lazy() && root->second.is_all_populated()) populated_roots++;
     }
 
     if (populated_roots >= pending_split.second) {
@@ -109,7 +148,27 @@ Result<> PollingThread::cycle()
     pending_splits.erase(channel_id);
   }
 
-  return emit_all(buffer.begin(), buffer.end());
+  if (!coalescer.is_enabled() && coalescer.empty()) return emit_all(buffer.begin(), buffer.end());
+
+  MessageBuffer ready;
+  coalescer.absorb(buffer, ready);
+  if (coalescer.is_due() || !coalescer.is_enabled()) coalescer.flush(ready);
+  return emit_all(ready.begin(), ready.end());
+}
+
+Result<> PollingThread::flush_coalescer()
+{
+  if (coalescer.empty()) return ok_result();
+
+  MessageBuffer ready;
+  coalescer.flush(ready);
+  return emit_all(ready.begin(), ready.end());
+}
+
+bool PollingThread::is_due(PolledRoot &root) const
+{
+  if (!root.is_lazy() || !root.is_all_populated() || root.is_promoting()) return true;
+  return cycle_count % LAZY_SWEEP_CYCLES == 0;
 }
 
 Result<Thread::OfflineCommandOutcome> PollingThread::handle_offline_command(const CommandPayload *command)
@@ -129,6 +188,14 @@ Result<Thread::OfflineCommandOutcome> PollingThread::handle_offline_command(cons
     handle_polling_throttle_command(command);
   }
 
+  if (command->get_action() == COMMAND_POLLING_STAT_BACKEND) {
+    handle_polling_stat_backend_command(command);
+  }
+
+  if (command->get_action() == COMMAND_COALESCE_LATENCY) {
+    handle_coalesce_latency_command(command);
+  }
+
   if (command->get_action() == COMMAND_STATUS) {
     handle_status_command(command);
   }
@@ -140,12 +207,20 @@ Result<Thread::CommandOutcome> PollingThread::handle_add_command(const CommandPa
 {
   ostream &logline = LOGGER << "Adding poll root at path " << command->get_root();
   if (!command->get_recursive()) logline << " (non-recursively)";
+  if (command->get_lazy()) logline << " (lazily)";
+  if (command->get_filter()) logline << " with " << command->get_filter()->describe();
   logline << " to channel " << command->get_channel_id() << " with " << plural(command->get_split_count(), "split")
           << "." << endl;
 
+  if (command->get_filter()) filters.set(command->get_channel_id(), command->get_filter());
   roots.emplace(std::piecewise_construct,
     std::forward_as_tuple(command->get_channel_id()),
-    std::forward_as_tuple(string(command->get_root()), command->get_channel_id(), command->get_recursive()));
+    std::forward_as_tuple(string(command->get_root()),
+      command->get_channel_id(),
+      command->get_recursive(),
+      command->get_lazy(),
+      command->get_filter(),
+      filters.get_ignore_rules(command->get_channel_id())));
 
   auto existing = pending_splits.find(command->get_channel_id());
   if (existing != pending_splits.end()) {
@@ -203,6 +278,8 @@ Result<Thread::CommandOutcome> PollingThread::handle_remove_command(const Comman
   LOGGER << "Removing poll roots at channel " << channel_id << "." << endl;
 
   roots.erase(command->get_channel_id());
+  coalescer.discard(channel_id);
+  filters.remove(channel_id);
 
   // Ensure that we ack the ADD command even if the REMOVE command arrives before all of its splits populate.
   auto pending = pending_splits.find(channel_id);
@@ -217,12 +294,38 @@ Result<Thread::CommandOutcome> PollingThread::handle_remove_command(const Comman
 
   if (roots.empty()) {
     LOGGER << "Final root removed." << endl;
+    Result<> fr = flush_coalescer();
+    if (fr.is_error()) return fr.propagate<CommandOutcome>();
     return ok_result(TRIGGER_STOP);
   }
 
   return ok_result(ACK);
 }
 
+Result<Thread::CommandOutcome> PollingThread::handle_release_command(const CommandPayload *command)
+{
+  const ChannelID &channel_id = command->get_channel_id();
+  const string &root_path = command->get_root();
+
+  auto channel_roots = roots.equal_range(channel_id);
+  for (auto it = channel_roots.first; it != channel_roots.second; ++it) {
+    if (!it->second.is_lazy() || it->second.get_path() != root_path) continue;
+
+    LOGGER << "Releasing " << it->second << " now that the worker thread watches it." << endl;
+    roots.erase(it);
+    break;
+  }
+
+  if (roots.empty()) {
+    LOGGER << "Final root released." << endl;
+    Result<> fr = flush_coalescer();
+    if (fr.is_error()) return fr.propagate<CommandOutcome>();
+    return ok_result(TRIGGER_STOP);
+  }
+
+  return ok_result(NOTHING);
+}
+
 Result<Thread::CommandOutcome> PollingThread::handle_polling_interval_command(const CommandPayload *command)
 {
   poll_interval = std::chrono::milliseconds(command->get_arg());
@@ -235,6 +338,19 @@ Result<Thread::CommandOutcome> PollingThread::handle_polling_throttle_command(co
   return ok_result(ACK);
 }
 
+Result<Thread::CommandOutcome> PollingThread::handle_polling_stat_backend_command(const CommandPayload *command)
+{
+  stats.force_backend(static_cast<StatBackend>(command->get_arg()));
+  return ok_result(ACK);
+}
+
+Result<Thread::CommandOutcome> PollingThread::handle_coalesce_latency_command(const CommandPayload *command)
+{
+  // Events held under the previous setting are delivered by the next cycle.
+  coalescer.set_latency(std::chrono::milliseconds(command->get_arg()));
+  return ok_result(ACK);
+}
+
 Result<Thread::CommandOutcome> PollingThread::handle_status_command(const CommandPayload *command)
 {
   unique_ptr<Status> status{new Status()};
@@ -245,12 +361,16 @@ Result<Thread::CommandOutcome> PollingThread::handle_status_command(const Comman
   status->polling_in_ok = get_in_queue_error();
   status->polling_out_size = get_out_queue_size();
   status->polling_out_ok = get_out_queue_error();
+  status->polling_out_channel_depth = get_out_queue_channel_depth();
+  status->polling_out_dropped = get_out_queue_dropped();
 
   status->polling_root_count = roots.size();
+  status->polling_stat_backend = stats.get_backend();
 
   status->polling_entry_count = 0;
   for (auto &pair : roots) {
     status->polling_entry_count += pair.second.count_entries();
+    if (pair.second.is_lazy()) status->polling_lazy_root_count++;
   }
 
   Result<> r = emit(Message(StatusPayload(command->get_request_id(), move(status))));
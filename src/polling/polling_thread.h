@@ -8,7 +8,10 @@
 #include <utility>
 #include <uv.h>
 
+#include "../event_coalescer.h"
+#include "../path_filter.h"
 #include "../result.h"
+#include "../stat_engine.h"
 #include "../status.h"
 #include "../thread.h"
 #include "polled_root.h"
@@ -16,6 +19,9 @@
 const std::chrono::milliseconds DEFAULT_POLL_INTERVAL = std::chrono::milliseconds(100);
 const uint_fast32_t DEFAULT_POLL_THROTTLE = 1000;
 
+// Lazy roots are only advanced once every this many cycles after their first complete scan.
+const uint_fast32_t LAZY_SWEEP_CYCLES = 10;
+
 // The PollingThread observes filesystem changes by repeatedly calling scandir() and lstat() on registered root
 // directories. It runs automatically when a `COMMAND_ADD` message is sent to it, and stops automatically when a
 // `COMMAND_REMOVE` message removes the last polled root.
@@ -23,6 +29,12 @@ const uint_fast32_t DEFAULT_POLL_THROTTLE = 1000;
 // It has a configurable "throttle" which roughly corresponds to the number of filesystem calls performed within each
 // polling cycle. The throttle is distributed among polled roots so that small directories won't be starved by large
 // ones.
+//
+// Lazy roots cover subtrees beneath the Linux worker's watch depth. They're swept slowly, and each is handed back to
+// the worker thread with a `COMMAND_PROMOTE` message as soon as a sweep observes a change within it. A promoting root
+// is polled every cycle until the worker thread answers with a `COMMAND_RELEASE` message once its watches are in place.
+// In the other direction, the polling thread sends `COMMAND_RELEASE` to the worker thread when a lazy root's first
+// complete scan finishes, so that the worker thread only removes a demoted subtree's watches once it's polled.
 class PollingThread : public Thread
 {
 public:
@@ -43,6 +55,12 @@ private:
   // Perform a single polling cycle.
   Result<> cycle();
 
+  // Emit every event held by the coalescer, so that none are stranded when the thread stops.
+  Result<> flush_coalescer();
+
+  // Return true if `root` should be advanced during the current cycle.
+  bool is_due(PolledRoot &root) const;
+
   // Wake up when a `COMMAND_ADD` message is received while stopped.
   Result<OfflineCommandOutcome> handle_offline_command(const CommandPayload *command) override;
 
@@ -50,20 +68,42 @@ private:
 
   Result<CommandOutcome> handle_remove_command(const CommandPayload *command) override;
 
+  // Stop polling a lazy root that the worker thread now watches.
+  Result<CommandOutcome> handle_release_command(const CommandPayload *command) override;
+
   // Configure the sleep interval.
   Result<CommandOutcome> handle_polling_interval_command(const CommandPayload *command) override;
 
   // Configure the number of system calls to perform during each `cycle()`.
   Result<CommandOutcome> handle_polling_throttle_command(const CommandPayload *command) override;
 
+  // Choose the backend of `stats`, so that tests can exercise each one.
+  Result<CommandOutcome> handle_polling_stat_backend_command(const CommandPayload *command) override;
+
+  // Configure the window within which polled events are merged.
+  Result<CommandOutcome> handle_coalesce_latency_command(const CommandPayload *command) override;
+
   // Respond to a request for collecting status.
   Result<CommandOutcome> handle_status_command(const CommandPayload *command) override;
 
   std::chrono::milliseconds poll_interval;
   uint_fast32_t poll_throttle;
 
+  // Number of cycles performed since the thread was created. Used to pace lazy sweeps.
+  uint_fast64_t cycle_count;
+
   std::multimap<ChannelID, PolledRoot> roots;
 
+  // Discards polled events on filtered channels. Every root of a channel shares its PathFilter.
+  PathFilterTable filters;
+
+  // Holds events produced by polling cycles within the configured coalescing window. Windows are only checked once per
+  // cycle, so events may be held for up to one polling interval longer than the configured latency.
+  EventCoalescer coalescer;
+
+  // Batches the lstat() calls made while comparing each scanned directory's entries against their records.
+  StatEngine stats;
+
   using PendingSplit = std::pair<CommandID, size_t>;
   std::map<ChannelID, PendingSplit> pending_splits;
 };
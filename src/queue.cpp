@@ -1,20 +1,49 @@
-#include <iterator>
-#include <string>
+#include <atomic>
+#include <memory>
+#include <new>
 #include <utility>
 #include <uv.h>
 #include <vector>
 
+#include "event_coalescer.h"
 #include "lock.h"
 #include "message.h"
+#include "message_buffer.h"
 #include "queue.h"
 #include "result.h"
 
+using std::atomic_thread_fence;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::memory_order_seq_cst;
 using std::move;
-using std::string;
 using std::unique_ptr;
 using std::vector;
 
-Queue::Queue() : active{new vector<Message>}
+const size_t Queue::DEFAULT_CAPACITY = 1024;
+
+// Round `n` up to the nearest power of two, and to at least 2.
+static size_t ring_size_for(size_t n)
+{
+  size_t size = 2;
+  while (size < n) size <<= 1;
+  return size;
+}
+
+Queue::Queue(size_t capacity) :
+  slots{new Slot[ring_size_for(capacity)]},
+  mask{ring_size_for(capacity) - 1},
+  head{0},
+  cached_tail{0},
+  tail{0},
+  cached_head{0},
+  armed{true},
+  spilled{false},
+  consumer_wake{nullptr},
+  budget{0},
+  policy{OVERFLOW_COALESCE},
+  dropped_count{0}
 {
   int err;
 
@@ -22,36 +51,225 @@ Queue::Queue() : active{new vector<Message>}
   if (err != 0) {
     report_uv_error(err);
   }
+
+  err = uv_cond_init(&drained);
+  if (err != 0) {
+    report_uv_error(err);
+  }
   freeze();
 }
 
 Queue::~Queue()
 {
+  size_t t = tail.load(memory_order_acquire);
+  for (size_t h = head.load(memory_order_relaxed); h != t; h++) {
+    reinterpret_cast<Message *>(&slots[h & mask])->~Message();
+  }
+
+  uv_cond_destroy(&drained);
   uv_mutex_destroy(&mutex);
 }
 
-void Queue::enqueue(Message &&message)
+bool Queue::enqueue(Message &&message)
+{
+  if (takes_locked_path() || !push(message)) {
+    Lock lock(mutex);
+    admit(move(message));
+  }
+
+  return claim_wake();
+}
+
+void Queue::enqueue_foreign(Message &&message)
 {
   Lock lock(mutex);
-  active->push_back(move(message));
+  admit(move(message));
 }
 
 unique_ptr<vector<Message>> Queue::accept_all()
 {
-  Lock lock(mutex);
+  // Arm before looking for Messages, so that a producer that enqueues after the ring is read always signals again.
+  armed.store(true, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
 
-  if (active->empty()) {
+  size_t h = head.load(memory_order_relaxed);
+  cached_tail = tail.load(memory_order_acquire);
+  bool must_lock = spilled.load(memory_order_acquire);
+
+  if (cached_tail == h && !must_lock) {
     unique_ptr<vector<Message>> n;
     return n;
   }
 
-  unique_ptr<vector<Message>> consumed = move(active);
-  active.reset(new vector<Message>);
+  unique_ptr<vector<Message>> consumed(new vector<Message>);
+  if (!must_lock) {
+    consumed->reserve(cached_tail - h);
+    pop_into(*consumed, cached_tail - h);
+    return consumed;
+  }
+
+  Lock lock(mutex);
+
+  // Messages in the ring were all enqueued before anything spilled, so they're accepted first.
+  h = head.load(memory_order_relaxed);
+  cached_tail = tail.load(memory_order_acquire);
+  consumed->reserve(cached_tail - h + overflow.size());
+  pop_into(*consumed, cached_tail - h);
+
+  for (Message &message : overflow) {
+    consumed->push_back(move(message));
+  }
+  overflow.clear();
+
+  if (!held.empty()) {
+    MessageBuffer merged;
+    held.flush(merged);
+    for (Message &message : merged) {
+      consumed->push_back(move(message));
+    }
+  }
+
+  if (!depths.empty()) {
+    depths.clear();
+    uv_cond_broadcast(&drained);
+  }
+
+  spilled.store(false, memory_order_release);
+
+  if (consumed->empty()) {
+    unique_ptr<vector<Message>> n;
+    return n;
+  }
   return consumed;
 }
 
+void Queue::set_budget(size_t budget, OverflowPolicy policy)
+{
+  Lock lock(mutex);
+  this->budget.store(budget, memory_order_relaxed);
+  this->policy = policy;
+
+  // Release any producer waiting on a budget that no longer applies.
+  uv_cond_broadcast(&drained);
+}
+
+void Queue::set_consumer_wake(uv_async_t *handle)
+{
+  Lock lock(mutex);
+  consumer_wake = handle;
+}
+
 size_t Queue::size()
+{
+  size_t in_ring = tail.load(memory_order_acquire) - head.load(memory_order_acquire);
+
+  Lock lock(mutex);
+  return in_ring + overflow.size();
+}
+
+size_t Queue::deepest_channel()
+{
+  Lock lock(mutex);
+
+  size_t deepest = 0;
+  for (auto &pair : depths) {
+    size_t depth = pair.second.queued + pair.second.held;
+    if (depth > deepest) deepest = depth;
+  }
+  return deepest;
+}
+
+size_t Queue::dropped()
 {
   Lock lock(mutex);
-  return active->size();
+  return dropped_count;
+}
+
+bool Queue::push(Message &message)
+{
+  size_t t = tail.load(memory_order_relaxed);
+  if (t - cached_head > mask) {
+    cached_head = head.load(memory_order_acquire);
+    if (t - cached_head > mask) return false;
+  }
+
+  new (&slots[t & mask]) Message(move(message));
+  tail.store(t + 1, memory_order_release);
+  return true;
+}
+
+void Queue::pop_into(vector<Message> &into, size_t count)
+{
+  size_t h = head.load(memory_order_relaxed);
+  for (size_t i = 0; i < count; i++) {
+    auto *message = reinterpret_cast<Message *>(&slots[(h + i) & mask]);
+    into.push_back(move(*message));
+    message->~Message();
+  }
+  head.store(h + count, memory_order_release);
+}
+
+bool Queue::claim_wake()
+{
+  // Pairs with the fence in accept_all(): either the consumer sees this producer's Messages, or this producer sees
+  // that the consumer has been armed again.
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!armed.load(memory_order_relaxed)) return false;
+  return armed.exchange(false, memory_order_relaxed);
+}
+
+void Queue::admit(Message &&message)
+{
+  spilled.store(true, memory_order_relaxed);
+
+  size_t limit = budget.load(memory_order_relaxed);
+  const FileSystemBatchPayload *batch = message.as_filesystem_batch();
+  if (limit != 0 && batch != nullptr) {
+    // Each event counts against its own channel's budget.
+    for (size_t i = 0; i < batch->size(); i++) {
+      admit(Message(batch->payload_at(i)));
+    }
+    return;
+  }
+
+  const FileSystemPayload *fs = message.as_filesystem();
+  if (limit == 0 || fs == nullptr) {
+    overflow.push_back(move(message));
+    return;
+  }
+
+  ChannelID channel_id = fs->get_channel_id();
+  // accept_all() may clear `depths` while this thread waits, so look the channel up again each time.
+  while (limit != 0 && policy == OVERFLOW_BLOCK && depths[channel_id].queued >= limit) {
+    // Earlier Messages from the same batch may not have been signalled yet.
+    if (consumer_wake != nullptr) uv_async_send(consumer_wake);
+
+    uv_cond_wait(&drained, &mutex);
+    limit = budget.load(memory_order_relaxed);
+  }
+
+  Depth &depth = depths[channel_id];
+  if (limit == 0 || depth.queued < limit) {
+    overflow.push_back(move(message));
+    depth.queued++;
+    return;
+  }
+
+  if (policy == OVERFLOW_COALESCE && depth.held < limit) {
+    held.add(move(message));
+    depth.held++;
+    return;
+  }
+
+  dropped_count++;
+  if (depth.overflowed) return;
+  depth.overflowed = true;
+
+  // Deliver the notice after any events that are held aside, so that none arrive after a client has rescanned.
+  Message notice(FileSystemPayload::overflowed(channel_id));
+  if (depth.held > 0) {
+    held.add(move(notice));
+  } else {
+    overflow.push_back(move(notice));
+  }
 }
@@ -1,60 +1,198 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
-#include <algorithm>
-#include <iterator>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <uv.h>
 #include <vector>
 
 #include "errable.h"
+#include "event_coalescer.h"
 #include "lock.h"
 #include "message.h"
 #include "result.h"
 
+// What a Queue does with filesystem events from a channel that already has as many waiting as its budget allows.
+enum OverflowPolicy
+{
+  OVERFLOW_COALESCE,  // Hold later events aside, merging those that affect the same path, up to a second budget.
+  OVERFLOW_DROP,  // Discard later events and enqueue one ACTION_OVERFLOWED event in their place.
+  OVERFLOW_BLOCK  // Make the producing thread wait until the consumer has accepted the channel's waiting events.
+};
+
 // Primary channel of communication between threads.
 //
 // The producing thread accumulates a sequence of Messages to be handled through repeated
 // calls to .enqueue_all(). The consumer processes a chunk of Messages by calling
 // .accept_all().
+//
+// Each Queue has one usual producer and one consumer, which exchange Messages through a fixed-capacity ring without
+// taking a lock. Messages that don't fit, and Messages from any other producer, spill into a mutex-guarded overflow
+// vector instead; once anything has spilled, later Messages follow it there until the consumer catches up, so that
+// order is preserved. The enqueue methods report whether the consumer may be waiting for a wake-up, so that producers
+// only signal it once for each time it drains the Queue.
+//
+// A Queue may be given a budget that limits the number of filesystem events waiting from each channel, so that a
+// consumer that falls behind can't cause it to grow without bound. Other Messages are never limited. Every Message
+// takes the locked path while a budget is in effect.
 class Queue : public Errable
 {
 public:
-  Queue();
+  // Number of Messages that fit within the ring unless another capacity is requested.
+  static const size_t DEFAULT_CAPACITY;
+
+  // Construct a Queue whose ring holds `capacity` Messages, rounded up to a power of two.
+  explicit Queue(size_t capacity = DEFAULT_CAPACITY);
 
   ~Queue() override;
 
-  // Atomically enqueue a single Message.
-  void enqueue(Message &&message);
+  // Enqueue a single Message from the usual producer. Return true if the consumer should be woken to accept it.
+  bool enqueue(Message &&message);
 
-  // Atomically enqueue a collection of Messages from a source STL container type between
-  // the iterators [begin, end).
+  // Enqueue a collection of Messages from a source STL container type between the iterators [begin, end) from the
+  // usual producer. Return true if the consumer should be woken to accept them.
   template <class InputIt>
-  void enqueue_all(InputIt begin, InputIt end)
+  bool enqueue_all(InputIt begin, InputIt end)
+  {
+    InputIt it = begin;
+    if (!takes_locked_path()) {
+      while (it != end && push(*it)) {
+        ++it;
+      }
+    }
+
+    if (it != end) {
+      Lock lock(mutex);
+      for (; it != end; ++it) {
+        admit(std::move(*it));
+      }
+    }
+
+    return claim_wake();
+  }
+
+  // Atomically enqueue a collection of Messages from a thread other than the usual producer, such as acks created by
+  // the main thread while the producing thread is stopped.
+  template <class InputIt>
+  void enqueue_all_foreign(InputIt begin, InputIt end)
   {
     Lock lock(mutex);
-    std::move(begin, end, std::back_inserter(*active));
+    for (InputIt it = begin; it != end; ++it) {
+      admit(std::move(*it));
+    }
   }
 
-  // Atomically consume the current contents of the queue, emptying it.
+  // Atomically enqueue a single Message from a thread other than the usual producer.
+  void enqueue_foreign(Message &&message);
+
+  // Consume the current contents of the queue, emptying it. Must only be called from the consumer.
   //
   // Returns a result containing unique_ptr to the vector of Messages, nullptr if no Messages were
   // present, or an error if the Queue is unhealthy.
   std::unique_ptr<std::vector<Message>> accept_all();
 
-  // Atomically report the number of items waiting on the queue.
+  // Limit the filesystem events waiting from each channel to `budget`, applying `policy` to any beyond it. A budget
+  // of 0 removes the limit.
+  void set_budget(size_t budget, OverflowPolicy policy);
+
+  // Signal `handle` whenever a producer must wait for the consumer under OVERFLOW_BLOCK.
+  void set_consumer_wake(uv_async_t *handle);
+
+  // Report the number of items waiting on the queue. Approximate while either thread is active.
   size_t size();
 
+  // Atomically report the largest number of filesystem events waiting from any single channel, including those held
+  // aside to be merged.
+  size_t deepest_channel();
+
+  // Atomically report the number of filesystem events that have been discarded to remain within the budget.
+  size_t dropped();
+
   Queue(const Queue &) = delete;
   Queue(Queue &&) = delete;
   Queue &operator=(const Queue &) = delete;
   Queue &operator=(Queue &&) = delete;
 
 private:
+  // Filesystem events waiting from a single channel.
+  struct Depth
+  {
+    // Enqueued within `overflow`.
+    size_t queued;
+
+    // Held aside within `held`.
+    size_t held;
+
+    // True once an ACTION_OVERFLOWED event has been enqueued.
+    bool overflowed;
+  };
+
+  // Uninitialized storage for one Message within the ring.
+  using Slot = std::aligned_storage<sizeof(Message), alignof(Message)>::type;
+
+  // Keep indices written by different threads on different cache lines.
+  static const size_t CACHE_LINE = 64;
+
+  // Return true if the usual producer must enqueue through `admit()` to preserve ordering or apply the budget.
+  bool takes_locked_path() const
+  {
+    return spilled.load(std::memory_order_acquire) || budget.load(std::memory_order_relaxed) != 0;
+  }
+
+  // Move `message` into the ring from the usual producer. Return false, leaving `message` untouched, if it's full.
+  bool push(Message &message);
+
+  // Move `count` Messages from the front of the ring onto the end of `into`. Must only be called from the consumer.
+  void pop_into(std::vector<Message> &into, size_t count);
+
+  // Return true exactly once for each time the consumer has begun draining the queue since the last wake-up.
+  bool claim_wake();
+
+  // Enqueue a single Message on the overflow vector, applying the budget. Must be called with `mutex` held.
+  void admit(Message &&message);
+
+  // Ring storage, shared by both threads.
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+
+  // Index of the next Message to accept. Written only by the consumer.
+  char head_pad[CACHE_LINE]{};
+  std::atomic<size_t> head;
+  size_t cached_tail;
+
+  // Index of the next free Slot. Written only by the usual producer.
+  char tail_pad[CACHE_LINE]{};
+  std::atomic<size_t> tail;
+  size_t cached_head;
+
+  char shared_pad[CACHE_LINE]{};
+
+  // Set by the consumer as it begins to drain the queue and cleared by the first producer to see it set afterwards.
+  std::atomic<bool> armed;
+
+  // True while Messages are waiting in `overflow` or `held`. Cleared only by the consumer, with `mutex` held.
+  std::atomic<bool> spilled;
+
   uv_mutex_t mutex{};
-  std::unique_ptr<std::vector<Message>> active;
+  uv_cond_t drained{};
+  std::vector<Message> overflow;
+
+  uv_async_t *consumer_wake;
+
+  std::atomic<size_t> budget;
+  OverflowPolicy policy;
+
+  // Reset each time `overflow` is accepted.
+  std::unordered_map<ChannelID, Depth> depths;
+
+  // Events from channels that exceeded the budget under OVERFLOW_COALESCE, appended to `overflow` when it's accepted.
+  EventCoalescer held;
+
+  size_t dropped_count;
 };
 
 #endif
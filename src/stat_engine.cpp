@@ -0,0 +1,404 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <uv.h>
+#include <vector>
+
+#include "helper/libuv.h"
+#include "lock.h"
+#include "log.h"
+#include "stat_engine.h"
+#include "thread_pool.h"
+
+#if defined(PLATFORM_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+// IORING_OP_STATX and IORING_REGISTER_PROBE arrived in the same release as IORING_FEAT_RW_CUR_POS.
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(STATX_BASIC_STATS)
+#define STAT_ENGINE_IO_URING
+#endif
+#endif
+#endif
+
+using std::endl;
+using std::min;
+using std::string;
+using std::vector;
+
+const size_t StatEngine::DEFAULT_FALLBACK_THREADS = 8;
+
+#ifdef STAT_ENGINE_IO_URING
+
+// Maximum number of operations in flight on a ring at once. Larger batches are submitted in several rounds.
+static const unsigned RING_DEPTH = 64;
+
+struct StatEngine::Ring
+{
+  int fd{-1};
+
+  void *sq_map{MAP_FAILED};
+  size_t sq_map_size{0};
+  void *cq_map{MAP_FAILED};
+  size_t cq_map_size{0};
+  io_uring_sqe *sqes{static_cast<io_uring_sqe *>(MAP_FAILED)};
+  size_t sqes_size{0};
+
+  unsigned *sq_tail{nullptr};
+  unsigned *sq_mask{nullptr};
+  unsigned *sq_array{nullptr};
+
+  unsigned *cq_head{nullptr};
+  unsigned *cq_tail{nullptr};
+  unsigned *cq_mask{nullptr};
+  io_uring_cqe *cqes{nullptr};
+
+  // Destination of each operation in the current round, indexed by its user_data.
+  struct statx buffers[RING_DEPTH];
+
+  Ring() = default;
+
+  ~Ring()
+  {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (cq_map != MAP_FAILED && cq_map != sq_map) munmap(cq_map, cq_map_size);
+    if (sq_map != MAP_FAILED) munmap(sq_map, sq_map_size);
+    if (fd != -1) close(fd);
+  }
+
+  // Create and map a ring, or return the errno that prevented it. ENOSYS, EPERM, and EOPNOTSUPP indicate that the
+  // kernel doesn't offer io_uring or IORING_OP_STATX to this process.
+  int open()
+  {
+    io_uring_params params{};
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, RING_DEPTH, &params));
+    if (fd == -1) return errno;
+
+    // Kernels that predate IORING_REGISTER_PROBE also predate IORING_OP_STATX.
+    const unsigned probe_ops = IORING_OP_STATX + 1;
+    vector<char> probe_buffer(sizeof(io_uring_probe) + probe_ops * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probe_buffer.data());
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, probe_ops) == -1) return EOPNOTSUPP;
+    if (probe->last_op < IORING_OP_STATX || (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED) == 0) {
+      return EOPNOTSUPP;
+    }
+
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0u) {
+      sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+    }
+
+    sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) return errno;
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0u) {
+      cq_map = sq_map;
+    } else {
+      cq_map = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq_map == MAP_FAILED) return errno;
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(
+      mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) return errno;
+
+    char *sq = static_cast<char *>(sq_map);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char *>(cq_map);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return 0;
+  }
+
+  // Queue a statx() of `path` into buffers[index] without submitting it.
+  void prepare(const string &path, unsigned index)
+  {
+    unsigned tail = *sq_tail;
+    unsigned slot = tail & *sq_mask;
+
+    io_uring_sqe *sqe = &sqes[slot];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(path.c_str());
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = reinterpret_cast<uintptr_t>(&buffers[index]);
+    sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+    sqe->user_data = index;
+    sq_array[slot] = slot;
+
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  // Hand up to `count` queued operations to the kernel. Return the number it accepted, or -errno.
+  int submit(unsigned count)
+  {
+    while (true) {
+      long result = syscall(__NR_io_uring_enter, fd, count, 0, 0, nullptr, 0);
+      if (result >= 0) return static_cast<int>(result);
+      if (errno != EINTR) return -errno;
+    }
+  }
+
+  // Block until `count` completions have been posted, passing each to `reap` as (index, result). Return 0, or the
+  // errno that interrupted the wait.
+  template <class F>
+  int wait(unsigned count, F reap)
+  {
+    while (count > 0) {
+      unsigned head = *cq_head;
+      unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      while (head != tail && count > 0) {
+        io_uring_cqe &cqe = cqes[head & *cq_mask];
+        reap(static_cast<unsigned>(cqe.user_data), cqe.res);
+        head++;
+        count--;
+      }
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+      if (count == 0) break;
+
+      long result = syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (result < 0 && errno != EINTR) return errno;
+    }
+    return 0;
+  }
+
+  Ring(const Ring &) = delete;
+  Ring(Ring &&) = delete;
+  Ring &operator=(const Ring &) = delete;
+  Ring &operator=(Ring &&) = delete;
+};
+
+// Translate statx() results into the form that uv_fs_lstat() produces.
+static void uv_stat_from_statx(const struct statx &stx, uv_stat_t &stat)
+{
+  stat.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  stat.st_mode = stx.stx_mode;
+  stat.st_nlink = stx.stx_nlink;
+  stat.st_uid = stx.stx_uid;
+  stat.st_gid = stx.stx_gid;
+  stat.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+  stat.st_ino = stx.stx_ino;
+  stat.st_size = stx.stx_size;
+  stat.st_blksize = stx.stx_blksize;
+  stat.st_blocks = stx.stx_blocks;
+  stat.st_flags = 0;
+  stat.st_gen = 0;
+  stat.st_atim.tv_sec = stx.stx_atime.tv_sec;
+  stat.st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+  stat.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+  stat.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+  stat.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+  stat.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+  stat.st_birthtim.tv_sec = stx.stx_btime.tv_sec;
+  stat.st_birthtim.tv_nsec = stx.stx_btime.tv_nsec;
+}
+
+#else
+
+struct StatEngine::Ring
+{
+  //
+};
+
+#endif
+
+StatEngine::StatEngine(size_t fallback_threads) :
+  started{false},
+  preferred{STAT_BACKEND_DEFAULT},
+  fallback_threads{fallback_threads},
+  unfinished{0}
+{
+  int err = uv_mutex_init(&mutex);
+  if (err != 0) {
+    report_uv_error(err);
+    freeze();
+    return;
+  }
+
+  err = uv_cond_init(&finished);
+  if (err != 0) report_uv_error(err);
+  freeze();
+}
+
+StatEngine::~StatEngine()
+{
+  // Join the pool before destroying the state its threads signal.
+  pool.reset();
+
+  if (is_healthy()) {
+    uv_cond_destroy(&finished);
+    uv_mutex_destroy(&mutex);
+  }
+}
+
+void StatEngine::lstat_all(const vector<string> &paths, vector<StatOutcome> &outcomes)
+{
+  outcomes.resize(paths.size());
+  if (paths.size() < 2) {
+    lstat_each(paths, outcomes, 0, paths.size());
+    return;
+  }
+
+  if (!started) start();
+
+  size_t begin = 0;
+  if (ring) begin = lstat_on_ring(paths, outcomes, 0, paths.size());
+  if (begin == paths.size()) return;
+
+  if (pool) {
+    lstat_on_pool(paths, outcomes, begin, paths.size());
+  } else {
+    lstat_each(paths, outcomes, begin, paths.size());
+  }
+}
+
+const char *StatEngine::get_backend() const
+{
+  if (ring) return "io_uring";
+  if (pool) return "thread pool";
+  return started ? "synchronous" : "none";
+}
+
+void StatEngine::force_backend(StatBackend backend)
+{
+  preferred = backend;
+  started = false;
+  ring.reset();
+  pool.reset();
+}
+
+void StatEngine::start()
+{
+  started = true;
+
+#ifdef STAT_ENGINE_IO_URING
+  if (preferred == STAT_BACKEND_DEFAULT) {
+    ring.reset(new Ring());
+    int ring_errno = ring->open();
+    if (ring_errno == 0) {
+      LOGGER << "Batching lstat() calls with io_uring." << endl;
+      return;
+    }
+    ring.reset();
+    LOGGER << "io_uring is unavailable: " << strerror(ring_errno) << "." << endl;
+  }
+#endif
+
+  if (!is_healthy() || fallback_threads == 0 || preferred == STAT_BACKEND_SYNCHRONOUS) {
+    LOGGER << "Performing lstat() calls one at a time." << endl;
+    return;
+  }
+
+  pool.reset(new ThreadPool(fallback_threads));
+  if (!pool->is_healthy() || pool->size() == 0) {
+    LOGGER << "Unable to start threads to batch lstat() calls: " << pool->get_message() << "." << endl;
+    pool.reset();
+    return;
+  }
+  LOGGER << "Batching lstat() calls across " << plural(pool->size(), "thread") << "." << endl;
+}
+
+size_t StatEngine::lstat_on_ring(const vector<string> &paths, vector<StatOutcome> &outcomes, size_t begin, size_t end)
+{
+#ifdef STAT_ENGINE_IO_URING
+  while (begin < end) {
+    unsigned round = static_cast<unsigned>(min(end - begin, static_cast<size_t>(RING_DEPTH)));
+    for (unsigned i = 0; i < round; i++) {
+      ring->prepare(paths[begin + i], i);
+    }
+
+    int submitted = ring->submit(round);
+    unsigned accepted = submitted > 0 ? static_cast<unsigned>(submitted) : 0;
+
+    int wait_errno = ring->wait(accepted, [&](unsigned index, int32_t res) {
+      StatOutcome &outcome = outcomes[begin + index];
+      outcome.err = res;
+      if (res == 0) uv_stat_from_statx(ring->buffers[index], outcome.stat);
+    });
+
+    int failure = 0;
+    if (submitted < 0) {
+      failure = -submitted;
+    } else if (accepted < round) {
+      failure = EAGAIN;
+    }
+    if (wait_errno != 0) failure = wait_errno;
+
+    if (failure != 0) {
+      // Operations that the kernel refused are still queued, so the ring can't be reused. Leave the rest of the batch
+      // to the fallback.
+      LOGGER << "io_uring failed: " << strerror(failure) << ". Abandoning it." << endl;
+      if (wait_errno == 0) {
+        ring.reset();
+        return begin + accepted;
+      }
+
+      // Operations that were never reaped may still write into the ring's buffers, so leak it rather than free them.
+      ring.release();
+      return begin;
+    }
+
+    begin += round;
+  }
+#else
+  (void) paths;
+  (void) outcomes;
+  (void) end;
+#endif
+  return begin;
+}
+
+void StatEngine::lstat_on_pool(const vector<string> &paths, vector<StatOutcome> &outcomes, size_t begin, size_t end)
+{
+  size_t share_size = (end - begin + pool->size() - 1) / pool->size();
+
+  {
+    Lock lock(mutex);
+    unfinished = (end - begin + share_size - 1) / share_size;
+  }
+
+  const vector<string> *paths_ptr = &paths;
+  vector<StatOutcome> *outcomes_ptr = &outcomes;
+  for (size_t share_begin = begin; share_begin < end; share_begin += share_size) {
+    size_t share_end = min(share_begin + share_size, end);
+    pool->enqueue([this, paths_ptr, outcomes_ptr, share_begin, share_end]() {
+      lstat_each(*paths_ptr, *outcomes_ptr, share_begin, share_end);
+
+      Lock lock(mutex);
+      unfinished--;
+      if (unfinished == 0) uv_cond_signal(&finished);
+    });
+  }
+
+  Lock lock(mutex);
+  while (unfinished > 0) {
+    uv_cond_wait(&finished, &mutex);
+  }
+}
+
+void StatEngine::lstat_each(const vector<string> &paths, vector<StatOutcome> &outcomes, size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; i++) {
+    FSReq lstat_req;
+    StatOutcome &outcome = outcomes[i];
+    outcome.err = uv_fs_lstat(nullptr, &lstat_req.req, paths[i].c_str(), nullptr);
+    if (outcome.err == 0) outcome.stat = lstat_req.req.statbuf;
+  }
+}
@@ -0,0 +1,105 @@
+#ifndef STAT_ENGINE_H
+#define STAT_ENGINE_H
+
+#include <memory>
+#include <string>
+#include <uv.h>
+#include <vector>
+
+#include "errable.h"
+#include "thread_pool.h"
+
+// The mechanisms that a StatEngine may dispatch batches to, each falling back to the next where it's unavailable.
+enum StatBackend
+{
+  STAT_BACKEND_DEFAULT,  // Prefer io_uring, then a ThreadPool.
+  STAT_BACKEND_POOL,  // Skip io_uring and use a ThreadPool.
+  STAT_BACKEND_SYNCHRONOUS  // lstat() each path on the calling thread.
+};
+
+// The result of a single lstat() performed as part of a batch: an `err` of 0 and the entry's metadata in `stat`, or a
+// libuv error code.
+struct StatOutcome
+{
+  int err;
+  uv_stat_t stat;
+};
+
+// Perform lstat() calls in batches, so that their latencies overlap instead of accumulating. On network and overlay
+// filesystems each call can spend far longer waiting on the filesystem than working, so this bounds how quickly a
+// directory's entries can be examined.
+//
+// On Linux, each batch is submitted to an io_uring as IORING_OP_STATX operations and reaped together. Where io_uring
+// is unavailable, because the kernel predates it or a seccomp policy denies it, batches are divided among the threads
+// of a ThreadPool instead. The backend is chosen, and any pool started, on the first batch.
+//
+// A StatEngine must only be used by one thread at a time.
+class StatEngine : public Errable
+{
+public:
+  // Number of threads that share each batch when io_uring is unavailable.
+  static const size_t DEFAULT_FALLBACK_THREADS;
+
+  explicit StatEngine(size_t fallback_threads = DEFAULT_FALLBACK_THREADS);
+
+  ~StatEngine() override;
+
+  // lstat() every path in `paths` and block until all have completed. Replace the contents of `outcomes` with one
+  // result for each path, in the same order.
+  void lstat_all(const std::vector<std::string> &paths, std::vector<StatOutcome> &outcomes);
+
+  // Name the mechanism that batches are dispatched to, or "none" before the first batch.
+  const char *get_backend() const;
+
+  // Choose the backend again on the next batch, starting from `backend`. Used by tests to exercise the fallbacks on
+  // hosts where io_uring is available.
+  void force_backend(StatBackend backend);
+
+  StatEngine(const StatEngine &) = delete;
+  StatEngine(StatEngine &&) = delete;
+  StatEngine &operator=(const StatEngine &) = delete;
+  StatEngine &operator=(StatEngine &&) = delete;
+
+private:
+  // Submission and completion queues shared with the kernel. Only defined where io_uring is supported.
+  struct Ring;
+
+  // Choose a backend for all subsequent batches.
+  void start();
+
+  // Complete `outcomes[begin, end)` on the io_uring. Return the index of the first path that wasn't submitted, which
+  // is `end` unless the ring has failed and been closed.
+  size_t lstat_on_ring(const std::vector<std::string> &paths,
+    std::vector<StatOutcome> &outcomes,
+    size_t begin,
+    size_t end);
+
+  // Complete `outcomes[begin, end)` on the ThreadPool, returning once every pool thread has finished its share.
+  void lstat_on_pool(const std::vector<std::string> &paths,
+    std::vector<StatOutcome> &outcomes,
+    size_t begin,
+    size_t end);
+
+  // Complete `outcomes[begin, end)` on the calling thread, one path at a time.
+  static void lstat_each(const std::vector<std::string> &paths,
+    std::vector<StatOutcome> &outcomes,
+    size_t begin,
+    size_t end);
+
+  bool started;
+
+  StatBackend preferred;
+
+  size_t fallback_threads;
+
+  std::unique_ptr<Ring> ring;
+
+  std::unique_ptr<ThreadPool> pool;
+
+  // Signalled by pool threads as each finishes its share of a batch.
+  uv_mutex_t mutex{};
+  uv_cond_t finished{};
+  size_t unfinished;
+};
+
+#endif
@@ -15,16 +15,25 @@ void Status::assimilate_worker_status(const Status &other)
   worker_in_ok = other.worker_in_ok;
   worker_out_size = other.worker_out_size;
   worker_out_ok = other.worker_out_ok;
+  worker_out_channel_depth = other.worker_out_channel_depth;
+  worker_out_dropped = other.worker_out_dropped;
 
   worker_subscription_count = other.worker_subscription_count;
+  worker_recent_file_cache_size = other.worker_recent_file_cache_size;
 #ifdef PLATFORM_MACOS
   worker_rename_buffer_size = other.worker_rename_buffer_size;
-  worker_recent_file_cache_size = other.worker_recent_file_cache_size;
 #endif
 #ifdef PLATFORM_LINUX
   worker_watch_descriptor_count = other.worker_watch_descriptor_count;
   worker_channel_count = other.worker_channel_count;
   worker_cookie_jar_size = other.worker_cookie_jar_size;
+  worker_watch_limit = other.worker_watch_limit;
+  worker_watch_allowance = other.worker_watch_allowance;
+  worker_budget_polled_root_count = other.worker_budget_polled_root_count;
+  worker_budget_polled_directory_count = other.worker_budget_polled_directory_count;
+  worker_promoted_subtree_count = other.worker_promoted_subtree_count;
+  worker_promotion_count = other.worker_promotion_count;
+  worker_demotion_count = other.worker_demotion_count;
 #endif
 
   worker_received = true;
@@ -38,9 +47,13 @@ void Status::assimilate_polling_status(const Status &other)
   polling_in_ok = other.polling_in_ok;
   polling_out_size = other.polling_out_size;
   polling_out_ok = other.polling_out_ok;
+  polling_out_channel_depth = other.polling_out_channel_depth;
+  polling_out_dropped = other.polling_out_dropped;
 
   polling_root_count = other.polling_root_count;
   polling_entry_count = other.polling_entry_count;
+  polling_lazy_root_count = other.polling_lazy_root_count;
+  polling_stat_backend = other.polling_stat_backend;
 
   polling_received = true;
 }
@@ -51,22 +64,33 @@ ostream &operator<<(ostream &out, const Status &status)
       << "* main thread:\n"
       << "  - " << plural(status.pending_callback_count, "pending callback") << "\n"
       << "  - " << plural(status.channel_callback_count, "channel callback") << "\n"
+      << "  - dispatch time: " << status.dispatch_latest << "us latest, " << status.dispatch_longest << "us longest, "
+      << plural(status.dispatch_yield_count, "yield") << "\n"
       << "* worker thread:\n"
       << "  - state: " << status.worker_thread_state << "\n"
       << "  - health: " << status.worker_thread_ok << "\n"
       << "  - in queue health: " << status.worker_in_ok << "\n"
       << "  - " << plural(status.worker_in_size, "in queue message") << "\n"
       << "  - out queue health: " << status.worker_out_ok << "\n"
-      << "  - " << plural(status.worker_out_size, "out queue message") << "* polling thread\n"
-      << "  - " << plural(status.worker_subscription_count, "subscription") << endl;
+      << "  - " << plural(status.worker_out_size, "out queue message") << "\n"
+      << "  - " << plural(status.worker_out_channel_depth, "event") << " waiting from the deepest channel, "
+      << status.worker_out_dropped << " dropped\n"
+      << "  - " << plural(status.worker_subscription_count, "subscription") << "\n"
+      << "  - " << plural(status.worker_recent_file_cache_size, "recent cache entry", "recent cache entries") << endl;
 #ifdef PLATFORM_MACOS
-  out << "  - " << plural(status.worker_rename_buffer_size, "rename buffer entry", "rename buffer entries") << "\n"
-      << "  - " << plural(status.worker_recent_file_cache_size, "recent cache entry", "recent cache entries") << "\n";
+  out << "  - " << plural(status.worker_rename_buffer_size, "rename buffer entry", "rename buffer entries") << "\n";
 #endif
 #ifdef PLATFORM_LINUX
   out << "  - " << plural(status.worker_watch_descriptor_count, "active watch descriptor") << "\n"
       << "  - " << plural(status.worker_channel_count, "channel") << "\n"
-      << "  - " << plural(status.worker_cookie_jar_size, "cookies") << "\n";
+      << "  - " << plural(status.worker_cookie_jar_size, "cookies") << "\n"
+      << "  - " << status.worker_watch_allowance << " of " << status.worker_watch_limit << " watches usable\n"
+      << "  - " << plural(status.worker_budget_polled_root_count, "subtree") << " containing "
+      << plural(status.worker_budget_polled_directory_count, "directory", "directories")
+      << " polled to remain within budget\n"
+      << "  - " << plural(status.worker_promoted_subtree_count, "promoted subtree") << " ("
+      << plural(status.worker_promotion_count, "promotion") << ", " << plural(status.worker_demotion_count, "demotion")
+      << ")\n";
 #endif
   out << "* polling thread\n"
       << "  - state: " << status.polling_thread_state << "\n"
@@ -75,8 +99,12 @@ ostream &operator<<(ostream &out, const Status &status)
       << "  - " << plural(status.polling_in_size, "in queue message") << "\n"
       << "  - out queue health: " << status.worker_out_ok << "\n"
       << "  - " << plural(status.polling_out_size, "out queue message") << "\n"
+      << "  - " << plural(status.polling_out_channel_depth, "event") << " waiting from the deepest channel, "
+      << status.polling_out_dropped << " dropped\n"
       << "  - " << plural(status.polling_root_count, "polled root") << "\n"
       << "  - " << plural(status.polling_entry_count, "polled entry", "polled entries") << "\n"
+      << "  - " << plural(status.polling_lazy_root_count, "lazy root") << "\n"
+      << "  - lstat() backend: " << status.polling_stat_backend << "\n"
       << endl;
   return out;
 }
@@ -1,6 +1,7 @@
 #ifndef STATUS_H
 #define STATUS_H
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 
@@ -12,6 +13,9 @@ public:
   // Main thread
   size_t pending_callback_count{0};
   size_t channel_callback_count{0};
+  uint64_t dispatch_latest{0};
+  uint64_t dispatch_longest{0};
+  size_t dispatch_yield_count{0};
 
   // Worker thread
   std::string worker_thread_state{};
@@ -20,16 +24,25 @@ public:
   std::string worker_in_ok{};
   size_t worker_out_size{0};
   std::string worker_out_ok{};
+  size_t worker_out_channel_depth{0};
+  size_t worker_out_dropped{0};
 
   size_t worker_subscription_count{0};
+  size_t worker_recent_file_cache_size{0};
 #ifdef PLATFORM_MACOS
   size_t worker_rename_buffer_size{0};
-  size_t worker_recent_file_cache_size{0};
 #endif
 #ifdef PLATFORM_LINUX
   size_t worker_watch_descriptor_count{0};
   size_t worker_channel_count{0};
   size_t worker_cookie_jar_size{0};
+  size_t worker_watch_limit{0};
+  size_t worker_watch_allowance{0};
+  size_t worker_budget_polled_root_count{0};
+  size_t worker_budget_polled_directory_count{0};
+  size_t worker_promoted_subtree_count{0};
+  size_t worker_promotion_count{0};
+  size_t worker_demotion_count{0};
 #endif
 
   // Polling thread
@@ -39,9 +52,13 @@ public:
   std::string polling_in_ok{};
   size_t polling_out_size{0};
   std::string polling_out_ok{};
+  size_t polling_out_channel_depth{0};
+  size_t polling_out_dropped{0};
 
   size_t polling_root_count{0};
   size_t polling_entry_count{0};
+  size_t polling_lazy_root_count{0};
+  std::string polling_stat_backend{};
 
   bool worker_received{false};
   bool polling_received{false};
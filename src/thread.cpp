@@ -37,20 +37,34 @@ Thread::DispatchTable::DispatchTable()
   handlers[COMMAND_LOG_DISABLE] = &Thread::handle_log_disable_command;
   handlers[COMMAND_POLLING_INTERVAL] = &Thread::handle_polling_interval_command;
   handlers[COMMAND_POLLING_THROTTLE] = &Thread::handle_polling_throttle_command;
+  handlers[COMMAND_POLLING_STAT_BACKEND] = &Thread::handle_polling_stat_backend_command;
   handlers[COMMAND_CACHE_SIZE] = &Thread::handle_cache_size_command;
+  handlers[COMMAND_TRAVERSAL_THREADS] = &Thread::handle_traversal_threads_command;
+  handlers[COMMAND_FANOTIFY] = &Thread::handle_fanotify_command;
+  handlers[COMMAND_COALESCE_LATENCY] = &Thread::handle_coalesce_latency_command;
+  handlers[COMMAND_OVERFLOW_RESYNC] = &Thread::handle_overflow_resync_command;
+  handlers[COMMAND_WATCH_DEPTH] = &Thread::handle_watch_depth_command;
+  handlers[COMMAND_RENAME_WINDOW] = &Thread::handle_rename_window_command;
+  handlers[COMMAND_PROMOTE] = &Thread::handle_promote_command;
+  handlers[COMMAND_RELEASE] = &Thread::handle_release_command;
   handlers[COMMAND_DRAIN] = &Thread::handle_unknown_command;
   handlers[COMMAND_STATUS] = &Thread::handle_status_command;
 }
 
 const Thread::DispatchTable Thread::command_handlers;
 
+// Commands arrive far less often than events, so the input ring can be much smaller than the output ring.
+static const size_t COMMAND_QUEUE_CAPACITY = 64;
+
 Thread::Thread(std::string &&name, uv_async_t *main_callback, unique_ptr<ThreadStarter> starter) :
   name{move(name)},
   state{State::STOPPED},
   starter{move(starter)},
+  in{COMMAND_QUEUE_CAPACITY},
   main_callback{main_callback},
   work_fn{bind(&Thread::start, this)}
 {
+  out.set_consumer_wake(main_callback);
   report_errable(in);
   report_errable(out);
 };
@@ -88,7 +102,7 @@ Result<bool> Thread::send(Message &&message)
       ostringstream m;
       m << "Non-command message " << message << " sent to a stopped thread";
 
-      out.enqueue(Message::ack(message, false, m.str()));
+      out.enqueue_foreign(Message::ack(message, false, m.str()));
       return ok_result(true);
     }
 
@@ -96,7 +110,7 @@ Result<bool> Thread::send(Message &&message)
     Result<OfflineCommandOutcome> r0 = handle_offline_command(command);
     LOGGER << "Result: " << r0 << "." << endl;
     if (r0.is_error() || r0.get_value() == OFFLINE_ACK) {
-      out.enqueue(Message::ack(message, r0.propagate_as_void()));
+      out.enqueue_foreign(Message::ack(message, r0.propagate_as_void()));
       return ok_result(true);
     }
 
@@ -145,7 +159,7 @@ void Thread::start()
   // Artificially enqueue any messages that establish the thread's starting state.
   vector<Message> starter_messages = starter->get_messages();
   if (!starter_messages.empty()) {
-    in.enqueue_all(starter_messages.begin(), starter_messages.end());
+    in.enqueue_all_foreign(starter_messages.begin(), starter_messages.end());
   }
 
   // Initialize any state necessary to call command handler methods.
@@ -173,7 +187,7 @@ void Thread::start()
 
 Result<> Thread::emit(Message &&message)
 {
-  out.enqueue(move(message));
+  if (!out.enqueue(move(message))) return ok_result();
 
   int uv_err = uv_async_send(main_callback);
   if (uv_err != 0) {
@@ -314,11 +328,56 @@ Result<Thread::CommandOutcome> Thread::handle_polling_throttle_command(const Com
   return handle_unknown_command(payload);
 }
 
+Result<Thread::CommandOutcome> Thread::handle_polling_stat_backend_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
 Result<Thread::CommandOutcome> Thread::handle_cache_size_command(const CommandPayload *payload)
 {
   return handle_unknown_command(payload);
 }
 
+Result<Thread::CommandOutcome> Thread::handle_traversal_threads_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
+Result<Thread::CommandOutcome> Thread::handle_fanotify_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
+Result<Thread::CommandOutcome> Thread::handle_coalesce_latency_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
+Result<Thread::CommandOutcome> Thread::handle_overflow_resync_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
+Result<Thread::CommandOutcome> Thread::handle_watch_depth_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
+Result<Thread::CommandOutcome> Thread::handle_rename_window_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
+Result<Thread::CommandOutcome> Thread::handle_promote_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
+Result<Thread::CommandOutcome> Thread::handle_release_command(const CommandPayload *payload)
+{
+  return handle_unknown_command(payload);
+}
+
 Result<Thread::CommandOutcome> Thread::handle_status_command(const CommandPayload *payload)
 {
   return handle_unknown_command(payload);
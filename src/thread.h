@@ -61,6 +61,10 @@ public:
   // instead.
   std::unique_ptr<std::vector<Message>> receive_all();
 
+  // Limit the filesystem events from each channel that may wait on this thread's output queue for the main thread to
+  // accept them. See `Queue::set_budget()`. Safe to call whether or not the thread is running.
+  void set_event_budget(size_t budget, OverflowPolicy policy) { out.set_budget(budget, policy); }
+
   // Re-send any `Messages` that were sent between the acceptance of the message batch that caused the thread to
   // stop and the transition of the thread to the `STOPPING` phase. Note that this may cause the thread to immediately
   // run again.
@@ -86,7 +90,8 @@ protected:
   virtual Result<> wake() { return ok_result(); }
 
   // Enqueue a `Message` to be sent back to the main thread on the output queue. Trigger the `uv_async_t` callback to
-  // prompt the main thread to consume it at its nearest convenience.
+  // prompt the main thread to consume it at its nearest convenience, unless it's already been triggered since the main
+  // thread last consumed the queue.
   Result<> emit(Message &&message);
 
   // Enqueue a batch of `Messages` to be sent back to the main thread on the output queue. Trigger the `uv_async_t`
@@ -147,9 +152,36 @@ protected:
   // Configure the number of system calls to perform during each polling cycle.
   virtual Result<CommandOutcome> handle_polling_throttle_command(const CommandPayload *payload);
 
+  // Choose the mechanism that batches the polling thread's lstat() calls. Only used by tests.
+  virtual Result<CommandOutcome> handle_polling_stat_backend_command(const CommandPayload *payload);
+
   // Configure the number of stat() entries to cache on MacOS.
   virtual Result<CommandOutcome> handle_cache_size_command(const CommandPayload *payload);
 
+  // Configure the number of threads used to install recursive watches on Linux.
+  virtual Result<CommandOutcome> handle_traversal_threads_command(const CommandPayload *payload);
+
+  // Choose whether new watch roots prefer fanotify over inotify on Linux.
+  virtual Result<CommandOutcome> handle_fanotify_command(const CommandPayload *payload);
+
+  // Configure the window within which filesystem events are merged before they're emitted.
+  virtual Result<CommandOutcome> handle_coalesce_latency_command(const CommandPayload *payload);
+
+  // Choose whether lost events are recovered by rescanning watched directories after a queue overflow on Linux.
+  virtual Result<CommandOutcome> handle_overflow_resync_command(const CommandPayload *payload);
+
+  // Configure the number of directory levels beneath each recursive root that are watched eagerly on Linux.
+  virtual Result<CommandOutcome> handle_watch_depth_command(const CommandPayload *payload);
+
+  // Configure how long an unmatched rename event waits for its other half on Linux.
+  virtual Result<CommandOutcome> handle_rename_window_command(const CommandPayload *payload);
+
+  // Watch a lazily polled subtree that has shown activity.
+  virtual Result<CommandOutcome> handle_promote_command(const CommandPayload *payload);
+
+  // Stop covering a subtree that the other thread has taken over.
+  virtual Result<CommandOutcome> handle_release_command(const CommandPayload *payload);
+
   // Respond to a prompt for thread-local status.
   virtual Result<CommandOutcome> handle_status_command(const CommandPayload *payload);
 
@@ -200,6 +232,8 @@ protected:
   std::string get_in_queue_error() { return in.get_message(); }
   size_t get_out_queue_size() { return out.size(); }
   std::string get_out_queue_error() { return out.get_message(); }
+  size_t get_out_queue_channel_depth() { return out.deepest_channel(); }
+  size_t get_out_queue_dropped() { return out.dropped(); }
 
 private:
   // Diagnostic aid.
@@ -285,7 +319,7 @@ Result<bool> Thread::send_all(InputIt begin, InputIt end)
     }
 
     if (!acks.empty()) {
-      out.enqueue_all(acks.begin(), acks.end());
+      out.enqueue_all_foreign(acks.begin(), acks.end());
     }
 
     if (should_run) {
@@ -307,7 +341,7 @@ Result<bool> Thread::send_all(InputIt begin, InputIt end)
 template <class InputIt>
 Result<> Thread::emit_all(InputIt begin, InputIt end)
 {
-  out.enqueue_all(begin, end);
+  if (!out.enqueue_all(begin, end)) return ok_result();
 
   int uv_err = uv_async_send(main_callback);
   if (uv_err) {
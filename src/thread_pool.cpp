@@ -0,0 +1,80 @@
+#include <utility>
+#include <uv.h>
+#include <vector>
+
+#include "lock.h"
+#include "thread_pool.h"
+
+using std::move;
+
+ThreadPool::ThreadPool(size_t thread_count) : stopping{false}
+{
+  int err = uv_mutex_init(&mutex);
+  if (err != 0) {
+    report_uv_error(err);
+    freeze();
+    return;
+  }
+
+  err = uv_cond_init(&available);
+  if (err != 0) {
+    report_uv_error(err);
+    freeze();
+    return;
+  }
+
+  threads.reserve(thread_count);
+  for (size_t i = 0; i < thread_count; i++) {
+    uv_thread_t thread{};
+    err = uv_thread_create(&thread, [](void *arg) { static_cast<ThreadPool *>(arg)->work(); }, this);
+    if (err != 0) {
+      report_uv_error(err);
+      break;
+    }
+    threads.push_back(thread);
+  }
+  freeze();
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    Lock lock(mutex);
+    stopping = true;
+    uv_cond_broadcast(&available);
+  }
+
+  for (uv_thread_t &thread : threads) {
+    uv_thread_join(&thread);
+  }
+
+  uv_cond_destroy(&available);
+  uv_mutex_destroy(&mutex);
+}
+
+void ThreadPool::enqueue(Task &&task)
+{
+  Lock lock(mutex);
+  tasks.emplace_back(move(task));
+  uv_cond_signal(&available);
+}
+
+void ThreadPool::work()
+{
+  while (true) {
+    Task task;
+
+    {
+      Lock lock(mutex);
+      while (tasks.empty() && !stopping) {
+        uv_cond_wait(&available, &mutex);
+      }
+      if (tasks.empty()) return;
+
+      task = move(tasks.front());
+      tasks.pop_front();
+    }
+
+    task();
+  }
+}
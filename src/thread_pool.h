@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <functional>
+#include <uv.h>
+#include <vector>
+
+#include "errable.h"
+
+// Fixed-size pool of libuv threads that execute queued tasks in FIFO order.
+//
+// Tasks run on pool threads, so they must not touch any state owned by the thread that enqueued them without
+// synchronization. Pool threads have no Logger configured; report problems back to the owning thread instead.
+class ThreadPool : public Errable
+{
+public:
+  using Task = std::function<void()>;
+
+  // Start `thread_count` threads that wait for work.
+  explicit ThreadPool(size_t thread_count);
+
+  // Allow already-enqueued tasks to finish, then join all threads.
+  ~ThreadPool() override;
+
+  // Schedule a task to run on the next available pool thread. Safe to call from any thread, including from within a
+  // running task.
+  void enqueue(Task &&task);
+
+  // Number of threads in the pool.
+  size_t size() const { return threads.size(); }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+
+private:
+  // Loop executed by each pool thread.
+  void work();
+
+  uv_mutex_t mutex{};
+  uv_cond_t available{};
+  std::deque<Task> tasks;
+  bool stopping;
+
+  std::vector<uv_thread_t> threads;
+};
+
+#endif
@@ -1,8 +1,10 @@
+#include <chrono>
+#include <cstdint>
 #include <deque>
-#include <map>
 #include <memory>
 #include <string>
 #include <sys/types.h>
+#include <unordered_map>
 #include <utility>
 
 #include "../../message.h"
@@ -10,64 +12,26 @@
 #include "../recent_file_cache.h"
 #include "cookie_jar.h"
 
+using std::make_pair;
 using std::move;
 using std::string;
-using std::unique_ptr;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 
-Cookie::Cookie(ChannelID channel_id, std::string &&from_path, EntryKind kind) noexcept :
-  channel_id{channel_id}, from_path(move(from_path)), kind{kind}
+Cookie::Cookie(ChannelID channel_id, std::string &&from_path, EntryKind kind, uint64_t serial) noexcept :
+  channel_id{channel_id}, from_path(move(from_path)), kind{kind}, serial{serial}
 {
   //
 }
 
 Cookie::Cookie(Cookie &&other) noexcept :
-  channel_id{other.channel_id}, from_path(move(other.from_path)), kind{other.kind}
+  channel_id{other.channel_id}, from_path(move(other.from_path)), kind{other.kind}, serial{other.serial}
 {
   //
 }
 
-void CookieBatch::moved_from(MessageBuffer &messages,
-  ChannelID channel_id,
-  uint32_t cookie,
-  string &&old_path,
-  EntryKind kind)
-{
-  auto existing = from_paths.find(cookie);
-  if (existing != from_paths.end()) {
-    // Duplicate IN_MOVED_FROM cookie.
-    // Resolve the old one as a deletion.
-    Cookie dup(move(existing->second));
-    messages.deleted(dup.get_channel_id(), dup.move_from_path(), dup.get_kind());
-    from_paths.erase(existing);
-  }
-
-  Cookie c(channel_id, move(old_path), kind);
-  from_paths.emplace(cookie, move(c));
-}
-
-unique_ptr<Cookie> CookieBatch::yoink(uint32_t cookie)
-{
-  auto from = from_paths.find(cookie);
-  if (from == from_paths.end()) {
-    return unique_ptr<Cookie>(nullptr);
-  }
-
-  unique_ptr<Cookie> c(new Cookie(move(from->second)));
-  from_paths.erase(from);
-  return c;
-}
-
-void CookieBatch::flush(MessageBuffer &messages, RecentFileCache &cache)
-{
-  for (auto &pair : from_paths) {
-    Cookie dup(move(pair.second));
-    cache.evict(dup.get_from_path());
-    messages.deleted(dup.get_channel_id(), dup.move_from_path(), dup.get_kind());
-  }
-  from_paths.clear();
-}
-
-CookieJar::CookieJar(unsigned int max_batches) : batches(max_batches)
+CookieJar::CookieJar(milliseconds window) : window{window}
 {
   //
 }
@@ -76,11 +40,22 @@ void CookieJar::moved_from(MessageBuffer &messages,
   ChannelID channel_id,
   uint32_t cookie,
   std::string &&old_path,
-  EntryKind kind)
+  EntryKind kind,
+  steady_clock::time_point now)
 {
-  if (batches.empty()) return;
+  Key key = make_pair(cookie, channel_id);
+  auto existing = cookies.find(key);
+  if (existing != cookies.end()) {
+    // Duplicate IN_MOVED_FROM cookie.
+    // Resolve the old one as a deletion.
+    Cookie dup(move(existing->second));
+    messages.deleted(dup.get_channel_id(), dup.move_from_path(), dup.get_kind());
+    cookies.erase(existing);
+  }
 
-  batches.back().moved_from(messages, channel_id, cookie, move(old_path), kind);
+  uint64_t serial = next_serial++;
+  cookies.emplace(key, Cookie(channel_id, move(old_path), kind, serial));
+  deadlines.push_back(Deadline{now, key, serial});
 }
 
 void CookieJar::moved_to(MessageBuffer &messages,
@@ -89,43 +64,63 @@ void CookieJar::moved_to(MessageBuffer &messages,
   std::string &&new_path,
   EntryKind kind)
 {
-  unique_ptr<Cookie> from;
-  for (auto &batch : batches) {
-    unique_ptr<Cookie> found = batch.yoink(cookie);
-    if (found) {
-      if (from) {
-        // Multiple IN_MOVED_FROM results.
-        // Report deletions for all but the most recent.
-        messages.deleted(from->get_channel_id(), from->move_from_path(), from->get_kind());
-      }
-
-      from = move(found);
-    }
-  }
-
-  if (!from) {
+  auto found = cookies.find(make_pair(cookie, channel_id));
+  if (found == cookies.end()) {
     // Unmatched IN_MOVED_TO.
     // Resolve it as a creation.
     messages.created(channel_id, move(new_path), kind);
     return;
   }
 
-  if (from->get_channel_id() != channel_id || kinds_are_different(from->get_kind(), kind)) {
+  Cookie from(move(found->second));
+  cookies.erase(found);
+  if (cookies.empty()) deadlines.clear();
+
+  if (kinds_are_different(from.get_kind(), kind)) {
     // Existing IN_MOVED_FROM with this cookie does not match.
     // Resolve it as a deletion/creation pair.
-    messages.deleted(from->get_channel_id(), from->move_from_path(), from->get_kind());
+    messages.deleted(from.get_channel_id(), from.move_from_path(), from.get_kind());
     messages.created(channel_id, move(new_path), kind);
     return;
   }
 
-  messages.renamed(channel_id, from->move_from_path(), move(new_path), kind);
+  messages.renamed(channel_id, from.move_from_path(), move(new_path), kind);
 }
 
-void CookieJar::flush_oldest_batch(MessageBuffer &messages, RecentFileCache &cache)
+void CookieJar::flush_expired(MessageBuffer &messages, RecentFileCache &cache, steady_clock::time_point now)
 {
-  if (batches.empty()) return;
+  while (!deadlines.empty()) {
+    Deadline &deadline = deadlines.front();
+
+    auto held = cookies.find(deadline.key);
+    if (held == cookies.end() || held->second.get_serial() != deadline.serial) {
+      // This Cookie has already been matched or replaced.
+      deadlines.pop_front();
+      continue;
+    }
+
+    if (deadline.seen + window > now) break;
+
+    Cookie dup(move(held->second));
+    cookies.erase(held);
+    deadlines.pop_front();
+
+    if (dup.get_kind() == KIND_DIRECTORY) {
+      cache.evict_subtree(dup.get_from_path());
+    } else {
+      cache.evict(dup.get_from_path());
+    }
+    messages.deleted(dup.get_channel_id(), dup.move_from_path(), dup.get_kind());
+  }
+}
+
+milliseconds CookieJar::until_next_expiry(steady_clock::time_point now) const
+{
+  if (deadlines.empty()) return milliseconds(0);
+
+  steady_clock::time_point expiry = deadlines.front().seen + window;
+  if (expiry <= now) return milliseconds(0);
 
-  batches.front().flush(messages, cache);
-  batches.pop_front();
-  batches.emplace_back();
+  // Round up, so that a timer armed with the result doesn't fire just before the deadline.
+  return duration_cast<milliseconds>(expiry - now + milliseconds(1) - steady_clock::duration(1));
 }
@@ -1,23 +1,28 @@
 #ifndef COOKIE_JAR
 #define COOKIE_JAR
 
+#include <chrono>
+#include <cstdint>
 #include <deque>
-#include <map>
 #include <memory>
 #include <string>
 #include <sys/types.h>
+#include <unordered_map>
 #include <utility>
 
 #include "../../message.h"
 #include "../../message_buffer.h"
 #include "../recent_file_cache.h"
 
+// Default duration that an IN_MOVED_FROM event waits for its corresponding IN_MOVED_TO event.
+const std::chrono::milliseconds DEFAULT_RENAME_WINDOW(500);
+
 // Remember a path that was observed in an IN_MOVED_FROM inotify event until its corresponding IN_MOVED_TO event
 // is observed, or until it times out.
 class Cookie
 {
 public:
-  Cookie(ChannelID channel_id, std::string &&from_path, EntryKind kind);
+  Cookie(ChannelID channel_id, std::string &&from_path, EntryKind kind, uint64_t serial) noexcept;
   Cookie(Cookie &&other) noexcept;
   ~Cookie() = default;
 
@@ -31,6 +36,9 @@ public:
 
   const EntryKind &get_kind() { return kind; }
 
+  // Distinguish this Cookie from any earlier one that shared its cookie value and channel.
+  uint64_t get_serial() const { return serial; }
+
   Cookie(const Cookie &other) = delete;
   Cookie &operator=(Cookie &&cookie) = delete;
   Cookie &operator=(const Cookie &other) = delete;
@@ -39,76 +47,59 @@ private:
   const ChannelID channel_id;
   std::string from_path;
   const EntryKind kind;
+  const uint64_t serial;
 };
 
-// Collection of Cookies observed from rename events within a single cycle of inotify events. Batches are used to
-// age off rename events that haven't been matched after a fixed number of inotify deliveries.
-class CookieBatch
+// Associate IN_MOVED_FROM and IN_MOVED_TO events from inotify that arrive within a configurable window of time of one
+// another, regardless of how the events are split among read() calls. Unmatched IN_MOVED_FROM events are held in a
+// single table keyed by cookie value and channel. Once their window has elapsed they're aged off and emitted as
+// deletion events.
+class CookieJar
 {
 public:
-  CookieBatch() = default;
-  ~CookieBatch() = default;
+  // Construct a CookieJar that correlates rename events whose halves arrive within `window` of each other. A longer
+  // window improves the watcher's ability to match rename events that occur at high rates, at the cost of memory and
+  // of the latency of deletion events delivered when an entry is renamed outside of a watched directory. A window of
+  // 0 only matches rename events that are consumed together.
+  explicit CookieJar(std::chrono::milliseconds window = DEFAULT_RENAME_WINDOW);
+  ~CookieJar() = default;
 
-  // Insert a new Cookie to eventually match an IN_MOVED_FROM event. If an existing Cookie already exists for this
-  // cookie value, immediately age the old Cookie off and buffer a deletion event.
+  // Observe an IN_MOVED_FROM event by adding a Cookie that expires one window after `now`. If a Cookie already exists
+  // for this cookie value on the same channel, immediately age the old Cookie off and buffer a deletion event.
   void moved_from(MessageBuffer &messages,
     ChannelID channel_id,
     uint32_t cookie,
     std::string &&old_path,
-    EntryKind kind);
-
-  // Remove a Cookie from this batch that has the specified cookie value. Return nullptr instead if no such cookie
-  // exists.
-  std::unique_ptr<Cookie> yoink(uint32_t cookie);
+    EntryKind kind,
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+  // Observe an IN_MOVED_TO event. Look up an unexpired IN_MOVED_FROM event with a matching `cookie` value on the same
+  // channel. If no match is found, emit a creation event for the entry; an entry moved between the roots of two
+  // different channels is reported as a creation on one and, once its Cookie ages off, a deletion on the other. If a
+  // match is found but the entry kind doesn't match, emit a delete/create event pair for the old and new entries.
+  // Otherwise, emit the successfully correlated rename event.
+  void moved_to(MessageBuffer &messages, ChannelID channel_id, uint32_t cookie, std::string &&new_path, EntryKind kind);
 
-  // Age off all Cookies within this batch by buffering them as deletion events. Evict them from the cache.
-  void flush(MessageBuffer &messages, RecentFileCache &cache);
+  // Buffer deletion events for any Cookies that have gone unmatched for longer than the window as of `now`. Evict them,
+  // and anything cached beneath them, from the cache.
+  void flush_expired(MessageBuffer &messages,
+    RecentFileCache &cache,
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
 
-  bool empty() const { return from_paths.empty(); }
+  // Return the time remaining from `now` until the oldest unmatched Cookie expires, or zero if it already has. Only
+  // meaningful if the CookieJar isn't empty.
+  std::chrono::milliseconds until_next_expiry(
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const;
 
-  CookieBatch(const CookieBatch &) = delete;
-  CookieBatch(CookieBatch &&) = delete;
-  CookieBatch &operator=(const CookieBatch &) = delete;
-  CookieBatch &operator=(CookieBatch &&) = delete;
+  // Change the window for every Cookie, including those already held.
+  void set_window(std::chrono::milliseconds window) { this->window = window; }
 
-private:
-  std::map<uint32_t, Cookie> from_paths;
-};
+  std::chrono::milliseconds get_window() const { return window; }
 
-// Associate IN_MOVED_FROM and IN_MOVED_TO events from inotify received within a configurable number of consecutive
-// notification cycles. The CookieJar contains a fixed number of CookieBatches that contain unmatched IN_MOVED_FROM
-// events collected within a single notification cycle. As more notifications arrive or read() calls time out, events
-// that remain unmatched are aged off and emitted as deletion events.
-class CookieJar
-{
-public:
-  // Construct a CookieJar capable of correlating rename events across `max_batches` consecutive inotify event cycles.
-  // Specifying a higher number of batches improves the watcher's ability to match rename events that occur at
-  // high rates, at the cost of increasing memory usage and the latency of delete events delivered when an entry
-  // is renamed outside of a watched directory. If `max_batches` is 0, _no_ rename correlation will be done at
-  // all; all renames will be emitted as create/delete pairs instead. If `max_batches` is 1, only rename events
-  // that arrive within the same notification cycle will be caught, but deletion events will be delivered with
-  // no additional latency. The default of 2 correlates rename events across consecutive notification cycles but
-  // no further.
-  explicit CookieJar(unsigned int max_batches = 2);
-  ~CookieJar() = default;
-
-  // Observe an IN_MOVED_FROM event by adding a Cookie to the freshest CookieBatch.
-  void moved_from(MessageBuffer &messages,
-    ChannelID channel_id,
-    uint32_t cookie,
-    std::string &&old_path,
-    EntryKind kind);
-
-  // Observe an IN_MOVED_TO event. Search the current CookieBatches for a recent IN_MOVED_FROM event with a matching
-  // `cookie` value. If no match is found, emit a creation event for the entry. If a match is found but the channel
-  // or entry kind don't match, emit a delete/create event pair for the old and new entries. Otherwise, emit the
-  // successfully correlated rename event.
-  void moved_to(MessageBuffer &messages, ChannelID channel_id, uint32_t cookie, std::string &&new_path, EntryKind kind);
+  // Return true if no unmatched IN_MOVED_FROM event is being held.
+  bool empty() const { return cookies.empty(); }
 
-  // Buffer deletion events for any Cookies that have not been matched within `max_batches` CookieBatches. Add a
-  // fresh CookieBatch to capture the next cycle of rename events.
-  void flush_oldest_batch(MessageBuffer &messages, RecentFileCache &cache);
+  size_t size() const { return cookies.size(); }
 
   CookieJar(const CookieJar &other) = delete;
   CookieJar(CookieJar &&other) = delete;
@@ -116,7 +107,34 @@ public:
   CookieJar &operator=(CookieJar &&other) = delete;
 
 private:
-  std::deque<CookieBatch> batches;
+  // A cookie value and the channel that saw it. When several channels watch the same directory, each receives its own
+  // copy of a rename event, and each copy must be matched only against the other half on the same channel.
+  using Key = std::pair<uint32_t, ChannelID>;
+
+  struct KeyHash
+  {
+    size_t operator()(const Key &key) const
+    {
+      return std::hash<uint32_t>()(key.first) ^ (std::hash<ChannelID>()(key.second) * 31);
+    }
+  };
+
+  struct Deadline
+  {
+    std::chrono::steady_clock::time_point seen;
+    Key key;
+    uint64_t serial;
+  };
+
+  std::chrono::milliseconds window;
+
+  std::unordered_map<Key, Cookie, KeyHash> cookies;
+
+  // Every Cookie shares one window, so ordering them as they were observed also orders them by deadline. Entries for
+  // Cookies that have since been matched or replaced are discarded when they reach the front.
+  std::deque<Deadline> deadlines;
+
+  uint64_t next_serial{0};
 };
 
 #endif
@@ -0,0 +1,14 @@
+#include <dirent.h>
+
+#include "../../message.h"
+#include "directory_snapshot.h"
+
+EntryKind DirectorySnapshot::kind_of(unsigned char type)
+{
+  switch (type) {
+    case DT_REG: return KIND_FILE;
+    case DT_DIR: return KIND_DIRECTORY;
+    case DT_LNK: return KIND_SYMLINK;
+    default: return KIND_UNKNOWN;
+  }
+}
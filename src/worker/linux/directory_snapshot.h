@@ -0,0 +1,79 @@
+#ifndef DIRECTORY_SNAPSHOT_H
+#define DIRECTORY_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "../../helper/linux/directory_reader.h"
+#include "../../message.h"
+
+// The entries of a single watched directory as of the last time it was listed, kept current by the inotify events
+// that arrive for it afterwards. When inotify's queue overflows and events are lost, the directory's current contents
+// can be compared against its snapshot to reconstruct what changed.
+class DirectorySnapshot
+{
+public:
+  struct Entry
+  {
+    // Inode number, or 0 if it's not known.
+    uint64_t ino;
+
+    EntryKind kind;
+  };
+
+  using Entries = std::unordered_map<std::string, Entry>;
+
+  DirectorySnapshot() = default;
+  DirectorySnapshot(DirectorySnapshot &&) = default;
+  DirectorySnapshot &operator=(DirectorySnapshot &&) = default;
+  ~DirectorySnapshot() = default;
+
+  // Translate a DT_* constant from a directory entry into an EntryKind.
+  static EntryKind kind_of(unsigned char type);
+
+  // Discard any existing entries and begin recording a fresh listing.
+  void reset()
+  {
+    entries.clear();
+    taken = true;
+  }
+
+  // Discard all entries and stop recording.
+  void clear()
+  {
+    entries.clear();
+    taken = false;
+  }
+
+  // Record a single entry produced by a DirectoryReader.
+  void add(const DirectoryReader::Entry &entry) { entries[entry.name] = Entry{entry.ino, kind_of(entry.type)}; }
+
+  // Record an entry that has been created or renamed into this directory.
+  void add(const std::string &name, uint64_t ino, EntryKind kind) { entries[name] = Entry{ino, kind}; }
+
+  // Forget an entry that has been deleted or renamed out of this directory.
+  void remove(const std::string &name) { entries.erase(name); }
+
+  // Replace the recorded entries with `replacement`.
+  void replace(Entries &&replacement)
+  {
+    entries.swap(replacement);
+    taken = true;
+  }
+
+  // Return true if this directory has been listed since snapshots were enabled.
+  bool is_taken() const { return taken; }
+
+  const Entries &get_entries() const { return entries; }
+
+  DirectorySnapshot(const DirectorySnapshot &) = delete;
+  DirectorySnapshot &operator=(const DirectorySnapshot &) = delete;
+
+private:
+  bool taken{false};
+
+  Entries entries;
+};
+
+#endif
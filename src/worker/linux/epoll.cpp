@@ -0,0 +1,84 @@
+#include <cerrno>
+#include <string>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <utility>
+
+#include "../../errable.h"
+#include "../../helper/linux/helper.h"
+#include "../../result.h"
+#include "epoll.h"
+
+using std::move;
+using std::to_string;
+
+// Maximum number of ready file descriptors to collect from a single epoll_wait() call.
+const int MAX_EVENTS = 16;
+
+Epoll::Epoll() : epoll_fd{-1}
+{
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    report_if_error<>(errno_result<>("Unable to create epoll instance"));
+  }
+  freeze();
+}
+
+Epoll::~Epoll()
+{
+  if (epoll_fd != -1) {
+    close(epoll_fd);
+  }
+}
+
+Result<> Epoll::add(int fd, Handler &&handler)
+{
+  if (handlers.find(fd) != handlers.end()) {
+    return error_result("File descriptor " + to_string(fd) + " is already registered with epoll");
+  }
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    return errno_result<>("Unable to add file descriptor " + to_string(fd) + " to epoll");
+  }
+
+  handlers.emplace(fd, move(handler));
+  return ok_result();
+}
+
+Result<> Epoll::remove(int fd)
+{
+  if (handlers.erase(fd) == 0) return ok_result();
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+    return errno_result<>("Unable to remove file descriptor " + to_string(fd) + " from epoll");
+  }
+
+  return ok_result();
+}
+
+Result<> Epoll::wait()
+{
+  epoll_event events[MAX_EVENTS];
+
+  int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+  if (count == -1) {
+    if (errno == EINTR) return ok_result();
+    return errno_result<>("Unable to wait for epoll events");
+  }
+
+  for (int i = 0; i < count; i++) {
+    // Look the handler up again for each event, in case an earlier handler removed this descriptor.
+    auto it = handlers.find(events[i].data.fd);
+    if (it == handlers.end()) continue;
+
+    // Copy the handler so that it remains valid even if it removes itself.
+    Handler handler = it->second;
+    Result<> r = handler();
+    if (r.is_error()) return r;
+  }
+
+  return ok_result();
+}
@@ -0,0 +1,49 @@
+#ifndef EPOLL_H
+#define EPOLL_H
+
+#include <functional>
+#include <unordered_map>
+
+#include "../../errable.h"
+#include "../../result.h"
+
+// RAII wrapper for an epoll instance created with epoll_create1(2). Any number of file descriptors may be registered,
+// each with a handler callback that's invoked from wait() whenever its descriptor becomes readable.
+class Epoll : public Errable
+{
+public:
+  // Callback invoked when a registered file descriptor is ready to read.
+  using Handler = std::function<Result<>()>;
+
+  // Construct an epoll instance with no registered file descriptors.
+  Epoll();
+
+  // Close the epoll instance. Registered file descriptors are not closed.
+  ~Epoll() override;
+
+  // Begin watching `fd` for readability. `handler` will be called from wait() each time it's ready. Each file
+  // descriptor may be registered only once.
+  Result<> add(int fd, Handler &&handler);
+
+  // Stop watching `fd`. It's safe to call this from within a handler, including the handler for `fd` itself.
+  Result<> remove(int fd);
+
+  // Block until at least one registered file descriptor is ready, then dispatch its handler. Errors from handlers
+  // are returned immediately; any ready descriptors that were not yet dispatched remain ready for the next call.
+  Result<> wait();
+
+  // Number of file descriptors currently registered.
+  size_t size() const { return handlers.size(); }
+
+  Epoll(const Epoll &) = delete;
+  Epoll(Epoll &&) = delete;
+  Epoll &operator=(const Epoll &) = delete;
+  Epoll &operator=(Epoll &&) = delete;
+
+private:
+  int epoll_fd;
+
+  std::unordered_map<int, Handler> handlers;
+};
+
+#endif
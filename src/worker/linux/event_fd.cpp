@@ -0,0 +1,61 @@
+#include <cerrno>
+#include <cstdint>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../../errable.h"
+#include "../../helper/linux/helper.h"
+#include "../../result.h"
+#include "event_fd.h"
+
+EventFd::EventFd() : fd{-1}
+{
+  fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (fd == -1) {
+    report_if_error<>(errno_result<>("Unable to create eventfd"));
+  }
+  freeze();
+}
+
+EventFd::~EventFd()
+{
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+Result<> EventFd::signal()
+{
+  uint64_t increment = 1;
+  ssize_t result = write(fd, &increment, sizeof(uint64_t));
+  if (result == -1) {
+    int write_errno = errno;
+
+    if (write_errno == EAGAIN || write_errno == EWOULDBLOCK) {
+      // If the counter is saturated, that means there's already a pending signal.
+      return ok_result();
+    }
+
+    return errno_result<>("Unable to signal eventfd", write_errno);
+  }
+
+  return ok_result();
+}
+
+Result<> EventFd::consume()
+{
+  uint64_t value = 0;
+  ssize_t result = read(fd, &value, sizeof(uint64_t));
+  if (result == -1) {
+    int read_errno = errno;
+
+    if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) {
+      // Counter was already zero.
+      return ok_result();
+    }
+
+    return errno_result<>("Unable to read from eventfd", read_errno);
+  }
+
+  return ok_result();
+}
@@ -0,0 +1,36 @@
+#ifndef EVENT_FD_H
+#define EVENT_FD_H
+
+#include "../../errable.h"
+#include "../../result.h"
+
+// RAII wrapper for a Linux eventfd created with eventfd(2). Used to wake the worker thread's epoll loop when commands
+// are waiting. We don't care about the counter value; only whether or not it's nonzero.
+class EventFd : public Errable
+{
+public:
+  // Construct a new, unsignalled, non-blocking EventFd.
+  EventFd();
+
+  // Deallocate and close() the underlying file descriptor.
+  ~EventFd() override;
+
+  // Increment the counter to inform readers that data is available.
+  Result<> signal();
+
+  // Reset the counter to zero to prepare for a new signal.
+  Result<> consume();
+
+  // Access the file descriptor that should be polled for readiness.
+  int get_fd() const { return fd; }
+
+  EventFd(const EventFd &) = delete;
+  EventFd(EventFd &&) = delete;
+  EventFd &operator=(const EventFd &) = delete;
+  EventFd &operator=(EventFd &&) = delete;
+
+private:
+  int fd;
+};
+
+#endif
@@ -0,0 +1,473 @@
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "../../helper/linux/helper.h"
+#include "../../log.h"
+#include "../../message.h"
+#include "../../message_buffer.h"
+#include "../../result.h"
+#include "../recent_file_cache.h"
+#include "fanotify_registry.h"
+
+using std::endl;
+using std::move;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+
+// Events requested from each marked filesystem. FAN_ONDIR includes events that act on directories themselves.
+const uint64_t MARK_MASK = FAN_CREATE | FAN_DELETE | FAN_MODIFY | FAN_ATTRIB | FAN_ONDIR;
+
+// Bytes requested from each read() of the fanotify descriptor.
+const size_t READ_SIZE = 64 * 1024;
+
+// Upper bound on the number of resolved directory handles to remember before starting over.
+const size_t MAX_DIRECTORY_PATHS = 64 * 1024;
+
+// Suffix that readlink() appends to /proc/self/fd entries for unlinked directories.
+const char DELETED_SUFFIX[] = " (deleted)";
+
+static_assert(sizeof(fsid_t) == sizeof(uint64_t), "Unexpected fsid_t size");
+static_assert(sizeof(__kernel_fsid_t) == sizeof(uint64_t), "Unexpected __kernel_fsid_t size");
+
+static uint64_t fsid_key(const void *fsid)
+{
+  uint64_t key = 0;
+  memcpy(&key, fsid, sizeof(uint64_t));
+  return key;
+}
+
+// Access the entry name that follows the file handle within a *_DFID_NAME info record.
+static const char *entry_name(const fanotify_event_info_fid *info)
+{
+  const auto *handle = reinterpret_cast<const file_handle *>(info->handle);
+  return reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+}
+
+static string path_join(const string &dir, const char *name)
+{
+  string path;
+  path.reserve(dir.size() + 1 + strlen(name));
+  path.append(dir);
+  if (path.empty() || path.back() != '/') path.push_back('/');
+  path.append(name);
+  return path;
+}
+
+// Read the path of an open file descriptor back from procfs.
+static bool path_of_fd(int fd, string &out)
+{
+  char link[PATH_MAX];
+  string proc_path = "/proc/self/fd/" + to_string(fd);
+
+  ssize_t length = readlink(proc_path.c_str(), link, sizeof(link));
+  if (length <= 0 || static_cast<size_t>(length) >= sizeof(link)) return false;
+
+  out.assign(link, static_cast<size_t>(length));
+
+  const size_t suffix_length = sizeof(DELETED_SUFFIX) - 1;
+  return !(out.size() > suffix_length && out.compare(out.size() - suffix_length, suffix_length, DELETED_SUFFIX) == 0);
+}
+
+FanotifyRegistry::FanotifyRegistry() : fanotify_fd{-1}
+{
+  fanotify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+    O_RDONLY | O_CLOEXEC | O_LARGEFILE);
+  if (fanotify_fd == -1) {
+    report_if_error<>(errno_result<>("Unable to initialize fanotify"));
+  }
+  freeze();
+}
+
+FanotifyRegistry::~FanotifyRegistry()
+{
+  for (Filesystem &filesystem : filesystems) {
+    close(filesystem.mount_fd);
+  }
+
+  if (fanotify_fd != -1) {
+    close(fanotify_fd);
+  }
+}
+
+Result<> FanotifyRegistry::add(ChannelID channel_id, const string &root, bool recursive)
+{
+  struct statfs fs_stat = {};
+  if (statfs(root.c_str(), &fs_stat) != 0) {
+    return errno_result("Unable to identify the filesystem of " + root);
+  }
+  uint64_t fsid = fsid_key(&fs_stat.f_fsid);
+
+  int root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd == -1) {
+    return errno_result("Unable to open " + root);
+  }
+
+  // Resolve the root through its own file handle. This confirms that directory handles reported by events can be
+  // opened, and produces the same canonical path that they'll resolve to.
+  alignas(file_handle) char handle_storage[sizeof(file_handle) + MAX_HANDLE_SZ];
+  auto *handle = reinterpret_cast<file_handle *>(handle_storage);
+  handle->handle_bytes = MAX_HANDLE_SZ;
+  int mount_id = 0;
+  if (name_to_handle_at(root_fd, "", handle, &mount_id, AT_EMPTY_PATH) != 0) {
+    int handle_errno = errno;
+    close(root_fd);
+    return errno_result("Unable to encode a file handle for " + root, handle_errno);
+  }
+
+  int opened_fd = open_by_handle_at(root_fd, handle, O_PATH | O_CLOEXEC);
+  if (opened_fd == -1) {
+    int open_errno = errno;
+    close(root_fd);
+    return errno_result("Unable to open a file handle for " + root, open_errno);
+  }
+  string resolved;
+  bool found = path_of_fd(opened_fd, resolved);
+  close(opened_fd);
+  if (!found) {
+    close(root_fd);
+    return error_result("Unable to resolve the path of " + root);
+  }
+
+  Filesystem *filesystem = find_filesystem(fsid);
+  if (filesystem == nullptr) {
+    uint64_t mask = MARK_MASK;
+#ifdef FAN_RENAME
+    mask |= FAN_RENAME;
+    int mark_err = fanotify_mark(fanotify_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, root_fd, nullptr);
+    if (mark_err != 0 && errno == EINVAL) {
+      // FAN_RENAME arrived in Linux 5.17. Report the two halves of a rename separately on older kernels.
+      mask = MARK_MASK | FAN_MOVED_FROM | FAN_MOVED_TO;
+      mark_err = fanotify_mark(fanotify_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, root_fd, nullptr);
+    }
+#else
+    mask |= FAN_MOVED_FROM | FAN_MOVED_TO;
+    int mark_err = fanotify_mark(fanotify_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, root_fd, nullptr);
+#endif
+    if (mark_err != 0) {
+      int mark_errno = errno;
+      close(root_fd);
+      return errno_result("Unable to mark the filesystem containing " + root, mark_errno);
+    }
+
+    LOGGER << "Marked filesystem containing [" << root << "] with fanotify." << endl;
+    filesystems.push_back(Filesystem{fsid, root_fd, mask, 0});
+    filesystem = &filesystems.back();
+  } else {
+    close(root_fd);
+  }
+
+  filesystem->root_count++;
+  roots.push_back(Root{channel_id, root, move(resolved), recursive, fsid});
+
+  LOGGER << "Watching path [" << root << "] with fanotify on channel " << channel_id << "." << endl;
+  return ok_result();
+}
+
+Result<> FanotifyRegistry::remove(ChannelID channel_id)
+{
+  Result<> r = ok_result();
+
+  auto it = roots.begin();
+  while (it != roots.end()) {
+    if (it->channel_id != channel_id) {
+      ++it;
+      continue;
+    }
+
+    uint64_t fsid = it->fsid;
+    it = roots.erase(it);
+
+    Filesystem *filesystem = find_filesystem(fsid);
+    if (filesystem == nullptr) continue;
+
+    filesystem->root_count--;
+    if (filesystem->root_count > 0) continue;
+
+    int unmark_err = fanotify_mark(
+      fanotify_fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, filesystem->mask, filesystem->mount_fd, nullptr);
+    if (unmark_err != 0 && errno != ENOENT) {
+      r = errno_result("Unable to remove fanotify filesystem mark");
+    }
+    close(filesystem->mount_fd);
+
+    *filesystem = filesystems.back();
+    filesystems.pop_back();
+    directory_paths.clear();
+  }
+
+  return r;
+}
+
+Result<> FanotifyRegistry::consume(MessageBuffer &messages, RecentFileCache &cache)
+{
+  if (read_buffer.size() < READ_SIZE) read_buffer.resize(READ_SIZE);
+
+  while (true) {
+    ssize_t result = read(fanotify_fd, read_buffer.data(), read_buffer.size());
+    if (result == 0) return ok_result();
+    if (result < 0) {
+      int read_errno = errno;
+      if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) return ok_result();
+      if (read_errno == EINTR) continue;
+      return errno_result("Unable to read fanotify events", read_errno);
+    }
+
+    auto *event = reinterpret_cast<fanotify_event_metadata *>(read_buffer.data());
+    ssize_t remaining = result;
+    while (FAN_EVENT_OK(event, remaining)) {
+      if (event->vers != FANOTIFY_METADATA_VERSION) {
+        return error_result("Unexpected fanotify metadata version " + to_string(event->vers));
+      }
+
+      handle_event(event, messages, cache);
+      event = FAN_EVENT_NEXT(event, remaining);
+    }
+  }
+}
+
+void FanotifyRegistry::handle_event(const fanotify_event_metadata *event,
+  MessageBuffer &messages,
+  RecentFileCache &cache)
+{
+  // Groups that report file handles never receive open descriptors, but be certain not to leak one.
+  if (event->fd >= 0) close(event->fd);
+
+  uint64_t mask = event->mask;
+  if ((mask & FAN_Q_OVERFLOW) == FAN_Q_OVERFLOW) {
+    LOGGER << "fanotify event queue overflowed." << endl;
+    for (Root &root : roots) {
+      messages.error(root.channel_id, "fanotify event queue overflowed. Some events have been lost.", false);
+    }
+    return;
+  }
+
+  string dir;
+  string old_dir;
+  string new_dir;
+  const char *name = nullptr;
+  const char *old_name = nullptr;
+  const char *new_name = nullptr;
+
+  const char *cursor = reinterpret_cast<const char *>(event) + event->metadata_len;
+  const char *end = reinterpret_cast<const char *>(event) + event->event_len;
+  while (cursor + sizeof(fanotify_event_info_header) <= end) {
+    const auto *header = reinterpret_cast<const fanotify_event_info_header *>(cursor);
+    if (header->len == 0 || cursor + header->len > end) break;
+    const auto *info = reinterpret_cast<const fanotify_event_info_fid *>(cursor);
+
+    switch (header->info_type) {
+      case FAN_EVENT_INFO_TYPE_DFID_NAME:
+        if (resolve_directory(info, dir)) name = entry_name(info);
+        break;
+#ifdef FAN_RENAME
+      case FAN_EVENT_INFO_TYPE_OLD_DFID_NAME:
+        if (resolve_directory(info, old_dir)) old_name = entry_name(info);
+        break;
+      case FAN_EVENT_INFO_TYPE_NEW_DFID_NAME:
+        if (resolve_directory(info, new_dir)) new_name = entry_name(info);
+        break;
+#endif
+      default: break;
+    }
+
+    cursor += header->len;
+  }
+
+  // Renaming or deleting a directory invalidates the cached paths of everything beneath it.
+  if ((mask & FAN_ONDIR) == FAN_ONDIR && (mask & (FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)) != 0) {
+    directory_paths.clear();
+  }
+
+#ifdef FAN_RENAME
+  if ((mask & FAN_RENAME) == FAN_RENAME) {
+    directory_paths.clear();
+
+    uint64_t dir_flag = mask & FAN_ONDIR;
+    if (old_name != nullptr && new_name != nullptr) {
+      emit_rename_event(mask, old_dir, old_name, new_dir, new_name, messages, cache);
+    } else if (old_name != nullptr) {
+      emit_entry_event(FAN_MOVED_FROM | dir_flag, old_dir, old_name, messages, cache);
+    } else if (new_name != nullptr) {
+      emit_entry_event(FAN_MOVED_TO | dir_flag, new_dir, new_name, messages, cache);
+    }
+    return;
+  }
+#endif
+
+  if (name != nullptr) emit_entry_event(mask, dir, name, messages, cache);
+}
+
+void FanotifyRegistry::emit_entry_event(uint64_t mask,
+  const string &dir,
+  const char *name,
+  MessageBuffer &messages,
+  RecentFileCache &cache)
+{
+  string path = path_join(dir, name);
+  bool dir_hint = (mask & FAN_ONDIR) == FAN_ONDIR;
+
+  bool created = (mask & (FAN_CREATE | FAN_MOVED_TO)) != 0;
+  bool deleted = (mask & (FAN_DELETE | FAN_MOVED_FROM)) != 0;
+  bool modified = (mask & (FAN_MODIFY | FAN_ATTRIB)) != 0;
+
+  // Determine if this entry is a symlink or not from the cached lstat() entry. Only directories carry FAN_ONDIR, and an
+  // entry that's only been removed can't be examined, so stat the entry only when neither settles it.
+  EntryKind kind = dir_hint ? KIND_DIRECTORY : KIND_FILE;
+  shared_ptr<StatResult> stat = cache.present_at_path(path);
+  if (stat) {
+    kind = stat->get_entry_kind();
+  } else if (!dir_hint && (created || modified)) {
+    stat = cache.current_at_path(path, true, false, false);
+    cache.apply();
+    kind = stat->get_entry_kind();
+  }
+  if (deleted && kind == KIND_DIRECTORY) {
+    cache.evict_subtree(path);
+  } else if (deleted) {
+    cache.evict(path);
+  }
+
+  // Identical events for the same entry may be merged in the queue, losing their order. If an entry that was both
+  // created and deleted still exists, assume that it was deleted first.
+  bool deleted_first = false;
+  if (created && deleted) {
+    struct stat st = {};
+    deleted_first = lstat(path.c_str(), &st) == 0;
+  }
+
+  string event_path;
+  for (const Root &root : roots) {
+    if (!translate(root, dir, path, event_path)) continue;
+
+    if (deleted && deleted_first) messages.deleted(root.channel_id, string(event_path), kind);
+    if (created) messages.created(root.channel_id, string(event_path), kind);
+    if (modified) messages.modified(root.channel_id, string(event_path), kind);
+    if (deleted && !deleted_first) messages.deleted(root.channel_id, string(event_path), kind);
+  }
+}
+
+void FanotifyRegistry::emit_rename_event(uint64_t mask,
+  const string &old_dir,
+  const char *old_name,
+  const string &new_dir,
+  const char *new_name,
+  MessageBuffer &messages,
+  RecentFileCache &cache)
+{
+  string old_path = path_join(old_dir, old_name);
+  string new_path = path_join(new_dir, new_name);
+  bool dir_hint = (mask & FAN_ONDIR) == FAN_ONDIR;
+
+  EntryKind kind = KIND_DIRECTORY;
+  if (!dir_hint) {
+    shared_ptr<StatResult> stat = cache.present_at_path(old_path);
+    if (!stat) {
+      stat = cache.current_at_path(new_path, true, false, false);
+      cache.apply();
+    }
+    kind = stat->get_entry_kind();
+  }
+  if (kind == KIND_DIRECTORY) {
+    cache.update_for_rename(old_path, new_path);
+  } else {
+    cache.evict(old_path);
+  }
+
+  string old_event_path;
+  string new_event_path;
+  for (const Root &root : roots) {
+    bool from_inside = translate(root, old_dir, old_path, old_event_path);
+    bool to_inside = translate(root, new_dir, new_path, new_event_path);
+
+    if (from_inside && to_inside) {
+      messages.renamed(root.channel_id, string(old_event_path), string(new_event_path), kind);
+    } else if (from_inside) {
+      messages.deleted(root.channel_id, string(old_event_path), kind);
+    } else if (to_inside) {
+      messages.created(root.channel_id, string(new_event_path), kind);
+    }
+  }
+}
+
+bool FanotifyRegistry::resolve_directory(const fanotify_event_info_fid *info, string &out)
+{
+  const auto *handle = reinterpret_cast<const file_handle *>(info->handle);
+  const size_t handle_size = sizeof(file_handle) + handle->handle_bytes;
+  if (handle->handle_bytes > MAX_HANDLE_SZ) return false;
+
+  string key(reinterpret_cast<const char *>(&info->fsid), sizeof(info->fsid));
+  key.append(reinterpret_cast<const char *>(handle), handle_size);
+
+  auto cached = directory_paths.find(key);
+  if (cached != directory_paths.end()) {
+    out = cached->second;
+    return true;
+  }
+
+  Filesystem *filesystem = find_filesystem(fsid_key(&info->fsid));
+  if (filesystem == nullptr) return false;
+
+  // open_by_handle_at() requires a mutable, suitably aligned handle.
+  alignas(file_handle) char handle_storage[sizeof(file_handle) + MAX_HANDLE_SZ];
+  memcpy(handle_storage, handle, handle_size);
+
+  int dir_fd = open_by_handle_at(
+    filesystem->mount_fd, reinterpret_cast<file_handle *>(handle_storage), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    // ESTALE if the directory has already been deleted.
+    int open_errno = errno;
+    if (open_errno != ESTALE && open_errno != ENOENT) {
+      LOGGER << "Unable to open fanotify directory handle: " << errno_result(string(), open_errno) << "." << endl;
+    }
+    return false;
+  }
+
+  bool found = path_of_fd(dir_fd, out);
+  close(dir_fd);
+  if (!found) return false;
+
+  if (directory_paths.size() >= MAX_DIRECTORY_PATHS) directory_paths.clear();
+  directory_paths.emplace(move(key), out);
+  return true;
+}
+
+bool FanotifyRegistry::translate(const Root &root, const string &dir, const string &path, string &out) const
+{
+  const string &prefix = root.resolved;
+
+  bool inside = path == prefix || dir == prefix;
+  if (!inside && root.recursive && dir.size() > prefix.size() && dir.compare(0, prefix.size(), prefix) == 0) {
+    inside = prefix.back() == '/' || dir[prefix.size()] == '/';
+  }
+  if (!inside) return false;
+
+  if (root.path == prefix) {
+    out = path;
+  } else {
+    out = root.path;
+    out.append(path, prefix.size(), string::npos);
+  }
+  return true;
+}
+
+FanotifyRegistry::Filesystem *FanotifyRegistry::find_filesystem(uint64_t fsid)
+{
+  for (Filesystem &filesystem : filesystems) {
+    if (filesystem.fsid == fsid) return &filesystem;
+  }
+  return nullptr;
+}
@@ -0,0 +1,133 @@
+#ifndef FANOTIFY_REGISTRY_H
+#define FANOTIFY_REGISTRY_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../errable.h"
+#include "../../message.h"
+#include "../../message_buffer.h"
+#include "../../result.h"
+#include "../recent_file_cache.h"
+
+struct fanotify_event_metadata;
+struct fanotify_event_info_fid;
+
+// Watch directory trees with a single fanotify(7) mark per filesystem instead of one inotify watch descriptor per
+// directory. Adding a channel costs one statfs() and, for the first channel on a filesystem, one fanotify_mark(), no
+// matter how large the tree beneath it is. The inotify watch limit does not apply.
+//
+// The fanotify group reports events with FAN_REPORT_DFID_NAME: each event identifies its parent directory by file
+// handle, along with the name of the affected entry. Handles are resolved to paths with open_by_handle_at() and cached
+// until a directory is renamed or deleted. Resolved paths are then matched against the root of each channel.
+//
+// Marking a filesystem requires CAP_SYS_ADMIN and resolving handles requires CAP_DAC_READ_SEARCH, so add() fails
+// when the process lacks either.
+class FanotifyRegistry : public Errable
+{
+public:
+  // Initialize a fanotify group. Enter an error state if fanotify is unavailable or not permitted.
+  FanotifyRegistry();
+
+  // Release the fanotify group and any directory descriptors held open to resolve handles.
+  ~FanotifyRegistry() override;
+
+  // Begin delivering events that occur beneath the directory `root` on `channel_id`. Mark its filesystem unless
+  // another channel has already done so. If `recursive` is false, only report events for immediate children.
+  Result<> add(ChannelID channel_id, const std::string &root, bool recursive);
+
+  // Stop delivering events on `channel_id`. Remove the filesystem mark once no remaining channel needs it. Channels
+  // that were never added are ignored.
+  Result<> remove(ChannelID channel_id);
+
+  // Read and translate all queued fanotify events. Use the RecentFileCache to identify symlinks without doing a stat
+  // for every event.
+  Result<> consume(MessageBuffer &messages, RecentFileCache &cache);
+
+  // Return the file descriptor that should be polled to wake up when fanotify events are available.
+  int get_read_fd() const { return fanotify_fd; }
+
+  // Number of channels currently delivered by fanotify.
+  size_t get_channel_count() const { return roots.size(); }
+
+  FanotifyRegistry(const FanotifyRegistry &) = delete;
+  FanotifyRegistry(FanotifyRegistry &&) = delete;
+  FanotifyRegistry &operator=(const FanotifyRegistry &) = delete;
+  FanotifyRegistry &operator=(FanotifyRegistry &&) = delete;
+
+private:
+  // A watched directory tree.
+  struct Root
+  {
+    ChannelID channel_id;
+
+    // Path as requested, used to report events.
+    std::string path;
+
+    // Path as resolved from a file handle, used to match events.
+    std::string resolved;
+
+    bool recursive;
+
+    uint64_t fsid;
+  };
+
+  // A marked filesystem.
+  struct Filesystem
+  {
+    uint64_t fsid;
+
+    // Directory on the filesystem, held open to serve as the mount_fd argument of open_by_handle_at().
+    int mount_fd;
+
+    // Events requested by the fanotify_mark() call, so that the same mask can be removed.
+    uint64_t mask;
+
+    size_t root_count;
+  };
+
+  // Translate a single event into messages for each channel whose root contains it.
+  void handle_event(const fanotify_event_metadata *event, MessageBuffer &messages, RecentFileCache &cache);
+
+  // Emit created, modified, or deleted messages for an entry within the directory at `dir`.
+  void emit_entry_event(uint64_t mask,
+    const std::string &dir,
+    const char *name,
+    MessageBuffer &messages,
+    RecentFileCache &cache);
+
+  // Emit the messages for a FAN_RENAME event that moved an entry from `old_dir` to `new_dir`.
+  void emit_rename_event(uint64_t mask,
+    const std::string &old_dir,
+    const char *old_name,
+    const std::string &new_dir,
+    const char *new_name,
+    MessageBuffer &messages,
+    RecentFileCache &cache);
+
+  // Resolve the directory file handle within an info record to an absolute path. Return false if the directory no
+  // longer exists or its filesystem is no longer marked.
+  bool resolve_directory(const fanotify_event_info_fid *info, std::string &out);
+
+  // If the event at `path`, within the directory `dir`, falls within `root`, translate `path` to be relative to the
+  // requested root path rather than its resolved one and return true.
+  bool translate(const Root &root, const std::string &dir, const std::string &path, std::string &out) const;
+
+  Filesystem *find_filesystem(uint64_t fsid);
+
+  int fanotify_fd;
+
+  std::vector<Root> roots;
+
+  std::vector<Filesystem> filesystems;
+
+  // Directory paths resolved from file handles, keyed by filesystem ID and handle bytes.
+  std::unordered_map<std::string, std::string> directory_paths;
+
+  // Reused across consume() calls.
+  std::vector<char> read_buffer;
+};
+
+#endif
@@ -1,108 +1,122 @@
+#include <chrono>
 #include <iostream>
 #include <memory>
-#include <poll.h>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "../../event_coalescer.h"
 #include "../../helper/linux/helper.h"
 #include "../../log.h"
 #include "../../message.h"
+#include "../../message_buffer.h"
+#include "../../path_filter.h"
 #include "../../result.h"
+#include "../../status.h"
+#include "../../thread_pool.h"
 #include "../recent_file_cache.h"
 #include "../worker_platform.h"
 #include "../worker_thread.h"
 #include "cookie_jar.h"
-#include "pipe.h"
+#include "epoll.h"
+#include "event_fd.h"
+#include "fanotify_registry.h"
 #include "side_effect.h"
+#include "timer_fd.h"
 #include "watch_registry.h"
 
 using std::endl;
 using std::ostream;
+using std::pair;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
+using std::chrono::milliseconds;
 
 const size_t DEFAULT_CACHE_SIZE = 4096;
 
-// In milliseconds
-const int RENAME_TIMEOUT = 500;
-
 // Platform-specific worker implementation for Linux systems.
 class LinuxWorkerPlatform : public WorkerPlatform
 {
 public:
-  LinuxWorkerPlatform(WorkerThread *thread) : WorkerPlatform(thread), cache{DEFAULT_CACHE_SIZE}
+  LinuxWorkerPlatform(WorkerThread *thread) : WorkerPlatform(thread), registry(filters), cache{DEFAULT_CACHE_SIZE}
   {
-    report_errable(pipe);
+    report_errable(epoll);
+    report_errable(wake_fd);
+    report_errable(rename_timer);
+    report_errable(coalesce_timer);
+    report_errable(demotion_timer);
     report_errable(registry);
+
+    if (is_healthy()) {
+      report_if_error(epoll.add(wake_fd.get_fd(), [this]() { return handle_wake(); }));
+      report_if_error(epoll.add(registry.get_read_fd(), [this]() { return handle_inotify(); }));
+      report_if_error(epoll.add(rename_timer.get_fd(), [this]() { return handle_rename_timeout(); }));
+      report_if_error(epoll.add(coalesce_timer.get_fd(), [this]() { return handle_coalesce_timeout(); }));
+      report_if_error(epoll.add(demotion_timer.get_fd(), [this]() { return handle_demotion_timeout(); }));
+      report_if_error(epoll.add(registry.get_crawl_fd(), [this]() { return handle_crawl_completion(); }));
+    }
     freeze();
   };
 
+  // ~ThreadPool runs every task still queued, and each crawl task enqueues its children. Cancel the crawls first so
+  // that the remaining tasks return immediately.
+  ~LinuxWorkerPlatform() override { registry.cancel_crawls(); }
+
   // Inform the listen() loop that one or more commands are waiting from the main thread.
-  Result<> wake() override { return pipe.signal(); }
+  Result<> wake() override { return wake_fd.signal(); }
 
-  // Main event loop. Use poll(2) to wait on I/O from either the Pipe or inotify events.
+  // Main event loop. Use epoll(7) to wait on I/O from the EventFd, the inotify descriptor, the rename timer, or any
+  // other registered sources. The thread sleeps without timeout until one of them is ready.
   Result<> listen() override
   {
-    pollfd to_poll[2];
-    to_poll[0].fd = pipe.get_read_fd();
-    to_poll[0].events = POLLIN;
-    to_poll[0].revents = 0;
-    to_poll[1].fd = registry.get_read_fd();
-    to_poll[1].events = POLLIN;
-    to_poll[1].revents = 0;
-
     while (true) {
-      int result = poll(to_poll, 2, RENAME_TIMEOUT);
-
-      if (result < 0) {
-        return errno_result<>("Unable to poll");
-      }
-
-      if (result == 0) {
-        // Poll timeout. Cycle the CookieJar.
-        MessageBuffer messages;
-        jar.flush_oldest_batch(messages, cache);
-
-        if (!messages.empty()) {
-          LOGGER << "Flushing " << plural(messages.size(), "unpaired rename") << "." << endl;
-          Result<> er = emit_all(messages.begin(), messages.end());
-          if (er.is_error()) return er;
-        }
-
-        continue;
-      }
+      Result<> r = epoll.wait();
+      if (r.is_error()) return r;
+    }
 
-      if ((to_poll[0].revents & (POLLIN | POLLERR)) != 0u) {
-        Result<> cr = pipe.consume();
-        if (cr.is_error()) return cr;
+    return error_result("Polling loop exited unexpectedly");
+  }
 
-        Result<> hr = handle_commands();
-        if (hr.is_error()) return hr;
-      }
+  // Recursively watch a directory tree. Use a fanotify filesystem mark if one was requested and the process is
+  // permitted to, falling back to inotify otherwise. If traversal threads have been configured, install recursive
+  // inotify watches in the background and acknowledge the command once they're in place, unless another channel
+  // already watches the tree and its watch descriptors can be shared immediately.
+  //
+  // Events that `filter` rejects are discarded before they're buffered, whichever backend produced them.
+  Result<bool> handle_add_command(CommandID command,
+    ChannelID channel,
+    const string &root_path,
+    bool recursive,
+    WatchBackend backend,
+    const shared_ptr<const PathFilter> &filter) override
+  {
+    filters.set(channel, filter);
+    if (filter) LOGGER << "Filtering channel " << channel << " with " << filter->describe() << "." << endl;
 
-      if ((to_poll[1].revents & (POLLIN | POLLERR)) != 0u) {
-        MessageBuffer messages;
+    if (backend == BACKEND_FANOTIFY || (backend == BACKEND_DEFAULT && prefer_fanotify)) {
+      Result<> fr = add_with_fanotify(channel, root_path, recursive);
+      if (fr.is_ok()) return ok_result(true);
 
-        Result<> cr = registry.consume(messages, jar, cache);
-        if (cr.is_error()) LOGGER << cr << endl;
+      LOGGER << "Unable to watch path " << root_path << " with fanotify: " << fr << ". Falling back to inotify."
+             << endl;
+    }
 
-        if (!messages.empty()) {
-          Result<> er = emit_all(messages.begin(), messages.end());
-          if (er.is_error()) return er;
+    if (recursive && traversal_threads > 0 && !registry.covers(root_path)) {
+      if (!traversal_pool || (traversal_pool->size() != traversal_threads && !registry.has_pending_crawls())) {
+        traversal_pool.reset(new ThreadPool(traversal_threads));
+        Result<> hr = traversal_pool->health_err_result();
+        if (hr.is_error()) {
+          traversal_pool.reset();
+          return hr.propagate<bool>();
         }
       }
-    }
 
-    return error_result("Polling loop exited unexpectedly");
-  }
+      registry.add_parallel(channel, command, string(root_path), *traversal_pool);
+      return ok_result(false);
+    }
 
-  // Recursively watch a directory tree.
-  Result<bool> handle_add_command(CommandID /*command*/,
-    ChannelID channel,
-    const string &root_path,
-    bool recursive) override
-  {
     Timer t;
     vector<string> poll;
 
@@ -115,13 +129,24 @@ public:
     Result<> r = registry.add(channel, string(root_path), recursive, poll);
     if (r.is_error()) return r.propagate<bool>();
 
+    // Lazy roots are acknowledged along with the rest of the watcher rather than once they've been populated.
+    MessageBuffer lazy_messages;
+    registry.flush_lazy_roots(lazy_messages);
+    if (!lazy_messages.empty()) {
+      Result<> er = emit_all(lazy_messages.begin(), lazy_messages.end());
+      if (er.is_error()) return er.propagate<bool>();
+    }
+
     if (!poll.empty()) {
       vector<Message> poll_messages;
       poll_messages.reserve(poll.size());
 
       for (string &poll_root : poll) {
         poll_messages.emplace_back(
-          CommandPayloadBuilder::add(channel, move(poll_root), recursive, poll.size()).build());
+          CommandPayloadBuilder::add(channel, move(poll_root), recursive, poll.size())
+            .set_id(command)
+            .set_filter(filter)
+            .build());
       }
 
       t.stop();
@@ -138,14 +163,318 @@ public:
   // Unwatch a directory tree.
   Result<bool> handle_remove_command(CommandID /*command*/, ChannelID channel) override
   {
-    return registry.remove(channel).propagate(true);
+    Result<> r = registry.remove(channel);
+    if (fanotify && fanotify->is_healthy()) r &= fanotify->remove(channel);
+    coalescer.discard(channel);
+    filters.remove(channel);
+    return r.propagate(true);
+  }
+
+  // Bound the number of lstat() results cached to identify the kinds of entries named by events.
+  void handle_cache_size_command(size_t cache_size) override
+  {
+    LOGGER << "Changing cache size to " << cache_size << "." << endl;
+    cache.resize(cache_size);
+  }
+
+  // Configure the number of threads used to install recursive watches. Zero installs them synchronously.
+  void handle_traversal_threads_command(size_t thread_count) override
+  {
+    LOGGER << "Using " << plural(thread_count, "traversal thread") << "." << endl;
+    traversal_threads = thread_count;
+  }
+
+  // Choose whether watch roots that don't request a specific backend should use fanotify when it's available.
+  void handle_fanotify_command(bool enabled) override
+  {
+    LOGGER << (enabled ? "Preferring" : "Not preferring") << " fanotify for new watch roots." << endl;
+    prefer_fanotify = enabled;
+  }
+
+  // Merge filesystem events that occur within `latency` of one another before emitting them. Deliver anything held
+  // under the previous setting right away.
+  Result<> handle_coalesce_latency_command(milliseconds latency) override
+  {
+    LOGGER << "Coalescing filesystem events within " << plural(latency.count(), "millisecond") << "." << endl;
+    coalescer.set_latency(latency);
+
+    if (coalescer.empty()) return ok_result();
+    return flush_coalesced();
+  }
+
+  // Watch only `depth` levels of each new recursive root with inotify and poll the rest lazily.
+  void handle_watch_depth_command(size_t depth) override
+  {
+    if (depth == 0) {
+      LOGGER << "Watching every level of new recursive roots." << endl;
+    } else {
+      LOGGER << "Watching " << plural(depth, "level") << " of new recursive roots." << endl;
+    }
+    registry.set_watch_depth(depth);
+  }
+
+  // The polling thread has observed changes within a lazily polled subtree. Watch it with inotify until it falls quiet.
+  // The polling thread keeps polling it until it's released here, once its watches are in place.
+  Result<> handle_promote_command(ChannelID channel, const string &root_path) override
+  {
+    vector<string> poll;
+    Result<> r = registry.promote(channel, root_path, poll);
+
+    MessageBuffer messages;
+    if (r.is_error()) {
+      messages.error(channel, string(r.get_error()), false);
+    } else {
+      messages.add(Message(CommandPayloadBuilder::release(channel, string(root_path)).build()));
+    }
+    for (string &poll_root : poll) {
+      messages.add(Message(CommandPayloadBuilder::add(channel, move(poll_root), true, 1)
+                             .set_filter(filters.get(channel))
+                             .build()));
+    }
+    registry.flush_lazy_roots(messages);
+
+    Result<> er = deliver(messages);
+    if (er.is_error()) return er;
+
+    return reset_demotion_timer();
+  }
+
+  // The polling thread has completed its first scan of a demoted subtree. Its watches are no longer needed.
+  Result<> handle_release_command(ChannelID channel, const string &root_path) override
+  {
+    registry.release(channel, root_path);
+    return ok_result();
+  }
+
+  // Hold unmatched IN_MOVED_FROM events for `window` before reporting them as deletions.
+  Result<> handle_rename_window_command(milliseconds window) override
+  {
+    LOGGER << "Correlating renames within " << plural(window.count(), "millisecond") << "." << endl;
+    jar.set_window(window);
+
+    return reset_rename_timer();
+  }
+
+  // Report inotify watch descriptor usage.
+  void populate_status(Status &status) override
+  {
+    registry.populate_status(status);
+    status.worker_cookie_jar_size = jar.size();
+    status.worker_recent_file_cache_size = cache.size();
+  }
+
+  // Choose whether to snapshot every watched directory so that events lost to an inotify queue overflow can be
+  // recovered by rescanning.
+  void handle_overflow_resync_command(bool enabled) override
+  {
+    LOGGER << (enabled ? "Resyncing" : "Not resyncing") << " watched directories after queue overflows." << endl;
+    registry.enable_snapshots(enabled);
   }
 
 private:
-  Pipe pipe;
+  // Commands have arrived from the main thread.
+  Result<> handle_wake()
+  {
+    Result<> cr = wake_fd.consume();
+    if (cr.is_error()) return cr;
+
+    return handle_commands();
+  }
+
+  // Inotify events are ready to be read.
+  Result<> handle_inotify()
+  {
+    MessageBuffer messages(&filters);
+
+    Result<> cr = registry.consume(messages, jar, cache);
+    if (cr.is_error()) LOGGER << cr << endl;
+    reload_ignore_rules(messages);
+    registry.flush_lazy_roots(messages);
+
+    Result<> er = deliver(messages);
+    if (er.is_error()) return er;
+
+    return reset_rename_timer();
+  }
+
+  // Mark the filesystem containing `root_path` with fanotify, initializing the fanotify group on first use.
+  Result<> add_with_fanotify(ChannelID channel, const string &root_path, bool recursive)
+  {
+    if (!fanotify) {
+      fanotify.reset(new FanotifyRegistry());
+      if (fanotify->is_healthy()) {
+        Result<> er = epoll.add(fanotify->get_read_fd(), [this]() { return handle_fanotify(); });
+        if (er.is_error()) return er;
+      }
+    }
+
+    Result<> hr = fanotify->health_err_result();
+    if (hr.is_error()) return hr;
+
+    return fanotify->add(channel, root_path, recursive);
+  }
+
+  // Fanotify events are ready to be read.
+  Result<> handle_fanotify()
+  {
+    MessageBuffer messages(&filters);
+
+    Result<> cr = fanotify->consume(messages, cache);
+    if (cr.is_error()) LOGGER << cr << endl;
+    reload_ignore_rules(messages);
+
+    return deliver(messages);
+  }
+
+  // The oldest unmatched IN_MOVED_FROM event has outlived the rename window. Age off every Cookie that has expired.
+  Result<> handle_rename_timeout()
+  {
+    Result<> cr = rename_timer.consume();
+    if (cr.is_error()) return cr;
+
+    MessageBuffer messages(&filters);
+    jar.flush_expired(messages, cache);
+    reload_ignore_rules(messages);
+
+    if (!messages.empty()) {
+      LOGGER << "Flushing " << plural(messages.size(), "unpaired rename") << "." << endl;
+      Result<> er = deliver(messages);
+      if (er.is_error()) return er;
+    }
+
+    return reset_rename_timer();
+  }
+
+  // One or more parallel traversals have finished.
+  Result<> handle_crawl_completion()
+  {
+    MessageBuffer messages(&filters);
+
+    Result<> cr = registry.collect_crawls(messages, jar, cache);
+    if (cr.is_error()) return cr;
+    reload_ignore_rules(messages);
+    registry.flush_lazy_roots(messages);
+
+    Result<> er = deliver(messages);
+    if (er.is_error()) return er;
+
+    return reset_rename_timer();
+  }
+
+  // Reread the ignore files that have changed since the last call and adjust the watches beneath them. Buffer ADD
+  // commands for any subtrees that must be polled instead.
+  void reload_ignore_rules(MessageBuffer &messages)
+  {
+    for (pair<ChannelID, string> &changed : filters.take_changed_ignore_files()) {
+      ChannelID channel = changed.first;
+      vector<string> poll;
+
+      Result<> r = registry.reload_ignore_rules(channel, changed.second, poll);
+      if (r.is_error()) messages.error(channel, string(r.get_error()), false);
+
+      for (string &poll_root : poll) {
+        messages.add(Message(CommandPayloadBuilder::add(channel, move(poll_root), true, 1)
+                               .set_filter(filters.get(channel))
+                               .build()));
+      }
+    }
+  }
+
+  // The coalescing window has closed. Emit the events collected within it.
+  Result<> handle_coalesce_timeout()
+  {
+    Result<> cr = coalesce_timer.consume();
+    if (cr.is_error()) return cr;
+
+    return flush_coalesced();
+  }
+
+  // Check promoted subtrees for inactivity. Return those that have fallen quiet to lazy polling.
+  Result<> handle_demotion_timeout()
+  {
+    Result<> cr = demotion_timer.consume();
+    if (cr.is_error()) return cr;
+
+    MessageBuffer messages;
+    registry.demote_idle();
+    registry.flush_lazy_roots(messages);
+
+    Result<> er = deliver(messages);
+    if (er.is_error()) return er;
+
+    return reset_demotion_timer();
+  }
+
+  // Keep the demotion timer running while any promoted subtrees are watched, without restarting its countdown.
+  Result<> reset_demotion_timer()
+  {
+    if (!registry.has_promoted()) return demotion_timer.disarm();
+    if (demotion_timer.is_armed()) return ok_result();
+
+    return demotion_timer.arm(PROMOTION_IDLE_TIMEOUT);
+  }
+
+  // Emit a batch of messages, holding filesystem events back within the coalescing window if one is configured.
+  Result<> deliver(MessageBuffer &messages)
+  {
+    if (messages.empty()) return ok_result();
+    if (!coalescer.is_enabled()) return emit_all(messages.begin(), messages.end());
+
+    // Open a new window with the first event absorbed.
+    bool was_empty = coalescer.empty();
+    MessageBuffer immediate;
+    coalescer.absorb(messages, immediate);
+    if (was_empty && !coalescer.empty()) {
+      Result<> ar = coalesce_timer.arm(coalescer.get_latency());
+      if (ar.is_error()) return ar;
+    }
+
+    if (immediate.empty()) return ok_result();
+    return emit_all(immediate.begin(), immediate.end());
+  }
+
+  // Emit every event held by the EventCoalescer and stop the coalescing timer.
+  Result<> flush_coalesced()
+  {
+    MessageBuffer messages;
+    coalescer.flush(messages);
+
+    Result<> r = coalesce_timer.disarm();
+    if (!messages.empty()) r &= emit_all(messages.begin(), messages.end());
+    return r;
+  }
+
+  // Arm the rename timer to fire when the oldest unmatched Cookie expires, or disarm it if the CookieJar is empty so
+  // that an idle worker is never woken.
+  Result<> reset_rename_timer()
+  {
+    if (jar.empty()) return rename_timer.disarm();
+
+    return rename_timer.arm(jar.until_next_expiry());
+  }
+
+  Epoll epoll;
+  EventFd wake_fd;
+  TimerFd rename_timer;
+  TimerFd coalesce_timer;
+  TimerFd demotion_timer;
+
+  // Declared before the WatchRegistry, which refers to it.
+  PathFilterTable filters;
   WatchRegistry registry;
   CookieJar jar;
   RecentFileCache cache;
+  EventCoalescer coalescer;
+
+  size_t traversal_threads{0};
+
+  // Created on first use. Left in place, unhealthy, if fanotify can't be initialized so that it isn't retried for
+  // each new root.
+  unique_ptr<FanotifyRegistry> fanotify;
+  bool prefer_fanotify{false};
+
+  // Declared last so that its threads are joined before any state their tasks reference is destroyed.
+  unique_ptr<ThreadPool> traversal_pool;
 };
 
 unique_ptr<WorkerPlatform> WorkerPlatform::for_worker(WorkerThread *thread)
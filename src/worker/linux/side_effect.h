@@ -1,7 +1,6 @@
 #ifndef SIDE_EFFECT_H
 #define SIDE_EFFECT_H
 
-#include <memory>
 #include <set>
 #include <string>
 #include <utility>
@@ -25,14 +24,14 @@ public:
   SideEffect() = default;
   ~SideEffect() = default;
 
-  // Recursively watch a newly created subdirectory.
-  void track_subdirectory(std::string subdir, ChannelID channel_id);
+  // Recursively watch a newly created subdirectory of `parent`.
+  void track_subdirectory(WatchedDirectory *parent, std::string subdir, ChannelID channel_id);
 
   // Unsubscribe from a channel after this event has been handled.
   void remove_channel(ChannelID channel_id) { removed_roots.insert(channel_id); }
 
   // Perform all enqueued actions.
-  void enact_in(const std::shared_ptr<WatchedDirectory> &parent, WatchRegistry *registry, MessageBuffer &messages);
+  void enact_in(WatchRegistry *registry, MessageBuffer &messages);
 
   SideEffect(const SideEffect &other) = delete;
   SideEffect(SideEffect &&other) = delete;
@@ -42,18 +41,21 @@ public:
 private:
   struct Subdirectory
   {
-    Subdirectory(std::string &&basename, ChannelID channel_id) : basename(std::move(basename)), channel_id{channel_id}
+    Subdirectory(WatchedDirectory *parent, std::string &&basename, ChannelID channel_id) :
+      parent{parent}, basename(std::move(basename)), channel_id{channel_id}
     {
       //
     }
 
-    Subdirectory(Subdirectory &&original) : basename{std::move(original.basename)}, channel_id{original.channel_id}
+    Subdirectory(Subdirectory &&original) :
+      parent{original.parent}, basename{std::move(original.basename)}, channel_id{original.channel_id}
     {
       //
     }
 
     ~Subdirectory() = default;
 
+    WatchedDirectory *parent;
     std::string basename;
     ChannelID channel_id;
 
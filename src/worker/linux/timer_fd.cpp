@@ -0,0 +1,78 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "../../errable.h"
+#include "../../helper/linux/helper.h"
+#include "../../result.h"
+#include "timer_fd.h"
+
+using std::chrono::milliseconds;
+
+TimerFd::TimerFd() : fd{-1}, armed{false}
+{
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd == -1) {
+    report_if_error<>(errno_result<>("Unable to create timerfd"));
+  }
+  freeze();
+}
+
+TimerFd::~TimerFd()
+{
+  if (fd != -1) {
+    close(fd);
+  }
+}
+
+Result<> TimerFd::arm(milliseconds timeout)
+{
+  // A zero it_value would disarm the timer instead.
+  if (timeout.count() <= 0) timeout = milliseconds(1);
+
+  itimerspec spec{};
+  spec.it_value.tv_sec = timeout.count() / 1000;
+  spec.it_value.tv_nsec = (timeout.count() % 1000) * 1000000;
+
+  if (timerfd_settime(fd, 0, &spec, nullptr) == -1) {
+    return errno_result<>("Unable to arm timerfd");
+  }
+
+  armed = true;
+  return ok_result();
+}
+
+Result<> TimerFd::disarm()
+{
+  if (!armed) return ok_result();
+
+  itimerspec spec{};
+  if (timerfd_settime(fd, 0, &spec, nullptr) == -1) {
+    return errno_result<>("Unable to disarm timerfd");
+  }
+
+  armed = false;
+  return ok_result();
+}
+
+Result<> TimerFd::consume()
+{
+  armed = false;
+
+  uint64_t expirations = 0;
+  ssize_t result = read(fd, &expirations, sizeof(uint64_t));
+  if (result == -1) {
+    int read_errno = errno;
+
+    if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) {
+      // The timer was re-armed or disarmed after it became readable.
+      return ok_result();
+    }
+
+    return errno_result<>("Unable to read from timerfd", read_errno);
+  }
+
+  return ok_result();
+}
@@ -0,0 +1,46 @@
+#ifndef TIMER_FD_H
+#define TIMER_FD_H
+
+#include <chrono>
+
+#include "../../errable.h"
+#include "../../result.h"
+
+// RAII wrapper for a one-shot Linux timerfd created with timerfd_create(2). While disarmed, the timer consumes no
+// resources and never causes its file descriptor to become readable.
+class TimerFd : public Errable
+{
+public:
+  // Construct a new, disarmed TimerFd on the monotonic clock.
+  TimerFd();
+
+  // Deallocate and close() the underlying file descriptor.
+  ~TimerFd() override;
+
+  // Arm the timer to expire once after `timeout` has elapsed. If the timer is already armed, its countdown is
+  // restarted.
+  Result<> arm(std::chrono::milliseconds timeout);
+
+  // Stop the timer if it's armed.
+  Result<> disarm();
+
+  // Acknowledge an expiration so that the file descriptor is no longer readable. The timer is left disarmed.
+  Result<> consume();
+
+  // Return true if the timer is currently counting down.
+  bool is_armed() const { return armed; }
+
+  // Access the file descriptor that should be polled for expirations.
+  int get_fd() const { return fd; }
+
+  TimerFd(const TimerFd &) = delete;
+  TimerFd(TimerFd &&) = delete;
+  TimerFd &operator=(const TimerFd &) = delete;
+  TimerFd &operator=(TimerFd &&) = delete;
+
+private:
+  int fd;
+  bool armed;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <queue>
+#include <vector>
+
+#include "../../log.h"
+#include "watch_budget.h"
+
+using std::endl;
+using std::ifstream;
+using std::priority_queue;
+using std::vector;
+
+// Used when the limit can't be read from procfs. This has long been the kernel's default.
+const size_t DEFAULT_WATCH_LIMIT = 8192;
+
+// Fraction of the limit left for other inotify users.
+const size_t RESERVE_DIVISOR = 10;
+
+WatchBudget::WatchBudget() : limit{DEFAULT_WATCH_LIMIT}, allowance{0}, in_use{0}, pledged{0}
+{
+  ifstream proc("/proc/sys/fs/inotify/max_user_watches");
+  size_t read_limit = 0;
+  if (proc >> read_limit && read_limit > 0) {
+    limit = read_limit;
+  } else {
+    LOGGER << "Unable to read max_user_watches. Assuming a limit of " << limit << "." << endl;
+  }
+
+  allowance = limit - limit / RESERVE_DIVISOR;
+}
+
+vector<bool> WatchBudget::place(const vector<Candidate> &candidates, size_t allowance)
+{
+  size_t count = candidates.size();
+  vector<bool> polled(count, false);
+  if (count <= allowance) return polled;
+
+  if (allowance == 0) {
+    polled[0] = true;
+    return polled;
+  }
+
+  // Accumulate the size and most recent modification time of each subtree, then index each candidate's children.
+  // Candidates always follow their parent, so a single reverse pass reaches every child before its parent.
+  vector<size_t> size(count);
+  vector<int64_t> heat(count);
+  vector<size_t> child_offset(count + 1, 0);
+  size_t watched = 0;
+  for (size_t i = 0; i < count; i++) {
+    size[i] = candidates[i].eligible ? 1 : 0;
+    heat[i] = candidates[i].mtime;
+    watched += size[i];
+  }
+  if (watched <= allowance) return polled;
+
+  for (size_t i = count - 1; i > 0; i--) {
+    size_t parent = candidates[i].parent;
+    size[parent] += size[i];
+    if (heat[i] > heat[parent]) heat[parent] = heat[i];
+    child_offset[parent + 1]++;
+  }
+  for (size_t i = 0; i < count; i++) {
+    child_offset[i + 1] += child_offset[i];
+  }
+  vector<size_t> children(count > 0 ? count - 1 : 0);
+  vector<size_t> filled(child_offset.begin(), child_offset.end() - 1);
+  for (size_t i = 1; i < count; i++) {
+    children[filled[candidates[i].parent]++] = i;
+  }
+
+  // Order the frontier coldest first, preferring larger subtrees among those equally cold.
+  auto warmer = [&](size_t a, size_t b) {
+    if (heat[a] != heat[b]) return heat[a] > heat[b];
+    return size[a] < size[b];
+  };
+  priority_queue<size_t, vector<size_t>, decltype(warmer)> frontier(warmer);
+  for (size_t j = child_offset[0]; j < child_offset[1]; j++) {
+    if (candidates[children[j]].eligible) frontier.push(children[j]);
+  }
+
+  while (watched > allowance && !frontier.empty()) {
+    size_t candidate = frontier.top();
+    frontier.pop();
+
+    size_t overage = watched - allowance;
+    if (size[candidate] > overage) {
+      // Keep this directory watched and consider its subtrees individually instead.
+      for (size_t j = child_offset[candidate]; j < child_offset[candidate + 1]; j++) {
+        if (candidates[children[j]].eligible) frontier.push(children[j]);
+      }
+      continue;
+    }
+
+    polled[candidate] = true;
+    watched -= size[candidate];
+  }
+
+  return polled;
+}
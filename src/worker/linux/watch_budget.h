@@ -0,0 +1,92 @@
+#ifndef WATCH_BUDGET_H
+#define WATCH_BUDGET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Track the inotify watch descriptors in use against the per-user limit in /proc/sys/fs/inotify/max_user_watches, and
+// decide which parts of a new directory tree should be watched with inotify and which should be polled when the
+// remaining budget can't cover all of it.
+//
+// The limit is shared with every other inotify user running as the same user, so a tenth of it is held in reserve.
+class WatchBudget
+{
+public:
+  // A single directory within a tree that's about to be watched.
+  struct Candidate
+  {
+    // Index of the containing directory's Candidate, which must precede this one. Ignored for the root at index 0.
+    size_t parent;
+
+    // Last modification time of the directory, in nanoseconds since the epoch. A directory's modification time
+    // advances whenever an entry is created, deleted, or renamed within it.
+    int64_t mtime;
+
+    // False for directories that could neither be watched nor listed. These cost nothing and are never polled.
+    bool eligible;
+  };
+
+  // Read the limit from procfs, or assume a conservative default if it can't be read.
+  WatchBudget();
+
+  ~WatchBudget() = default;
+
+  // Count a watch descriptor that has been installed or released.
+  void acquire() { in_use++; }
+
+  void release()
+  {
+    if (in_use > 0) in_use--;
+  }
+
+  // Hold back `count` watches for a traversal that will install them later. Return them with redeem() once the
+  // traversal has been merged or abandoned.
+  void pledge(size_t count) { pledged += count; }
+
+  void redeem(size_t count) { pledged -= count < pledged ? count : pledged; }
+
+  // Number of watches that may still be installed.
+  size_t available() const
+  {
+    size_t committed = in_use + pledged;
+    return committed < allowance ? allowance - committed : 0;
+  }
+
+  // The per-user limit reported by the kernel.
+  size_t get_limit() const { return limit; }
+
+  // The kernel refused a watch while `installed` watches were in place, so other processes are using more of the limit
+  // than the reserve allows for. Lower the allowance to match.
+  void exhausted(size_t installed)
+  {
+    if (installed < allowance) allowance = installed;
+  }
+
+  // Number of watches this process may use: the limit less the reserve.
+  size_t get_allowance() const { return allowance; }
+
+  size_t get_in_use() const { return in_use; }
+
+  // Choose which subtrees of a tree of `candidates` to poll so that the rest fits within `allowance` watches. Returns
+  // a flag for each candidate that is true for the root of each subtree that should be polled.
+  //
+  // Subtrees are considered from the top down, coldest first, where a subtree's temperature is the most recent
+  // modification time of any directory within it. A cold subtree that's larger than the remaining overage is split
+  // into its children rather than polled whole, so that as few directories as possible are polled and those that are
+  // changing most recently stay on inotify.
+  static std::vector<bool> place(const std::vector<Candidate> &candidates, size_t allowance);
+
+  WatchBudget(const WatchBudget &) = delete;
+  WatchBudget(WatchBudget &&) = delete;
+  WatchBudget &operator=(const WatchBudget &) = delete;
+  WatchBudget &operator=(WatchBudget &&) = delete;
+
+private:
+  size_t limit;
+  size_t allowance;
+  size_t in_use;
+  size_t pledged;
+};
+
+#endif
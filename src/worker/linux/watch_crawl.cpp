@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <utility>
+#include <uv.h>
+#include <vector>
+
+#include "../../helper/linux/directory_reader.h"
+#include "../../ignore_rules.h"
+#include "../../lock.h"
+#include "../../message.h"
+#include "../../thread_pool.h"
+#include "event_fd.h"
+#include "watch_crawl.h"
+
+using std::move;
+using std::remove_if;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+const size_t WatchCrawl::NO_PARENT;
+
+WatchCrawl::WatchCrawl(ChannelID channel_id,
+  CommandID command_id,
+  string &&root,
+  int inotify_fd,
+  uint32_t mask,
+  bool snapshot,
+  size_t allowance,
+  size_t max_depth,
+  shared_ptr<const PathFilter> &&filter,
+  shared_ptr<IgnoreRules> &&ignore,
+  EventFd &done) :
+  channel_id{channel_id},
+  command_id{command_id},
+  inotify_fd{inotify_fd},
+  mask{mask},
+  snapshot{snapshot},
+  allowance{allowance},
+  max_depth{max_depth},
+  filter(move(filter)),
+  done(done),
+  ignore(move(ignore)),
+  cancelled{false},
+  remaining{allowance},
+  deferred{false},
+  exhausted{false},
+  outstanding{0}
+{
+  uv_mutex_init(&mutex);
+  uv_mutex_init(&ignore_mutex);
+  records.emplace_back(NO_PARENT, move(root), 0);
+}
+
+WatchCrawl::~WatchCrawl()
+{
+  uv_mutex_destroy(&mutex);
+  uv_mutex_destroy(&ignore_mutex);
+}
+
+void WatchCrawl::start(ThreadPool &pool)
+{
+  string root_path;
+  {
+    Lock lock(mutex);
+    outstanding++;
+    root_path = records.front().name;
+  }
+
+  shared_ptr<WatchCrawl> self = shared_from_this();
+  pool.enqueue([self, &pool, root_path]() { self->visit(&pool, 0, root_path); });
+}
+
+void WatchCrawl::run()
+{
+  {
+    Lock lock(mutex);
+    outstanding++;
+    inline_visits.emplace_back(0, records.front().name);
+  }
+
+  while (!inline_visits.empty()) {
+    pair<size_t, string> next = move(inline_visits.back());
+    inline_visits.pop_back();
+    visit(nullptr, next.first, next.second);
+  }
+}
+
+bool WatchCrawl::is_complete()
+{
+  Lock lock(mutex);
+  return outstanding == 0;
+}
+
+bool WatchCrawl::spend()
+{
+  size_t current = remaining.load();
+  while (current > 0) {
+    if (remaining.compare_exchange_weak(current, current - 1)) return true;
+  }
+  return false;
+}
+
+void WatchCrawl::visit(ThreadPool *pool, size_t index, const string &path)
+{
+  int wd = -1;
+  int add_errno = 0;
+  int list_errno = 0;
+  bool unwatched = false;
+  bool pruned = false;
+  timespec mtime{0, 0};
+  vector<string> subdirs;
+  DirectorySnapshot listing;
+
+  if (!is_cancelled()) {
+    if (spend()) {
+      wd = inotify_add_watch(inotify_fd, path.c_str(), mask);
+      if (wd == -1) add_errno = errno;
+
+      if (add_errno == ENOSPC) {
+        exhausted.store(true);
+        remaining.store(0);
+        add_errno = 0;
+      }
+    }
+
+    if (wd == -1 && add_errno == 0) {
+      unwatched = true;
+      deferred.store(true);
+    }
+  }
+
+  if ((wd != -1 || unwatched) && !is_cancelled()) {
+    // Each thread reuses a single buffer for every directory it visits.
+    static thread_local DirectoryReader reader;
+
+    int open_errno = reader.open(path);
+    if (open_errno != 0) {
+      if (open_errno != EACCES && open_errno != ENOENT && open_errno != ENOTDIR) {
+        list_errno = open_errno;
+      }
+      if (unwatched) add_errno = open_errno;
+    } else {
+      struct stat dir_stat {};
+      if (reader.stat(dir_stat) == 0) mtime = dir_stat.st_mtim;
+      if (snapshot) listing.reset();
+
+      DirectoryReader::Entry entry{};
+      while (reader.next(entry)) {
+        if (entry.may_be_directory()) {
+          if (filter && filter->excludes(path + "/" + entry.name)) {
+            pruned = true;
+          } else {
+            subdirs.emplace_back(entry.name);
+          }
+        }
+        if (snapshot) listing.add(entry);
+      }
+      list_errno = reader.get_errno();
+    }
+
+    if (ignore && !subdirs.empty()) {
+      Lock lock(ignore_mutex);
+
+      size_t before = subdirs.size();
+      auto is_ignored = [&](const string &subdir) { return ignore->ignores(path + "/" + subdir, true); };
+      subdirs.erase(remove_if(subdirs.begin(), subdirs.end(), is_ignored), subdirs.end());
+      if (subdirs.size() != before) pruned = true;
+    }
+  }
+
+  shared_ptr<WatchCrawl> self = pool != nullptr ? shared_from_this() : nullptr;
+  bool finished = false;
+  {
+    Lock lock(mutex);
+
+    Record &record = records[index];
+    record.wd = wd;
+    record.add_errno = add_errno;
+    record.list_errno = list_errno;
+    record.deferred = unwatched && add_errno == 0;
+    record.pruned = pruned;
+    record.mtime = mtime;
+    if (list_errno == 0) record.snapshot = move(listing);
+
+    size_t child_depth = record.depth + 1;
+    bool lazy = max_depth > 0 && child_depth > max_depth;
+    for (string &subdir : subdirs) {
+      if (lazy) {
+        records.emplace_back(index, move(subdir), child_depth);
+        records.back().lazy = true;
+        continue;
+      }
+
+      size_t child_index = records.size();
+      string child_path;
+      child_path.reserve(path.size() + 1 + subdir.size());
+      child_path.append(path);
+      child_path.push_back('/');
+      child_path.append(subdir);
+
+      records.emplace_back(index, move(subdir), child_depth);
+      outstanding++;
+      if (pool != nullptr) {
+        pool->enqueue([self, pool, child_index, child_path]() { self->visit(pool, child_index, child_path); });
+      } else {
+        inline_visits.emplace_back(child_index, move(child_path));
+      }
+    }
+
+    outstanding--;
+    finished = outstanding == 0;
+  }
+
+  if (finished && pool != nullptr) done.signal();
+}
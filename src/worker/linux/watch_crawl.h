@@ -0,0 +1,209 @@
+#ifndef WATCH_CRAWL_H
+#define WATCH_CRAWL_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <uv.h>
+#include <vector>
+
+#include "../../ignore_rules.h"
+#include "../../message.h"
+#include "../../path_filter.h"
+#include "../../thread_pool.h"
+#include "directory_snapshot.h"
+#include "event_fd.h"
+
+// Recursively install inotify watches on a directory tree from the threads of a ThreadPool, so that the worker thread
+// remains free to drain inotify events and handle commands while a large tree is enumerated. inotify_add_watch() is
+// safe to call concurrently on a shared inotify descriptor.
+//
+// Each directory that's visited is recorded in a flat list. Records always follow their parent's record, so the list
+// can be merged into the WatchRegistry in a single forward pass once the crawl is complete. The WatchRegistry is only
+// modified on the worker thread.
+//
+// A crawl installs at most `allowance` watches. Once those are spent, or inotify refuses a watch because the per-user
+// limit has been reached, it continues to list directories without watching them, so that the WatchRegistry can see
+// the whole tree and decide which parts to watch when it's merged.
+//
+// If the crawl has a `max_depth`, directories more than that many levels beneath the root are recorded as lazy but
+// neither watched nor listed. Subdirectories excluded by the crawl's PathFilter are skipped entirely.
+class WatchCrawl : public std::enable_shared_from_this<WatchCrawl>
+{
+public:
+  // Parent index used by the root Record.
+  static const size_t NO_PARENT = std::numeric_limits<size_t>::max();
+
+  // A single directory discovered by the crawl.
+  struct Record
+  {
+    Record(size_t parent, std::string &&name, size_t depth) :
+      parent{parent},
+      name(std::move(name)),
+      depth{depth},
+      wd{-1},
+      add_errno{0},
+      list_errno{0},
+      deferred{false},
+      lazy{false},
+      pruned{false},
+      mtime{0, 0}
+    {
+      //
+    }
+
+    Record(Record &&original) noexcept :
+      parent{original.parent},
+      name(std::move(original.name)),
+      depth{original.depth},
+      wd{original.wd},
+      add_errno{original.add_errno},
+      list_errno{original.list_errno},
+      deferred{original.deferred},
+      lazy{original.lazy},
+      pruned{original.pruned},
+      mtime(original.mtime),
+      snapshot(std::move(original.snapshot))
+    {
+      //
+    }
+
+    ~Record() = default;
+
+    // Index of the Record for the containing directory, or NO_PARENT for the crawl root.
+    size_t parent;
+
+    // Entry name within the parent directory, or the absolute path of the crawl root.
+    std::string name;
+
+    // Number of levels between this directory and the crawl root.
+    size_t depth;
+
+    // Watch descriptor assigned by inotify, or -1 if the watch could not be installed.
+    int wd;
+
+    // errno reported by inotify_add_watch() if `wd` is -1.
+    int add_errno;
+
+    // errno reported while enumerating this directory's entries, or 0 if its children were all recorded.
+    int list_errno;
+
+    // If true, the crawl's allowance was spent before this directory was reached, so it was listed but not watched.
+    bool deferred;
+
+    // If true, this directory lies beneath the crawl's maximum depth, so it was neither listed nor watched.
+    bool lazy;
+
+    // If true, some of this directory's subdirectories were excluded by the crawl's PathFilter or IgnoreRules.
+    bool pruned;
+
+    // Modification time of the directory when it was listed.
+    timespec mtime;
+
+    // Every entry of this directory, if the crawl was asked to take snapshots.
+    DirectorySnapshot snapshot;
+
+    Record(const Record &) = delete;
+    Record &operator=(const Record &) = delete;
+    Record &operator=(Record &&) = delete;
+  };
+
+  // Prepare a crawl that installs at most `allowance` watches. `done` is signalled from a pool thread once every
+  // directory has been visited or the crawl has been cancelled. If `snapshot` is true, record a DirectorySnapshot of
+  // each directory that's visited. If `max_depth` is nonzero, stop descending that many levels beneath the root. If
+  // `filter` is non-null, don't descend into the subdirectories that it excludes. Likewise, if `ignore` is non-null,
+  // don't descend into the subdirectories that it ignores. The crawl must have sole use of its IgnoreRules.
+  WatchCrawl(ChannelID channel_id,
+    CommandID command_id,
+    std::string &&root,
+    int inotify_fd,
+    uint32_t mask,
+    bool snapshot,
+    size_t allowance,
+    size_t max_depth,
+    std::shared_ptr<const PathFilter> &&filter,
+    std::shared_ptr<IgnoreRules> &&ignore,
+    EventFd &done);
+
+  ~WatchCrawl();
+
+  // Begin visiting directories on `pool`. The ThreadPool must outlive the crawl's tasks.
+  void start(ThreadPool &pool);
+
+  // Visit every directory on the calling thread and return once the crawl is complete. `done` is not signalled.
+  void run();
+
+  // Stop visiting new directories as soon as possible. Watches that were already installed are left in place for the
+  // WatchRegistry to clean up.
+  void cancel() { cancelled.store(true); }
+
+  bool is_cancelled() const { return cancelled.load(); }
+
+  // Return true once no further tasks are running or queued for this crawl.
+  bool is_complete();
+
+  // Access the visited directories. Only call this after is_complete() returns true.
+  std::vector<Record> &get_records() { return records; }
+
+  ChannelID get_channel_id() const { return channel_id; }
+
+  // The number of watches this crawl was permitted to install.
+  size_t get_allowance() const { return allowance; }
+
+  // Return true if any directories were listed without being watched because the allowance was spent.
+  bool was_deferred() const { return deferred.load(); }
+
+  // Return true if inotify refused a watch with ENOSPC before the allowance was spent.
+  bool was_exhausted() const { return exhausted.load(); }
+
+  CommandID get_command_id() const { return command_id; }
+
+  // Access the IgnoreRules that pruned this crawl, or null. Only call this after is_complete() returns true.
+  const std::shared_ptr<IgnoreRules> &get_ignore_rules() const { return ignore; }
+
+  WatchCrawl(const WatchCrawl &) = delete;
+  WatchCrawl(WatchCrawl &&) = delete;
+  WatchCrawl &operator=(const WatchCrawl &) = delete;
+  WatchCrawl &operator=(WatchCrawl &&) = delete;
+
+private:
+  // Install a watch on the directory at `path` described by the Record at `index`, then enqueue a visit for each
+  // subdirectory on `pool`, or on `inline_visits` if `pool` is null.
+  void visit(ThreadPool *pool, size_t index, const std::string &path);
+
+  // Consume one watch from the allowance. Return false if none remain.
+  bool spend();
+
+  const ChannelID channel_id;
+  const CommandID command_id;
+  const int inotify_fd;
+  const uint32_t mask;
+  const bool snapshot;
+  const size_t allowance;
+  const size_t max_depth;
+  const std::shared_ptr<const PathFilter> filter;
+  EventFd &done;
+
+  // Guards `ignore`, which loads ignore files as they're first needed.
+  uv_mutex_t ignore_mutex{};
+  const std::shared_ptr<IgnoreRules> ignore;
+
+  std::atomic<bool> cancelled;
+  std::atomic<size_t> remaining;
+  std::atomic<bool> deferred;
+  std::atomic<bool> exhausted;
+
+  // Directories waiting to be visited by run().
+  std::vector<std::pair<size_t, std::string>> inline_visits;
+
+  // Guards `records` and `outstanding`.
+  uv_mutex_t mutex{};
+  std::vector<Record> records;
+  size_t outstanding;
+};
+
+#endif
@@ -1,39 +1,67 @@
+#include <algorithm>
 #include <cerrno>
-#include <dirent.h>
+#include <chrono>
+#include <ctime>
 #include <iostream>
+#include <limits.h>
 #include <memory>
-#include <set>
-#include <sstream>
 #include <string>
 #include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "../../helper/linux/directory_reader.h"
 #include "../../helper/linux/helper.h"
+#include "../../ignore_rules.h"
 #include "../../log.h"
 #include "../../message.h"
 #include "../../message_buffer.h"
 #include "../../result.h"
+#include "../../status.h"
+#include "../../thread_pool.h"
 #include "../recent_file_cache.h"
 #include "cookie_jar.h"
+#include "directory_snapshot.h"
+#include "event_fd.h"
 #include "side_effect.h"
+#include "watch_budget.h"
+#include "watch_crawl.h"
 #include "watch_registry.h"
 #include "watched_directory.h"
 
 using std::endl;
+using std::find;
 using std::ostream;
-using std::ostringstream;
-using std::set;
+using std::make_pair;
+using std::move;
+using std::pair;
+using std::remove_if;
 using std::shared_ptr;
+using std::sort;
+using std::static_pointer_cast;
 using std::string;
-using std::unordered_multimap;
+using std::unique;
+using std::unique_ptr;
+using std::unordered_map;
+using std::unordered_set;
 using std::vector;
+using std::chrono::steady_clock;
 
-using WatchedDirectoryPtr = shared_ptr<WatchedDirectory>;
-using WDMap = unordered_multimap<int, WatchedDirectoryPtr>;
-using WDIter = WDMap::iterator;
+// Events requested for each watched directory.
+const uint32_t WATCH_MASK = IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF
+  | IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW | IN_EXCL_UNLINK | IN_ONLYDIR;
+
+// Smallest read() buffer guaranteed to hold at least one inotify event with a maximum-length name.
+const size_t MIN_READ_SIZE = sizeof(inotify_event) + NAME_MAX + 1;
+
+// Most raw inotify events held for watch descriptors of unmerged traversals, in bytes.
+const size_t MAX_DEFERRED_EVENT_BYTES = 1024 * 1024;
 
 static ostream &operator<<(ostream &out, const inotify_event *event)
 {
@@ -65,14 +93,86 @@ static ostream &operator<<(ostream &out, const inotify_event *event)
   return out;
 }
 
-WatchRegistry::WatchRegistry()
+// Determine the kind of the entry at `path` that an inotify event describes. Consult the cached lstat() entry first.
+// Otherwise, trust the event mask whenever it's conclusive, because only directories carry IN_ISDIR and only watched
+// directories report events about themselves. Removed entries can't be examined at all. Stat the entry only to tell
+// files from symlinks, or when `want_inode` asks for its inode. Evict entries that the event has removed, along with
+// everything cached beneath a removed directory. Set `inode` to the entry's inode number if it's known, or 0 if not.
+static EntryKind classify(const inotify_event &event,
+  const string &path,
+  RecentFileCache &cache,
+  bool want_inode,
+  uint64_t &inode)
+{
+  bool dir_hint = (event.mask & IN_ISDIR) == IN_ISDIR;
+  bool self = (event.mask & (IN_DELETE_SELF | IN_UNMOUNT | IN_MOVE_SELF)) != 0u;
+  bool removed = self || (event.mask & (IN_DELETE | IN_MOVED_FROM)) != 0u;
+
+  shared_ptr<StatResult> stat = cache.present_at_path(path);
+  if (stat && !self && (stat->get_entry_kind() == KIND_DIRECTORY) != dir_hint) {
+    // The entry has been replaced by one of another kind since it was cached.
+    cache.evict(path);
+    stat.reset();
+  }
+
+  EntryKind kind = KIND_UNKNOWN;
+  inode = 0;
+  if (stat) {
+    kind = stat->get_entry_kind();
+    inode = static_pointer_cast<PresentEntry>(stat)->get_inode();
+  } else if (self || (dir_hint && !want_inode)) {
+    kind = KIND_DIRECTORY;
+  } else if (removed) {
+    kind = dir_hint ? KIND_DIRECTORY : KIND_FILE;
+  } else {
+    stat = cache.current_at_path(path, !dir_hint, dir_hint, false);
+    cache.apply();
+    kind = stat->get_entry_kind();
+    if (stat->is_present()) inode = static_pointer_cast<PresentEntry>(stat)->get_inode();
+  }
+
+  if (removed) {
+    if (kind == KIND_DIRECTORY) {
+      cache.evict_subtree(path);
+    } else {
+      cache.evict(path);
+    }
+  }
+  return kind;
+}
+
+// Return true if `prior` and `current` record different entries that happen to share a name.
+static bool was_replaced(const DirectorySnapshot::Entry &prior, const DirectorySnapshot::Entry &current)
+{
+  if (prior.ino != 0 && current.ino != 0 && prior.ino != current.ino) return true;
+  return prior.kind != KIND_UNKNOWN && current.kind != KIND_UNKNOWN && prior.kind != current.kind;
+}
+
+static bool at_or_after(const timespec &ts, const timespec &since)
+{
+  return ts.tv_sec > since.tv_sec || (ts.tv_sec == since.tv_sec && ts.tv_nsec >= since.tv_nsec);
+}
+
+WatchRegistry::WatchRegistry(const PathFilterTable &filters) :
+  filters(filters),
+  deferred_overflow{false},
+  deferred_since{0, 0},
+  read_buffer(MIN_READ_SIZE),
+  snapshots{false},
+  watch_depth{0},
+  promotion_count{0},
+  demotion_count{0},
+  last_drained{0, 0}
 {
   inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 
   if (inotify_fd == -1) {
     report_if_error(errno_result("Unable to initialize inotify"));
   }
+  report_errable(crawl_done);
   freeze();
+
+  clock_gettime(CLOCK_REALTIME, &last_drained);
 }
 
 WatchRegistry::~WatchRegistry()
@@ -82,27 +182,140 @@ WatchRegistry::~WatchRegistry()
   }
 }
 
+WatchedDirectory *WatchRegistry::WatchSlot::find(ChannelID channel_id) const
+{
+  for (uint32_t i = 0; i < count; i++) {
+    WatchedDirectory *subscriber = at(i);
+    if (subscriber->get_channel_id() == channel_id) return subscriber;
+  }
+  return nullptr;
+}
+
+void WatchRegistry::WatchSlot::add(WatchedDirectory *subscriber)
+{
+  if (count < INLINE_SUBSCRIBERS) {
+    inline_subscribers[count] = subscriber;
+  } else {
+    overflow.push_back(subscriber);
+  }
+  count++;
+}
+
+void WatchRegistry::WatchSlot::remove(WatchedDirectory *subscriber)
+{
+  for (uint32_t i = 0; i < count; i++) {
+    if (at(i) != subscriber) continue;
+
+    // Fill the gap with the final subscriber.
+    ref(i) = at(count - 1);
+    if (count > INLINE_SUBSCRIBERS) {
+      overflow.pop_back();
+    } else {
+      inline_subscribers[count - 1] = nullptr;
+    }
+    count--;
+    return;
+  }
+}
+
+void WatchRegistry::WatchSlot::clear()
+{
+  for (WatchedDirectory *&subscriber : inline_subscribers) {
+    subscriber = nullptr;
+  }
+  overflow.clear();
+  count = 0;
+  snapshot.clear();
+}
+
+WatchRegistry::WatchSlot &WatchRegistry::claim_slot(int wd)
+{
+  WatchSlot *existing = slot_for(wd);
+  if (existing != nullptr) return *existing;
+
+  uint32_t index = 0;
+  if (free_slots.empty()) {
+    slots.emplace_back();
+    index = static_cast<uint32_t>(slots.size());
+  } else {
+    index = free_slots.back();
+    free_slots.pop_back();
+  }
+  budget.acquire();
+
+  if (static_cast<size_t>(wd) >= slot_by_wd.size()) slot_by_wd.resize(wd + 1, 0);
+  slot_by_wd[wd] = index;
+  return slots[index - 1];
+}
+
+void WatchRegistry::release_slot(int wd)
+{
+  uint32_t index = slot_by_wd[wd];
+  slot_by_wd[wd] = 0;
+  slots[index - 1].clear();
+  free_slots.push_back(index);
+  budget.release();
+
+  while (!slot_by_wd.empty() && slot_by_wd.back() == 0) {
+    slot_by_wd.pop_back();
+  }
+}
+
 Result<> WatchRegistry::add(ChannelID channel_id,
-  const shared_ptr<WatchedDirectory> &parent,
+  WatchedDirectory *parent,
   const string &name,
   bool recursive,
   vector<string> &poll)
 {
-  uint32_t mask = IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM
-    | IN_MOVED_TO | IN_DONT_FOLLOW | IN_EXCL_UNLINK | IN_ONLYDIR;
-
-  ostringstream absolute_builder;
+  string absolute;
   if (parent) {
-    absolute_builder << parent->get_absolute_path() << "/";
+    const string &parent_path = parent->get_absolute_path();
+    absolute.reserve(parent_path.size() + 1 + name.size());
+    absolute.append(parent_path);
+    absolute.push_back('/');
+  }
+  absolute.append(name);
+
+  // Survey new recursive roots before watching them, so that the WatchBudget can decide which subtrees to poll.
+  if (parent == nullptr && recursive && !covers(absolute)) return add_inline(channel_id, absolute, poll);
+
+  if (parent != nullptr && filters.excludes(channel_id, absolute, true)) {
+    LOGGER << "Not watching excluded directory " << absolute << "." << endl;
+    parent->mark_incomplete();
+    return ok_result();
+  }
+
+  if (parent != nullptr && recursive && is_beyond_watch_depth(parent)) {
+    LOGGER << "Polling directory " << absolute << " lazily beneath the watch depth." << endl;
+    parent->mark_incomplete();
+    lazy_roots.emplace_back(channel_id, move(absolute));
+    return ok_result();
   }
-  absolute_builder << name;
-  string absolute = absolute_builder.str();
 
+  return watch(channel_id, parent, name, absolute, recursive, false, poll);
+}
+
+Result<> WatchRegistry::watch(ChannelID channel_id,
+  WatchedDirectory *parent,
+  const string &name,
+  const string &absolute,
+  bool recursive,
+  bool promote,
+  vector<string> &poll)
+{
   ostream &logline = LOGGER << "Watching path [" << absolute << "]";
   if (!recursive) logline << " (non-recursively)";
   logline << "." << endl;
 
-  int wd = inotify_add_watch(inotify_fd, absolute.c_str(), mask);
+  if (budget.available() == 0) {
+    LOGGER << "Watch budget exhausted. Falling back to polling for directory " << absolute << "." << endl;
+    if (parent != nullptr) parent->mark_incomplete();
+    poll.push_back(absolute);
+    budget_split[channel_id].polled_roots++;
+    return ok_result();
+  }
+
+  int wd = inotify_add_watch(inotify_fd, absolute.c_str(), WATCH_MASK);
   if (wd == -1) {
     int watch_errno = errno;
 
@@ -113,132 +326,958 @@ Result<> WatchRegistry::add(ChannelID channel_id,
 
     if (watch_errno == ENOSPC) {
       LOGGER << "Falling back to polling for directory " << absolute << "." << endl;
+      budget.exhausted(budget.get_in_use());
+      if (parent != nullptr) parent->mark_incomplete();
       poll.push_back(absolute);
+      budget_split[channel_id].polled_roots++;
       return ok_result();
     }
 
+    if (parent != nullptr && watch_errno != ENOTDIR) parent->mark_incomplete();
     return errno_result("Unable to watch directory", watch_errno);
   }
 
   LOGGER << "Assigned watch descriptor " << wd << " at [" << absolute << "] on channel " << channel_id << "." << endl;
 
-  auto range = by_wd.equal_range(wd);
-  bool updated = false;
-  for (auto existing = range.first; existing != range.second; ++existing) {
-    shared_ptr<WatchedDirectory> &other = existing->second;
-    if (other->get_channel_id() == channel_id) {
-      assert(parent != nullptr);
-      updated = true;
-      other->was_renamed(parent, name);
+  bool created = false;
+  WatchedDirectory *watched_dir = subscribe(channel_id, wd, parent, name, recursive, created);
+  if (!created) return ok_result();
+
+  if (promote) {
+    watched_dir->promote(steady_clock::now());
+    promoted.push_back(watched_dir);
+    promotion_count++;
+  }
+
+  WatchSlot *slot = slot_for(wd);
+  if (!recursive) {
+    if (snapshots && !slot->snapshot.is_taken()) take_snapshot(*slot, absolute);
+    return ok_result();
+  }
+
+  // If another channel already watches this directory recursively, its subtree is already known.
+  for (uint32_t i = 0; i < slot->size(); i++) {
+    WatchedDirectory *source = slot->at(i);
+    if (source != watched_dir && source->is_recursive()) {
+      if (snapshots && !slot->snapshot.is_taken()) take_snapshot(*slot, absolute);
+      mirror(channel_id, source, watched_dir, poll);
+      return ok_result();
+    }
+  }
+
+  return populate(channel_id, watched_dir, poll);
+}
+
+Result<> WatchRegistry::populate(ChannelID channel_id, WatchedDirectory *watched_dir, vector<string> &poll)
+{
+  const string &absolute = watched_dir->get_absolute_path();
+
+  // Collect subdirectory names before recursing so that the shared DirectoryReader is free for each child.
+  vector<string> subdirs;
+  int open_errno = reader.open(absolute);
+  if (open_errno != 0) {
+    if (open_errno != EACCES && open_errno != ENOENT && open_errno != ENOTDIR) {
+      watched_dir->mark_incomplete();
+      return errno_result("Unable to recurse into directory " + absolute, open_errno);
     }
+    return ok_result();
   }
-  if (updated) return ok_result();
 
-  shared_ptr<WatchedDirectory> watched_dir(new WatchedDirectory(wd, channel_id, parent, string(name), recursive));
+  // Record the listing as this directory's snapshot, unless another channel has already done so.
+  DirectorySnapshot *snapshot = nullptr;
+  if (snapshots) {
+    WatchSlot *slot = slot_for(watched_dir->get_descriptor());
+    if (slot != nullptr && !slot->snapshot.is_taken()) {
+      snapshot = &slot->snapshot;
+      snapshot->reset();
+    }
+  }
 
-  by_wd.emplace(wd, watched_dir);
-  by_channel.emplace(channel_id, watched_dir);
+  DirectoryReader::Entry entry{};
+  while (reader.next(entry)) {
+    if (entry.may_be_directory()) subdirs.emplace_back(entry.name);
+    if (snapshot != nullptr) snapshot->add(entry);
+  }
+  if (reader.get_errno() != 0) {
+    if (snapshot != nullptr) snapshot->clear();
+    watched_dir->mark_incomplete();
+    return errno_result("Unable to iterate entries of directory " + absolute, reader.get_errno());
+  }
 
-  if (recursive) {
-    DIR *dir = opendir(absolute.c_str());
-    if (dir == nullptr) {
-      int open_errno = errno;
-      if (open_errno != EACCES && open_errno != ENOENT && open_errno != ENOTDIR) {
-        return errno_result("Unable to recurse into directory " + absolute, open_errno);
-      }
+  for (string &subdir : subdirs) {
+    Result<> add_r = add(channel_id, watched_dir, subdir, true, poll);
+    if (add_r.is_error()) {
+      LOGGER << "Unable to recurse into " << watched_dir->get_absolute_path() << "/" << subdir << ": " << add_r << "."
+             << endl;
+    }
+  }
+
+  return ok_result();
+}
+
+void WatchRegistry::take_snapshot(WatchSlot &slot, const string &path)
+{
+  int open_errno = reader.open(path);
+  if (open_errno != 0) {
+    LOGGER << "Unable to snapshot directory " << path << ": " << errno_result<>("", open_errno) << "." << endl;
+    return;
+  }
+
+  slot.snapshot.reset();
+  DirectoryReader::Entry entry{};
+  while (reader.next(entry)) {
+    slot.snapshot.add(entry);
+  }
+  if (reader.get_errno() != 0) {
+    LOGGER << "Unable to snapshot directory " << path << ": " << errno_result<>("", reader.get_errno()) << "." << endl;
+    slot.snapshot.clear();
+  }
+}
+
+void WatchRegistry::enable_snapshots(bool enabled)
+{
+  if (snapshots == enabled) return;
+  snapshots = enabled;
+
+  Timer t;
+  size_t count = 0;
+  for (size_t wd = 0; wd < slot_by_wd.size(); wd++) {
+    WatchSlot *slot = slot_for(static_cast<int>(wd));
+    if (slot == nullptr || slot->empty()) continue;
+
+    if (enabled) {
+      take_snapshot(*slot, slot->at(0)->get_absolute_path());
+      count++;
     } else {
-      errno = 0;
-      dirent *entry = readdir(dir);
-      while (entry != nullptr) {
-        string basename(entry->d_name);
-
-        if (basename == "." || basename == "..") {
-          entry = readdir(dir);
-          continue;
-        }
+      slot->snapshot.clear();
+    }
+  }
 
-#ifdef _DIRENT_HAVE_D_TYPE
-        if (entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN) {
-          Result<> add_r = add(channel_id, watched_dir, basename, recursive, poll);
-          if (add_r.is_error()) {
-            LOGGER << "Unable to recurse into " << absolute << "/" << basename << ": " << add_r << "." << endl;
-          }
-        }
-#else
-        Result<> add_r = add(channel_id, watched_dir, basename, recursive, poll);
-        if (add_r.is_error()) {
-          LOGGER << "Unable to recurse into " << absolute << "/" << basename << ": " << add_r << "." << endl;
-        }
-#endif
+  t.stop();
+  if (enabled) {
+    LOGGER << "Snapshotted " << plural(count, "watched directory", "watched directories") << " in " << t << "." << endl;
+  } else {
+    LOGGER << "Discarded directory snapshots." << endl;
+  }
+}
+
+void WatchRegistry::mirror(ChannelID channel_id,
+  WatchedDirectory *source,
+  WatchedDirectory *dest,
+  vector<string> &poll)
+{
+  if (!source->is_complete()) {
+    Result<> r = populate(channel_id, dest, poll);
+    if (r.is_error()) LOGGER << "Unable to recurse into " << dest->get_absolute_path() << ": " << r << "." << endl;
+    return;
+  }
+
+  for (WatchedDirectory *source_child : source->get_children()) {
+    int wd = source_child->get_descriptor();
+    if (wd == -1) continue;
 
-        errno = 0;
-        entry = readdir(dir);
+    if (filters.excludes(channel_id, source_child->get_absolute_path(), true)) {
+      dest->mark_incomplete();
+      continue;
+    }
+
+    bool created = false;
+    WatchedDirectory *dest_child = subscribe(channel_id, wd, dest, source_child->get_name(), true, created);
+    if (created) mirror(channel_id, source_child, dest_child, poll);
+  }
+}
+
+bool WatchRegistry::covers(const string &root)
+{
+  for (auto &pair : by_channel) {
+    if (pair.second.empty()) continue;
+
+    // A channel's first WatchedDirectory is always its root.
+    WatchedDirectory *top = pair.second.front().get();
+    if (!top->is_root() || !top->is_recursive()) continue;
+
+    WatchedDirectory *current = descend(top, root);
+    if (current != nullptr && current->get_descriptor() != -1) return true;
+  }
+  return false;
+}
+
+WatchedDirectory *WatchRegistry::descend(WatchedDirectory *top, const string &path)
+{
+  const string &top_path = top->get_absolute_path();
+  if (path.compare(0, top_path.size(), top_path) != 0) return nullptr;
+  if (path.size() > top_path.size() && path[top_path.size()] != '/') return nullptr;
+
+  // Descend one path component at a time through the channel's existing children.
+  WatchedDirectory *current = top;
+  size_t pos = top_path.size();
+  while (current != nullptr && pos < path.size()) {
+    size_t start = pos + 1;
+    size_t next = path.find('/', start);
+    if (next == string::npos) next = path.size();
+
+    WatchedDirectory *match = nullptr;
+    for (WatchedDirectory *child : current->get_children()) {
+      const string &child_name = child->get_name();
+      if (child_name.size() == next - start && path.compare(start, next - start, child_name) == 0) {
+        match = child;
+        break;
       }
-      if (errno != 0) {
-        return errno_result("Unable to iterate entries of directory " + absolute);
+    }
+    current = match;
+    pos = next;
+  }
+  return current;
+}
+
+bool WatchRegistry::is_beyond_watch_depth(WatchedDirectory *parent)
+{
+  if (watch_depth == 0) return false;
+
+  // Every level beneath a promoted directory is watched.
+  size_t depth = 1;
+  for (WatchedDirectory *current = parent; !current->is_root(); current = current->get_parent()) {
+    if (current->is_promoted()) return false;
+    depth++;
+  }
+  return depth > watch_depth;
+}
+
+WatchedDirectory *WatchRegistry::subscribe(ChannelID channel_id,
+  int wd,
+  WatchedDirectory *parent,
+  const string &name,
+  bool recursive,
+  bool &created)
+{
+  WatchSlot &slot = claim_slot(wd);
+  WatchedDirectory *existing = slot.find(channel_id);
+  if (existing != nullptr) {
+    assert(parent != nullptr);
+    existing->was_renamed(parent, name);
+    created = false;
+    return existing;
+  }
+
+  WatchedDirectory *watched_dir = new WatchedDirectory(wd, channel_id, parent, string(name), recursive);
+  by_channel[channel_id].emplace_back(watched_dir);
+  slot.add(watched_dir);
+  created = true;
+  return watched_dir;
+}
+
+Result<> WatchRegistry::add_inline(ChannelID channel_id, const string &root, vector<string> &poll)
+{
+  size_t allowance = budget.available();
+  LOGGER << "Watching path [" << root << "] within a budget of " << plural(allowance, "watch", "watches") << "."
+         << endl;
+
+  budget.pledge(allowance);
+  shared_ptr<WatchCrawl> crawl(
+    new WatchCrawl(channel_id,
+      0,
+      string(root),
+      inotify_fd,
+      WATCH_MASK,
+      snapshots,
+      allowance,
+      watch_depth,
+      filters.get(channel_id),
+      crawl_ignore_rules(channel_id),
+      crawl_done));
+  crawl->run();
+  return install(*crawl, poll);
+}
+
+void WatchRegistry::add_parallel(ChannelID channel_id, CommandID command_id, string &&root, ThreadPool &pool)
+{
+  size_t allowance = budget.available();
+  LOGGER << "Watching path [" << root << "] with " << plural(pool.size(), "traversal thread") << " within a budget of "
+         << plural(allowance, "watch", "watches") << "." << endl;
+
+  budget.pledge(allowance);
+  shared_ptr<WatchCrawl> crawl(new WatchCrawl(channel_id,
+    command_id,
+    move(root),
+    inotify_fd,
+    WATCH_MASK,
+    snapshots,
+    allowance,
+    watch_depth,
+    filters.get(channel_id),
+    crawl_ignore_rules(channel_id),
+    crawl_done));
+  crawls.push_back(crawl);
+  crawl->start(pool);
+}
+
+shared_ptr<IgnoreRules> WatchRegistry::crawl_ignore_rules(ChannelID channel_id)
+{
+  shared_ptr<IgnoreRules> rules = filters.get_ignore_rules(channel_id);
+  if (!rules) return rules;
+
+  // Crawls run on other threads, so each reads the ignore files it needs for itself.
+  return shared_ptr<IgnoreRules>(new IgnoreRules(string(rules->get_root())));
+}
+
+void WatchRegistry::discard_watch(int wd)
+{
+  if (slot_for(wd) != nullptr) return;
+
+  // Another crawl that's still running may have been handed the same watch descriptor.
+  if (!crawls.empty()) {
+    orphaned_wds.push_back(wd);
+    return;
+  }
+
+  if (inotify_rm_watch(inotify_fd, wd) == -1) {
+    LOGGER << "Unable to remove watch descriptor " << wd << ": " << errno_result<>("") << "." << endl;
+  }
+}
+
+Result<> WatchRegistry::collect_crawls(MessageBuffer &messages, CookieJar &jar, RecentFileCache &cache)
+{
+  Result<> cr = crawl_done.consume();
+  if (cr.is_error()) return cr;
+
+  vector<shared_ptr<WatchCrawl>> completed;
+  for (auto it = crawls.begin(); it != crawls.end();) {
+    if ((*it)->is_complete()) {
+      completed.push_back(*it);
+      it = crawls.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (completed.empty()) return ok_result();
+
+  for (shared_ptr<WatchCrawl> &crawl : completed) {
+    if (crawl->is_cancelled()) {
+      abandon(*crawl, messages);
+    } else {
+      merge(*crawl, messages);
+    }
+  }
+
+  if (crawls.empty()) {
+    for (int wd : orphaned_wds) {
+      if (slot_for(wd) != nullptr) continue;
+
+      if (inotify_rm_watch(inotify_fd, wd) == -1) {
+        LOGGER << "Unable to remove orphaned watch descriptor " << wd << ": " << errno_result<>("") << "." << endl;
       }
-      closedir(dir);
+    }
+    orphaned_wds.clear();
+  }
+
+  // Deliver events that arrived for watch descriptors before their crawl was merged.
+  if (!deferred_events.empty()) {
+    vector<char> replay;
+    replay.swap(deferred_events);
+
+    LOGGER << "Replaying " << plural(replay.size(), "byte") << " of deferred inotify events." << endl;
+
+    const char *current = replay.data();
+    const char *end = current + replay.size();
+    while (current < end) {
+      const auto *event = reinterpret_cast<const inotify_event *>(current);
+      current += sizeof(inotify_event) + event->len;
+
+      dispatch(event, messages, jar, cache);
     }
   }
 
+  if (crawls.empty() && deferred_overflow) recover_deferred_overflow(messages, cache);
+
   return ok_result();
 }
 
-Result<> WatchRegistry::remove(ChannelID channel_id)
+void WatchRegistry::cancel_crawls()
+{
+  for (shared_ptr<WatchCrawl> &crawl : crawls) {
+    crawl->cancel();
+  }
+}
+
+void WatchRegistry::recover_deferred_overflow(MessageBuffer &messages, RecentFileCache &cache)
+{
+  deferred_overflow = false;
+
+  if (snapshots) {
+    resync(messages, cache, deferred_since);
+    return;
+  }
+
+  report_lost_events(messages, "Too many events arrived while directories were being crawled. Some have been lost.");
+}
+
+void WatchRegistry::report_lost_events(MessageBuffer &messages, const string &description)
+{
+  for (auto &pair : by_channel) {
+    if (pair.second.empty()) continue;
+    messages.error(pair.first, string(description), false);
+  }
+}
+
+void WatchRegistry::merge(WatchCrawl &crawl, MessageBuffer &messages)
 {
-  auto its = by_channel.equal_range(channel_id);
-  set<int> wds;
-  for (auto it = its.first; it != its.second; ++it) {
-    wds.insert(it->second->get_descriptor());
+  vector<string> poll;
+  Result<> r = install(crawl, poll);
+  if (r.is_error()) {
+    messages.ack(crawl.get_command_id(), crawl.get_channel_id(), false, string(r.get_error()));
+    return;
   }
 
-  LOGGER << "Stopping " << plural(wds.size(), "inotify watch descriptor") << "." << endl;
+  if (poll.empty()) {
+    messages.ack(crawl.get_command_id(), crawl.get_channel_id(), true, "");
+    return;
+  }
+
+  // The polling thread acknowledges the command once every polled root has been populated.
+  for (string &poll_root : poll) {
+    messages.add(Message(CommandPayloadBuilder::add(crawl.get_channel_id(), move(poll_root), true, poll.size())
+                           .set_id(crawl.get_command_id())
+                           .set_filter(filters.get(crawl.get_channel_id()))
+                           .build()));
+  }
+}
+
+Result<> WatchRegistry::install(WatchCrawl &crawl, vector<string> &poll)
+{
+  Timer t;
+  ChannelID channel_id = crawl.get_channel_id();
+  vector<WatchCrawl::Record> &records = crawl.get_records();
+  vector<WatchedDirectory *> merged(records.size(), nullptr);
+  size_t watched_count = 0;
+
+  // Watches installed by the crawl are counted as they're subscribed below.
+  budget.redeem(crawl.get_allowance());
+
+  // Keep the ignore rules that the crawl pruned with, so that changes to them can be recognized later.
+  shared_ptr<IgnoreRules> rules = filters.get_ignore_rules(channel_id);
+  if (rules && crawl.get_ignore_rules()) rules->adopt(*crawl.get_ignore_rules());
+
+  // If the crawl ran out of allowance, decide which subtrees to watch now that the whole tree is known. Otherwise,
+  // every directory it listed was watched as it went.
+  vector<bool> polled;
+  size_t polled_directories = 0;
+  size_t polled_roots = 0;
+  if (crawl.was_deferred()) {
+    if (crawl.was_exhausted()) {
+      // The kernel's limit was reached before the allowance was. Only the watches the crawl managed to install fit.
+      size_t installed = 0;
+      for (WatchCrawl::Record &record : records) {
+        if (record.wd != -1 && slot_for(record.wd) == nullptr) installed++;
+      }
+      budget.exhausted(budget.get_in_use() + installed);
+      LOGGER << "Inotify watch limit reached. Reducing allowance to " << budget.get_allowance() << "." << endl;
+    }
+
+    vector<WatchBudget::Candidate> candidates;
+    candidates.reserve(records.size());
+    for (WatchCrawl::Record &record : records) {
+      int64_t mtime = static_cast<int64_t>(record.mtime.tv_sec) * 1000000000 + record.mtime.tv_nsec;
+      bool eligible = record.wd != -1 || record.deferred;
+      candidates.push_back(WatchBudget::Candidate{record.parent, mtime, eligible});
+    }
+    polled = WatchBudget::place(candidates, budget.available());
+
+    // Release the watches within polled subtrees before installing any deferred ones in their place.
+    vector<bool> beneath(records.size(), false);
+    for (size_t i = 0; i < records.size(); i++) {
+      size_t parent = records[i].parent;
+      beneath[i] = polled[i] || (parent != WatchCrawl::NO_PARENT && beneath[parent]);
+      if (!beneath[i]) continue;
+
+      if (!records[i].lazy) polled_directories++;
+      if (records[i].wd != -1) {
+        discard_watch(records[i].wd);
+        records[i].wd = -1;
+      }
+    }
+  }
+
+  // Directories that were listed before they were watched, and may have gained subdirectories in between.
+  vector<size_t> unlisted;
+
+  for (size_t i = 0; i < records.size(); i++) {
+    WatchCrawl::Record &record = records[i];
+
+    WatchedDirectory *parent = nullptr;
+    if (record.parent != WatchCrawl::NO_PARENT) {
+      parent = merged[record.parent];
+      if (parent == nullptr) continue;
+    }
+
+    string absolute;
+    if (parent != nullptr) {
+      absolute.append(parent->get_absolute_path());
+      absolute.push_back('/');
+    }
+    absolute.append(record.name);
+
+    if (record.lazy) {
+      LOGGER << "Polling directory " << absolute << " lazily beneath the watch depth." << endl;
+      parent->mark_incomplete();
+      lazy_roots.emplace_back(channel_id, move(absolute));
+      continue;
+    }
+
+    if (!polled.empty() && polled[i]) {
+      LOGGER << "Polling directory " << absolute << " to remain within the inotify watch budget." << endl;
+      if (parent != nullptr) parent->mark_incomplete();
+      poll.push_back(move(absolute));
+      polled_roots++;
+      continue;
+    }
+
+    if (record.deferred) {
+      if (budget.available() > 0) {
+        record.wd = inotify_add_watch(inotify_fd, absolute.c_str(), WATCH_MASK);
+        if (record.wd == -1) record.add_errno = errno;
+        if (record.add_errno == ENOSPC) budget.exhausted(budget.get_in_use());
+      } else {
+        record.add_errno = ENOSPC;
+      }
+    }
+
+    if (record.wd == -1) {
+      if (record.add_errno == ENOSPC) {
+        LOGGER << "Falling back to polling for directory " << absolute << "." << endl;
+        if (parent != nullptr) parent->mark_incomplete();
+        poll.push_back(move(absolute));
+        polled_roots++;
+      } else if (record.add_errno == ENOENT || record.add_errno == EACCES) {
+        LOGGER << "Directory " << absolute << " is no longer accessible. Ignoring." << endl;
+      } else if (parent == nullptr) {
+        return errno_result<>("Unable to watch directory", record.add_errno);
+      } else {
+        if (record.add_errno != ENOTDIR) parent->mark_incomplete();
+        LOGGER << "Unable to watch directory " << absolute << ": " << errno_result<>("", record.add_errno) << "."
+               << endl;
+      }
+      continue;
+    }
 
-  by_channel.erase(channel_id);
-  for (auto &wd : wds) {
-    auto wd_matches = by_wd.equal_range(wd);
+    bool created = false;
+    merged[i] = subscribe(channel_id, record.wd, parent, record.name, true, created);
+    watched_count++;
+    if (record.deferred) unlisted.push_back(i);
 
-    vector<WDIter> to_erase;
-    for (auto each_wd = wd_matches.first; each_wd != wd_matches.second; ++each_wd) {
-      if (each_wd->second->get_channel_id() == channel_id) {
-        to_erase.push_back(each_wd);
+    // Snapshots may have been enabled or disabled while the crawl was running.
+    if (snapshots) {
+      WatchSlot *slot = slot_for(record.wd);
+      if (!slot->snapshot.is_taken()) {
+        if (record.snapshot.is_taken() && !record.deferred) {
+          slot->snapshot = move(record.snapshot);
+        } else if (record.list_errno == 0) {
+          take_snapshot(*slot, absolute);
+        }
       }
     }
-    for (WDIter &it : to_erase) {
-      by_wd.erase(it);
+
+    if (record.pruned) merged[i]->mark_incomplete();
+    if (record.list_errno != 0) {
+      merged[i]->mark_incomplete();
+      LOGGER << "Unable to iterate entries of directory " << absolute << ": "
+             << errno_result<>("", record.list_errno) << "." << endl;
+    }
+  }
+
+  if (!unlisted.empty()) {
+    recover_unlisted(channel_id, records, merged, unlisted, poll);
+  }
+
+  if (polled_roots > 0) {
+    BudgetSplit &split = budget_split[channel_id];
+    split.polled_roots += polled_roots;
+    split.polled_directories += polled_directories;
+  }
+
+  t.stop();
+  LOGGER << "Merged " << plural(watched_count, "watch descriptor") << " for path [" << records.front().name
+         << "] on channel " << channel_id << " in " << t << "." << endl;
+  if (polled_roots > 0) {
+    LOGGER << plural(polled_roots, "subtree") << " containing "
+           << plural(polled_directories, "directory", "directories") << " will be polled. "
+           << plural(budget.available(), "watch", "watches") << " remain available." << endl;
+  }
+  return ok_result();
+}
+
+void WatchRegistry::recover_unlisted(ChannelID channel_id,
+  vector<WatchCrawl::Record> &records,
+  vector<WatchedDirectory *> &merged,
+  vector<size_t> &unlisted,
+  vector<string> &poll)
+{
+  unordered_map<size_t, unordered_set<string>> known_children;
+  for (size_t index : unlisted) {
+    known_children[index];
+  }
+  for (WatchCrawl::Record &record : records) {
+    auto it = known_children.find(record.parent);
+    if (it != known_children.end()) it->second.insert(record.name);
+  }
+
+  for (size_t index : unlisted) {
+    WatchedDirectory *watched_dir = merged[index];
+    string absolute = watched_dir->get_absolute_path();
+
+    struct stat dir_stat {};
+    if (lstat(absolute.c_str(), &dir_stat) != 0) continue;
+    const timespec &listed = records[index].mtime;
+    if (dir_stat.st_mtim.tv_sec == listed.tv_sec && dir_stat.st_mtim.tv_nsec == listed.tv_nsec) continue;
+
+    // Entries were created, deleted, or renamed since the directory was listed. Watch any new subdirectories.
+    vector<string> added;
+    if (reader.open(absolute) != 0) continue;
+    DirectoryReader::Entry entry{};
+    const unordered_set<string> &known = known_children[index];
+    while (reader.next(entry)) {
+      if (entry.may_be_directory() && known.count(entry.name) == 0) added.emplace_back(entry.name);
     }
 
-    if (by_wd.count(wd) == 0) {
-      int err = inotify_rm_watch(inotify_fd, wd);
-      if (err == -1) {
-        LOGGER << "Unable to remove watch descriptor " << wd << ": " << errno_result<>("") << "." << endl;
+    for (string &name : added) {
+      Result<> add_r = add(channel_id, watched_dir, name, true, poll);
+      if (add_r.is_error()) {
+        LOGGER << "Unable to recurse into " << absolute << "/" << name << ": " << add_r << "." << endl;
       }
     }
+
+    if (snapshots) {
+      WatchSlot *slot = slot_for(watched_dir->get_descriptor());
+      if (slot != nullptr) take_snapshot(*slot, absolute);
+    }
+  }
+}
+
+void WatchRegistry::abandon(WatchCrawl &crawl, MessageBuffer &messages)
+{
+  // Watch descriptors may be shared with other channels or with crawls that are still in progress. Remove only those
+  // that are still unsubscribed once every crawl has finished.
+  for (WatchCrawl::Record &record : crawl.get_records()) {
+    if (record.wd != -1 && slot_for(record.wd) == nullptr) {
+      orphaned_wds.push_back(record.wd);
+    }
+  }
+
+  budget.redeem(crawl.get_allowance());
+
+  LOGGER << "Abandoned crawl on channel " << crawl.get_channel_id() << "." << endl;
+  messages.ack(crawl.get_command_id(), crawl.get_channel_id(), false, "Command cancelled");
+}
+
+Result<> WatchRegistry::remove(ChannelID channel_id)
+{
+  for (shared_ptr<WatchCrawl> &crawl : crawls) {
+    if (crawl->get_channel_id() == channel_id) crawl->cancel();
   }
 
+  budget_split.erase(channel_id);
+
+  auto is_on_channel = [channel_id](const pair<ChannelID, string> &lazy) { return lazy.first == channel_id; };
+  lazy_roots.erase(remove_if(lazy_roots.begin(), lazy_roots.end(), is_on_channel), lazy_roots.end());
+  demoting.erase(remove_if(demoting.begin(), demoting.end(), is_on_channel), demoting.end());
+
+  auto is_promoted_on_channel = [channel_id](WatchedDirectory *top) { return top->get_channel_id() == channel_id; };
+  promoted.erase(remove_if(promoted.begin(), promoted.end(), is_promoted_on_channel), promoted.end());
+
+  auto it = by_channel.find(channel_id);
+  if (it == by_channel.end()) {
+    LOGGER << "Channel " << channel_id << " has no inotify watch descriptors." << endl;
+    return ok_result();
+  }
+
+  vector<unique_ptr<WatchedDirectory>> &watched_dirs = it->second;
+  LOGGER << "Stopping " << plural(watched_dirs.size(), "inotify watch descriptor") << "." << endl;
+
+  for (unique_ptr<WatchedDirectory> &watched_dir : watched_dirs) {
+    int wd = watched_dir->get_descriptor();
+    WatchSlot *slot = slot_for(wd);
+    if (slot == nullptr) continue;
+
+    slot->remove(watched_dir.get());
+    if (!slot->empty()) continue;
+
+    release_slot(wd);
+    int err = inotify_rm_watch(inotify_fd, wd);
+    if (err == -1) {
+      LOGGER << "Unable to remove watch descriptor " << wd << ": " << errno_result<>("") << "." << endl;
+    }
+  }
+
+  by_channel.erase(it);
+
   LOGGER << "Channel " << channel_id << " has been unwatched." << endl;
   return ok_result();
 }
 
+void WatchRegistry::populate_status(Status &status)
+{
+  status.worker_watch_descriptor_count = budget.get_in_use();
+  status.worker_channel_count = by_channel.size();
+  status.worker_watch_limit = budget.get_limit();
+  status.worker_watch_allowance = budget.get_allowance();
+
+  for (auto &pair : budget_split) {
+    status.worker_budget_polled_root_count += pair.second.polled_roots;
+    status.worker_budget_polled_directory_count += pair.second.polled_directories;
+  }
+
+  status.worker_promoted_subtree_count = promoted.size();
+  status.worker_promotion_count = promotion_count;
+  status.worker_demotion_count = demotion_count;
+}
+
+Result<> WatchRegistry::promote(ChannelID channel_id, const string &root, vector<string> &poll)
+{
+  auto it = by_channel.find(channel_id);
+  if (it == by_channel.end() || it->second.empty()) {
+    LOGGER << "Channel " << channel_id << " has been unwatched. Not promoting " << root << "." << endl;
+    return ok_result();
+  }
+
+  size_t slash = root.rfind('/');
+  WatchedDirectory *parent = nullptr;
+  if (slash != string::npos && slash > 0) parent = descend(it->second.front().get(), root.substr(0, slash));
+  if (parent == nullptr || parent->get_descriptor() == -1) {
+    LOGGER << "The parent of " << root << " is no longer watched on channel " << channel_id << ". Not promoting."
+           << endl;
+    return ok_result();
+  }
+
+  LOGGER << "Promoting lazily polled directory " << root << " on channel " << channel_id << "." << endl;
+  return watch(channel_id, parent, root.substr(slash + 1), root, true, true, poll);
+}
+
+void WatchRegistry::demote_idle()
+{
+  steady_clock::time_point now = steady_clock::now();
+
+  vector<WatchedDirectory *> idle;
+  auto is_idle = [&](WatchedDirectory *top) {
+    // The kernel has already released the watch descriptor of a promoted directory that was deleted.
+    if (top->get_descriptor() == -1) return true;
+    if (now - top->get_last_active() < PROMOTION_IDLE_TIMEOUT) return false;
+
+    idle.push_back(top);
+    return true;
+  };
+  promoted.erase(remove_if(promoted.begin(), promoted.end(), is_idle), promoted.end());
+
+  for (WatchedDirectory *top : idle) {
+    demote(top);
+  }
+}
+
+void WatchRegistry::demote(WatchedDirectory *top)
+{
+  ChannelID channel_id = top->get_channel_id();
+  string root(top->get_absolute_path());
+
+  if (top->get_descriptor() == -1) {
+    // The directory is gone, so there's nothing left for its watches to report.
+    unwatch(top);
+  } else {
+    demoting.emplace_back(channel_id, root);
+  }
+
+  LOGGER << "Demoting " << root << " on channel " << channel_id << " to lazy polling after it received no events."
+         << endl;
+  lazy_roots.emplace_back(channel_id, move(root));
+  demotion_count++;
+}
+
+void WatchRegistry::release(ChannelID channel_id, const string &root)
+{
+  auto pending = find(demoting.begin(), demoting.end(), make_pair(channel_id, root));
+  if (pending == demoting.end()) return;
+  demoting.erase(pending);
+
+  auto it = by_channel.find(channel_id);
+  if (it == by_channel.end() || it->second.empty()) return;
+
+  WatchedDirectory *top = descend(it->second.front().get(), root);
+  if (top == nullptr || !top->is_promoted()) {
+    LOGGER << "Demoted directory " << root << " is no longer watched on channel " << channel_id << "." << endl;
+    return;
+  }
+
+  size_t count = unwatch(top);
+  LOGGER << "Released " << plural(count, "directory", "directories") << " beneath " << root << " on channel "
+         << channel_id << " to the polling thread." << endl;
+}
+
+size_t WatchRegistry::unwatch(WatchedDirectory *top)
+{
+  ChannelID channel_id = top->get_channel_id();
+
+  // Gather the subtree breadth-first.
+  vector<WatchedDirectory *> subtree{top};
+  for (size_t i = 0; i < subtree.size(); i++) {
+    const vector<WatchedDirectory *> &children = subtree[i]->get_children();
+    subtree.insert(subtree.end(), children.begin(), children.end());
+  }
+
+  for (WatchedDirectory *watched_dir : subtree) {
+    int wd = watched_dir->get_descriptor();
+    WatchSlot *slot = slot_for(wd);
+    if (slot == nullptr) continue;
+
+    slot->remove(watched_dir);
+    if (!slot->empty()) continue;
+
+    release_slot(wd);
+    if (inotify_rm_watch(inotify_fd, wd) == -1) {
+      LOGGER << "Unable to remove watch descriptor " << wd << ": " << errno_result<>("") << "." << endl;
+    }
+  }
+  top->was_ignored();
+
+  unordered_set<WatchedDirectory *> doomed(subtree.begin(), subtree.end());
+  vector<unique_ptr<WatchedDirectory>> &owned = by_channel[channel_id];
+  auto is_doomed = [&doomed](const unique_ptr<WatchedDirectory> &watched_dir) {
+    return doomed.count(watched_dir.get()) != 0;
+  };
+  auto is_doomed_top = [&doomed](WatchedDirectory *promoted_top) { return doomed.count(promoted_top) != 0; };
+  promoted.erase(remove_if(promoted.begin(), promoted.end(), is_doomed_top), promoted.end());
+  owned.erase(remove_if(owned.begin(), owned.end(), is_doomed), owned.end());
+
+  return subtree.size();
+}
+
+Result<> WatchRegistry::reload_ignore_rules(ChannelID channel_id, const string &dir, vector<string> &poll)
+{
+  shared_ptr<IgnoreRules> rules = filters.get_ignore_rules(channel_id);
+  if (!rules) return ok_result();
+
+  auto it = by_channel.find(channel_id);
+  WatchedDirectory *top = nullptr;
+  if (it != by_channel.end() && !it->second.empty()) top = descend(it->second.front().get(), dir);
+  if (top == nullptr || top->get_descriptor() == -1 || !top->is_recursive()) {
+    rules->reload(dir);
+    return ok_result();
+  }
+
+  LOGGER << "Ignore files within " << dir << " have changed on channel " << channel_id << "." << endl;
+
+  // Before the new rules are read, list the watched subtree to find the subdirectories that the old rules excluded.
+  vector<WatchedDirectory *> subtree{top};
+  vector<pair<WatchedDirectory *, string>> excluded;
+  for (size_t i = 0; i < subtree.size(); i++) {
+    WatchedDirectory *watched_dir = subtree[i];
+    const string &absolute = watched_dir->get_absolute_path();
+
+    int open_errno = reader.open(absolute);
+    if (open_errno != 0) continue;
+
+    DirectoryReader::Entry entry{};
+    while (reader.next(entry)) {
+      if (!entry.may_be_directory()) continue;
+
+      string name(entry.name);
+      WatchedDirectory *child = nullptr;
+      for (WatchedDirectory *candidate : watched_dir->get_children()) {
+        if (candidate->get_name() == name) child = candidate;
+      }
+
+      if (child != nullptr) {
+        subtree.push_back(child);
+      } else if (filters.excludes(channel_id, absolute + "/" + name, true)) {
+        excluded.emplace_back(watched_dir, move(name));
+      }
+    }
+  }
+
+  rules->reload(dir);
+
+  // Watch the subdirectories that the new rules no longer exclude.
+  for (pair<WatchedDirectory *, string> &formerly : excluded) {
+    Result<> r = add(channel_id, formerly.first, formerly.second, true, poll);
+    if (r.is_error()) {
+      LOGGER << "Unable to watch " << formerly.first->get_absolute_path() << "/" << formerly.second << ": " << r << "."
+             << endl;
+    }
+  }
+
+  // Stop watching the outermost subdirectories that the new rules exclude.
+  vector<WatchedDirectory *> doomed;
+  for (size_t i = 1; i < subtree.size(); i++) {
+    WatchedDirectory *watched_dir = subtree[i];
+    WatchedDirectory *parent = watched_dir->get_parent();
+    if (!filters.excludes(channel_id, watched_dir->get_absolute_path(), true)) continue;
+    if (parent != top && filters.excludes(channel_id, parent->get_absolute_path(), true)) continue;
+
+    doomed.push_back(watched_dir);
+  }
+  for (WatchedDirectory *watched_dir : doomed) {
+    LOGGER << "Not watching newly ignored directory " << watched_dir->get_absolute_path() << "." << endl;
+    watched_dir->get_parent()->mark_incomplete();
+    unwatch(watched_dir);
+  }
+
+  return ok_result();
+}
+
+void WatchRegistry::flush_lazy_roots(MessageBuffer &messages)
+{
+  for (pair<ChannelID, string> &lazy : lazy_roots) {
+    messages.add(Message(CommandPayloadBuilder::add(lazy.first, move(lazy.second), true, 1)
+                           .set_lazy(true)
+                           .set_filter(filters.get(lazy.first))
+                           .build()));
+  }
+  lazy_roots.clear();
+}
+
+void WatchRegistry::note_activity(WatchedDirectory *watched_dir, steady_clock::time_point now)
+{
+  for (WatchedDirectory *current = watched_dir; current != nullptr; current = current->get_parent()) {
+    if (current->is_promoted()) {
+      current->mark_active(now);
+      return;
+    }
+  }
+}
+
 Result<> WatchRegistry::consume(MessageBuffer &messages, CookieJar &jar, RecentFileCache &cache)
 {
   Timer t;
-  const size_t BUFSIZE = 2048 * sizeof(inotify_event);
-  char buf[BUFSIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
-  ssize_t result = 0;
   size_t batch_count = 0;
   size_t event_count = 0;
+  size_t byte_count = 0;
+  bool overflowed = false;
 
   while (true) {
-    result = read(inotify_fd, &buf, BUFSIZE);
+    // Size each read to drain everything the kernel has queued so far, so that bursts are consumed in as few read()
+    // calls as possible.
+    int available = 0;
+    if (ioctl(inotify_fd, FIONREAD, &available) == -1) {
+      return errno_result<>("Unable to query queued inotify event size");
+    }
+
+    ssize_t result = 0;
+    if (available > 0) {
+      size_t wanted = static_cast<size_t>(available) < MIN_READ_SIZE ? MIN_READ_SIZE : static_cast<size_t>(available);
+      if (read_buffer.size() < wanted) read_buffer.resize(wanted);
+
+      result = read(inotify_fd, read_buffer.data(), read_buffer.size());
+    }
 
     if (result <= 0) {
-      jar.flush_oldest_batch(messages, cache);
+      jar.flush_expired(messages, cache);
+      if (overflowed && snapshots) {
+        resync(messages, cache, last_drained);
+      } else if (overflowed) {
+        report_lost_events(messages, "The inotify event queue overflowed. Some events have been lost.");
+      }
+      clock_gettime(CLOCK_REALTIME, &last_drained);
 
       t.stop();
       LOGGER << plural(batch_count, "filesystem event batch", "filesystem event batches") << " containing "
-             << plural(event_count, "event") << " completed. " << plural(messages.size(), "message") << " produced in "
-             << t << "." << endl;
+             << plural(event_count, "event") << " in " << plural(byte_count, "byte") << " completed. "
+             << plural(messages.size(), "message") << " produced in " << t << "." << endl;
     }
 
     if (result < 0) {
@@ -256,40 +1295,311 @@ Result<> WatchRegistry::consume(MessageBuffer &messages, CookieJar &jar, RecentF
       return ok_result();
     }
 
-    // At least one inotify event to read.
+    // At least one inotify event to read. Decode each in place within the read buffer.
     batch_count++;
-    char *current = buf;
-    inotify_event *event = nullptr;
-    while (current < buf + result) {
-      event = reinterpret_cast<inotify_event *>(current);
+    byte_count += result;
+    const char *current = read_buffer.data();
+    const char *end = current + result;
+    prefetch(current, end, cache);
+    while (current < end) {
+      const inotify_event *event = reinterpret_cast<const inotify_event *>(current);
       current += sizeof(inotify_event) + event->len;
 
-      LOGGER << "Received inotify event: " << event << "." << endl;
-
       if ((event->mask & IN_Q_OVERFLOW) == IN_Q_OVERFLOW) {
         LOGGER << "Event queue overflow. Some events have been missed." << endl;
+        overflowed = true;
         continue;
       }
 
-      auto its = by_wd.equal_range(event->wd);
-      if (its.first == by_wd.end() && its.second == by_wd.end()) {
-        LOGGER << "Received event for unknown watch descriptor " << event->wd << "." << endl;
-        continue;
+      if (dispatch(event, messages, jar, cache)) event_count++;
+    }
+  }
+}
+
+void WatchRegistry::prefetch(const char *begin, const char *end, RecentFileCache &cache)
+{
+  // Mirror the cases in which classify() stats an entry.
+  prefetch_paths.clear();
+  for (const char *current = begin; current < end;) {
+    const inotify_event *event = reinterpret_cast<const inotify_event *>(current);
+    current += sizeof(inotify_event) + event->len;
+
+    if (event->len == 0 || (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_IGNORED | IN_Q_OVERFLOW)) != 0u) continue;
+
+    WatchSlot *slot = slot_for(event->wd);
+    if (slot == nullptr) continue;
+
+    bool want_inode = slot->snapshot.is_taken() && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0u;
+    if ((event->mask & IN_ISDIR) == IN_ISDIR && !want_inode) continue;
+
+    string path = slot->at(0)->event_path(*event);
+    if (cache.present_at_path(path)) continue;
+    prefetch_paths.push_back(move(path));
+  }
+
+  // Repeated events about the same entry are common.
+  sort(prefetch_paths.begin(), prefetch_paths.end());
+  prefetch_paths.erase(unique(prefetch_paths.begin(), prefetch_paths.end()), prefetch_paths.end());
+
+  // A lone entry gains nothing from a batch, so leave it to classify().
+  if (prefetch_paths.size() < 2) return;
+
+  cache.prefetch(stats, prefetch_paths);
+}
+
+bool WatchRegistry::dispatch(const inotify_event *event,
+  MessageBuffer &messages,
+  CookieJar &jar,
+  RecentFileCache &cache)
+{
+  WatchSlot *slot = slot_for(event->wd);
+  if (slot == nullptr) {
+    if (!crawls.empty()) {
+      // This watch descriptor may have been installed by a crawl that hasn't been merged yet.
+      size_t length = sizeof(inotify_event) + event->len;
+      if (deferred_events.size() + length > MAX_DEFERRED_EVENT_BYTES) {
+        if (!deferred_overflow) {
+          LOGGER << "Too many events deferred while crawls are running. Some events have been missed." << endl;
+          deferred_overflow = true;
+          deferred_since = last_drained;
+        }
+        return false;
+      }
+
+      const char *raw = reinterpret_cast<const char *>(event);
+      deferred_events.insert(deferred_events.end(), raw, raw + length);
+      return false;
+    }
+
+    LOGGER << "Received event for unknown watch descriptor: " << event << "." << endl;
+    return false;
+  }
+
+  if ((event->mask & IN_IGNORED) == IN_IGNORED) {
+    // The directory is gone and the kernel has already released its watch descriptor.
+    for (uint32_t i = 0; i < slot->size(); i++) {
+      slot->at(i)->was_ignored();
+    }
+    release_slot(event->wd);
+    return true;
+  }
+
+  // Resolve the event's path and kind once on behalf of every subscriber. Subscribers on different channels usually
+  // see the directory at the same path, unless one of them reached it through a symlinked root.
+  WatchedDirectory *first = slot->at(0);
+  string path = first->event_path(*event);
+  bool snapshot = slot->snapshot.is_taken() && event->len > 0;
+  uint64_t inode = 0;
+  EntryKind kind = classify(*event, path, cache, snapshot && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0u, inode);
+
+  if (snapshot) {
+    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0u) {
+      slot->snapshot.add(event->name, inode, kind);
+    } else if ((event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0u) {
+      slot->snapshot.remove(event->name);
+    }
+  }
+
+  // Deliver the event to each subscribed channel, then apply their combined SideEffect. Only the SideEffect
+  // modifies the registry, so the WatchSlot remains valid throughout the fan-out.
+  SideEffect side;
+  string own_path;
+  steady_clock::time_point now;
+  if (!promoted.empty()) now = steady_clock::now();
+  for (uint32_t i = 0; i < slot->size(); i++) {
+    WatchedDirectory *subscriber = slot->at(i);
+    if (!promoted.empty()) note_activity(subscriber, now);
+    bool shared = i == 0 || subscriber->get_absolute_path() == first->get_absolute_path();
+    if (!shared) own_path = subscriber->event_path(*event);
+
+    Result<> r = subscriber->accept_event(messages, jar, side, *event, shared ? path : own_path, kind);
+    if (r.is_error()) LOGGER << "Unable to process event: " << r << "." << endl;
+  }
+  side.enact_in(this, messages);
+  return true;
+}
+
+void WatchRegistry::resync(MessageBuffer &messages, RecentFileCache &cache, const timespec &drained)
+{
+  Timer t;
+  size_t count = 0;
+
+  // The kernel stamps entries from a coarse clock that may lag CLOCK_REALTIME by a scheduler tick. Allow for that when
+  // deciding which entries may have been modified while events were being lost.
+  timespec since = drained;
+  since.tv_nsec -= 20 * 1000 * 1000;
+  if (since.tv_nsec < 0) {
+    since.tv_sec -= 1;
+    since.tv_nsec += 1000 * 1000 * 1000;
+  }
+
+  // New subdirectories are watched once every directory has been reconciled, so that the table of slots remains
+  // stable throughout.
+  SideEffect side;
+  for (size_t wd = 0; wd < slot_by_wd.size(); wd++) {
+    WatchSlot *slot = slot_for(static_cast<int>(wd));
+    if (slot == nullptr || slot->empty() || !slot->snapshot.is_taken()) continue;
+
+    count++;
+    if (resync_directory(*slot, since, messages, side, cache)) continue;
+
+    // The directory is gone. Its IN_IGNORED event may have been lost along with the rest.
+    for (uint32_t i = 0; i < slot->size(); i++) {
+      WatchedDirectory *subscriber = slot->at(i);
+      if (subscriber->is_root()) {
+        side.remove_channel(subscriber->get_channel_id());
+        messages.deleted(subscriber->get_channel_id(), string(subscriber->get_absolute_path()), KIND_DIRECTORY);
       }
+      subscriber->was_ignored();
+    }
+    release_slot(static_cast<int>(wd));
+    inotify_rm_watch(inotify_fd, static_cast<int>(wd));
+  }
+  side.enact_in(this, messages);
+
+  for (auto &pair : by_channel) {
+    if (pair.second.empty()) continue;
+
+    WatchedDirectory *root = pair.second.front().get();
+    if (!root->is_root() || root->get_descriptor() == -1) continue;
+    messages.resynced(pair.first, string(root->get_absolute_path()));
+  }
+
+  t.stop();
+  LOGGER << "Resynchronized " << plural(count, "watched directory", "watched directories") << " after an event queue "
+         << "overflow in " << t << "." << endl;
+}
+
+bool WatchRegistry::resync_directory(WatchSlot &slot,
+  const timespec &since,
+  MessageBuffer &messages,
+  SideEffect &side,
+  RecentFileCache &cache)
+{
+  string dir_path = slot.at(0)->get_absolute_path();
 
-      event_count++;
+  int open_errno = reader.open(dir_path);
+  if (open_errno == ENOENT || open_errno == ENOTDIR) return false;
+  if (open_errno != 0) {
+    LOGGER << "Unable to resync directory " << dir_path << ": " << errno_result<>("", open_errno) << "." << endl;
+    return true;
+  }
+
+  DirectorySnapshot::Entries current;
+  DirectoryReader::Entry entry{};
+  while (reader.next(entry)) {
+    current.emplace(entry.name, DirectorySnapshot::Entry{entry.ino, DirectorySnapshot::kind_of(entry.type)});
+  }
+  if (reader.get_errno() != 0) {
+    LOGGER << "Unable to resync directory " << dir_path << ": " << errno_result<>("", reader.get_errno()) << "."
+           << endl;
+    return true;
+  }
 
-      vector<shared_ptr<WatchedDirectory>> watched_directories;
-      for (auto it = its.first; it != its.second; ++it) {
-        watched_directories.emplace_back(it->second);
+  using Change = pair<string, DirectorySnapshot::Entry>;
+  const DirectorySnapshot::Entries &previous = slot.snapshot.get_entries();
+  vector<Change> deleted;
+  vector<Change> created;
+  vector<Change> modified;
+  vector<pair<Change, Change>> renamed;
+
+  for (const auto &prior : previous) {
+    auto it = current.find(prior.first);
+    if (it == current.end() || was_replaced(prior.second, it->second)) deleted.emplace_back(prior);
+  }
+
+  for (auto &now : current) {
+    auto it = previous.find(now.first);
+    bool is_new = it == previous.end() || was_replaced(it->second, now.second);
+
+    // Surviving subdirectories are reconciled through their own snapshots. Other surviving entries are reported as
+    // modified if their timestamps moved while events were being lost.
+    if (!is_new && now.second.kind == KIND_DIRECTORY) continue;
+
+    struct stat st {};
+    string entry_path(dir_path + "/" + now.first);
+    if (lstat(entry_path.c_str(), &st) != 0) continue;
+    if (now.second.kind == KIND_UNKNOWN) {
+      if (S_ISDIR(st.st_mode)) {
+        now.second.kind = KIND_DIRECTORY;
+      } else if (S_ISLNK(st.st_mode)) {
+        now.second.kind = KIND_SYMLINK;
+      } else {
+        now.second.kind = KIND_FILE;
       }
+    }
+
+    if (is_new) {
+      created.emplace_back(now);
+    } else if (at_or_after(st.st_mtim, since) || at_or_after(st.st_ctim, since)) {
+      modified.emplace_back(now);
+    }
+  }
+
+  // An inode that vanished under one name and appeared under another was renamed within this directory.
+  unordered_map<uint64_t, size_t> deleted_by_inode;
+  for (size_t i = 0; i < deleted.size(); i++) {
+    if (deleted[i].second.ino != 0) deleted_by_inode.emplace(deleted[i].second.ino, i);
+  }
+  vector<bool> deleted_live(deleted.size(), true);
+  for (auto it = created.begin(); it != created.end();) {
+    auto match = deleted_by_inode.find(it->second.ino);
+    if (it->second.ino == 0 || match == deleted_by_inode.end() || !deleted_live[match->second]) {
+      ++it;
+      continue;
+    }
+
+    deleted_live[match->second] = false;
+    renamed.emplace_back(deleted[match->second], move(*it));
+    it = created.erase(it);
+  }
 
-      for (shared_ptr<WatchedDirectory> &watched_directory : watched_directories) {
-        SideEffect side;
-        Result<> r = watched_directory->accept_event(messages, jar, side, cache, *event);
-        if (r.is_error()) LOGGER << "Unable to process event: " << r << "." << endl;
-        side.enact_in(watched_directory, this, messages);
+  for (uint32_t i = 0; i < slot.size(); i++) {
+    WatchedDirectory *subscriber = slot.at(i);
+    ChannelID channel_id = subscriber->get_channel_id();
+    string base = subscriber->get_absolute_path() + "/";
+
+    for (size_t j = 0; j < deleted.size(); j++) {
+      if (!deleted_live[j]) continue;
+      string path = base + deleted[j].first;
+      if (deleted[j].second.kind == KIND_DIRECTORY) {
+        cache.evict_subtree(path);
+      } else {
+        cache.evict(path);
+      }
+      messages.deleted(channel_id, move(path), deleted[j].second.kind);
+    }
+
+    for (pair<Change, Change> &rename : renamed) {
+      string old_path = base + rename.first.first;
+      if (rename.second.second.kind == KIND_DIRECTORY) {
+        cache.update_for_rename(old_path, base + rename.second.first);
+      } else {
+        cache.evict(old_path);
+      }
+      messages.renamed(channel_id, move(old_path), base + rename.second.first, rename.second.second.kind);
+
+      if (rename.second.second.kind != KIND_DIRECTORY) continue;
+      for (WatchedDirectory *child : subscriber->get_children()) {
+        if (child->get_name() == rename.first.first) {
+          child->was_renamed(subscriber, rename.second.first);
+          break;
+        }
       }
     }
+
+    for (Change &change : created) {
+      if (change.second.kind == KIND_DIRECTORY && subscriber->is_recursive()) {
+        side.track_subdirectory(subscriber, change.first, channel_id);
+      }
+      messages.created(channel_id, base + change.first, change.second.kind);
+    }
+
+    for (Change &change : modified) {
+      messages.modified(channel_id, base + change.first, change.second.kind);
+    }
   }
+
+  slot.snapshot.replace(move(current));
+  return true;
 }
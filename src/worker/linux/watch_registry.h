@@ -1,33 +1,58 @@
 #ifndef WATCHER_REGISTRY_H
 #define WATCHER_REGISTRY_H
 
+#include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <memory>
 #include <string>
 #include <sys/inotify.h>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../../errable.h"
+#include "../../helper/linux/directory_reader.h"
+#include "../../ignore_rules.h"
 #include "../../message_buffer.h"
+#include "../../path_filter.h"
 #include "../../result.h"
+#include "../../stat_engine.h"
+#include "../../status.h"
+#include "../../thread_pool.h"
 #include "../recent_file_cache.h"
 #include "cookie_jar.h"
+#include "directory_snapshot.h"
+#include "event_fd.h"
 #include "side_effect.h"
+#include "watch_budget.h"
+#include "watch_crawl.h"
 #include "watched_directory.h"
 
+// Promoted subtrees that receive no events for this long are returned to lazy polling.
+const std::chrono::milliseconds PROMOTION_IDLE_TIMEOUT(60000);
+
 // Manage the set of open inotify watch descriptors.
+//
+// With a watch depth configured, only the top levels of each recursive root are watched. Deeper subtrees are handed
+// to the polling thread as lazy roots. When the polling thread sees one change, it's promoted back to a fully watched
+// subtree here; promoted subtrees that fall quiet are demoted to lazy polling again. A demoted subtree stays watched
+// until the polling thread releases it after its first complete scan, so that neither hand-off leaves a gap.
+//
+// Directories excluded by a channel's PathFilter or ignored by its IgnoreRules within `filters` are never watched on
+// that channel.
 class WatchRegistry : public Errable
 {
 public:
-  // Initialize inotify. Enter an error state if inotify initialization fails.
-  WatchRegistry();
+  // Initialize inotify. Enter an error state if inotify initialization fails. `filters` must outlive the registry.
+  explicit WatchRegistry(const PathFilterTable &filters);
 
   // Stop inotify and release all kernel resources associated with it.
   ~WatchRegistry() override;
 
-  // Begin watching a root path. If `recursive` is `true`, recursively watch all subdirectories as well. If inotify
-  // watch descriptors are exhausted before the entire directory tree can be watched, the unsuccessfully watched roots
-  // will be accumulated into the `poll` vector.
+  // Begin watching a root path. If `recursive` is `true`, recursively watch all subdirectories as well. If the tree
+  // doesn't fit within the WatchBudget, or inotify watch descriptors are exhausted before the entire directory tree can
+  // be watched, the roots of the subtrees that should be polled instead will be accumulated into the `poll` vector.
   //
   // `root` must name a directory if `recursive` is `true`.
   Result<> add(ChannelID channel_id, const std::string &root, bool recursive, std::vector<std::string> &poll)
@@ -37,37 +62,340 @@ public:
 
   // Begin watching path beneath an existing WatchedDirectory. If `recursive` is `true`, recursively watch all
   // subdirectories as well. If inotify watch descriptors are exhausted before the entire directory tree can be watched,
-  // the unsuccessfully watched roots will be accumulated into the `poll` vector.
+  // the unsuccessfully watched roots will be accumulated into the `poll` vector. If the path lies beneath the watch
+  // depth, it's queued as a lazy root instead.
   //
   // `root` must name a directory if `recursive` is `true`.
   Result<> add(ChannelID channel_id,
-    const std::shared_ptr<WatchedDirectory> &parent,
+    WatchedDirectory *parent,
     const std::string &name,
     bool recursive,
     std::vector<std::string> &poll);
 
-  // Uninstall inotify watchers used to deliver events on a specified channel.
+  // Begin watching a root path recursively, installing watches from the threads of `pool` instead of the calling
+  // thread. When the traversal completes, collect_crawls() merges its results and buffers the ack for `command_id`,
+  // or ADD commands for the subtrees that should be polled.
+  void add_parallel(ChannelID channel_id, CommandID command_id, std::string &&root, ThreadPool &pool);
+
+  // Merge the results of each completed parallel traversal into the registry. Buffer an ack for each, or ADD commands
+  // for subtrees that must be polled instead. Then deliver any inotify events that arrived for the new watch
+  // descriptors before they were merged.
+  Result<> collect_crawls(MessageBuffer &messages, CookieJar &jar, RecentFileCache &cache);
+
+  // Return true if `root` is already watched as part of a recursive tree on some channel, so that adding it can copy
+  // that tree's structure rather than traverse the filesystem again.
+  bool covers(const std::string &root);
+
+  // Return true if any parallel traversals are still running.
+  bool has_pending_crawls() const { return !crawls.empty(); }
+
+  // Cancel every parallel traversal that's still running, so that the ThreadPool executing them can be shut down
+  // without visiting the rest of their subtrees.
+  void cancel_crawls();
+
+  // Uninstall inotify watchers used to deliver events on a specified channel. Cancel any parallel traversal still
+  // running for it.
   Result<> remove(ChannelID channel_id);
 
   // Interpret all inotify events created since the previous call to consume(), until the
-  // read() call would block. Buffer messages corresponding to each inotify event. Use the
-  // CookieJar to match pairs of rename events across event batches and the RecentFileCache to
-  // identify symlinks without doing a stat for every event.
+  // inotify queue is empty. Each read() is sized with FIONREAD to drain everything queued so far.
+  // Buffer messages corresponding to each inotify event. Use the CookieJar to match pairs of
+  // rename events within its rename window and the RecentFileCache to identify symlinks without
+  // doing a stat for every event.
+  //
+  // If the inotify queue overflowed, events have been lost on every channel. With snapshots enabled, rescan every
+  // watched directory, buffer the events that reconcile each channel with its current contents, and follow them with
+  // a resynced event on each channel. Otherwise, buffer an error on each channel.
   Result<> consume(MessageBuffer &messages, CookieJar &jar, RecentFileCache &cache);
 
+  // Choose whether to keep a DirectorySnapshot of every watched directory, for recovery from queue overflows. Enabling
+  // snapshots lists every directory that's already watched.
+  void enable_snapshots(bool enabled);
+
+  // Watch only `depth` levels of directories beneath each recursive root that's added from now on, or every level if
+  // `depth` is zero.
+  void set_watch_depth(size_t depth) { watch_depth = depth; }
+
+  // Recursively watch `root`, a lazily polled subtree of `channel_id` that has changed. Its subdirectories are watched
+  // regardless of the watch depth. Roots that must be polled to remain within the WatchBudget are accumulated in
+  // `poll`.
+  Result<> promote(ChannelID channel_id, const std::string &root, std::vector<std::string> &poll);
+
+  // Return every promoted subtree that has received no events within PROMOTION_IDLE_TIMEOUT to lazy polling.
+  void demote_idle();
+
+  // Stop watching the demoted subtree at `root` now that the polling thread covers it. Roots that aren't awaiting
+  // release on `channel_id` are ignored.
+  void release(ChannelID channel_id, const std::string &root);
+
+  // Return true if any promoted subtrees remain watched.
+  bool has_promoted() const { return !promoted.empty(); }
+
+  // Buffer an ADD command for the polling thread for each lazy root queued since the last call.
+  void flush_lazy_roots(MessageBuffer &messages);
+
+  // Reread the ignore files within `dir` on `channel_id`. Stop watching the subdirectories beneath it that are now
+  // ignored, and watch those that no longer are. Roots that must be polled to remain within the WatchBudget are
+  // accumulated in `poll`.
+  Result<> reload_ignore_rules(ChannelID channel_id, const std::string &dir, std::vector<std::string> &poll);
+
+  // Access the PathFilter that subtrees of a channel handed to the polling thread must carry, or null if the channel
+  // is unfiltered.
+  std::shared_ptr<const PathFilter> filter_for(ChannelID channel_id) const { return filters.get(channel_id); }
+
+  // Report watch descriptor usage and the split between watched and polled directories.
+  void populate_status(Status &status);
+
   // Return the file descriptor that should be polled to wake up when inotify events are
   // available.
   int get_read_fd() { return inotify_fd; }
 
+  // Return the file descriptor that becomes readable when a parallel traversal completes.
+  int get_crawl_fd() { return crawl_done.get_fd(); }
+
   WatchRegistry(const WatchRegistry &) = delete;
   WatchRegistry(WatchRegistry &&) = delete;
   WatchRegistry &operator=(const WatchRegistry &) = delete;
   WatchRegistry &operator=(WatchRegistry &&) = delete;
 
 private:
+  // Number of subscribers to a single watch descriptor that are stored without a separate allocation.
+  static const uint32_t INLINE_SUBSCRIBERS = 2;
+
+  // The WatchedDirectories, at most one per channel, that receive events delivered to a single watch descriptor.
+  // Nearly every directory is watched by only one or two channels, so those are stored inline.
+  class WatchSlot
+  {
+  public:
+    WatchSlot() = default;
+
+    WatchedDirectory *at(uint32_t i) const
+    {
+      return i < INLINE_SUBSCRIBERS ? inline_subscribers[i] : overflow[i - INLINE_SUBSCRIBERS];
+    }
+
+    // Return the subscriber on `channel_id`, or nullptr if that channel is not subscribed.
+    WatchedDirectory *find(ChannelID channel_id) const;
+
+    void add(WatchedDirectory *subscriber);
+
+    void remove(WatchedDirectory *subscriber);
+
+    uint32_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    // Forget every subscriber and the snapshot so that this slot can be reused for another watch descriptor.
+    void clear();
+
+    // Entries of the directory, if snapshots are enabled.
+    DirectorySnapshot snapshot;
+
+  private:
+    WatchedDirectory *&ref(uint32_t i)
+    {
+      return i < INLINE_SUBSCRIBERS ? inline_subscribers[i] : overflow[i - INLINE_SUBSCRIBERS];
+    }
+
+    uint32_t count{0};
+    WatchedDirectory *inline_subscribers[INLINE_SUBSCRIBERS]{};
+    std::vector<WatchedDirectory *> overflow;
+  };
+
+  // Subscribe a channel to events from an inotify watch descriptor. If the channel is already subscribed to `wd`, the
+  // directory must have been moved beneath `parent`: update and return the existing WatchedDirectory, and set `created`
+  // to false.
+  WatchedDirectory *subscribe(ChannelID channel_id,
+    int wd,
+    WatchedDirectory *parent,
+    const std::string &name,
+    bool recursive,
+    bool &created);
+
+  // Install a watch for the directory at `absolute`, named `name` within `parent`, and subscribe `channel_id` to it.
+  // Recurse into its subdirectories if `recursive` is `true`. If `promote` is true, mark it as the top of a promoted
+  // subtree before recursing.
+  Result<> watch(ChannelID channel_id,
+    WatchedDirectory *parent,
+    const std::string &name,
+    const std::string &absolute,
+    bool recursive,
+    bool promote,
+    std::vector<std::string> &poll);
+
+  // Return true if subdirectories of `parent` lie beneath the watch depth.
+  bool is_beyond_watch_depth(WatchedDirectory *parent);
+
+  // Follow the children of `top` to the directory at `path`. Return nullptr if `path` is not beneath `top` or any
+  // directory along the way is not watched.
+  WatchedDirectory *descend(WatchedDirectory *top, const std::string &path);
+
+  // Stamp the promoted subtree containing `watched_dir`, if any, as active at `now`.
+  void note_activity(WatchedDirectory *watched_dir, std::chrono::steady_clock::time_point now);
+
+  // Queue a promoted subtree as a lazy root. Its watches remain until the polling thread releases it.
+  void demote(WatchedDirectory *top);
+
+  // Stop watching `top` and every directory beneath it on its channel. Return the number of directories released.
+  size_t unwatch(WatchedDirectory *top);
+
+  // Create the IgnoreRules that a crawl on `channel_id` should use, or null if the channel doesn't honor ignore files.
+  std::shared_ptr<IgnoreRules> crawl_ignore_rules(ChannelID channel_id);
+
+  // Recursively watch every subdirectory beneath `watched_dir`, listing each directory to discover them.
+  Result<> populate(ChannelID channel_id, WatchedDirectory *watched_dir, std::vector<std::string> &poll);
+
+  // Subscribe `channel_id` to the watch descriptors of every subdirectory of `source`, a directory already watched
+  // recursively on another channel, attaching them beneath `dest`. Fall back to populate() wherever the structure of
+  // `source` is incomplete.
+  void mirror(ChannelID channel_id, WatchedDirectory *source, WatchedDirectory *dest, std::vector<std::string> &poll);
+
+  // Cache the lstat() results of every entry that classifying the events within [begin, end) would examine, fetching
+  // them together in a single batch.
+  void prefetch(const char *begin, const char *end, RecentFileCache &cache);
+
+  // Deliver a single inotify event to each channel subscribed to its watch descriptor. The event's path and entry
+  // kind are resolved once and shared by every subscriber on the same directory. Return false if no channel is
+  // subscribed.
+  bool dispatch(const inotify_event *event, MessageBuffer &messages, CookieJar &jar, RecentFileCache &cache);
+
+  // List the directory at `path` into the snapshot of `slot`.
+  void take_snapshot(WatchSlot &slot, const std::string &path);
+
+  // Compare every watched directory against its snapshot and buffer events for the differences. Entries modified since
+  // `drained`, the last time that no events were lost, are reported as modified. Buffer a resynced event for each
+  // channel once its directories have been reconciled.
+  void resync(MessageBuffer &messages, RecentFileCache &cache, const timespec &drained);
+
+  // Recover from raw inotify events that were dropped because too many were deferred while traversals were running.
+  // With snapshots enabled, resync every watched directory. Otherwise, buffer an error on each channel.
+  void recover_deferred_overflow(MessageBuffer &messages, RecentFileCache &cache);
+
+  // Buffer a non-fatal error with `description` on every channel that still has watched directories, so that clients
+  // know to rescan.
+  void report_lost_events(MessageBuffer &messages, const std::string &description);
+
+  // Reconcile a single watched directory with its snapshot. Entries modified at or after `since` are reported as
+  // modified. Return false if the directory no longer exists.
+  bool resync_directory(WatchSlot &slot,
+    const timespec &since,
+    MessageBuffer &messages,
+    SideEffect &side,
+    RecentFileCache &cache);
+
+  // List and watch a new recursive root on the calling thread.
+  Result<> add_inline(ChannelID channel_id, const std::string &root, std::vector<std::string> &poll);
+
+  // Install the watches discovered by a completed WatchCrawl and buffer an ack or ADD commands for polled subtrees.
+  void merge(WatchCrawl &crawl, MessageBuffer &messages);
+
+  // Subscribe to the watches installed by a completed WatchCrawl. If the crawl deferred any directories, choose the
+  // subtrees to poll with the WatchBudget, accumulate them in `poll`, and watch the rest. Return an error if the crawl
+  // root could not be watched.
+  Result<> install(WatchCrawl &crawl, std::vector<std::string> &poll);
+
+  // Directories in `unlisted` were listed by a crawl before they were watched. Watch any subdirectories created in
+  // between.
+  void recover_unlisted(ChannelID channel_id,
+    std::vector<WatchCrawl::Record> &records,
+    std::vector<WatchedDirectory *> &merged,
+    std::vector<size_t> &unlisted,
+    std::vector<std::string> &poll);
+
+  // Remove a watch that was installed by a crawl but will not be used, unless another channel shares it.
+  void discard_watch(int wd);
+
+  // Discard the results of a cancelled WatchCrawl.
+  void abandon(WatchCrawl &crawl, MessageBuffer &messages);
+
+  // Locate the WatchSlot for a watch descriptor, or return nullptr if it is not in use.
+  WatchSlot *slot_for(int wd)
+  {
+    if (wd < 0 || static_cast<size_t>(wd) >= slot_by_wd.size()) return nullptr;
+    uint32_t index = slot_by_wd[wd];
+    return index == 0 ? nullptr : &slots[index - 1];
+  }
+
+  // Locate or allocate the WatchSlot for a watch descriptor.
+  WatchSlot &claim_slot(int wd);
+
+  // Return a WatchSlot that no longer has any subscribers to the free list.
+  void release_slot(int wd);
+
   int inotify_fd;
-  std::unordered_multimap<int, std::shared_ptr<WatchedDirectory>> by_wd;
-  std::unordered_multimap<ChannelID, std::shared_ptr<WatchedDirectory>> by_channel;
+
+  // PathFilters of each filtered channel, owned by the worker platform.
+  const PathFilterTable &filters;
+
+  // Dense table indexed directly by watch descriptor, containing one more than the index of its WatchSlot within
+  // `slots`, or 0 if the descriptor is unused. The kernel hands out watch descriptors as small, increasing integers,
+  // so this stays compact; trailing unused entries are trimmed as descriptors are released.
+  std::vector<uint32_t> slot_by_wd;
+  std::vector<WatchSlot> slots;
+  std::vector<uint32_t> free_slots;
+
+  // Owns every WatchedDirectory, grouped by the channel it broadcasts on. A channel's directories are always
+  // released together, so WatchSlots and child directories may safely hold raw pointers to them.
+  std::unordered_map<ChannelID, std::vector<std::unique_ptr<WatchedDirectory>>> by_channel;
+
+  // Parallel traversals that have not yet been merged, and the EventFd they signal on completion.
+  std::vector<std::shared_ptr<WatchCrawl>> crawls;
+  EventFd crawl_done;
+
+  // Raw inotify events received for unknown watch descriptors while traversals were running, to be replayed once they
+  // have been merged. Events beyond MAX_DEFERRED_EVENT_BYTES are dropped, and `deferred_overflow` is set until every
+  // traversal has been merged and the loss recovered from. `deferred_since` holds `last_drained` from when the first
+  // event was dropped.
+  std::vector<char> deferred_events;
+  bool deferred_overflow;
+  timespec deferred_since;
+
+  // Watch descriptors installed by cancelled traversals. Removed from inotify once every traversal has finished if no
+  // channel has subscribed to them in the meantime.
+  std::vector<int> orphaned_wds;
+
+  // Reused across consume() calls. Grown as needed to hold the largest backlog of queued events seen so far.
+  std::vector<char> read_buffer;
+
+  // lstat()s the entries named by each read() of inotify events together.
+  StatEngine stats;
+
+  // Reused across prefetch() calls.
+  std::vector<std::string> prefetch_paths;
+
+  // Lists directory entries during synchronous recursive add() calls.
+  DirectoryReader reader;
+
+  // Watch descriptors in use and the per-user limit.
+  WatchBudget budget;
+
+  // Subtrees of each channel that are polled to remain within the WatchBudget.
+  struct BudgetSplit
+  {
+    size_t polled_roots{0};
+    size_t polled_directories{0};
+  };
+  std::unordered_map<ChannelID, BudgetSplit> budget_split;
+
+  // If true, keep a DirectorySnapshot for every watched directory.
+  bool snapshots;
+
+  // Number of directory levels beneath each recursive root that are watched, or zero to watch every level.
+  size_t watch_depth;
+
+  // Subtrees beneath the watch depth that have been discovered since flush_lazy_roots() was last called.
+  std::vector<std::pair<ChannelID, std::string>> lazy_roots;
+
+  // The top directory of each promoted subtree.
+  std::vector<WatchedDirectory *> promoted;
+
+  // Demoted subtrees that remain watched until the polling thread releases them.
+  std::vector<std::pair<ChannelID, std::string>> demoting;
+  size_t promotion_count;
+  size_t demotion_count;
+
+  // When consume() last emptied the inotify queue. Events that occurred after this may be lost in an overflow.
+  timespec last_drained;
 };
 
 #endif
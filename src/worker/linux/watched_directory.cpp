@@ -1,8 +1,10 @@
-#include <memory>
-#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <sys/inotify.h>
 #include <utility>
+#include <vector>
 
 #include "../../message.h"
 #include "../../message_buffer.h"
@@ -12,94 +14,79 @@
 #include "side_effect.h"
 #include "watched_directory.h"
 
+using std::find;
 using std::move;
-using std::ostringstream;
-using std::shared_ptr;
 using std::string;
+using std::vector;
+
+uint64_t WatchedDirectory::rename_generation = 1;
 
 WatchedDirectory::WatchedDirectory(int wd,
   ChannelID channel_id,
-  shared_ptr<WatchedDirectory> parent,
+  WatchedDirectory *parent,
   string &&name,
   bool recursive) :
-  wd{wd}, channel_id{channel_id}, parent{parent}, name{move(name)}, recursive{recursive}
+  wd{wd},
+  channel_id{channel_id},
+  parent{parent},
+  name{move(name)},
+  recursive{recursive},
+  complete{true},
+  promoted{false},
+  absolute_path_generation{0}
 {
-  //
+  if (parent != nullptr) parent->children.push_back(this);
 }
 
 Result<> WatchedDirectory::accept_event(MessageBuffer &buffer,
   CookieJar &jar,
   SideEffect &side,
-  RecentFileCache &cache,
-  const inotify_event &event)
+  const inotify_event &event,
+  const string &path,
+  EntryKind kind)
 {
-  string basename{event.name};
-  string path = absolute_event_path(event);
-
-  bool dir_hint = (event.mask & IN_ISDIR) == IN_ISDIR;
-
-  // Read or refresh the cached lstat() entry primarily to determine if this entry is a symlink or not.
-  shared_ptr<StatResult> stat = cache.former_at_path(path, !dir_hint, dir_hint, false);
-  if (stat->is_absent()) {
-    stat = cache.current_at_path(path, !dir_hint, dir_hint, false);
-    cache.apply();
-  }
-  EntryKind kind = stat->get_entry_kind();
-
   if ((event.mask & IN_CREATE) == IN_CREATE) {
     // create entry inside directory
     if (kind == KIND_DIRECTORY && recursive) {
-      side.track_subdirectory(basename, channel_id);
+      side.track_subdirectory(this, string(event.name), channel_id);
     }
-    buffer.created(channel_id, move(path), kind);
+    buffer.created(channel_id, string(path), kind);
     return ok_result();
   }
 
   if ((event.mask & IN_DELETE) == IN_DELETE) {
     // delete entry inside directory
-    cache.evict(path);
-    buffer.deleted(channel_id, move(path), kind);
+    buffer.deleted(channel_id, string(path), kind);
     return ok_result();
   }
 
   if ((event.mask & (IN_MODIFY | IN_ATTRIB)) != 0u) {
     // modify entry inside directory or attribute change for directory or entry inside directory
-    buffer.modified(channel_id, move(path), kind);
-    return ok_result();
-  }
-
-  if ((event.mask & (IN_DELETE_SELF | IN_UNMOUNT)) != 0u) {
-    if (is_root()) {
-      side.remove_channel(channel_id);
-      cache.evict(get_absolute_path());
-      buffer.deleted(channel_id, get_absolute_path(), KIND_DIRECTORY);
-    }
+    buffer.modified(channel_id, string(path), kind);
     return ok_result();
   }
 
-  if ((event.mask & IN_MOVE_SELF) == IN_MOVE_SELF) {
-    // directory itself was renamed
+  if ((event.mask & (IN_DELETE_SELF | IN_UNMOUNT | IN_MOVE_SELF)) != 0u) {
+    // directory itself was deleted, unmounted, or renamed
     if (is_root()) {
       side.remove_channel(channel_id);
-      cache.evict(get_absolute_path());
-      buffer.deleted(channel_id, get_absolute_path(), KIND_DIRECTORY);
+      buffer.deleted(channel_id, string(get_absolute_path()), KIND_DIRECTORY);
     }
     return ok_result();
   }
 
   if ((event.mask & IN_MOVED_FROM) == IN_MOVED_FROM) {
     // rename source for directory or entry inside directory
-    cache.evict(path);
-    jar.moved_from(buffer, channel_id, event.cookie, move(path), kind);
+    jar.moved_from(buffer, channel_id, event.cookie, string(path), kind);
     return ok_result();
   }
 
   if ((event.mask & IN_MOVED_TO) == IN_MOVED_TO) {
     // rename destination for directory or entry inside directory
     if (kind == KIND_DIRECTORY && recursive) {
-      side.track_subdirectory(basename, channel_id);
+      side.track_subdirectory(this, string(event.name), channel_id);
     }
-    jar.moved_to(buffer, channel_id, event.cookie, move(path), kind);
+    jar.moved_to(buffer, channel_id, event.cookie, string(path), kind);
     return ok_result();
   }
 
@@ -108,28 +95,62 @@ Result<> WatchedDirectory::accept_event(MessageBuffer &buffer,
   return ok_result();
 }
 
-string WatchedDirectory::get_absolute_path()
+void WatchedDirectory::was_renamed(WatchedDirectory *new_parent, const string &new_name)
 {
-  ostringstream stream;
-  build_absolute_path(stream);
-  return stream.str();
+  if (new_parent != parent) {
+    detach();
+    parent = new_parent;
+    if (parent != nullptr) parent->children.push_back(this);
+  }
+  name = new_name;
+  rename_generation++;
+}
+
+void WatchedDirectory::was_ignored()
+{
+  detach();
+  wd = -1;
 }
 
-void WatchedDirectory::build_absolute_path(ostringstream &stream)
+void WatchedDirectory::detach()
 {
+  if (parent == nullptr) return;
+
+  vector<WatchedDirectory *> &siblings = parent->children;
+  auto it = find(siblings.begin(), siblings.end(), this);
+  if (it != siblings.end()) siblings.erase(it);
+}
+
+const string &WatchedDirectory::get_absolute_path()
+{
+  if (absolute_path_generation == rename_generation) return absolute_path;
+
   if (parent) {
-    parent->build_absolute_path(stream);
-    stream << "/";
+    const string &parent_path = parent->get_absolute_path();
+
+    absolute_path.clear();
+    absolute_path.reserve(parent_path.size() + 1 + name.size());
+    absolute_path.append(parent_path);
+    absolute_path.push_back('/');
+    absolute_path.append(name);
+  } else {
+    absolute_path = name;
   }
-  stream << name;
+
+  absolute_path_generation = rename_generation;
+  return absolute_path;
 }
 
-string WatchedDirectory::absolute_event_path(const inotify_event &event)
+string WatchedDirectory::event_path(const inotify_event &event)
 {
-  ostringstream stream;
-  build_absolute_path(stream);
-  if (event.len > 0) {
-    stream << "/" << event.name;
-  }
-  return stream.str();
+  const string &dir_path = get_absolute_path();
+  if (event.len == 0) return dir_path;
+
+  size_t name_len = strlen(event.name);
+  string path;
+  path.reserve(dir_path.size() + 1 + name_len);
+  path.append(dir_path);
+  path.push_back('/');
+  path.append(event.name, name_len);
+  return path;
 }
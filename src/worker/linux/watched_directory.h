@@ -1,8 +1,8 @@
 #ifndef WATCHED_DIRECTORY
 #define WATCHED_DIRECTORY
 
-#include <memory>
-#include <sstream>
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <sys/inotify.h>
 #include <vector>
@@ -19,27 +19,49 @@ class WatchedDirectory
 public:
   WatchedDirectory(int wd,
     ChannelID channel_id,
-    std::shared_ptr<WatchedDirectory> parent,
+    WatchedDirectory *parent,
     std::string &&name,
     bool recursive);
 
   ~WatchedDirectory() = default;
 
   // Interpret a single inotify event. Buffer messages, store or resolve rename Cookies from the CookieJar, and
-  // enqueue SideEffects based on the event's mask.
+  // enqueue SideEffects based on the event's mask. `path` is the absolute path of the entry the event describes, as
+  // returned by event_path(), and `kind` is its entry kind. Both are computed once by the WatchRegistry and shared by
+  // every channel subscribed to the same watch descriptor.
   Result<> accept_event(MessageBuffer &buffer,
     CookieJar &jar,
     SideEffect &side,
-    RecentFileCache &cache,
-    const inotify_event &event);
+    const inotify_event &event,
+    const std::string &path,
+    EntryKind kind);
+
+  // Translate the relative path within an inotify event into an absolute path within this directory.
+  std::string event_path(const inotify_event &event);
 
   // A parent WatchedDirectory reported that this directory was renamed. Update our internal state immediately so
-  // that events on child paths will be reported with the correct path.
-  void was_renamed(const std::shared_ptr<WatchedDirectory> &new_parent, const std::string &new_name)
-  {
-    parent = new_parent;
-    name = new_name;
-  }
+  // that events on child paths will be reported with the correct path. Cached absolute paths throughout the tree
+  // are invalidated by advancing the rename generation; each is rebuilt lazily the next time it's needed.
+  void was_renamed(WatchedDirectory *new_parent, const std::string &new_name);
+
+  // The kernel has dropped this directory's watch descriptor because the directory was deleted or unmounted. Detach
+  // it from its parent so that it's no longer considered part of the watched tree.
+  void was_ignored();
+
+  // Note that one or more subdirectories could not be watched or listed, so `get_children()` is missing entries.
+  void mark_incomplete() { complete = false; }
+
+  // Return false if `get_children()` may be missing subdirectories that exist on disk.
+  bool is_complete() const { return complete; }
+
+  // Access the watched subdirectories of this directory on the same channel.
+  const std::vector<WatchedDirectory *> &get_children() const { return children; }
+
+  // Access the entry name of this directory within its parent, or its full path if it's a root.
+  const std::string &get_name() const { return name; }
+
+  // Return true if newly created subdirectories are watched as well.
+  bool is_recursive() const { return recursive; }
 
   // Access the Channel ID this WatchedDirectory will broadcast on.
   ChannelID get_channel_id() { return channel_id; }
@@ -50,8 +72,28 @@ public:
   // Return true if this directory is the root of a recursively watched subtree.
   bool is_root() { return parent == nullptr; }
 
-  // Return the full absolute path to this directory.
-  std::string get_absolute_path();
+  // Access the directory that contains this one, or nullptr if this is a root.
+  WatchedDirectory *get_parent() { return parent; }
+
+  // Mark this directory as the top of a subtree that was promoted from lazy polling after changes were observed within
+  // it. Every level beneath a promoted directory is watched.
+  void promote(std::chrono::steady_clock::time_point now)
+  {
+    promoted = true;
+    last_active = now;
+  }
+
+  // Return true if this directory is the top of a promoted subtree.
+  bool is_promoted() const { return promoted; }
+
+  // Note that an event was delivered within this promoted subtree.
+  void mark_active(std::chrono::steady_clock::time_point now) { last_active = now; }
+
+  // Access the time at which an event was last delivered within this promoted subtree.
+  std::chrono::steady_clock::time_point get_last_active() const { return last_active; }
+
+  // Return the full absolute path to this directory. The path is cached until the next rename.
+  const std::string &get_absolute_path();
 
   WatchedDirectory(const WatchedDirectory &other) = delete;
   WatchedDirectory(WatchedDirectory &&other) = delete;
@@ -59,16 +101,31 @@ public:
   WatchedDirectory &operator=(WatchedDirectory &&other) = delete;
 
 private:
-  void build_absolute_path(std::ostringstream &stream);
-
-  // Translate the relative path within an inotify event into an absolute path within this directory.
-  std::string absolute_event_path(const inotify_event &event);
+  // Remove this directory from its parent's children.
+  void detach();
 
   int wd;
   ChannelID channel_id;
-  std::shared_ptr<WatchedDirectory> parent;
+  // Owned by the WatchRegistry. Parents are always released along with their children.
+  WatchedDirectory *parent;
   std::string name;
   bool recursive;
+  bool complete;
+  bool promoted;
+  std::chrono::steady_clock::time_point last_active;
+
+  // Subdirectories whose `parent` is this directory. Used to copy an existing tree's structure onto another channel
+  // without listing it again.
+  std::vector<WatchedDirectory *> children;
+
+  // Cached result of get_absolute_path(). Valid only while `absolute_path_generation` matches `rename_generation`.
+  std::string absolute_path;
+  uint64_t absolute_path_generation;
+
+  // Incremented each time any WatchedDirectory is renamed. Because a rename changes the absolute path of every
+  // descendant, any cached path computed during an earlier generation may be stale. WatchedDirectories are only
+  // accessed from the worker thread.
+  static uint64_t rename_generation;
 };
 
 #endif
@@ -96,7 +96,9 @@ public:
   Result<bool> handle_add_command(CommandID command_id,
     ChannelID channel_id,
     const string &root_path,
-    bool recursive) override
+    bool recursive,
+    WatchBackend /*backend*/,
+    const shared_ptr<const PathFilter> &filter) override
   {
     ostream &logline = LOGGER << "Adding watcher for path " << root_path;
     if (!recursive) {
@@ -152,7 +154,10 @@ public:
       LOGGER << "Falling back to polling for watch root " << root_path << "." << endl;
 
       // Emit an Add command for the polling thread to pick up
-      emit(Message(CommandPayloadBuilder::add(channel_id, string(root_path), true, 1).set_id(command_id).build()));
+      emit(Message(CommandPayloadBuilder::add(channel_id, string(root_path), true, 1)
+                     .set_id(command_id)
+                     .set_filter(filter)
+                     .build()));
       return ok_result(false);
     }
 
@@ -1,21 +1,29 @@
 #include "recent_file_cache.h"
 
-#include <chrono>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <memory>
 #include <queue>
 #include <sstream>
 #include <string>
-#include <unordered_map>
 #include <utility>
 #include <uv.h>
 #include <vector>
 
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
 #include "../helper/common.h"
 #include "../helper/libuv.h"
 #include "../log.h"
+#include "../stat_engine.h"
 
+using std::atomic;
 using std::endl;
 using std::move;
 using std::ostream;
@@ -26,33 +34,84 @@ using std::shared_ptr;
 using std::static_pointer_cast;
 using std::string;
 using std::vector;
-using std::chrono::minutes;
-using std::chrono::steady_clock;
-using std::chrono::time_point;
+
+#ifdef PLATFORM_WINDOWS
+static const char SEPARATOR = '\\';
+#else
+static const char SEPARATOR = '/';
+#endif
+
+// Produce the result of a failed lstat(), guessing the entry's kind from the caller's hints.
+static shared_ptr<StatResult> absent_after_error(string &&path,
+  int lstat_err,
+  bool file_hint,
+  bool directory_hint,
+  bool symlink_hint)
+{
+  // Ignore lstat() errors on entries that:
+  // (a) we aren't allowed to see
+  // (b) are at paths with too many symlinks or looping symlinks
+  // (c) have names that are too long
+  // (d) have a path component that is (no longer) a directory
+  // Log any other errno that we see.
+  if (lstat_err != UV_ENOENT && lstat_err != UV_EACCES && lstat_err != UV_ELOOP && lstat_err != UV_ENAMETOOLONG
+    && lstat_err != UV_ENOTDIR && lstat_err != UV_EBUSY && lstat_err != UV_EPERM) {
+    LOGGER << "lstat(" << path << ") failed: " << uv_strerror(lstat_err) << "." << endl;
+  }
+
+  EntryKind guessed_kind = KIND_UNKNOWN;
+  if (symlink_hint) guessed_kind = KIND_SYMLINK;
+  if (file_hint && !directory_hint && !symlink_hint) guessed_kind = KIND_FILE;
+  if (!file_hint && directory_hint && !symlink_hint) guessed_kind = KIND_DIRECTORY;
+  return shared_ptr<StatResult>(new AbsentEntry(move(path), guessed_kind));
+}
+
+#ifdef STATX_TYPE
+// Cleared the first time statx() fails in a way that means it can't be used at all.
+static atomic<bool> statx_available(true);
+
+// As libuv does, treat these errnos as statx() being unusable rather than as a failure to stat `path`. Seccomp
+// policies written before statx() existed reject it with EPERM, and some filesystems answer EOPNOTSUPP or EINVAL.
+static bool statx_unsupported(int statx_errno)
+{
+  return statx_errno == ENOSYS || statx_errno == EPERM || statx_errno == EOPNOTSUPP || statx_errno == EINVAL;
+}
+#endif
 
 shared_ptr<StatResult> StatResult::at(string &&path, bool file_hint, bool directory_hint, bool symlink_hint)
 {
+#ifdef STATX_TYPE
+  // Ask only for the fields that a PresentEntry keeps, and accept whatever the filesystem has cached locally.
+  if (statx_available.load(std::memory_order_relaxed)) {
+    struct statx stx = {};
+    if (statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE | STATX_INO, &stx) == 0) {
+      EntryKind kind = KIND_UNKNOWN;
+      if (S_ISLNK(stx.stx_mode)) {
+        kind = KIND_SYMLINK;
+      } else if (S_ISDIR(stx.stx_mode)) {
+        kind = KIND_DIRECTORY;
+      } else if (S_ISREG(stx.stx_mode)) {
+        kind = KIND_FILE;
+      }
+      uint64_t size = (stx.stx_mask & STATX_SIZE) == STATX_SIZE ? stx.stx_size : 0;
+      return shared_ptr<StatResult>(new PresentEntry(move(path), kind, stx.stx_ino, size));
+    }
+
+    int statx_errno = errno;
+    if (!statx_unsupported(statx_errno)) {
+      return absent_after_error(move(path), -statx_errno, file_hint, directory_hint, symlink_hint);
+    }
+
+    LOGGER << "statx() is unavailable: " << strerror(statx_errno) << ". Falling back to lstat()." << endl;
+    statx_available.store(false, std::memory_order_relaxed);
+  }
+#endif
+
   FSReq lstat_req;
 
   int lstat_err = uv_fs_lstat(nullptr, &lstat_req.req, path.c_str(), nullptr);
-
   if (lstat_err != 0) {
-    // Ignore lstat() errors on entries that:
-    // (a) we aren't allowed to see
-    // (b) are at paths with too many symlinks or looping symlinks
-    // (c) have names that are too long
-    // (d) have a path component that is (no longer) a directory
-    // Log any other errno that we see.
-    if (lstat_err != UV_ENOENT && lstat_err != UV_EACCES && lstat_err != UV_ELOOP && lstat_err != UV_ENAMETOOLONG
-      && lstat_err != UV_ENOTDIR && lstat_err != UV_EBUSY && lstat_err != UV_EPERM) {
-      LOGGER << "lstat(" << path << ") failed: " << uv_strerror(lstat_err) << "." << endl;
-    }
-
-    EntryKind guessed_kind = KIND_UNKNOWN;
-    if (symlink_hint) guessed_kind = KIND_SYMLINK;
-    if (file_hint && !directory_hint && !symlink_hint) guessed_kind = KIND_FILE;
-    if (!file_hint && directory_hint && !symlink_hint) guessed_kind = KIND_DIRECTORY;
-    return shared_ptr<StatResult>(new AbsentEntry(move(path), guessed_kind));
+    return absent_after_error(move(path), lstat_err, file_hint, directory_hint, symlink_hint);
   }
 
   uv_stat_t &stat = lstat_req.req.statbuf;
@@ -97,7 +156,7 @@ ostream &operator<<(ostream &out, const StatResult &result)
 }
 
 PresentEntry::PresentEntry(std::string &&path, EntryKind entry_kind, uint64_t inode, uint64_t size) :
-  StatResult(move(path), entry_kind), inode{inode}, size{size}, last_seen{steady_clock::now()}
+  StatResult(move(path), entry_kind), inode{inode}, size{size}
 {
   //
 }
@@ -135,11 +194,6 @@ uint64_t PresentEntry::get_size() const
   return size;
 }
 
-const time_point<steady_clock> &PresentEntry::get_last_seen() const
-{
-  return last_seen;
-}
-
 string PresentEntry::to_string(bool verbose) const
 {
   ostringstream result;
@@ -207,8 +261,8 @@ shared_ptr<StatResult> RecentFileCache::former_at_path(const string &path,
   bool directory_hint,
   bool symlink_hint)
 {
-  auto maybe = by_path.find(path);
-  if (maybe == by_path.end()) {
+  shared_ptr<PresentEntry> present = present_at_path(path);
+  if (!present) {
     EntryKind kind = KIND_UNKNOWN;
     if (symlink_hint) kind = KIND_SYMLINK;
     if (file_hint && !directory_hint && !symlink_hint) kind = KIND_FILE;
@@ -217,67 +271,91 @@ shared_ptr<StatResult> RecentFileCache::former_at_path(const string &path,
     return shared_ptr<StatResult>(new AbsentEntry(string(path), kind));
   }
 
-  return maybe->second;
+  return present;
 }
 
-void RecentFileCache::evict(const string &path)
+shared_ptr<PresentEntry> RecentFileCache::present_at_path(const string &path)
 {
-  auto maybe = by_path.find(path);
-  if (maybe != by_path.end()) {
-    shared_ptr<PresentEntry> existing = maybe->second;
+  auto maybe = find(path);
+  if (maybe == by_path.end()) return shared_ptr<PresentEntry>();
 
-    auto range = by_timestamp.equal_range(existing->get_last_seen());
-    auto to_erase = by_timestamp.end();
-    for (auto it = range.first; it != range.second; ++it) {
-      if (it->second == existing) {
-        to_erase = it;
-      }
-    }
-    if (to_erase != by_timestamp.end()) {
-      by_timestamp.erase(to_erase);
-    }
-
-    by_path.erase(maybe);
+  Slot *slot = &maybe->second;
+  if (slot != newest) {
+    unlink(slot);
+    link_newest(slot);
   }
+  return slot->entry;
+}
+
+void RecentFileCache::evict(const string &path)
+{
+  auto maybe = find(path);
+  if (maybe != by_path.end()) erase(maybe);
 }
 
 void RecentFileCache::evict(const shared_ptr<PresentEntry> &entry)
 {
-  auto maybe = by_path.find(entry->get_path());
-  if (maybe != by_path.end() && maybe->second == entry) {
-    evict(entry->get_path());
-  }
+  auto maybe = find(entry->get_path());
+  if (maybe != by_path.end() && maybe->second.entry == entry) erase(maybe);
+}
+
+void RecentFileCache::evict_subtree(const string &path)
+{
+  evict(path);
+  erase(descendants_of(path));
 }
 
 void RecentFileCache::update_for_rename(const string &from_dir_path, const string &to_dir_path)
 {
-  vector<pair<string, string>> renames;
+  if (from_dir_path == to_dir_path) return;
 
-  for (auto &each : by_path) {
-    if (each.second->update_for_rename(from_dir_path, to_dir_path)) {
-      renames.emplace_back(each.first, each.second->get_path());
-    }
+  vector<shared_ptr<PresentEntry>> moved;
+
+  auto self = find(from_dir_path);
+  if (self != by_path.end()) {
+    moved.push_back(move(self->second.entry));
+    erase(self);
   }
 
-  for (auto &rename : renames) {
-    shared_ptr<PresentEntry> p = by_path[rename.first];
-    by_path.emplace(rename.second, p);
+  auto range = descendants_of(from_dir_path);
+  for (auto it = range.first; it != range.second; ++it) {
+    moved.push_back(move(it->second.entry));
+  }
+  erase(range);
+  if (moved.empty()) return;
+
+  // Anything cached at the destination was replaced by the renamed entries.
+  evict_subtree(to_dir_path);
+
+  for (shared_ptr<PresentEntry> &entry : moved) {
+    entry->update_for_rename(from_dir_path, to_dir_path);
+    insert(move(entry));
   }
 }
 
 void RecentFileCache::apply()
 {
   for (auto &pair : pending) {
-    shared_ptr<PresentEntry> &present = pair.second;
+    insert(move(pair.second));
+  }
+  pending.clear();
 
-    // Clear an existing entry at the same path if one exists
-    evict(present->get_path());
+  trim();
+}
+
+void RecentFileCache::prefetch(StatEngine &stats, const vector<string> &paths)
+{
+  vector<StatOutcome> outcomes;
+  stats.lstat_all(paths, outcomes);
 
-    // Add the new PresentEntry
-    by_path.emplace(present->get_path(), present);
-    by_timestamp.emplace(present->get_last_seen(), present);
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (outcomes[i].err != 0) continue;
+
+    const uv_stat_t &stat = outcomes[i].stat;
+    pending[paths[i]] = shared_ptr<PresentEntry>(
+      new PresentEntry(string(paths[i]), kind_from_stat(stat), stat.st_ino, stat.st_size));
   }
-  pending.clear();
+  apply();
 }
 
 void RecentFileCache::prune()
@@ -286,23 +364,13 @@ void RecentFileCache::prune()
     return;
   }
   Timer t;
-  size_t to_remove = by_path.size() - maximum_size;
 
   LOGGER << "Cache currently contains " << plural(by_path.size(), "entry", "entries") << ". Pruning triggered." << endl;
 
-  auto last = by_timestamp.begin();
-  for (size_t i = 0; i < to_remove && last != by_timestamp.end(); i++) {
-    ++last;
-  }
-
-  for (auto it = by_timestamp.begin(); it != last; ++it) {
-    shared_ptr<PresentEntry> entry = it->second;
-    by_path.erase(entry->get_path());
-  }
-  by_timestamp.erase(by_timestamp.begin(), last);
+  size_t removed = trim();
 
   t.stop();
-  LOGGER << "Pruned " << plural(to_remove, "entry", "entries") << " in " << t << ". "
+  LOGGER << "Pruned " << plural(removed, "entry", "entries") << " in " << t << ". "
          << plural(by_path.size(), "entry", "entries") << " remain." << endl;
 }
 
@@ -318,6 +386,88 @@ void RecentFileCache::prepopulate(const string &root, size_t max, bool recursive
   LOGGER << "Pre-populated cache with " << entries << " entries in " << t << "." << endl;
 }
 
+pair<RecentFileCache::PathMap::iterator, RecentFileCache::PathMap::iterator> RecentFileCache::descendants_of(
+  const string &dir_path)
+{
+  // Every path beneath the directory sorts between its path with a trailing separator and the same prefix with the
+  // separator's successor in its place.
+  string lower(dir_path);
+  if (lower.empty() || lower.back() != SEPARATOR) lower += SEPARATOR;
+  string upper(lower);
+  upper.back() = static_cast<char>(SEPARATOR + 1);
+
+  return pair<PathMap::iterator, PathMap::iterator>(by_path.lower_bound(lower), by_path.lower_bound(upper));
+}
+
+void RecentFileCache::insert(shared_ptr<PresentEntry> &&entry)
+{
+  string path(entry->get_path());
+  evict(path);
+
+  auto inserted = by_path.emplace(move(path), Slot{move(entry), nullptr, nullptr});
+  index.emplace(&inserted.first->first, inserted.first);
+  link_newest(&inserted.first->second);
+}
+
+RecentFileCache::PathMap::iterator RecentFileCache::find(const string &path)
+{
+  auto hit = index.find(&path);
+  return hit != index.end() ? hit->second : by_path.end();
+}
+
+void RecentFileCache::erase(PathMap::iterator it)
+{
+  index.erase(&it->first);
+  unlink(&it->second);
+  by_path.erase(it);
+}
+
+void RecentFileCache::erase(pair<PathMap::iterator, PathMap::iterator> range)
+{
+  for (auto it = range.first; it != range.second; ++it) {
+    index.erase(&it->first);
+    unlink(&it->second);
+  }
+  by_path.erase(range.first, range.second);
+}
+
+void RecentFileCache::link_newest(Slot *slot)
+{
+  slot->newer = nullptr;
+  slot->older = newest;
+  if (newest != nullptr) newest->newer = slot;
+  newest = slot;
+  if (oldest == nullptr) oldest = slot;
+}
+
+void RecentFileCache::unlink(Slot *slot)
+{
+  if (slot->newer != nullptr) {
+    slot->newer->older = slot->older;
+  } else {
+    newest = slot->older;
+  }
+
+  if (slot->older != nullptr) {
+    slot->older->newer = slot->newer;
+  } else {
+    oldest = slot->newer;
+  }
+
+  slot->newer = nullptr;
+  slot->older = nullptr;
+}
+
+size_t RecentFileCache::trim()
+{
+  size_t removed = 0;
+  while (by_path.size() > maximum_size && oldest != nullptr) {
+    erase(find(oldest->entry->get_path()));
+    removed++;
+  }
+  return removed;
+}
+
 size_t RecentFileCache::prepopulate_helper(const string &root, size_t max, bool recursive)
 {
   size_t count = 0;
@@ -1,7 +1,7 @@
 #ifndef RECENT_FILE_CACHE_H
 #define RECENT_FILE_CACHE_H
 
-#include <chrono>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -9,9 +9,11 @@
 #include <unordered_map>
 #include <utility>
 #include <uv.h>
+#include <vector>
 
 #include "../helper/libuv.h"
 #include "../message.h"
+#include "../stat_engine.h"
 
 class StatResult
 {
@@ -68,8 +70,6 @@ public:
 
   uint64_t get_size() const;
 
-  const std::chrono::time_point<std::chrono::steady_clock> &get_last_seen() const;
-
   std::string to_string(bool verbose = false) const override;
 
   PresentEntry(const PresentEntry &) = delete;
@@ -80,7 +80,6 @@ public:
 private:
   uint64_t inode;
   uint64_t size;
-  std::chrono::time_point<std::chrono::steady_clock> last_seen;
 };
 
 class AbsentEntry : public StatResult
@@ -104,6 +103,8 @@ public:
   AbsentEntry &operator=(AbsentEntry &&) = delete;
 };
 
+// Recently observed lstat() results, keyed by absolute path. Holds at most a fixed number of entries: once that bound
+// is exceeded, the least recently used entries are evicted.
 class RecentFileCache
 {
 public:
@@ -121,16 +122,28 @@ public:
     bool directory_hint,
     bool symlink_hint);
 
+  // Return the cached entry at `path` and mark it as recently used, or return null without allocating if there isn't
+  // one.
+  std::shared_ptr<PresentEntry> present_at_path(const std::string &path);
+
   void evict(const std::string &path);
 
   void evict(const std::shared_ptr<PresentEntry> &entry);
 
+  void evict_subtree(const std::string &path);
+
   void update_for_rename(const std::string &from_dir_path, const std::string &to_dir_path);
 
+  // Cache the entries read by current_at_path() since the last call, evicting the least recently used entries to stay
+  // within the maximum size.
   void apply();
 
   void prune();
 
+  // lstat() every path in `paths` together with `stats` and cache the entries that are present, so that their
+  // latencies overlap instead of accumulating across later current_at_path() calls.
+  void prefetch(StatEngine &stats, const std::vector<std::string> &paths);
+
   void prepopulate(const std::string &root, size_t max, bool recursive);
 
   void resize(size_t maximum_size);
@@ -143,15 +156,63 @@ public:
   RecentFileCache &operator=(RecentFileCache &&) = delete;
 
 private:
+  // A cached entry, linked in place to its neighbours in order of use. Map nodes never move, so the links remain valid
+  // until the Slot is erased.
+  struct Slot
+  {
+    std::shared_ptr<PresentEntry> entry;
+    Slot *newer;
+    Slot *older;
+  };
+
+  using PathMap = std::map<std::string, Slot>;
+
+  // Hashes the keys of `by_path` in place, so that point lookups needn't copy or compare their way down the tree.
+  struct KeyHash
+  {
+    size_t operator()(const std::string *key) const { return std::hash<std::string>()(*key); }
+  };
+
+  struct KeyEqual
+  {
+    bool operator()(const std::string *a, const std::string *b) const { return *a == *b; }
+  };
+
+  using PathIndex = std::unordered_map<const std::string *, PathMap::iterator, KeyHash, KeyEqual>;
+
   size_t prepopulate_helper(const std::string &root, size_t max, bool recursive);
 
+  std::pair<PathMap::iterator, PathMap::iterator> descendants_of(const std::string &dir_path);
+
+  // Cache `entry` at its path as the most recently used entry, replacing any existing entry there.
+  void insert(std::shared_ptr<PresentEntry> &&entry);
+
+  // Locate the cached entry at `path` through `index`, or return `by_path.end()` if there isn't one.
+  PathMap::iterator find(const std::string &path);
+
+  void erase(PathMap::iterator it);
+
+  void erase(std::pair<PathMap::iterator, PathMap::iterator> range);
+
+  void link_newest(Slot *slot);
+
+  void unlink(Slot *slot);
+
+  // Evict least recently used entries until no more than `maximum_size` remain. Return the number evicted.
+  size_t trim();
+
   size_t maximum_size;
 
-  std::map<std::string, std::shared_ptr<PresentEntry>> pending;
+  std::unordered_map<std::string, std::shared_ptr<PresentEntry>> pending;
+
+  // Ordered so that the entries beneath a directory form a contiguous range.
+  PathMap by_path;
 
-  std::unordered_map<std::string, std::shared_ptr<PresentEntry>> by_path;
+  // Every entry of `by_path`, keyed by its own path, for lookups of a single path.
+  PathIndex index;
 
-  std::multimap<std::chrono::time_point<std::chrono::steady_clock>, std::shared_ptr<PresentEntry>> by_timestamp;
+  Slot *newest{nullptr};
+  Slot *oldest{nullptr};
 };
 
 #endif
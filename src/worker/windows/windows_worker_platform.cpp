@@ -107,7 +107,9 @@ public:
   Result<bool> handle_add_command(CommandID command,
     ChannelID channel,
     const string &root_path,
-    bool recursive) override
+    bool recursive,
+    WatchBackend /*backend*/,
+    const shared_ptr<const PathFilter> &filter) override
   {
     // Convert the path to a wide-character string
     Result<wstring> convr = to_wchar(root_path);
@@ -149,7 +151,8 @@ public:
     if (!schedr.get_value()) {
       LOGGER << "Falling back to polling for watch root " << root_path << "." << endl;
 
-      return emit(Message(CommandPayloadBuilder::add(channel, string(root_path), recursive, 1).build()))
+      return emit(
+        Message(CommandPayloadBuilder::add(channel, string(root_path), recursive, 1).set_filter(filter).build()))
         .propagate(false);
     }
 
@@ -179,6 +182,12 @@ public:
     cache.resize(cache_size);
   }
 
+  void populate_status(Status &status) override
+  {
+    status.worker_subscription_count = subscriptions.size();
+    status.worker_recent_file_cache_size = cache.size();
+  }
+
   Result<> handle_fs_event(DWORD error_code, DWORD num_bytes, Subscription *sub)
   {
     Timer t;
@@ -1,12 +1,14 @@
 #ifndef WORKER_PLATFORM_H
 #define WORKER_PLATFORM_H
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <utility>
 
 #include "../errable.h"
 #include "../message.h"
+#include "../path_filter.h"
 #include "../result.h"
 #include "../status.h"
 #include "worker_thread.h"
@@ -27,12 +29,36 @@ public:
   virtual Result<bool> handle_add_command(CommandID command,
     ChannelID channel,
     const std::string &root_path,
-    bool recursive) = 0;
+    bool recursive,
+    WatchBackend backend,
+    const std::shared_ptr<const PathFilter> &filter) = 0;
 
   virtual Result<bool> handle_remove_command(CommandID command, ChannelID channel) = 0;
 
   virtual void handle_cache_size_command(size_t /*cache_size*/) {}
 
+  virtual void handle_traversal_threads_command(size_t /*thread_count*/) {}
+
+  virtual void handle_fanotify_command(bool /*enabled*/) {}
+
+  virtual Result<> handle_coalesce_latency_command(std::chrono::milliseconds /*latency*/) { return ok_result(); }
+
+  virtual void handle_overflow_resync_command(bool /*enabled*/) {}
+
+  virtual void handle_watch_depth_command(size_t /*depth*/) {}
+
+  virtual Result<> handle_rename_window_command(std::chrono::milliseconds /*window*/) { return ok_result(); }
+
+  virtual Result<> handle_promote_command(ChannelID /*channel*/, const std::string & /*root_path*/)
+  {
+    return ok_result();
+  }
+
+  virtual Result<> handle_release_command(ChannelID /*channel*/, const std::string & /*root_path*/)
+  {
+    return ok_result();
+  }
+
   virtual void populate_status(Status & /*status*/) {}
 
   Result<> handle_commands() { return thread->handle_commands().propagate_as_void(); }
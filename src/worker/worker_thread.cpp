@@ -1,3 +1,4 @@
+#include <chrono>
 #include <memory>
 #include <string>
 #include <uv.h>
@@ -13,6 +14,7 @@
 
 using std::string;
 using std::unique_ptr;
+using std::chrono::milliseconds;
 
 WorkerThread::WorkerThread(uv_async_t *main_callback) :
   Thread("worker thread", main_callback), platform{WorkerPlatform::for_worker(this)}
@@ -43,8 +45,12 @@ Result<> WorkerThread::body()
 
 Result<Thread::CommandOutcome> WorkerThread::handle_add_command(const CommandPayload *payload)
 {
-  Result<bool> r = platform->handle_add_command(
-    payload->get_id(), payload->get_channel_id(), payload->get_root(), payload->get_recursive());
+  Result<bool> r = platform->handle_add_command(payload->get_id(),
+    payload->get_channel_id(),
+    payload->get_root(),
+    payload->get_recursive(),
+    payload->get_backend(),
+    payload->get_filter());
   return r.is_ok() ? r.propagate(r.get_value() ? ACK : NOTHING) : r.propagate<CommandOutcome>();
 }
 
@@ -60,6 +66,54 @@ Result<Thread::CommandOutcome> WorkerThread::handle_cache_size_command(const Com
   return ok_result(ACK);
 }
 
+Result<Thread::CommandOutcome> WorkerThread::handle_traversal_threads_command(const CommandPayload *payload)
+{
+  platform->handle_traversal_threads_command(payload->get_arg());
+  return ok_result(ACK);
+}
+
+Result<Thread::CommandOutcome> WorkerThread::handle_fanotify_command(const CommandPayload *payload)
+{
+  platform->handle_fanotify_command(payload->get_arg() != 0);
+  return ok_result(ACK);
+}
+
+Result<Thread::CommandOutcome> WorkerThread::handle_coalesce_latency_command(const CommandPayload *payload)
+{
+  Result<> r = platform->handle_coalesce_latency_command(milliseconds(payload->get_arg()));
+  return r.propagate(ACK);
+}
+
+Result<Thread::CommandOutcome> WorkerThread::handle_overflow_resync_command(const CommandPayload *payload)
+{
+  platform->handle_overflow_resync_command(payload->get_arg() != 0);
+  return ok_result(ACK);
+}
+
+Result<Thread::CommandOutcome> WorkerThread::handle_watch_depth_command(const CommandPayload *payload)
+{
+  platform->handle_watch_depth_command(payload->get_arg());
+  return ok_result(ACK);
+}
+
+Result<Thread::CommandOutcome> WorkerThread::handle_rename_window_command(const CommandPayload *payload)
+{
+  Result<> r = platform->handle_rename_window_command(milliseconds(payload->get_arg()));
+  return r.propagate(ACK);
+}
+
+Result<Thread::CommandOutcome> WorkerThread::handle_promote_command(const CommandPayload *payload)
+{
+  Result<> r = platform->handle_promote_command(payload->get_channel_id(), payload->get_root());
+  return r.propagate(NOTHING);
+}
+
+Result<Thread::CommandOutcome> WorkerThread::handle_release_command(const CommandPayload *payload)
+{
+  Result<> r = platform->handle_release_command(payload->get_channel_id(), payload->get_root());
+  return r.propagate(NOTHING);
+}
+
 Result<Thread::CommandOutcome> WorkerThread::handle_status_command(const CommandPayload *payload)
 {
   unique_ptr<Status> status{new Status()};
@@ -70,6 +124,8 @@ Result<Thread::CommandOutcome> WorkerThread::handle_status_command(const Command
   status->worker_in_ok = get_in_queue_error();
   status->worker_out_size = get_out_queue_size();
   status->worker_out_ok = get_out_queue_error();
+  status->worker_out_channel_depth = get_out_queue_channel_depth();
+  status->worker_out_dropped = get_out_queue_dropped();
 
   platform->populate_status(*status);
 
@@ -36,6 +36,22 @@ private:
 
   Result<CommandOutcome> handle_cache_size_command(const CommandPayload *payload) override;
 
+  Result<CommandOutcome> handle_traversal_threads_command(const CommandPayload *payload) override;
+
+  Result<CommandOutcome> handle_fanotify_command(const CommandPayload *payload) override;
+
+  Result<CommandOutcome> handle_coalesce_latency_command(const CommandPayload *payload) override;
+
+  Result<CommandOutcome> handle_overflow_resync_command(const CommandPayload *payload) override;
+
+  Result<CommandOutcome> handle_watch_depth_command(const CommandPayload *payload) override;
+
+  Result<CommandOutcome> handle_rename_window_command(const CommandPayload *payload) override;
+
+  Result<CommandOutcome> handle_promote_command(const CommandPayload *payload) override;
+
+  Result<CommandOutcome> handle_release_command(const CommandPayload *payload) override;
+
   Result<CommandOutcome> handle_status_command(const CommandPayload *payload) override;
 
   std::unique_ptr<WorkerPlatform> platform;
@@ -1,13 +1,26 @@
 const fs = require('fs-extra')
 
+const { configure } = require('../../lib/binding')
 const { Fixture } = require('../helper')
-const { EventMatcher } = require('../matcher');
+const { EventMatcher } = require('../matcher')
 
-[false, true].forEach(poll => {
-  describe(`basic events with poll = ${poll}`, function () {
+// Polled watchers are exercised with each mechanism that the polling thread may batch its lstat() calls with.
+const modes = [
+  { poll: false },
+  { poll: true, statBackend: 'default' },
+  { poll: true, statBackend: 'pool' },
+  { poll: true, statBackend: 'synchronous' }
+]
+
+modes.forEach(({ poll, statBackend }) => {
+  const suffix = statBackend ? ` and stat backend = ${statBackend}` : ''
+
+  describe(`basic events with poll = ${poll}${suffix}`, function () {
     let fixture, matcher
 
     beforeEach(async function () {
+      if (statBackend) await configure({ pollingStatBackend: statBackend })
+
       fixture = new Fixture()
       await fixture.before()
       await fixture.log()
@@ -18,6 +31,7 @@ const { EventMatcher } = require('../matcher');
 
     afterEach(async function () {
       await fixture.after(this.currentTest)
+      if (statBackend) await configure({ pollingStatBackend: 'default' })
     })
 
     it('when a file is created', async function () {
@@ -0,0 +1,61 @@
+const fs = require('fs-extra')
+
+const { configure } = require('../../lib/binding')
+const { EventBatch } = require('../../lib/event-batch')
+const { Fixture } = require('../helper')
+
+describe('binary event batches', function () {
+  let fixture, batches
+
+  beforeEach(async function () {
+    await configure({ binaryEvents: true })
+
+    fixture = new Fixture()
+    await fixture.before()
+    await fixture.log()
+
+    batches = []
+    await fixture.watch([], {}, (err, events) => {
+      if (err) throw err
+      batches.push(events)
+    })
+  })
+
+  afterEach(async function () {
+    await fixture.after(this.currentTest)
+    await configure({ binaryEvents: false })
+  })
+
+  it('delivers events as an EventBatch', async function () {
+    const createdFile = fixture.watchPath('file.txt')
+    const oldPath = fixture.watchPath('before.txt')
+    const newPath = fixture.watchPath('after.txt')
+
+    await fs.writeFile(oldPath, 'contents\n')
+    await fs.writeFile(createdFile, 'contents\n')
+    await fs.rename(oldPath, newPath)
+
+    const find = (predicate) => batches.some(batch => Array.from(batch).some(predicate))
+
+    await until('the creation event arrives', () => find(e => e.action === 'created' && e.path === createdFile))
+    await until('the rename event arrives', () => find(e => e.action === 'renamed' && e.path === newPath))
+
+    for (const batch of batches) {
+      assert.instanceOf(batch, EventBatch)
+
+      for (let i = 0; i < batch.length; i++) {
+        const event = batch.eventAt(i)
+        assert.strictEqual(batch.actionAt(i), event.action)
+        assert.strictEqual(batch.kindAt(i), event.kind)
+        assert.strictEqual(batch.pathAt(i), event.path)
+        assert.strictEqual(batch.oldPathAt(i), event.oldPath)
+
+        if (event.action === 'renamed') {
+          assert.strictEqual(event.oldPath, oldPath)
+        } else {
+          assert.notProperty(event, 'oldPath')
+        }
+      }
+    }
+  })
+})
@@ -0,0 +1,54 @@
+const fs = require('fs-extra')
+
+const { configure } = require('../../lib/binding')
+const { Fixture } = require('../helper')
+const { EventMatcher } = require('../matcher');
+
+[false, true].forEach(poll => {
+  describe(`coalesced events with poll = ${poll}`, function () {
+    let fixture, matcher
+
+    beforeEach(async function () {
+      await configure({ coalesceLatency: 500 })
+
+      fixture = new Fixture()
+      await fixture.before()
+      await fixture.log()
+
+      matcher = new EventMatcher(fixture)
+      await matcher.watch([], { poll })
+    })
+
+    afterEach(async function () {
+      await fixture.after(this.currentTest)
+      await configure({ coalesceLatency: 0 })
+    })
+
+    it('merges the writes that follow a file creation into the creation event', async function () {
+      const createdFile = fixture.watchPath('file.txt')
+      await fs.writeFile(createdFile, 'initial contents\n')
+      for (let i = 0; i < 10; i++) {
+        await fs.appendFile(createdFile, `line ${i}\n`)
+      }
+
+      await until('the creation event arrives', matcher.allEvents(
+        { action: 'created', kind: 'file', path: createdFile }
+      ))
+      assert.isTrue(matcher.noEvents({ action: 'modified', path: createdFile }))
+    })
+
+    it('omits files that are created and deleted within the window', async function () {
+      const transientFile = fixture.watchPath('transient.txt')
+      const survivingFile = fixture.watchPath('surviving.txt')
+
+      await fs.writeFile(transientFile, 'here and gone\n')
+      await fs.unlink(transientFile)
+      await fs.writeFile(survivingFile, 'still here\n')
+
+      await until('the surviving creation event arrives', matcher.allEvents(
+        { action: 'created', kind: 'file', path: survivingFile }
+      ))
+      assert.isTrue(matcher.noEvents({ path: transientFile }))
+    })
+  })
+})
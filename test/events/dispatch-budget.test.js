@@ -0,0 +1,43 @@
+const fs = require('fs-extra')
+
+const { configure, status } = require('../../lib/binding')
+const { Fixture } = require('../helper')
+const { EventMatcher } = require('../matcher')
+
+describe('time-sliced event dispatch', function () {
+  let fixture, matcher
+
+  beforeEach(async function () {
+    await configure({ dispatchBudget: 1 })
+
+    fixture = new Fixture()
+    await fixture.before()
+    await fixture.log()
+
+    matcher = new EventMatcher(fixture)
+    await matcher.watch([], {})
+  })
+
+  afterEach(async function () {
+    await fixture.after(this.currentTest)
+    await configure({ dispatchBudget: 0 })
+  })
+
+  it('delivers every event in order across turns of the event loop', async function () {
+    // Writing synchronously queues every event before the main thread can dispatch any of them.
+    const paths = []
+    for (let i = 0; i < 200; i++) {
+      const filePath = fixture.watchPath(`file-${i}.txt`)
+      fs.writeFileSync(filePath, 'contents\n')
+      paths.push(filePath)
+    }
+
+    await until('every creation event arrives in order', matcher.orderedEvents(
+      ...paths.map(filePath => ({ action: 'created', kind: 'file', path: filePath }))
+    ))
+
+    const s = await status()
+    assert.isAbove(s.dispatchYieldCount, 0)
+    assert.isAbove(s.dispatchLongestMicroseconds, 0)
+  })
+})
@@ -0,0 +1,144 @@
+const fs = require('fs-extra')
+
+const { configure } = require('../../lib/binding')
+const { Fixture } = require('../helper')
+const { EventMatcher } = require('../matcher')
+
+describe('overflowed event budgets', function () {
+  let fixture, matcher
+
+  beforeEach(async function () {
+    await configure({ eventBudget: 1, eventOverflow: 'drop' })
+
+    fixture = new Fixture()
+    await fixture.before()
+    await fixture.log()
+
+    matcher = new EventMatcher(fixture)
+    await matcher.watch([], {})
+  })
+
+  afterEach(async function () {
+    await fixture.after(this.currentTest)
+    await configure({ eventBudget: 0, eventOverflow: 'coalesce' })
+  })
+
+  it('reports an overflow at the root once events are discarded', async function () {
+    // Write synchronously so that the main thread can't consume any events until every file exists.
+    for (let i = 0; i < 20; i++) {
+      fs.writeFileSync(fixture.watchPath(`file-${i}.txt`), 'contents\n')
+    }
+
+    await until('the overflow event arrives', matcher.allEvents(
+      { action: 'overflowed', kind: 'directory', path: fixture.watchPath() }
+    ))
+  })
+
+  it('rejects an unrecognized overflow policy', async function () {
+    await assert.isRejected(configure({ eventOverflow: 'explode' }), /eventOverflow/)
+  })
+})
+
+describe('coalesced event budgets', function () {
+  let fixture, matcher
+
+  beforeEach(async function () {
+    await configure({ eventBudget: 1, eventOverflow: 'coalesce' })
+
+    fixture = new Fixture()
+    await fixture.before()
+    await fixture.log()
+
+    matcher = new EventMatcher(fixture)
+    await matcher.watch([], {})
+  })
+
+  afterEach(async function () {
+    await fixture.after(this.currentTest)
+    await configure({ eventBudget: 0, eventOverflow: 'coalesce' })
+  })
+
+  it('delivers the held events merged, followed by the overflow notice', async function () {
+    const target = fixture.watchPath('target.txt')
+    fs.writeFileSync(target, 'contents\n')
+    for (let i = 0; i < 50; i++) {
+      fs.appendFileSync(target, `line ${i}\n`)
+    }
+
+    const notice = { action: 'overflowed', kind: 'directory', path: fixture.watchPath() }
+    await until('the overflow event arrives', matcher.orderedEvents(
+      { action: 'created', path: target },
+      notice
+    ))
+
+    const noticeIndex = matcher.events.findIndex(event => event.action === 'overflowed')
+    const heldModifications = matcher.events.slice(0, noticeIndex)
+      .filter(event => event.action === 'modified' && event.path === target)
+    assert.isAtMost(heldModifications.length, 1)
+  })
+})
+
+describe('blocking event budgets', function () {
+  let fixture, matcher
+
+  beforeEach(async function () {
+    await configure({ eventBudget: 1, eventOverflow: 'block' })
+
+    fixture = new Fixture()
+    await fixture.before()
+    await fixture.log()
+
+    matcher = new EventMatcher(fixture)
+    await matcher.watch([], {})
+  })
+
+  afterEach(async function () {
+    await fixture.after(this.currentTest)
+    await configure({ eventBudget: 0, eventOverflow: 'coalesce' })
+  })
+
+  it('delivers every event without discarding any', async function () {
+    const paths = []
+    for (let i = 0; i < 20; i++) {
+      const filePath = fixture.watchPath(`file-${i}.txt`)
+      fs.writeFileSync(filePath, 'contents\n')
+      paths.push(filePath)
+    }
+
+    await until('every creation event arrives', matcher.allEvents(
+      ...paths.map(filePath => ({ action: 'created', kind: 'file', path: filePath }))
+    ))
+    assert.isTrue(matcher.noEvents({ action: 'overflowed' }))
+  })
+})
+
+describe('event budget configuration', function () {
+  let fixture, matcher
+
+  beforeEach(async function () {
+    fixture = new Fixture()
+    await fixture.before()
+    await fixture.log()
+
+    matcher = new EventMatcher(fixture)
+  })
+
+  afterEach(async function () {
+    await fixture.after(this.currentTest)
+    await configure({ eventBudget: 0, eventOverflow: 'coalesce' })
+  })
+
+  it('keeps the budget when only the overflow policy is changed', async function () {
+    await configure({ eventBudget: 1 })
+    await configure({ eventOverflow: 'drop' })
+    await matcher.watch([], {})
+
+    for (let i = 0; i < 20; i++) {
+      fs.writeFileSync(fixture.watchPath(`file-${i}.txt`), 'contents\n')
+    }
+
+    await until('the overflow event arrives', matcher.allEvents(
+      { action: 'overflowed', kind: 'directory', path: fixture.watchPath() }
+    ))
+  })
+})
@@ -1,5 +1,6 @@
 const fs = require('fs-extra')
 
+const { configure } = require('../../lib/binding')
 const { Fixture } = require('../helper')
 const { EventMatcher } = require('../matcher');
 
@@ -71,3 +72,57 @@ const { EventMatcher } = require('../matcher');
     })
   })
 })
+
+describe('unpaired rename events with a short rename window', function () {
+  let fixture, matcher
+
+  beforeEach(async function () {
+    if (process.platform !== 'linux') this.skip()
+
+    await configure({ workerRenameWindow: 50 })
+
+    fixture = new Fixture()
+    await fixture.before()
+    await fixture.log()
+
+    matcher = new EventMatcher(fixture)
+    await matcher.watch([], {})
+  })
+
+  afterEach(async function () {
+    if (process.platform !== 'linux') return
+
+    await fixture.after(this.currentTest)
+    await configure({ workerRenameWindow: 500 })
+  })
+
+  it('still pairs renames within the watch root', async function () {
+    const oldFile = fixture.watchPath('old.txt')
+    const newFile = fixture.watchPath('new.txt')
+
+    await fs.writeFile(oldFile, 'contents')
+    await until('the creation event arrives', matcher.allEvents(
+      { action: 'created', kind: 'file', path: oldFile }
+    ))
+
+    await fs.rename(oldFile, newFile)
+    await until('the rename event arrives', matcher.allEvents(
+      { action: 'renamed', kind: 'file', oldPath: oldFile, path: newFile }
+    ))
+  })
+
+  it('reports entries renamed out of the watch root as deleted', async function () {
+    const outsideFile = fixture.fixturePath('file.txt')
+    const insideFile = fixture.watchPath('file.txt')
+
+    await fs.writeFile(insideFile, 'contents')
+    await until('the creation event arrives', matcher.allEvents(
+      { action: 'created', kind: 'file', path: insideFile }
+    ))
+
+    await fs.rename(insideFile, outsideFile)
+    await until('the deletion event arrives', matcher.allEvents(
+      { action: 'deleted', kind: 'file', path: insideFile }
+    ))
+  })
+})
@@ -14,8 +14,8 @@ class EventMatcher {
 
   watch (...args) {
     return this.fixture.watch(...args, (err, events) => {
-      this.errors.push(err)
-      this.events.push(...events)
+      if (err) this.errors.push(err)
+      if (events) this.events.push(...events)
 
       if (process.env.VERBOSE) {
         console.log(events)
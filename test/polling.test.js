@@ -1,4 +1,6 @@
-const { status } = require('../lib/binding')
+const fs = require('fs-extra')
+
+const { configure, status } = require('../lib/binding')
 const { Fixture } = require('./helper')
 
 describe('polling', function () {
@@ -29,4 +31,39 @@ describe('polling', function () {
       await until(async () => (await status()).pollingThreadState === 'stopped')
     })
   })
+
+  describe('stat backends', function () {
+    afterEach(async function () {
+      await configure({ pollingStatBackend: 'default' })
+    })
+
+    const expected = { pool: 'thread pool', synchronous: 'synchronous' }
+    Object.keys(expected).forEach(backend => {
+      it(`batches lstat() calls with the ${backend} backend when forced to`, async function () {
+        await configure({ pollingStatBackend: backend })
+        await Promise.all(['a.txt', 'b.txt', 'c.txt'].map(name => fs.writeFile(fixture.watchPath(name), name)))
+
+        await fixture.watch([], { poll: true }, () => {})
+        await until('the first batch is complete', async () => (await status()).pollingStatBackend !== 'none')
+        assert.equal((await status()).pollingStatBackend, expected[backend])
+      })
+    })
+
+    it('rejects an unknown backend', async function () {
+      await assert.isRejected(configure({ pollingStatBackend: 'carrier pigeon' }), /pollingStatBackend/)
+    })
+  })
+
+  describe('watch budget', function () {
+    it('reports the inotify watch limit and the watches available to this process', async function () {
+      if (process.platform !== 'linux') this.skip()
+
+      await fixture.watch([], {}, () => {})
+      const s = await status()
+      assert.isAbove(s.workerWatchAllowance, 0)
+      assert.isAtMost(s.workerWatchAllowance, s.workerWatchLimit)
+      assert.isAtLeast(s.workerWatchAllowance, s.workerWatchDescriptorCount)
+      assert.equal(s.workerBudgetPolledRootCount, 0)
+    })
+  })
 })
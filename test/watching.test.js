@@ -1,4 +1,5 @@
 const fs = require('fs-extra')
+const { configure, status } = require('../lib/binding')
 const { Fixture } = require('./helper')
 const { EventMatcher } = require('./matcher')
 
@@ -150,4 +151,347 @@ describe('watching a directory', function () {
       { path: subFile }
     ))
   })
+
+  it('reports renames to a directory watcher and a later watcher on its parent', async function () {
+    const subDir = fixture.watchPath('subdir')
+    const oldPath = fixture.watchPath('subdir', 'old.txt')
+    const newPath = fixture.watchPath('subdir', 'new.txt')
+
+    await fs.mkdir(subDir)
+    await fs.writeFile(oldPath, 'contents\n')
+
+    const child = new EventMatcher(fixture)
+    await child.watch(['subdir'], {})
+
+    const parent = new EventMatcher(fixture)
+    await parent.watch([], {})
+
+    await fs.rename(oldPath, newPath)
+
+    await until('parent rename event arrives', parent.allEvents({ action: 'renamed', oldPath, path: newPath }))
+    await until('child rename event arrives', child.allEvents({ action: 'renamed', oldPath, path: newPath }))
+  })
+
+  describe('with parallel traversal threads', function () {
+    beforeEach(async function () {
+      await configure({ workerTraversalThreads: 2 })
+    })
+
+    afterEach(async function () {
+      await configure({ workerTraversalThreads: 0 })
+    })
+
+    it('watches existing subdirectories recursively', async function () {
+      const deepDir = fixture.watchPath('a', 'b', 'c')
+      await fs.mkdirs(deepDir)
+      await Promise.all(
+        ['d0', 'd1', 'd2'].map(subdir => fs.mkdirs(fixture.watchPath('a', subdir, 'e')))
+      )
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const deepFile = fixture.watchPath('a', 'b', 'c', 'deep.txt')
+      const siblingFile = fixture.watchPath('a', 'd2', 'e', 'sibling.txt')
+      await fs.writeFile(deepFile, 'deep')
+      await fs.writeFile(siblingFile, 'sibling')
+
+      await until('both events arrive', matcher.allEvents(
+        { path: deepFile },
+        { path: siblingFile }
+      ))
+    })
+
+    it('watches newly created subdirectories', async function () {
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const subdir = fixture.watchPath('subdir')
+      const file0 = fixture.watchPath('subdir', 'file-0.txt')
+
+      await fs.mkdir(subdir)
+      await until('the subdirectory creation event arrives', matcher.allEvents({ path: subdir }))
+
+      await fs.writeFile(file0, 'file 0')
+      await until('the modification event arrives', matcher.allEvents({ path: file0 }))
+    })
+  })
+
+  describe('with a small stat cache', function () {
+    beforeEach(async function () {
+      if (process.platform !== 'linux') this.skip()
+      await configure({ workerCacheSize: 8 })
+    })
+
+    afterEach(async function () {
+      await configure({ workerCacheSize: 4096 })
+    })
+
+    it('evicts cached entries beyond its size', async function () {
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const paths = []
+      for (let i = 0; i < 32; i++) {
+        const filePath = fixture.watchPath(`file-${i}.txt`)
+        await fs.writeFile(filePath, 'contents\n')
+        paths.push(filePath)
+      }
+      await until('every creation event arrives', matcher.allEvents(...paths.map(path => ({ path }))))
+
+      const s = await status()
+      assert.isAbove(s.workerRecentFileCacheSize, 0)
+      assert.isAtMost(s.workerRecentFileCacheSize, 8)
+    })
+  })
+
+  describe('with overflow resync enabled', function () {
+    beforeEach(async function () {
+      await configure({ workerResyncOnOverflow: true })
+    })
+
+    afterEach(async function () {
+      await configure({ workerResyncOnOverflow: false })
+    })
+
+    it('watches existing and newly created subdirectories', async function () {
+      const existingFile = fixture.watchPath('existing', 'file.txt')
+      await fs.mkdirs(fixture.watchPath('existing'))
+      await fs.writeFile(existingFile, 'existing')
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const renamedFile = fixture.watchPath('existing', 'renamed.txt')
+      await fs.rename(existingFile, renamedFile)
+      await until('the rename event arrives', matcher.allEvents(
+        { action: 'renamed', oldPath: existingFile, path: renamedFile }
+      ))
+
+      const subdir = fixture.watchPath('subdir')
+      const file0 = fixture.watchPath('subdir', 'file-0.txt')
+      await fs.mkdir(subdir)
+      await until('the subdirectory creation event arrives', matcher.allEvents({ path: subdir }))
+
+      await fs.writeFile(file0, 'file 0')
+      await until('the new file event arrives', matcher.allEvents({ path: file0 }))
+    })
+  })
+
+  describe('after an inotify queue overflow', function () {
+    // The kernel applies max_queued_events when the worker's inotify instance is created, so an overflow can only be
+    // forced reliably when it was lowered before the test process started, e.g. with
+    // `sysctl fs.inotify.max_queued_events=64`.
+    const MAX_QUEUED_EVENTS = '/proc/sys/fs/inotify/max_queued_events'
+
+    beforeEach(async function () {
+      if (process.platform !== 'linux') this.skip()
+      if (parseInt(await fs.readFile(MAX_QUEUED_EVENTS, 'utf8'), 10) > 1024) this.skip()
+    })
+
+    afterEach(async function () {
+      await configure({ workerResyncOnOverflow: false })
+    })
+
+    // Write files synchronously, so that the worker thread falls behind, until `lost` reports the overflow.
+    async function overflow (lost) {
+      for (let round = 0; round < 20 && !lost(); round++) {
+        for (let i = 0; i < 500; i++) {
+          fs.writeFileSync(fixture.watchPath(`file-${round}-${i}.txt`), 'contents\n')
+        }
+        await new Promise(resolve => setTimeout(resolve, 10))
+      }
+    }
+
+    it('reports an error when resync is disabled', async function () {
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const lost = () => matcher.errors.some(err => /overflowed/.test(err.message))
+      await overflow(lost)
+      await until('the lost events are reported', lost)
+    })
+
+    it('resyncs watched directories when resync is enabled', async function () {
+      await configure({ workerResyncOnOverflow: true })
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const resynced = matcher.allEvents({ action: 'resynced', path: fixture.watchPath() })
+      await overflow(resynced)
+      await until('the resynced event arrives', resynced)
+      assert.lengthOf(matcher.errors, 0)
+    })
+  })
+
+  describe('with a watch depth', function () {
+    beforeEach(async function () {
+      await configure({ workerWatchDepth: 1 })
+    })
+
+    afterEach(async function () {
+      await configure({ workerWatchDepth: 0 })
+    })
+
+    it('promotes lazily polled subtrees when they change', async function () {
+      const deepDir = fixture.watchPath('a', 'b', 'c')
+      await fs.mkdirs(deepDir)
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const deepFile = fixture.watchPath('a', 'b', 'c', 'deep.txt')
+      await fs.writeFile(deepFile, 'deep')
+      await until('the polled event arrives', matcher.allEvents({ path: deepFile }))
+
+      if (process.platform === 'linux') {
+        await until('the subtree is promoted', async () => (await status()).workerPromotionCount > 0)
+      }
+    })
+
+    it('delivers coalesced polled events when the last lazy root is promoted', async function () {
+      if (process.platform !== 'linux') this.skip()
+
+      // The lazy root is the polling thread's only root, so the thread stops as soon as the worker thread releases it.
+      await configure({ coalesceLatency: 200 })
+      try {
+        const deepDir = fixture.watchPath('a', 'b', 'c')
+        await fs.mkdirs(deepDir)
+
+        const matcher = new EventMatcher(fixture)
+        await matcher.watch([], {})
+        const promotions = (await status()).workerPromotionCount
+
+        const deepFile = fixture.watchPath('a', 'b', 'c', 'deep.txt')
+        await fs.writeFile(deepFile, 'deep')
+        await until('the subtree is promoted', async () => (await status()).workerPromotionCount > promotions)
+        await until('the polling thread stops', async () => (await status()).pollingThreadState === 'stopped')
+        await until('the polled event arrives', matcher.allEvents({ path: deepFile }))
+      } finally {
+        await configure({ coalesceLatency: 0 })
+      }
+    })
+
+    it('reports changes made while a subtree is handed over', async function () {
+      const deepDir = fixture.watchPath('a', 'b', 'c')
+      await fs.mkdirs(deepDir)
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], {})
+
+      const firstFile = fixture.watchPath('a', 'b', 'c', 'first.txt')
+      await fs.writeFile(firstFile, 'deep')
+      await until('the polled event arrives', matcher.allEvents({ path: firstFile }))
+
+      // The promotion was requested along with the first event, so these land while the subtree changes hands.
+      const deepFiles = []
+      for (let i = 0; i < 20; i++) {
+        const deepFile = fixture.watchPath('a', 'b', 'c', `deep-${i}.txt`)
+        await fs.writeFile(deepFile, 'deep')
+        deepFiles.push(deepFile)
+      }
+
+      await until('every event arrives', matcher.allEvents(...deepFiles.map(path => ({ path }))))
+    })
+  })
+
+  describe('with exclude and include rules', function () {
+    it('does not report events within excluded directories', async function () {
+      const excludedDir = fixture.watchPath('node_modules', 'dep')
+      await fs.mkdirs(excludedDir)
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], { exclude: ['node_modules'] })
+
+      const excludedFile = fixture.watchPath('node_modules', 'dep', 'index.js')
+      const reportedFile = fixture.watchPath('reported.txt')
+      await fs.writeFile(excludedFile, 'excluded')
+      await fs.writeFile(reportedFile, 'reported')
+
+      await until('the reported event arrives', matcher.allEvents({ path: reportedFile }))
+      assert.isTrue(matcher.noEvents({ path: excludedFile }))
+    })
+
+    it('reports only included entries', async function () {
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], { include: ['*.txt'] })
+
+      const ignoredFile = fixture.watchPath('ignored.log')
+      const reportedFile = fixture.watchPath('reported.txt')
+      await fs.writeFile(ignoredFile, 'ignored')
+      await fs.writeFile(reportedFile, 'reported')
+
+      await until('the reported event arrives', matcher.allEvents({ path: reportedFile }))
+      assert.isTrue(matcher.noEvents({ path: ignoredFile }))
+    })
+  })
+
+  describe('with ignore files', function () {
+    // Only the Linux worker and the polling thread read ignore files.
+    beforeEach(function () {
+      if (process.platform !== 'linux') this.skip()
+    })
+
+    it('follows the rules of .gitignore files as they change', async function () {
+      const buildDir = fixture.watchPath('build')
+      const ignoreFile = fixture.watchPath('.gitignore')
+      await fs.mkdirs(buildDir)
+      await fs.writeFile(ignoreFile, 'build/\n')
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], { gitignore: true })
+
+      const ignoredFile = fixture.watchPath('build', 'ignored.txt')
+      const reportedFile = fixture.watchPath('reported.txt')
+      await fs.writeFile(ignoredFile, 'ignored')
+      await fs.writeFile(reportedFile, 'reported')
+
+      await until('the reported event arrives', matcher.allEvents({ path: reportedFile }))
+      assert.isTrue(matcher.noEvents({ path: ignoredFile }))
+
+      await fs.writeFile(ignoreFile, '*.log\n')
+      await until('the ignore file change arrives', matcher.allEvents({ path: ignoreFile }))
+
+      const unignoredFile = fixture.watchPath('build', 'unignored.txt')
+      await fs.writeFile(unignoredFile, 'unignored')
+      await until('the formerly ignored event arrives', matcher.allEvents({ path: unignoredFile }))
+    })
+  })
+
+  describe('with the fanotify backend', function () {
+    // Without the necessary capabilities, or on other platforms, watchers fall back to the default backend. Either way
+    // the same events should arrive.
+    it('watches existing and newly created subdirectories', async function () {
+      const deepDir = fixture.watchPath('a', 'b')
+      await fs.mkdirs(deepDir)
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], { backend: 'fanotify' })
+
+      const deepFile = fixture.watchPath('a', 'b', 'deep.txt')
+      await fs.writeFile(deepFile, 'deep')
+      await until('the deep creation event arrives', matcher.allEvents({ path: deepFile }))
+
+      const subdir = fixture.watchPath('subdir')
+      const file0 = fixture.watchPath('subdir', 'file-0.txt')
+      await fs.mkdir(subdir)
+      await until('the subdirectory creation event arrives', matcher.allEvents({ path: subdir }))
+
+      await fs.writeFile(file0, 'file 0')
+      await until('the new file event arrives', matcher.allEvents({ path: file0 }))
+    })
+
+    it('reports renames within the watched tree', async function () {
+      const oldPath = fixture.watchPath('old.txt')
+      const newPath = fixture.watchPath('new.txt')
+      await fs.writeFile(oldPath, 'contents')
+
+      const matcher = new EventMatcher(fixture)
+      await matcher.watch([], { backend: 'fanotify' })
+
+      await fs.rename(oldPath, newPath)
+      await until('the rename event arrives', matcher.allEvents({ action: 'renamed', oldPath, path: newPath }))
+    })
+  })
 })